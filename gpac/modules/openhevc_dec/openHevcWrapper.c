@@ -19,14 +19,88 @@
  * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
  */
 #include <stdio.h>
+#if defined(__linux__)
+#include <unistd.h>
+#endif
 #include "openHevcWrapper.h"
 #include "libavcodec/avcodec.h"
 #include "libavformat/avformat.h"
 #include "libavutil/mem.h"
 #include "libavutil/opt.h"
+#include "libavutil/atomic.h"
+#include "libavutil/cpu.h"
+#include "libavutil/avstring.h"
+#include "libavutil/crc.h"
+#include "libavcodec/golomb.h"
 
 #define MAX_DECODERS 2
 #define ACTIVE_NAL
+
+/* NAL unit types bounding the VCL and IRAP ranges, see hevc.h */
+#define VCL_NAL_LAST   21
+#define IRAP_NAL_FIRST 16
+#define IRAP_NAL_LAST  23
+#define VPS_NAL        32
+#define SPS_NAL        33
+#define PPS_NAL        34
+
+/* CU syntax planes following the size plane, see MVDECODER_NB_MAPS in hevc.h */
+#define NB_SYNTAX_MAPS 6
+
+/* offset of the camera motion model in the metadata, see MVDECODER_META_GLOBAL_MOTION in hevc.h */
+#define META_GLOBAL_MOTION 16
+/* offset of the activity of a picture in the metadata, see MVDECODER_META_ACTIVITY in hevc.h */
+#define META_ACTIVITY      48
+
+/* thread_type value of libOpenHevcInit letting the wrapper pick the threading */
+#define THREAD_TYPE_AUTO     8
+#define MAX_AUTO_FRAME_THREADS 16
+
+/* data[7] of a picture decoded with coeff-features, see HEVCCoeffFeatures in hevc.h */
+typedef struct CoeffFeatures {
+    uint8_t *data;
+    int      size;
+} CoeffFeatures;
+
+/* A VPS, SPS or PPS NAL unit with its start code */
+typedef struct ParamSetNAL {
+    int      type;
+    int      layer_id;
+    int      id;
+    uint8_t *data;
+    int      size;
+} ParamSetNAL;
+
+/* What an SPS and a PPS tell about the parallelism available in the stream */
+typedef struct SPSTopology {
+    int valid;
+    int width;
+    int height;
+    int log2_ctb_size;
+} SPSTopology;
+
+typedef struct PPSTopology {
+    int valid;
+    int sps_id;
+    int tiles;
+    int tile_columns;
+    int tile_rows;
+    int wpp;
+} PPSTopology;
+
+/* The topology of the active SPS and PPS */
+typedef struct StreamTopology {
+    int has_sps;
+    int has_pps;
+    int width;
+    int height;
+    int log2_ctb_size;
+    int tiles;
+    int tile_columns;
+    int tile_rows;
+    int wpp;
+} StreamTopology;
+
 typedef struct OpenHevcWrapperContext {
     AVCodec *codec;
     AVCodecContext *c;
@@ -42,96 +116,845 @@ typedef struct OpenHevcWrapperContexts {
     int display_layer;
     int set_display;
     int set_vps;
+    int nb_pool_threads;
+    /* kept to set up the enhancement layer decoders when they are needed */
+    int nb_pthreads;
+    int thread_type;
+    int started;
+    int check_md5;
+    int temporal_layer_id;
+    int no_cropping;
+    int parallel_slices;
+    int parallel_filters;
+    int pad_refs;
+    int syntax_maps;
+    int global_motion;
+    int acc_motion;
+    int analysis;
+    int coeff_features;
+    uint8_t *extradata;
+    int extradata_size;
+    /* threading picked from the parameter sets in THREAD_TYPE_AUTO mode */
+    int auto_threads;
+    int nb_frame_threads;
+    int pending_thread_type;
+    int pending_pthreads;
+    int pending_frame_threads;
+    int *thread_cpus;
+    int nb_thread_cpus;
+    /* last parameter set of each type, layer and id received in the AUs of an
+     * auto handle, replayed into the decoders it recreates */
+    ParamSetNAL *param_sets;
+    int nb_param_sets;
+    /* base layer SPS and PPS of an auto handle by id, the PPS of the last
+     * slice read and the topology the threading was chosen for */
+    SPSTopology sps_topo[16];
+    PPSTopology pps_topo[64];
+    int active_pps;
+    StreamTopology topo;
+    /* Annex B copy of the AU given to libOpenHevcScanAU with hvcC extradata */
+    uint8_t *scan_buf;
+    unsigned int scan_buf_size;
+    int scan_param_sets;
 } OpenHevcWrapperContexts;
 
-OpenHevc_Handle libOpenHevcInit(int nb_pthreads, int thread_type)
+/* Process-wide thread budget shared by all the open handles (not set or
+ * negative: no limit, see libOpenHevcSetThreadPoolSize) */
+static volatile int thread_pool_size;
+static volatile int thread_pool_used;
+
+/* Take the threads of a decoder out of the shared budget: nb_pthreads slice
+ * threads for each of its *nb_frame_threads frame threads with frameslice
+ * threading (thread_type 4), nb_pthreads threads otherwise. The counts
+ * libavcodec picks for 0 are charged, and *nb_frame_threads is set to the
+ * number of frame threads to use. When the budget is short, frame threads are
+ * dropped before slice threads. Once the budget is spent, new decoders run
+ * without worker threads. The threads taken out of the budget are added to
+ * *charged, to be given back on close. */
+static int thread_pool_reserve(int thread_type, int nb_pthreads, int *nb_frame_threads,
+                               int *charged)
+{
+    int size    = avpriv_atomic_int_get(&thread_pool_size);
+    int nb_cpus = av_cpu_count();
+    int nb_frames = 1, cost, left;
+
+    if (size <= 0)
+        return nb_pthreads;
+
+    if (thread_type != 1 && thread_type != 2) {
+        if (nb_pthreads <= 0)
+            nb_pthreads = FFMAX(1, nb_cpus >> 1);
+        if (*nb_frame_threads <= 0)
+            *nb_frame_threads = FFMIN(nb_cpus / nb_pthreads + 1, MAX_AUTO_FRAME_THREADS);
+        nb_frames = *nb_frame_threads;
+    } else if (nb_pthreads <= 0)
+        nb_pthreads = nb_cpus > 1 ? FFMIN(nb_cpus + 1, MAX_AUTO_FRAME_THREADS) : 1;
+
+    cost = nb_pthreads * nb_frames;
+    if (cost <= 1)
+        return nb_pthreads;
+    left = size - avpriv_atomic_int_add_and_fetch(&thread_pool_used, cost) + cost;
+    if (left < cost) {
+        int grant;
+        if (nb_frames > 1 && left >= nb_pthreads) {
+            nb_frames = left / nb_pthreads;
+        } else {
+            nb_frames   = 1;
+            nb_pthreads = FFMAX(1, left);
+        }
+        grant = nb_pthreads * nb_frames;
+        /* a single thread is the caller's, it is not taken from the budget */
+        if (grant == 1)
+            grant = 0;
+        avpriv_atomic_int_add_and_fetch(&thread_pool_used, grant - cost);
+        cost = grant;
+    }
+    if (thread_type != 1 && thread_type != 2)
+        *nb_frame_threads = nb_frames;
+    *charged += cost;
+    return nb_pthreads;
+}
+
+static OpenHevcWrapperContext *init_decoder(OpenHevcWrapperContexts *openHevcContexts, int i)
+{
+    OpenHevcWrapperContext *openHevcContext;
+
+    openHevcContext = openHevcContexts->wraper[i] = av_mallocz(sizeof(OpenHevcWrapperContext));
+    av_init_packet(&openHevcContext->avpkt);
+    openHevcContext->codec = avcodec_find_decoder(AV_CODEC_ID_HEVC);
+    if (!openHevcContext->codec) {
+        fprintf(stderr, "codec not found\n");
+        return NULL;
+    }
+
+    openHevcContext->parser  = av_parser_init( openHevcContext->codec->id );
+    if (!openHevcContext->parser) {
+        fprintf(stderr, "parser not found\n");
+        return NULL;
+    }
+    openHevcContext->parser->flags |= PARSER_FLAG_COMPLETE_FRAMES;
+    openHevcContext->c       = avcodec_alloc_context3(openHevcContext->codec);
+    openHevcContext->picture = avcodec_alloc_frame();
+    openHevcContext->c->flags |= CODEC_FLAG_UNALIGNED;
+    /* the output picture keeps its extended_buf (accumulated motion) until
+     * the next decode call, unreferenced ones lose it */
+    openHevcContext->c->refcounted_frames = 1;
+
+    if(openHevcContext->codec->capabilities&CODEC_CAP_TRUNCATED)
+        openHevcContext->c->flags |= CODEC_FLAG_TRUNCATED; /* we do not send complete frames */
+
+    /* For some codecs, such as msmpeg4 and mpeg4, width and height
+     MUST be initialized there because this information is not
+     available in the bitstream. */
+
+    /*  Set the decoder id    */
+    av_opt_set_int(openHevcContext->c->priv_data, "decoder-id", i, 0);
+
+    /*  Apply the settings received before this decoder was created    */
+    if (openHevcContexts->check_md5 >= 0)
+        av_opt_set_int(openHevcContext->c->priv_data, "decode-checksum", openHevcContexts->check_md5, 0);
+    if (openHevcContexts->temporal_layer_id >= 0)
+        av_opt_set_int(openHevcContext->c->priv_data, "temporal-layer-id", openHevcContexts->temporal_layer_id+1, 0);
+    if (openHevcContexts->no_cropping >= 0)
+        av_opt_set_int(openHevcContext->c->priv_data, "no-cropping", openHevcContexts->no_cropping, 0);
+    if (openHevcContexts->parallel_slices >= 0)
+        av_opt_set_int(openHevcContext->c->priv_data, "parallel-slices", openHevcContexts->parallel_slices, 0);
+    if (openHevcContexts->parallel_filters >= 0)
+        av_opt_set_int(openHevcContext->c->priv_data, "parallel-filters", openHevcContexts->parallel_filters, 0);
+    if (openHevcContexts->pad_refs >= 0)
+        av_opt_set_int(openHevcContext->c->priv_data, "pad-refs", openHevcContexts->pad_refs, 0);
+    if (openHevcContexts->analysis >= 0)
+        av_opt_set_int(openHevcContext->c->priv_data, "analysis", openHevcContexts->analysis, 0);
+    if (openHevcContexts->global_motion >= 0)
+        av_opt_set_int(openHevcContext->c->priv_data, "global-motion", openHevcContexts->global_motion, 0);
+    if (openHevcContexts->acc_motion >= 0)
+        av_opt_set_int(openHevcContext->c->priv_data, "acc-motion", openHevcContexts->acc_motion, 0);
+    if (openHevcContexts->syntax_maps >= 0)
+        av_opt_set_int(openHevcContext->c->priv_data, "syntax-maps", openHevcContexts->syntax_maps, 0);
+    if (openHevcContexts->coeff_features >= 0)
+        av_opt_set_int(openHevcContext->c->priv_data, "coeff-features", openHevcContexts->coeff_features, 0);
+    if (openHevcContexts->extradata) {
+        openHevcContext->c->extradata = av_mallocz(openHevcContexts->extradata_size);
+        memcpy(openHevcContext->c->extradata, openHevcContexts->extradata, openHevcContexts->extradata_size);
+        openHevcContext->c->extradata_size = openHevcContexts->extradata_size;
+    }
+    openHevcContexts->nb_decoders = i + 1;
+    return openHevcContext;
+}
+
+/* Feed the parameter sets received so far to a decoder opened after them, and
+ * to the parser of the base layer for libOpenHevcScanAU */
+static void replay_param_sets(OpenHevcWrapperContexts *openHevcContexts, int i)
+{
+    OpenHevcWrapperContext *openHevcContext = openHevcContexts->wraper[i];
+    AVPacket avpkt;
+    uint8_t *buf, *out_buf;
+    int j, size = 0, got_picture, out_size;
+
+    for (j = 0; j < openHevcContexts->nb_param_sets; j++)
+        size += openHevcContexts->param_sets[j].size;
+    if (!size || !(buf = av_mallocz(size + FF_INPUT_BUFFER_PADDING_SIZE)))
+        return;
+    for (size = 0, j = 0; j < openHevcContexts->nb_param_sets; j++) {
+        memcpy(buf + size, openHevcContexts->param_sets[j].data, openHevcContexts->param_sets[j].size);
+        size += openHevcContexts->param_sets[j].size;
+    }
+
+    av_init_packet(&avpkt);
+    avpkt.data = buf;
+    avpkt.size = size;
+    avcodec_decode_video2(openHevcContext->c, openHevcContext->picture, &got_picture, &avpkt);
+    if (!i)
+        av_parser_parse2(openHevcContext->parser, openHevcContext->c, &out_buf, &out_size,
+                         buf, size, AV_NOPTS_VALUE, AV_NOPTS_VALUE, -1);
+    av_free(buf);
+}
+
+static int open_decoder(OpenHevcWrapperContexts *openHevcContexts, int i)
+{
+    OpenHevcWrapperContext *openHevcContext = openHevcContexts->wraper[i];
+    int nb_frame_threads = openHevcContexts->nb_frame_threads;
+    int nb_pthreads      = thread_pool_reserve(openHevcContexts->thread_type,
+                                               openHevcContexts->nb_pthreads, &nb_frame_threads,
+                                               &openHevcContexts->nb_pool_threads);
+
+    /*      set thread parameters    */
+    if(openHevcContexts->thread_type == 1)
+        av_opt_set(openHevcContext->c, "thread_type", "frame", 0);
+    else if (openHevcContexts->thread_type == 2)
+        av_opt_set(openHevcContext->c, "thread_type", "slice", 0);
+    else
+        av_opt_set(openHevcContext->c, "thread_type", "frameslice", 0);
+
+    av_opt_set_int(openHevcContext->c, "threads", nb_pthreads, 0);
+    if (nb_frame_threads > 0)
+        openHevcContext->c->thread_count_frame = nb_frame_threads;
+    openHevcContext->c->thread_cpus    = openHevcContexts->thread_cpus;
+    openHevcContext->c->nb_thread_cpus = openHevcContexts->nb_thread_cpus;
+
+    if (i > 0)
+        openHevcContext->c->BL_avcontext = openHevcContexts->wraper[i-1]->c;
+    if (avcodec_open2(openHevcContext->c, openHevcContext->codec, NULL) < 0) {
+        fprintf(stderr, "could not open codec\n");
+        return -1;
+    }
+    replay_param_sets(openHevcContexts, i);
+    return 0;
+}
+
+static int find_first_vcl_nal(const unsigned char *buff, int au_len, int *nal_unit_type, int *temporal_id)
 {
-    /* register all the codecs */
     int i;
-    OpenHevcWrapperContexts *openHevcContexts = av_mallocz(sizeof(OpenHevcWrapperContexts));
-    OpenHevcWrapperContext  *openHevcContext;
-    avcodec_register_all();
-    openHevcContexts->nb_decoders   = MAX_DECODERS;
-    openHevcContexts->active_layer  = MAX_DECODERS-1;
-    openHevcContexts->display_layer = MAX_DECODERS-1;
-    openHevcContexts->wraper = av_malloc(sizeof(OpenHevcWrapperContext*)*openHevcContexts->nb_decoders);
-    for(i=0; i < openHevcContexts->nb_decoders; i++){
-        openHevcContext = openHevcContexts->wraper[i] = av_malloc(sizeof(OpenHevcWrapperContext));
-        av_init_packet(&openHevcContext->avpkt);
-        openHevcContext->codec = avcodec_find_decoder(AV_CODEC_ID_HEVC);
-        if (!openHevcContext->codec) {
-            fprintf(stderr, "codec not found\n");
-            return NULL;
+    for (i = 0; i + 4 < au_len; i++) {
+        if (buff[i] == 0 && buff[i + 1] == 0 && buff[i + 2] == 1) {
+            const unsigned char *nal = buff + i + 3;
+            int type     = (nal[0] >> 1) & 0x3f;
+            int layer_id = ((nal[0] & 0x01) << 5) + ((nal[1] & 0xF8) >> 3);
+            if (type <= VCL_NAL_LAST && !layer_id) {
+                *nal_unit_type = type;
+                *temporal_id   = (nal[1] & 0x07) - 1;
+                return 1;
+            }
+            i += 2;
         }
+    }
+    return 0;
+}
 
-        openHevcContext->parser  = av_parser_init( openHevcContext->codec->id );
-        openHevcContext->c       = avcodec_alloc_context3(openHevcContext->codec);
-        openHevcContext->picture = avcodec_alloc_frame();
-        openHevcContext->c->flags |= CODEC_FLAG_UNALIGNED;
+/* An enhancement layer is present if the VPS signals more than one layer or if
+ * a NAL unit with nuh_layer_id > 0 shows up. */
+static int au_has_layers(const unsigned char *buff, int au_len)
+{
+    int i;
+    for (i = 0; i + 4 < au_len; i++) {
+        if (buff[i] == 0 && buff[i + 1] == 0 && buff[i + 2] == 1) {
+            const unsigned char *nal = buff + i + 3;
+            int type     = (nal[0] >> 1) & 0x3f;
+            int layer_id = ((nal[0] & 0x01) << 5) + ((nal[1] & 0xF8) >> 3);
+            if (layer_id)
+                return 1;
+            if (type == VPS_NAL && i + 6 < au_len && (((nal[2] & 0x03) << 4) | (nal[3] >> 4)))
+                return 1; // vps_max_layers_minus1
+            i += 2;
+        }
+    }
+    return 0;
+}
 
-        if(openHevcContext->codec->capabilities&CODEC_CAP_TRUNCATED)
-            openHevcContext->c->flags |= CODEC_FLAG_TRUNCATED; /* we do not send complete frames */
+/* Same check on hvcC extradata, which carries the VPS in a NAL array */
+static int hvcc_has_layers(const unsigned char *data, int size)
+{
+    int i, j, pos = 23, num_arrays;
+
+    if (size < 23 || (!data[0] && !data[1] && data[2] <= 1))
+        return au_has_layers(data, size);
+    num_arrays = data[22];
+    for (i = 0; i < num_arrays && pos + 3 <= size; i++) {
+        int type = data[pos] & 0x3f;
+        int cnt  = (data[pos + 1] << 8) | data[pos + 2];
+        pos += 3;
+        for (j = 0; j < cnt && pos + 2 <= size; j++) {
+            int len = (data[pos] << 8) | data[pos + 1];
+            pos += 2;
+            if (type == VPS_NAL && len >= 4 && pos + 4 <= size &&
+                (((data[pos + 2] & 0x03) << 4) | (data[pos + 3] >> 4)))
+                return 1;
+            pos += len;
+        }
+    }
+    return 0;
+}
+
+/* Create and open the enhancement layer decoders up to the active layer */
+static int add_layer_decoders(OpenHevcWrapperContexts *openHevcContexts)
+{
+    int i;
+    for (i = openHevcContexts->nb_decoders; i <= openHevcContexts->active_layer; i++) {
+        if (!init_decoder(openHevcContexts, i))
+            return -1;
+        if (openHevcContexts->started && open_decoder(openHevcContexts, i) < 0)
+            return -1;
+    }
+    return 0;
+}
 
-        /* For some codecs, such as msmpeg4 and mpeg4, width and height
-         MUST be initialized there because this information is not
-         available in the bitstream. */
+static void skip_profile_tier_level(GetBitContext *gb, int max_sub_layers)
+{
+    int i, sub_layer_profile[8], sub_layer_level[8];
 
-        /*      set thread parameters    */
-        if(thread_type == 1)
-            av_opt_set(openHevcContext->c, "thread_type", "frame", 0);
-        else if (thread_type == 2)
-            av_opt_set(openHevcContext->c, "thread_type", "slice", 0);
-        else
-            av_opt_set(openHevcContext->c, "thread_type", "frameslice", 0);
+    skip_bits_long(gb, 88); // general profile
+    skip_bits(gb, 8);       // general_level_idc
+    for (i = 0; i < max_sub_layers - 1; i++) {
+        sub_layer_profile[i] = get_bits1(gb);
+        sub_layer_level[i]   = get_bits1(gb);
+    }
+    if (max_sub_layers > 1)
+        for (i = max_sub_layers - 1; i < 8; i++)
+            skip_bits(gb, 2);
+    for (i = 0; i < max_sub_layers - 1; i++) {
+        if (sub_layer_profile[i])
+            skip_bits_long(gb, 88);
+        if (sub_layer_level[i])
+            skip_bits(gb, 8);
+    }
+}
 
-        av_opt_set_int(openHevcContext->c, "threads", nb_pthreads, 0);
+/* Payload of a NAL unit without its header and emulation prevention bytes,
+ * NULL if out of memory. To be freed with av_free. */
+static uint8_t *nal_to_rbsp(const unsigned char *nal, int len, int *rbsp_len)
+{
+    uint8_t *rbsp = av_mallocz(len + FF_INPUT_BUFFER_PADDING_SIZE);
+    int i;
 
-        /*  Set the decoder id    */
-        av_opt_set_int(openHevcContext->c->priv_data, "decoder-id", i, 0);
+    *rbsp_len = 0;
+    if (!rbsp)
+        return NULL;
+    for (i = 2; i < len; i++) {
+        if (i + 2 < len && !nal[i] && !nal[i + 1] && nal[i + 2] == 3) {
+            rbsp[(*rbsp_len)++] = 0;
+            rbsp[(*rbsp_len)++] = 0;
+            i += 2;
+        } else
+            rbsp[(*rbsp_len)++] = nal[i];
     }
-    return (OpenHevc_Handle) openHevcContexts;
+    return rbsp;
 }
 
-int libOpenHevcStartDecoder(OpenHevc_Handle openHevcHandle)
+/* Read the fields of a base layer SPS or PPS that decide how it can be split
+ * between threads, replacing the ones of the same id */
+static void parse_topology_nal(OpenHevcWrapperContexts *openHevcContexts,
+                               const unsigned char *nal, int len)
+{
+    GetBitContext gb;
+    uint8_t *rbsp;
+    int i, type, id, rbsp_len;
+
+    if (len < 3 || ((nal[0] & 0x01) << 5) + ((nal[1] & 0xF8) >> 3))
+        return;
+    type = (nal[0] >> 1) & 0x3f;
+    if (type != SPS_NAL && type != PPS_NAL)
+        return;
+
+    rbsp = nal_to_rbsp(nal, len, &rbsp_len);
+    if (!rbsp)
+        return;
+    init_get_bits8(&gb, rbsp, rbsp_len);
+
+    if (type == SPS_NAL) {
+        SPSTopology sps = { 0 };
+        int max_sub_layers, log2_min_cb_size;
+
+        skip_bits(&gb, 4); // sps_video_parameter_set_id
+        max_sub_layers = get_bits(&gb, 3) + 1;
+        skip_bits1(&gb);   // sps_temporal_id_nesting_flag
+        skip_profile_tier_level(&gb, max_sub_layers);
+        id = get_ue_golomb_long(&gb); // sps_seq_parameter_set_id
+        if (get_ue_golomb_long(&gb) == 3)
+            skip_bits1(&gb);
+        sps.width  = get_ue_golomb_long(&gb);
+        sps.height = get_ue_golomb_long(&gb);
+        if (get_bits1(&gb))   // conformance_window_flag
+            for (i = 0; i < 4; i++)
+                get_ue_golomb_long(&gb);
+        get_ue_golomb_long(&gb); // bit_depth_luma_minus8
+        get_ue_golomb_long(&gb); // bit_depth_chroma_minus8
+        get_ue_golomb_long(&gb); // log2_max_pic_order_cnt_lsb_minus4
+        i = get_bits1(&gb) ? 0 : max_sub_layers - 1;
+        for (; i < max_sub_layers; i++) {
+            get_ue_golomb_long(&gb); // sps_max_dec_pic_buffering_minus1
+            get_ue_golomb_long(&gb); // sps_max_num_reorder_pics
+            get_ue_golomb_long(&gb); // sps_max_latency_increase_plus1
+        }
+        log2_min_cb_size  = get_ue_golomb_long(&gb) + 3;
+        sps.log2_ctb_size = log2_min_cb_size + get_ue_golomb_long(&gb);
+        sps.valid         = sps.log2_ctb_size >= 4 && sps.log2_ctb_size <= 6 &&
+                            sps.width > 0 && sps.height > 0;
+        if (id < FF_ARRAY_ELEMS(openHevcContexts->sps_topo))
+            openHevcContexts->sps_topo[id] = sps;
+    } else {
+        PPSTopology pps = { 0 };
+
+        id         = get_ue_golomb_long(&gb); // pps_pic_parameter_set_id
+        pps.sps_id = get_ue_golomb_long(&gb); // pps_seq_parameter_set_id
+        skip_bits(&gb, 7);       // dependent_slice_segments_enabled_flag .. cabac_init_present_flag
+        get_ue_golomb_long(&gb); // num_ref_idx_l0_default_active_minus1
+        get_ue_golomb_long(&gb); // num_ref_idx_l1_default_active_minus1
+        get_se_golomb(&gb);      // init_qp_minus26
+        skip_bits(&gb, 2);       // constrained_intra_pred_flag, transform_skip_enabled_flag
+        if (get_bits1(&gb))      // cu_qp_delta_enabled_flag
+            get_ue_golomb_long(&gb);
+        get_se_golomb(&gb);      // pps_cb_qp_offset
+        get_se_golomb(&gb);      // pps_cr_qp_offset
+        skip_bits(&gb, 4);       // pps_slice_chroma_qp_offsets_present_flag .. transquant_bypass_enabled_flag
+        pps.tiles = get_bits1(&gb);
+        pps.wpp   = get_bits1(&gb);
+        if (pps.tiles) {
+            pps.tile_columns = get_ue_golomb_long(&gb) + 1;
+            pps.tile_rows    = get_ue_golomb_long(&gb) + 1;
+        }
+        pps.valid = pps.sps_id < FF_ARRAY_ELEMS(openHevcContexts->sps_topo);
+        if (id < FF_ARRAY_ELEMS(openHevcContexts->pps_topo)) {
+            openHevcContexts->pps_topo[id] = pps;
+            /* until a slice tells which one is used */
+            if (openHevcContexts->active_pps < 0)
+                openHevcContexts->active_pps = id;
+        }
+    }
+    av_free(rbsp);
+}
+
+/* Read the PPS id of the first base layer slice segment of an AU */
+static void parse_topology_slice(OpenHevcWrapperContexts *openHevcContexts,
+                                 const unsigned char *nal, int len)
+{
+    GetBitContext gb;
+    uint8_t *rbsp;
+    int type = (nal[0] >> 1) & 0x3f;
+    int id, rbsp_len;
+
+    // the id is in the first bytes of the header
+    rbsp = nal_to_rbsp(nal, FFMIN(len, 12), &rbsp_len);
+    if (!rbsp)
+        return;
+    init_get_bits8(&gb, rbsp, rbsp_len);
+    skip_bits1(&gb);     // first_slice_segment_in_pic_flag
+    if (type >= 16 && type <= 23)
+        skip_bits1(&gb); // no_output_of_prior_pics_flag
+    id = get_ue_golomb_long(&gb);
+    if (id < FF_ARRAY_ELEMS(openHevcContexts->pps_topo))
+        openHevcContexts->active_pps = id;
+    av_free(rbsp);
+}
+
+/* Look for the parameter sets in hvcC extradata or in an Annex B buffer, and
+ * for the PPS of the first slice of the AU. Returns 1 if an SPS or a PPS was
+ * seen. */
+static int scan_topology(OpenHevcWrapperContexts *openHevcContexts,
+                         const unsigned char *data, int size)
+{
+    int i, j, pos = 23, num_arrays, found = 0;
+
+    if (size >= 23 && !(!data[0] && !data[1] && data[2] <= 1)) {
+        num_arrays = data[22];
+        for (i = 0; i < num_arrays && pos + 3 <= size; i++) {
+            int type = data[pos] & 0x3f;
+            int cnt  = (data[pos + 1] << 8) | data[pos + 2];
+            pos += 3;
+            for (j = 0; j < cnt && pos + 2 <= size; j++) {
+                int len = (data[pos] << 8) | data[pos + 1];
+                pos += 2;
+                if ((type == SPS_NAL || type == PPS_NAL) && pos + len <= size) {
+                    parse_topology_nal(openHevcContexts, data + pos, len);
+                    found = 1;
+                }
+                pos += len;
+            }
+        }
+        return found;
+    }
+    for (i = 0; i + 4 < size; i++) {
+        if (data[i] == 0 && data[i + 1] == 0 && data[i + 2] == 1) {
+            const unsigned char *nal = data + i + 3;
+            int type     = (nal[0] >> 1) & 0x3f;
+            int layer_id = ((nal[0] & 0x01) << 5) + ((nal[1] & 0xF8) >> 3);
+            int len;
+            i += 2;
+            if ((type <= VCL_NAL_LAST && layer_id) ||
+                (type > VCL_NAL_LAST && type != SPS_NAL && type != PPS_NAL))
+                continue;
+            for (len = 2; nal + len + 2 < data + size; len++)
+                if (!nal[len] && !nal[len + 1] && nal[len + 2] <= 1)
+                    break;
+            if (nal + len + 2 >= data + size)
+                len = data + size - nal;
+            if (type <= VCL_NAL_LAST) {
+                parse_topology_slice(openHevcContexts, nal, len);
+                break;
+            }
+            parse_topology_nal(openHevcContexts, nal, len);
+            found = 1;
+        }
+    }
+    return found;
+}
+
+/* The topology of the active PPS and of its SPS, as far as they are known */
+static void active_topology(const OpenHevcWrapperContexts *openHevcContexts, StreamTopology *topo)
+{
+    const PPSTopology *pps;
+    const SPSTopology *sps;
+
+    memset(topo, 0, sizeof(*topo));
+    if (openHevcContexts->active_pps < 0)
+        return;
+    pps = &openHevcContexts->pps_topo[openHevcContexts->active_pps];
+    if (!pps->valid)
+        return;
+    topo->has_pps      = 1;
+    topo->tiles        = pps->tiles;
+    topo->tile_columns = pps->tile_columns;
+    topo->tile_rows    = pps->tile_rows;
+    topo->wpp          = pps->wpp;
+    sps = &openHevcContexts->sps_topo[pps->sps_id];
+    if (!sps->valid)
+        return;
+    topo->has_sps       = 1;
+    topo->width         = sps->width;
+    topo->height        = sps->height;
+    topo->log2_ctb_size = sps->log2_ctb_size;
+}
+
+/* Id of a VPS, SPS or PPS, -1 if it cannot be read */
+static int param_set_id(const unsigned char *nal, int len)
+{
+    GetBitContext gb;
+    uint8_t *rbsp;
+    int type     = (nal[0] >> 1) & 0x3f;
+    int layer_id = ((nal[0] & 0x01) << 5) + ((nal[1] & 0xF8) >> 3);
+    int id, rbsp_len, max_sub_layers;
+
+    if (len < 3)
+        return -1;
+    if (type == VPS_NAL)
+        return nal[2] >> 4;
+    rbsp = nal_to_rbsp(nal, len, &rbsp_len);
+    if (!rbsp)
+        return -1;
+    init_get_bits8(&gb, rbsp, rbsp_len);
+    if (type == SPS_NAL) {
+        skip_bits(&gb, 4); // sps_video_parameter_set_id
+        max_sub_layers = get_bits(&gb, 3) + 1;
+        // no profile_tier_level in the SPS of a layer signalling 7 (MultiLayerExtSpsFlag)
+        if (!layer_id || max_sub_layers != 8) {
+            skip_bits1(&gb); // sps_temporal_id_nesting_flag
+            skip_profile_tier_level(&gb, max_sub_layers);
+        }
+    }
+    id = get_ue_golomb_long(&gb);
+    av_free(rbsp);
+    return id < 64 ? id : -1;
+}
+
+/* Keep the VPS, SPS and PPS found before the first VCL NAL unit of an AU,
+ * replacing the ones of the same type, layer and id */
+static void store_param_sets(OpenHevcWrapperContexts *openHevcContexts,
+                             const unsigned char *data, int size)
+{
+    int i, j;
+
+    for (i = 0; i + 4 < size; i++) {
+        if (data[i] == 0 && data[i + 1] == 0 && data[i + 2] == 1) {
+            const unsigned char *nal = data + i + 3;
+            int type     = (nal[0] >> 1) & 0x3f;
+            int layer_id = ((nal[0] & 0x01) << 5) + ((nal[1] & 0xF8) >> 3);
+            int len, id;
+            ParamSetNAL *ps;
+            uint8_t *copy;
+
+            if (type <= VCL_NAL_LAST)
+                break;
+            i += 2;
+            if (type != VPS_NAL && type != SPS_NAL && type != PPS_NAL)
+                continue;
+            for (len = 2; nal + len + 2 < data + size; len++)
+                if (!nal[len] && !nal[len + 1] && nal[len + 2] <= 1)
+                    break;
+            if (nal + len + 2 >= data + size)
+                len = data + size - nal;
+            if ((id = param_set_id(nal, len)) < 0)
+                continue;
+
+            for (j = 0; j < openHevcContexts->nb_param_sets; j++) {
+                ps = &openHevcContexts->param_sets[j];
+                if (ps->type == type && ps->layer_id == layer_id && ps->id == id)
+                    break;
+            }
+            if (j == openHevcContexts->nb_param_sets) {
+                ps = av_realloc(openHevcContexts->param_sets, (j + 1) * sizeof(*ps));
+                if (!ps)
+                    return;
+                openHevcContexts->param_sets = ps;
+                openHevcContexts->nb_param_sets++;
+                ps += j;
+                ps->data = NULL;
+            } else if (ps->size == len + 3 && !memcmp(ps->data + 3, nal, len))
+                continue;
+            if (!(copy = av_malloc(len + 3)))
+                return;
+            copy[0] = copy[1] = 0;
+            copy[2] = 1;
+            memcpy(copy + 3, nal, len);
+            av_free(ps->data);
+            ps->type     = type;
+            ps->layer_id = layer_id;
+            ps->id       = id;
+            ps->data     = copy;
+            ps->size     = len + 3;
+        }
+    }
+}
+
+/* Split the thread budget between frames and WPP rows or tiles. A WPP picture
+ * keeps at most one row per two CTB columns busy (rows lag two CTBs behind each
+ * other), a tiled picture one thread per tile. What is left over goes to frame
+ * threads, and streams with neither tool only get frame threads. */
+static void choose_threading(const StreamTopology *topo, int budget,
+                             int *thread_type, int *nb_pthreads, int *nb_frame_threads)
+{
+    int slice_jobs = 1, nb_slice;
+
+    if (topo->has_sps && topo->has_pps) {
+        int ctb_width  = (topo->width  + (1 << topo->log2_ctb_size) - 1) >> topo->log2_ctb_size;
+        int ctb_height = (topo->height + (1 << topo->log2_ctb_size) - 1) >> topo->log2_ctb_size;
+        if (topo->tiles)
+            slice_jobs = topo->tile_columns * topo->tile_rows;
+        if (topo->wpp)
+            slice_jobs = FFMAX(slice_jobs, FFMIN(ctb_height, (ctb_width + 1) / 2));
+    }
+    nb_slice = FFMIN(budget, slice_jobs);
+
+    *nb_frame_threads = 0;
+    if (nb_slice < 2) {
+        *thread_type = 1;
+        *nb_pthreads = FFMIN(budget, MAX_AUTO_FRAME_THREADS);
+    } else if (budget / nb_slice >= 2) {
+        *thread_type      = 4;
+        *nb_pthreads      = nb_slice;
+        *nb_frame_threads = FFMIN(budget / nb_slice, MAX_AUTO_FRAME_THREADS);
+    } else {
+        *thread_type = 2;
+        *nb_pthreads = nb_slice;
+    }
+}
+
+static const char *thread_type_name(int thread_type)
+{
+    return thread_type == 1 ? "frame" : thread_type == 2 ? "slice" : "frameslice";
+}
+
+/* Pick the threading of an auto handle from the active SPS and PPS, once
+ * scan_topology has read the ones of the data received. It is only evaluated
+ * again when their topology changes. Once the decoders run, a different choice
+ * is kept pending until the next libOpenHevcStartAtIRAP, which restarts them
+ * anyway. */
+static void update_auto_threading(OpenHevcWrapperContexts *openHevcContexts)
+{
+    StreamTopology topo;
+    int thread_type, nb_pthreads, nb_frame_threads;
+
+    active_topology(openHevcContexts, &topo);
+    if (openHevcContexts->started && !memcmp(&topo, &openHevcContexts->topo, sizeof(topo)))
+        return;
+    openHevcContexts->topo = topo;
+    choose_threading(&topo, openHevcContexts->auto_threads, &thread_type, &nb_pthreads, &nb_frame_threads);
+
+    if (!openHevcContexts->started) {
+        openHevcContexts->thread_type      = thread_type;
+        openHevcContexts->nb_pthreads      = nb_pthreads;
+        openHevcContexts->nb_frame_threads = nb_frame_threads;
+    } else if (thread_type      != openHevcContexts->thread_type ||
+               nb_pthreads      != openHevcContexts->nb_pthreads ||
+               nb_frame_threads != openHevcContexts->nb_frame_threads) {
+        if (thread_type      != openHevcContexts->pending_thread_type ||
+            nb_pthreads      != openHevcContexts->pending_pthreads ||
+            nb_frame_threads != openHevcContexts->pending_frame_threads)
+            av_log(NULL, AV_LOG_INFO, "New parameter sets: %s threading with %d threads"
+                   " (%d frame threads) will be used after the next restart\n",
+                   thread_type_name(thread_type), nb_pthreads, nb_frame_threads);
+        openHevcContexts->pending_thread_type   = thread_type;
+        openHevcContexts->pending_pthreads      = nb_pthreads;
+        openHevcContexts->pending_frame_threads = nb_frame_threads;
+        return;
+    }
+    openHevcContexts->pending_thread_type = 0;
+}
+
+static void close_decoders(OpenHevcWrapperContexts *openHevcContexts)
 {
-    OpenHevcWrapperContexts *openHevcContexts = (OpenHevcWrapperContexts *) openHevcHandle;
     OpenHevcWrapperContext  *openHevcContext;
     int i;
-    for(i=0; i < openHevcContexts->nb_decoders; i++) {
+
+    for (i = openHevcContexts->nb_decoders-1; i >=0 ; i--){
         openHevcContext = openHevcContexts->wraper[i];
-        if (avcodec_open2(openHevcContext->c, openHevcContext->codec, NULL) < 0) {
-            fprintf(stderr, "could not open codec\n");
+        avcodec_close(openHevcContext->c);
+        av_parser_close(openHevcContext->parser);
+        av_freep(&openHevcContext->c);
+        av_frame_free(&openHevcContext->picture);
+        av_freep(&openHevcContexts->wraper[i]);
+    }
+    openHevcContexts->nb_decoders = 0;
+    if (openHevcContexts->nb_pool_threads)
+        avpriv_atomic_int_add_and_fetch(&thread_pool_used, -openHevcContexts->nb_pool_threads);
+    openHevcContexts->nb_pool_threads = 0;
+}
+
+/* The display layer may not have a decoder yet if the stream has a single layer */
+static OpenHevcWrapperContext *display_decoder(OpenHevcWrapperContexts *openHevcContexts)
+{
+    return openHevcContexts->wraper[FFMIN(openHevcContexts->display_layer, openHevcContexts->nb_decoders-1)];
+}
+
+/* Only the base layer decoder is created here, the enhancement layer decoders
+ * are added once the stream is known to carry more layers and the caller asked
+ * for them with libOpenHevcSetActiveDecoders.
+ * With thread_type THREAD_TYPE_AUTO (8), nb_pthreads is a thread budget (0 for
+ * one per core) the wrapper splits between frame and slice threads once it
+ * has seen the SPS and PPS. */
+OpenHevc_Handle libOpenHevcInit(int nb_pthreads, int thread_type)
+{
+    /* register all the codecs */
+    OpenHevcWrapperContexts *openHevcContexts = av_mallocz(sizeof(OpenHevcWrapperContexts));
+    avcodec_register_all();
+    openHevcContexts->nb_decoders       = 0;
+    openHevcContexts->active_layer      = MAX_DECODERS-1;
+    openHevcContexts->display_layer     = MAX_DECODERS-1;
+    openHevcContexts->nb_pthreads       = nb_pthreads;
+    openHevcContexts->thread_type       = thread_type;
+    openHevcContexts->check_md5         = -1;
+    openHevcContexts->temporal_layer_id = -1;
+    openHevcContexts->no_cropping       = -1;
+    openHevcContexts->parallel_slices   = -1;
+    openHevcContexts->parallel_filters  = -1;
+    openHevcContexts->pad_refs          = -1;
+    openHevcContexts->syntax_maps       = -1;
+    openHevcContexts->global_motion     = -1;
+    openHevcContexts->acc_motion        = -1;
+    openHevcContexts->analysis          = -1;
+    openHevcContexts->coeff_features    = -1;
+    if (thread_type == THREAD_TYPE_AUTO)
+        openHevcContexts->auto_threads  = nb_pthreads > 0 ? nb_pthreads : av_cpu_count();
+    openHevcContexts->active_pps        = -1;
+    openHevcContexts->wraper = av_mallocz(sizeof(OpenHevcWrapperContext*)*MAX_DECODERS);
+    if (!init_decoder(openHevcContexts, 0))
+        return NULL;
+    return (OpenHevc_Handle) openHevcContexts;
+}
+
+static int start_decoders(OpenHevcWrapperContexts *openHevcContexts)
+{
+    int i;
+
+    if (openHevcContexts->active_layer > 0 && openHevcContexts->extradata &&
+        hvcc_has_layers(openHevcContexts->extradata, openHevcContexts->extradata_size))
+        add_layer_decoders(openHevcContexts);
+    for(i=0; i < openHevcContexts->nb_decoders; i++) {
+        if (open_decoder(openHevcContexts, i) < 0)
             return -1;
-        }
-        if(i+1 < openHevcContexts->nb_decoders)
-            openHevcContexts->wraper[i+1]->c->BL_avcontext = openHevcContexts->wraper[i]->c;
     }
+    openHevcContexts->started = 1;
     return 1;
 }
 
+int libOpenHevcStartDecoder(OpenHevc_Handle openHevcHandle)
+{
+    OpenHevcWrapperContexts *openHevcContexts = (OpenHevcWrapperContexts *) openHevcHandle;
+
+    /* without parameter sets in the extradata, wait for the first AU */
+    if (openHevcContexts->auto_threads) {
+        if (!openHevcContexts->extradata ||
+            !scan_topology(openHevcContexts, openHevcContexts->extradata, openHevcContexts->extradata_size))
+            return 1;
+        update_auto_threading(openHevcContexts);
+    }
+    return start_decoders(openHevcContexts);
+}
+
 int libOpenHevcDecode(OpenHevc_Handle openHevcHandle, const unsigned char *buff, int au_len, int64_t pts)
 {
     int got_picture[MAX_DECODERS], len=0, i, max_layer;
     OpenHevcWrapperContexts *openHevcContexts = (OpenHevcWrapperContexts *) openHevcHandle;
     OpenHevcWrapperContext  *openHevcContext;
+
+    if (openHevcContexts->auto_threads && au_len) {
+        int started = openHevcContexts->started;
+        int nal_unit_type, temporal_id;
+        scan_topology(openHevcContexts, buff, au_len);
+        update_auto_threading(openHevcContexts);
+        if (!started) {
+            /* parameter sets alone do not start the decoders, they are replayed
+             * into them once the slices tell which ones are used */
+            if (!find_first_vcl_nal(buff, au_len, &nal_unit_type, &temporal_id)) {
+                store_param_sets(openHevcContexts, buff, au_len);
+                return 0;
+            }
+            if (start_decoders(openHevcContexts) < 0)
+                return -1;
+        }
+    }
+    if (!openHevcContexts->started)
+        return 0;
+    if (openHevcContexts->nb_decoders <= openHevcContexts->active_layer && au_len &&
+        au_has_layers(buff, au_len)) {
+        if (add_layer_decoders(openHevcContexts) < 0)
+            return -1;
+    }
     for(i =0; i < MAX_DECODERS; i++)  {
         got_picture[i]                 = 0;
+        /* decoders above the active layer are not fed at all */
+        if (i >= openHevcContexts->nb_decoders || i > openHevcContexts->active_layer)
+            continue;
         openHevcContext                = openHevcContexts->wraper[i];
         openHevcContext->c->quality_id = openHevcContexts->active_layer;
 //        printf("quality_id %d \n", openHevcContext->c->quality_id);
-        if (i <= openHevcContexts->active_layer) {
-            openHevcContext->avpkt.size = au_len;
-            openHevcContext->avpkt.data = (uint8_t *) buff;
-        } else {
-            openHevcContext->avpkt.size = 0;
-            openHevcContext->avpkt.data = NULL;
-        }
+        openHevcContext->avpkt.size = au_len;
+        openHevcContext->avpkt.data = (uint8_t *) buff;
         openHevcContext->avpkt.pts  = pts;
         len                         = avcodec_decode_video2( openHevcContext->c, openHevcContext->picture,
                                                              &got_picture[i], &openHevcContext->avpkt);
+        /* an empty packet flushes one frame thread at a time, the decoder is
+         * drained once none of them has a picture left */
+        if (!au_len) {
+            int j;
+            for (j = 1; j < openHevcContext->c->thread_count_frame && len >= 0 && !got_picture[i]; j++)
+                len = avcodec_decode_video2(openHevcContext->c, openHevcContext->picture,
+                                            &got_picture[i], &openHevcContext->avpkt);
+        }
         if(i+1 < openHevcContexts->nb_decoders)
             openHevcContexts->wraper[i+1]->c->BL_frame = openHevcContexts->wraper[i]->c->BL_frame;
     }
+    /* a restart for new parameter sets needs them in the new decoders */
+    if (openHevcContexts->auto_threads && au_len)
+        store_param_sets(openHevcContexts, buff, au_len);
     if (len < 0) {
         fprintf(stderr, "Error while decoding frame \n");
         return -1;
@@ -159,7 +982,11 @@ void libOpenHevcCopyExtraData(OpenHevc_Handle openHevcHandle, unsigned char *ext
     int i;
     OpenHevcWrapperContexts *openHevcContexts = (OpenHevcWrapperContexts *) openHevcHandle;
     OpenHevcWrapperContext  *openHevcContext;
-    for(i =0; i <= openHevcContexts->active_layer; i++)  {
+    av_freep(&openHevcContexts->extradata);
+    openHevcContexts->extradata = (uint8_t*)av_mallocz(extra_size_alloc);
+    memcpy(openHevcContexts->extradata, extra_data, extra_size_alloc);
+    openHevcContexts->extradata_size = extra_size_alloc;
+    for(i =0; i < openHevcContexts->nb_decoders && i <= openHevcContexts->active_layer; i++)  {
         openHevcContext = openHevcContexts->wraper[i];
         openHevcContext->c->extradata = (uint8_t*)av_mallocz(extra_size_alloc);
         memcpy( openHevcContext->c->extradata, extra_data, extra_size_alloc);
@@ -171,7 +998,7 @@ void libOpenHevcCopyExtraData(OpenHevc_Handle openHevcHandle, unsigned char *ext
 void libOpenHevcGetPictureInfo(OpenHevc_Handle openHevcHandle, OpenHevc_FrameInfo *openHevcFrameInfo)
 {
     OpenHevcWrapperContexts *openHevcContexts = (OpenHevcWrapperContexts *) openHevcHandle;
-    OpenHevcWrapperContext  *openHevcContext  = openHevcContexts->wraper[openHevcContexts->display_layer];
+    OpenHevcWrapperContext  *openHevcContext  = display_decoder(openHevcContexts);
     AVFrame                 *picture          = openHevcContext->picture;
 
     openHevcFrameInfo->nYPitch    = picture->linesize[0];
@@ -246,7 +1073,7 @@ void libOpenHevcGetPictureInfoCpy(OpenHevc_Handle openHevcHandle, OpenHevc_Frame
 {
 
     OpenHevcWrapperContexts *openHevcContexts = (OpenHevcWrapperContexts *) openHevcHandle;
-    OpenHevcWrapperContext  *openHevcContext  = openHevcContexts->wraper[openHevcContexts->display_layer];
+    OpenHevcWrapperContext  *openHevcContext  = display_decoder(openHevcContexts);
     AVFrame                 *picture          = openHevcContext->picture;
 
     switch (picture->format) {
@@ -339,7 +1166,7 @@ int libOpenHevcGetOutput(OpenHevc_Handle openHevcHandle, int got_picture, OpenHe
 {
     // get decoded frame output
     OpenHevcWrapperContexts *openHevcContexts = (OpenHevcWrapperContexts *) openHevcHandle;
-    OpenHevcWrapperContext  *openHevcContext  = openHevcContexts->wraper[openHevcContexts->display_layer];
+    OpenHevcWrapperContext  *openHevcContext  = display_decoder(openHevcContexts);
 
     // YUV data are saved in openHevcContext->picture->data
     if (got_picture) {
@@ -355,7 +1182,7 @@ int libOpenHevcGetOutput(OpenHevc_Handle openHevcHandle, int got_picture, OpenHe
 int libOpenHevcGetOutputCpy(OpenHevc_Handle openHevcHandle, int got_picture, OpenHevc_Frame_cpy *openHevcFrame)
 {
     OpenHevcWrapperContexts *openHevcContexts = (OpenHevcWrapperContexts *) openHevcHandle;
-    OpenHevcWrapperContext  *openHevcContext  = openHevcContexts->wraper[openHevcContexts->display_layer];
+    OpenHevcWrapperContext  *openHevcContext  = display_decoder(openHevcContexts);
 
     int y;
     int y_offset, y_offset2;
@@ -375,6 +1202,7 @@ int libOpenHevcGetOutputCpy(OpenHevc_Handle openHevcHandle, int got_picture, Ope
         int dst_stride;
         int src_stride_c;
         int dst_stride_c;
+        int dst_stride_mv;
 
         libOpenHevcGetPictureInfo(openHevcHandle, &openHevcFrame->frameInfo);
         format = openHevcFrame->frameInfo.chromat_format == YUV420 ? 1 : 0;
@@ -386,6 +1214,8 @@ int libOpenHevcGetOutputCpy(OpenHevc_Handle openHevcHandle, int got_picture, Ope
         libOpenHevcGetPictureInfoCpy(openHevcHandle, &openHevcFrame->frameInfo);
         dst_stride = openHevcFrame->frameInfo.nYPitch;
         dst_stride_c = openHevcFrame->frameInfo.nUPitch;
+        //the feature planes of pvMV are laid out in luma samples whatever the bit depth
+        dst_stride_mv = openHevcFrame->frameInfo.nWidth;
 
         y_offset = y_offset2 = 0;
 
@@ -405,7 +1235,7 @@ int libOpenHevcGetOutputCpy(OpenHevc_Handle openHevcHandle, int got_picture, Ope
         }
 
         int src_stride_pu_x2 = (src_stride >> 2) * 2; //int16_t
-        int dst_stride_pu_x2 = (dst_stride >> 2) * 2; //int16_t
+        int dst_stride_pu_x2 = (dst_stride_mv >> 2) * 2; //int16_t
         y_offset = y_offset2 = 0;
 
         //l0_mx
@@ -445,7 +1275,7 @@ int libOpenHevcGetOutputCpy(OpenHevc_Handle openHevcHandle, int got_picture, Ope
         }
 
         int src_stride_pu = src_stride >> 2;
-        int dst_stride_pu = dst_stride >> 2;
+        int dst_stride_pu = dst_stride_mv >> 2;
 
         //l0_ref
         for (y = 0; y < coded_height >> 2 ; y++){
@@ -466,7 +1296,7 @@ int libOpenHevcGetOutputCpy(OpenHevc_Handle openHevcHandle, int got_picture, Ope
         }
 
         int src_stride_cu = src_stride >> 3;
-        int dst_stride_cu = dst_stride >> 3;
+        int dst_stride_cu = dst_stride_mv >> 3;
 
         //size
         for (y = 0; y < height >> 3; y++){
@@ -474,8 +1304,22 @@ int libOpenHevcGetOutputCpy(OpenHevc_Handle openHevcHandle, int got_picture, Ope
             y_offset  += src_stride_cu;
             y_offset2 += dst_stride_cu;
         }
+        //CU syntax maps, one plane after the other (see MvDecoderSyntaxMap in hevc.h)
+        if (openHevcContexts->syntax_maps > 0) {
+            int src_pu = (coded_height >> 2) * (src_stride >> 2);
+            int i;
+
+            for (i = 0; i < NB_SYNTAX_MAPS; i++) {
+                y_offset = src_pu * 10 + (src_pu >> 2) * (1 + i);
+                for (y = 0; y < height >> 3; y++){
+                    memcpy(&MV[y_offset2], &openHevcContext->picture->data[3][y_offset], dst_stride_cu);
+                    y_offset  += src_stride_cu;
+                    y_offset2 += dst_stride_cu;
+                }
+            }
+        }
         //quadtree
-        memcpy(&MV[3 * dst_stride * height>>2], &openHevcContext->picture->data[3][3 * src_stride * coded_height>>2], dst_stride*height>>2);
+        memcpy(&MV[3 * dst_stride_mv * height>>2], &openHevcContext->picture->data[3][3 * src_stride * coded_height>>2], dst_stride_mv*height>>2);
         memset(&openHevcContext->picture->data[3][0],0, src_stride * coded_height); // clean the buffer
 
 
@@ -508,11 +1352,11 @@ void libOpenHevcSetDebugMode(OpenHevc_Handle openHevcHandle, int val)
 void libOpenHevcSetActiveDecoders(OpenHevc_Handle openHevcHandle, int val)
 {
     OpenHevcWrapperContexts *openHevcContexts = (OpenHevcWrapperContexts *) openHevcHandle;
-    if (val >= 0 && val < openHevcContexts->nb_decoders)
+    if (val >= 0 && val < MAX_DECODERS)
         openHevcContexts->active_layer = val;
     else {
-        fprintf(stderr, "The requested layer %d can not be decoded (it exceeds the number of allocated decoders %d ) \n", val, openHevcContexts->nb_decoders);
-        openHevcContexts->active_layer = openHevcContexts->nb_decoders-1;
+        fprintf(stderr, "The requested layer %d can not be decoded (it exceeds the number of decoders %d ) \n", val, MAX_DECODERS);
+        openHevcContexts->active_layer = MAX_DECODERS-1;
     }
 }
 
@@ -520,11 +1364,11 @@ void libOpenHevcSetViewLayers(OpenHevc_Handle openHevcHandle, int val)
 {
     OpenHevcWrapperContexts *openHevcContexts = (OpenHevcWrapperContexts *) openHevcHandle;
     //openHevcContexts->set_display = 1;
-    if (val >= 0 && val < openHevcContexts->nb_decoders)
+    if (val >= 0 && val < MAX_DECODERS)
         openHevcContexts->display_layer = val;
     else {
-        fprintf(stderr, "The requested layer %d can not be viewed (it exceeds the number of allocated decoders %d ) \n", val, openHevcContexts->nb_decoders);
-        openHevcContexts->display_layer = openHevcContexts->nb_decoders-1;
+        fprintf(stderr, "The requested layer %d can not be viewed (it exceeds the number of decoders %d ) \n", val, MAX_DECODERS);
+        openHevcContexts->display_layer = MAX_DECODERS-1;
     }
 }
 
@@ -535,6 +1379,8 @@ void libOpenHevcSetCheckMD5(OpenHevc_Handle openHevcHandle, int val)
     OpenHevcWrapperContext  *openHevcContext;
     int i;
 
+    openHevcContexts->check_md5 = val;
+
     for (i = 0; i < openHevcContexts->nb_decoders; i++) {
         openHevcContext = openHevcContexts->wraper[i];
 
@@ -548,6 +1394,8 @@ void libOpenHevcSetTemporalLayer_id(OpenHevc_Handle openHevcHandle, int val)
     OpenHevcWrapperContext  *openHevcContext;
     int i;
 
+    openHevcContexts->temporal_layer_id = val;
+
     for (i = 0; i < openHevcContexts->nb_decoders; i++) {
         openHevcContext = openHevcContexts->wraper[i];
         av_opt_set_int(openHevcContext->c->priv_data, "temporal-layer-id", val+1, 0);
@@ -561,46 +1409,543 @@ void libOpenHevcSetNoCropping(OpenHevc_Handle openHevcHandle, int val)
     OpenHevcWrapperContext  *openHevcContext;
     int i;
 
+    openHevcContexts->no_cropping = val;
+
     for (i = 0; i < openHevcContexts->nb_decoders; i++) {
         openHevcContext = openHevcContexts->wraper[i];
         av_opt_set_int(openHevcContext->c->priv_data, "no-cropping", val, 0);
     }
 }
 
-void libOpenHevcClose(OpenHevc_Handle openHevcHandle)
+void libOpenHevcSetParallelSlices(OpenHevc_Handle openHevcHandle, int val)
 {
     OpenHevcWrapperContexts *openHevcContexts = (OpenHevcWrapperContexts *) openHevcHandle;
     OpenHevcWrapperContext  *openHevcContext;
     int i;
 
-    for (i = openHevcContexts->nb_decoders-1; i >=0 ; i--){
+    openHevcContexts->parallel_slices = val;
+
+    for (i = 0; i < openHevcContexts->nb_decoders; i++) {
         openHevcContext = openHevcContexts->wraper[i];
-        avcodec_close(openHevcContext->c);
-        av_parser_close(openHevcContext->parser);
-        av_freep(&openHevcContext->c);
-        av_freep(&openHevcContext->picture);
-        av_freep(&openHevcContext);
+        av_opt_set_int(openHevcContext->c->priv_data, "parallel-slices", val, 0);
     }
+}
+
+void libOpenHevcSetParallelFilters(OpenHevc_Handle openHevcHandle, int val)
+{
+    OpenHevcWrapperContexts *openHevcContexts = (OpenHevcWrapperContexts *) openHevcHandle;
+    OpenHevcWrapperContext  *openHevcContext;
+    int i;
+
+    openHevcContexts->parallel_filters = val;
+
+    for (i = 0; i < openHevcContexts->nb_decoders; i++) {
+        openHevcContext = openHevcContexts->wraper[i];
+        av_opt_set_int(openHevcContext->c->priv_data, "parallel-filters", val, 0);
+    }
+}
+
+void libOpenHevcSetPadRefs(OpenHevc_Handle openHevcHandle, int val)
+{
+    OpenHevcWrapperContexts *openHevcContexts = (OpenHevcWrapperContexts *) openHevcHandle;
+    OpenHevcWrapperContext  *openHevcContext;
+    int i;
+
+    openHevcContexts->pad_refs = val;
+
+    for (i = 0; i < openHevcContexts->nb_decoders; i++) {
+        openHevcContext = openHevcContexts->wraper[i];
+        av_opt_set_int(openHevcContext->c->priv_data, "pad-refs", val, 0);
+    }
+}
+
+void libOpenHevcSetSyntaxMaps(OpenHevc_Handle openHevcHandle, int val)
+{
+    OpenHevcWrapperContexts *openHevcContexts = (OpenHevcWrapperContexts *) openHevcHandle;
+    OpenHevcWrapperContext  *openHevcContext;
+    int i;
+
+    openHevcContexts->syntax_maps = val;
+
+    for (i = 0; i < openHevcContexts->nb_decoders; i++) {
+        openHevcContext = openHevcContexts->wraper[i];
+        av_opt_set_int(openHevcContext->c->priv_data, "syntax-maps", val, 0);
+    }
+}
+
+void libOpenHevcSetGlobalMotion(OpenHevc_Handle openHevcHandle, int val)
+{
+    OpenHevcWrapperContexts *openHevcContexts = (OpenHevcWrapperContexts *) openHevcHandle;
+    OpenHevcWrapperContext  *openHevcContext;
+    int i;
+
+    openHevcContexts->global_motion = val;
+
+    for (i = 0; i < openHevcContexts->nb_decoders; i++) {
+        openHevcContext = openHevcContexts->wraper[i];
+        av_opt_set_int(openHevcContext->c->priv_data, "global-motion", val, 0);
+    }
+}
+
+int libOpenHevcGetGlobalMotion(OpenHevc_Handle openHevcHandle, OpenHevc_GlobalMotion *openHevcGlobalMotion)
+{
+    OpenHevcWrapperContexts *openHevcContexts = (OpenHevcWrapperContexts *) openHevcHandle;
+    OpenHevcWrapperContext  *openHevcContext  = display_decoder(openHevcContexts);
+    AVFrame *picture = openHevcContext->picture;
+    const uint8_t *meta;
+
+    memset(openHevcGlobalMotion, 0, sizeof(*openHevcGlobalMotion));
+    if (!picture->data[3])
+        return 0;
+    meta = picture->data[3] + ((picture->linesize[0] >> 1) * (openHevcContext->c->coded_height >> 1)) * 3;
+    if (!meta[4])
+        return 0;
+    memcpy(openHevcGlobalMotion, meta + META_GLOBAL_MOTION, sizeof(*openHevcGlobalMotion));
+    return openHevcGlobalMotion->nNbSamples > 0;
+}
+
+void libOpenHevcSetAccMotion(OpenHevc_Handle openHevcHandle, int val)
+{
+    OpenHevcWrapperContexts *openHevcContexts = (OpenHevcWrapperContexts *) openHevcHandle;
+    OpenHevcWrapperContext  *openHevcContext;
+    int i;
+
+    openHevcContexts->acc_motion = val;
+
+    for (i = 0; i < openHevcContexts->nb_decoders; i++) {
+        openHevcContext = openHevcContexts->wraper[i];
+        av_opt_set_int(openHevcContext->c->priv_data, "acc-motion", val, 0);
+    }
+}
+
+int libOpenHevcGetAccMotion(OpenHevc_Handle openHevcHandle, const int16_t **field, int *width, int *height)
+{
+    OpenHevcWrapperContexts *openHevcContexts = (OpenHevcWrapperContexts *) openHevcHandle;
+    OpenHevcWrapperContext  *openHevcContext  = display_decoder(openHevcContexts);
+    AVFrame *picture = openHevcContext->picture;
+    const uint8_t *meta;
+
+    *field  = NULL;
+    *width  = 0;
+    *height = 0;
+    if (!picture->data[3] || !picture->nb_extended_buf)
+        return 0;
+    meta = picture->data[3] + ((picture->linesize[0] >> 1) * (openHevcContext->c->coded_height >> 1)) * 3;
+    if (!meta[6])
+        return 0;
+    *field  = (const int16_t *)picture->extended_buf[0]->data;
+    *width  = openHevcContext->c->coded_width  >> meta[6];
+    *height = openHevcContext->c->coded_height >> meta[6];
+    return 1;
+}
+
+void libOpenHevcSetAnalysis(OpenHevc_Handle openHevcHandle, int val)
+{
+    OpenHevcWrapperContexts *openHevcContexts = (OpenHevcWrapperContexts *) openHevcHandle;
+    OpenHevcWrapperContext  *openHevcContext;
+    int i;
+
+    openHevcContexts->analysis = val;
+
+    for (i = 0; i < openHevcContexts->nb_decoders; i++) {
+        openHevcContext = openHevcContexts->wraper[i];
+        av_opt_set_int(openHevcContext->c->priv_data, "analysis", val, 0);
+    }
+}
+
+int libOpenHevcGetActivity(OpenHevc_Handle openHevcHandle, OpenHevc_Activity *openHevcActivity)
+{
+    OpenHevcWrapperContexts *openHevcContexts = (OpenHevcWrapperContexts *) openHevcHandle;
+    OpenHevcWrapperContext  *openHevcContext  = display_decoder(openHevcContexts);
+    AVFrame *picture = openHevcContext->picture;
+    const uint8_t *meta;
+
+    memset(openHevcActivity, 0, sizeof(*openHevcActivity));
+    if (!picture->data[3])
+        return 0;
+    meta = picture->data[3] + ((picture->linesize[0] >> 1) * (openHevcContext->c->coded_height >> 1)) * 3;
+    if (!meta[5])
+        return 0;
+    memcpy(openHevcActivity, meta + META_ACTIVITY, sizeof(*openHevcActivity));
+    return 1;
+}
+
+void libOpenHevcSetCoeffFeatures(OpenHevc_Handle openHevcHandle, int val)
+{
+    OpenHevcWrapperContexts *openHevcContexts = (OpenHevcWrapperContexts *) openHevcHandle;
+    OpenHevcWrapperContext  *openHevcContext;
+    int i;
+
+    openHevcContexts->coeff_features = val;
+
+    for (i = 0; i < openHevcContexts->nb_decoders; i++) {
+        openHevcContext = openHevcContexts->wraper[i];
+        av_opt_set_int(openHevcContext->c->priv_data, "coeff-features", val, 0);
+    }
+}
+
+int libOpenHevcGetCoeffFeatures(OpenHevc_Handle openHevcHandle, const uint8_t **data)
+{
+    OpenHevcWrapperContexts *openHevcContexts = (OpenHevcWrapperContexts *) openHevcHandle;
+    OpenHevcWrapperContext  *openHevcContext  = display_decoder(openHevcContexts);
+    const CoeffFeatures *cf = (const CoeffFeatures *) openHevcContext->picture->data[7];
+
+    *data = NULL;
+    if (!cf)
+        return 0;
+    *data = cf->data;
+    return cf->size;
+}
+
+static uint32_t plane_crc(const AVCRC *table, const uint8_t *src, int stride, int row_size, int rows)
+{
+    uint32_t crc = 0;
+    int y;
+
+    for (y = 0; y < rows; y++, src += stride)
+        crc = av_crc(table, crc, src, row_size);
+    return crc;
+}
+
+/* over the region libOpenHevcGetOutputCpy copies, so that the checksums of
+ * a picture match what it exports */
+int libOpenHevcGetChecksums(OpenHevc_Handle openHevcHandle, uint32_t crc[OPENHEVC_NB_CRC])
+{
+    OpenHevcWrapperContexts *openHevcContexts = (OpenHevcWrapperContexts *) openHevcHandle;
+    OpenHevcWrapperContext  *openHevcContext  = display_decoder(openHevcContexts);
+    AVFrame *picture = openHevcContext->picture;
+    const AVCRC *table = av_crc_get_table(AV_CRC_32_IEEE_LE);
+    OpenHevc_FrameInfo frameInfo;
+    const uint8_t *mv = picture->data[3];
+    int coded_height = openHevcContext->c->coded_height;
+    int stride_pu = picture->linesize[0] >> 2;
+    int stride_cu = picture->linesize[0] >> 3;
+    int src_pu = (coded_height >> 2) * stride_pu;
+    int width, height, format, i;
+
+    memset(crc, 0, OPENHEVC_NB_CRC * sizeof(*crc));
+    if (!mv)
+        return 0;
+    libOpenHevcGetPictureInfo(openHevcHandle, &frameInfo);
+    format = frameInfo.chromat_format == YUV420 ? 1 : 0;
+    libOpenHevcGetPictureInfoCpy(openHevcHandle, &frameInfo);
+    width  = frameInfo.nWidth;
+    height = frameInfo.nHeight;
+
+    for (i = 0; i < 3; i++) {
+        int row_size = i ? frameInfo.nUPitch : frameInfo.nYPitch;
+        int rows     = i ? height >> format : height;
+        crc[OPENHEVC_CRC_Y + i]     = plane_crc(table, picture->data[i], picture->linesize[i], row_size, rows);
+        crc[OPENHEVC_CRC_RES_Y + i] = plane_crc(table, picture->data[4 + i], picture->linesize[i], row_size, rows);
+    }
+    for (i = 0; i < 4; i++)
+        crc[OPENHEVC_CRC_MV_L0_X + i] = plane_crc(table, mv + src_pu * 2 * i, stride_pu * 2,
+                                                  (width >> 2) * 2, height >> 2);
+    for (i = 0; i < 2; i++)
+        crc[OPENHEVC_CRC_REF_L0 + i] = plane_crc(table, mv + src_pu * (8 + i), stride_pu,
+                                                 width >> 2, height >> 2);
+    crc[OPENHEVC_CRC_SIZE] = plane_crc(table, mv + src_pu * 10, stride_cu, width >> 3, height >> 3);
+    if (openHevcContexts->syntax_maps > 0)
+        for (i = 0; i < NB_SYNTAX_MAPS; i++)
+            crc[OPENHEVC_CRC_SYNTAX_MAPS + i] = plane_crc(table, mv + src_pu * 10 + (src_pu >> 2) * (1 + i),
+                                                          stride_cu, width >> 3, height >> 3);
+    crc[OPENHEVC_CRC_META] = av_crc(table, 0, mv + (3 * picture->linesize[0] * coded_height >> 2),
+                                    width * height >> 2);
+    return 1;
+}
+
+void libOpenHevcClose(OpenHevc_Handle openHevcHandle)
+{
+    OpenHevcWrapperContexts *openHevcContexts = (OpenHevcWrapperContexts *) openHevcHandle;
+    int i;
+
+    close_decoders(openHevcContexts);
     av_freep(&openHevcContexts->wraper);
+    av_freep(&openHevcContexts->extradata);
+    av_freep(&openHevcContexts->scan_buf);
+    av_freep(&openHevcContexts->thread_cpus);
+    for (i = 0; i < openHevcContexts->nb_param_sets; i++)
+        av_free(openHevcContexts->param_sets[i].data);
+    av_freep(&openHevcContexts->param_sets);
     av_freep(&openHevcContexts);
 }
 
 void libOpenHevcFlush(OpenHevc_Handle openHevcHandle)
 {
     OpenHevcWrapperContexts *openHevcContexts = (OpenHevcWrapperContexts *) openHevcHandle;
-    OpenHevcWrapperContext  *openHevcContext  = openHevcContexts->wraper[openHevcContexts->active_layer];
+    OpenHevcWrapperContext  *openHevcContext;
 
+    if (!openHevcContexts->started)
+        return;
+    openHevcContext = openHevcContexts->wraper[FFMIN(openHevcContexts->active_layer, openHevcContexts->nb_decoders-1)];
     openHevcContext->codec->flush(openHevcContext->c);
 }
 
 void libOpenHevcFlushSVC(OpenHevc_Handle openHevcHandle, int decoderId)
 {
     OpenHevcWrapperContexts *openHevcContexts = (OpenHevcWrapperContexts *) openHevcHandle;
-    OpenHevcWrapperContext  *openHevcContext  = openHevcContexts->wraper[decoderId];
+    OpenHevcWrapperContext  *openHevcContext;
 
+    if (!openHevcContexts->started || decoderId < 0 || decoderId >= openHevcContexts->nb_decoders)
+        return;
+    openHevcContext = openHevcContexts->wraper[decoderId];
     openHevcContext->codec->flush(openHevcContext->c);
 }
 
+/* Parse-only pass over one Annex B access unit: only the NAL unit headers, the
+ * parameter sets and the start of the first slice header are read, no slice
+ * data is decoded. Returns 1 if the AU holds a base layer picture. */
+/* Append a NAL unit with a start code to scan_buf, returns the new size */
+static int scan_append_nal(OpenHevcWrapperContexts *openHevcContexts, int pos,
+                           const unsigned char *nal, int len)
+{
+    uint8_t *buf = av_fast_realloc(openHevcContexts->scan_buf, &openHevcContexts->scan_buf_size,
+                                   pos + 3 + len + FF_INPUT_BUFFER_PADDING_SIZE);
+
+    if (!buf)
+        return AVERROR(ENOMEM);
+    openHevcContexts->scan_buf = buf;
+    buf[pos]     = 0;
+    buf[pos + 1] = 0;
+    buf[pos + 2] = 1;
+    memcpy(buf + pos + 3, nal, len);
+    memset(buf + pos + 3 + len, 0, FF_INPUT_BUFFER_PADDING_SIZE);
+    return pos + 3 + len;
+}
+
+/* The parser only reads start codes: with hvcC extradata, copy the AU in
+ * Annex B to scan_buf, after the parameter sets of the extradata for the
+ * first one. Returns the size of the copy, 0 if the AU is already Annex B. */
+static int scan_annexb(OpenHevcWrapperContexts *openHevcContexts, const unsigned char *buff, int au_len)
+{
+    const uint8_t *hvcc = openHevcContexts->extradata;
+    int i, j, num_arrays, length_size, pos = 23, size = 0;
+
+    if (openHevcContexts->extradata_size < 23 || (!hvcc[0] && !hvcc[1] && hvcc[2] <= 1))
+        return 0;
+    if (!openHevcContexts->scan_param_sets) {
+        num_arrays = hvcc[22];
+        for (i = 0; i < num_arrays && pos + 3 <= openHevcContexts->extradata_size; i++) {
+            int cnt = (hvcc[pos + 1] << 8) | hvcc[pos + 2];
+            pos += 3;
+            for (j = 0; j < cnt && pos + 2 <= openHevcContexts->extradata_size; j++) {
+                int len = (hvcc[pos] << 8) | hvcc[pos + 1];
+                pos += 2;
+                if (pos + len > openHevcContexts->extradata_size)
+                    return AVERROR_INVALIDDATA;
+                size = scan_append_nal(openHevcContexts, size, hvcc + pos, len);
+                if (size < 0)
+                    return size;
+                pos += len;
+            }
+        }
+        openHevcContexts->scan_param_sets = 1;
+    }
+    length_size = (hvcc[21] & 3) + 1;
+    for (i = 0; i + length_size <= au_len;) {
+        int len = 0;
+        for (j = 0; j < length_size; j++)
+            len = (len << 8) | buff[i + j];
+        i += length_size;
+        if (len > au_len - i)
+            return AVERROR_INVALIDDATA;
+        size = scan_append_nal(openHevcContexts, size, buff + i, len);
+        if (size < 0)
+            return size;
+        i += len;
+    }
+    return size;
+}
+
+int libOpenHevcScanAU(OpenHevc_Handle openHevcHandle, const unsigned char *buff, int au_len, int64_t pts, OpenHevc_AUInfo *openHevcAUInfo)
+{
+    OpenHevcWrapperContexts *openHevcContexts = (OpenHevcWrapperContexts *) openHevcHandle;
+    OpenHevcWrapperContext  *openHevcContext  = openHevcContexts->wraper[0];
+    AVCodecParserContext    *parser           = openHevcContext->parser;
+    const unsigned char     *data             = buff;
+    uint8_t *out_buf;
+    int out_size, nal_unit_type, temporal_id;
+    int size = scan_annexb(openHevcContexts, buff, au_len);
+
+    if (size < 0)
+        return size;
+    if (size)
+        data = openHevcContexts->scan_buf;
+    else
+        size = au_len;
+
+    /* keep the parameter sets up to date even if the AU holds no picture; the
+     * parser only sets the POC once the slice header is parsed */
+    parser->output_picture_number = INT_MIN;
+    av_parser_parse2(parser, openHevcContext->c, &out_buf, &out_size,
+                     data, size, pts, AV_NOPTS_VALUE, -1);
+
+    if (!find_first_vcl_nal(data, size, &nal_unit_type, &temporal_id))
+        return 0;
+    if (parser->output_picture_number == INT_MIN)
+        return AVERROR_INVALIDDATA;
+
+    openHevcAUInfo->nSize        = au_len;
+    openHevcAUInfo->nPoc         = parser->output_picture_number;
+    openHevcAUInfo->nTemporalId  = temporal_id;
+    openHevcAUInfo->nNalUnitType = nal_unit_type;
+    openHevcAUInfo->nSliceType   = parser->pict_type == AV_PICTURE_TYPE_B ? 0 :
+                                   parser->pict_type == AV_PICTURE_TYPE_P ? 1 : 2;
+    openHevcAUInfo->bIrap        = nal_unit_type >= IRAP_NAL_FIRST && nal_unit_type <= IRAP_NAL_LAST;
+    openHevcAUInfo->nTimeStamp   = pts;
+    return 1;
+}
+
+/* Drop the decoding state so that the next AU given to libOpenHevcDecode can
+ * be an IRAP taken from anywhere in the stream (e.g. from a scan index). The
+ * parameter sets already received are kept. */
+void libOpenHevcStartAtIRAP(OpenHevc_Handle openHevcHandle)
+{
+    OpenHevcWrapperContexts *openHevcContexts = (OpenHevcWrapperContexts *) openHevcHandle;
+    int i;
+
+    if (!openHevcContexts->started)
+        return;
+    /* the decoders are restarted anyway, apply the threading picked for the
+     * latest parameter sets; open_decoder replays them into the new decoders */
+    if (openHevcContexts->pending_thread_type) {
+        close_decoders(openHevcContexts);
+        openHevcContexts->thread_type         = openHevcContexts->pending_thread_type;
+        openHevcContexts->nb_pthreads         = openHevcContexts->pending_pthreads;
+        openHevcContexts->nb_frame_threads    = openHevcContexts->pending_frame_threads;
+        openHevcContexts->pending_thread_type = 0;
+        openHevcContexts->started             = 0;
+        if (init_decoder(openHevcContexts, 0))
+            start_decoders(openHevcContexts);
+        return;
+    }
+    for (i = 0; i < openHevcContexts->nb_decoders; i++)
+        avcodec_flush_buffers(openHevcContexts->wraper[i]->c);
+}
+
+int libOpenHevcGetThreadConfig(OpenHevc_Handle openHevcHandle, int *nb_frame_threads, int *nb_slice_threads)
+{
+    OpenHevcWrapperContexts *openHevcContexts = (OpenHevcWrapperContexts *) openHevcHandle;
+    AVCodecContext *c;
+
+    if (!openHevcContexts->started)
+        return 0;
+    c = openHevcContexts->wraper[0]->c;
+    *nb_frame_threads = c->active_thread_type & FF_THREAD_FRAME ? c->thread_count_frame : 1;
+    *nb_slice_threads = c->active_thread_type & FF_THREAD_SLICE ? c->thread_count : 1;
+    if ((c->active_thread_type & FF_THREAD_FRAME) && (c->active_thread_type & FF_THREAD_SLICE))
+        return 4;
+    return c->active_thread_type & FF_THREAD_SLICE ? 2 : 1;
+}
+
+/* When set, the next AUs are decoded through the cheapest path that keeps the
+ * reference pictures intact: non-reference pictures of the highest sub-layer
+ * are output without being decoded. Meant for the pictures before a window. */
+void libOpenHevcSetSkipNonRef(OpenHevc_Handle openHevcHandle, int val)
+{
+    OpenHevcWrapperContexts *openHevcContexts = (OpenHevcWrapperContexts *) openHevcHandle;
+    int i;
+
+    for (i = 0; i < openHevcContexts->nb_decoders; i++)
+        openHevcContexts->wraper[i]->c->skip_frame = val ? AVDISCARD_NONREF : AVDISCARD_DEFAULT;
+}
+
+/* Release an output picture without copying it. The MV plane is cleaned as in
+ * libOpenHevcGetOutputCpy so that the buffer goes back to the pool zeroed. */
+void libOpenHevcDiscardOutput(OpenHevc_Handle openHevcHandle)
+{
+    OpenHevcWrapperContexts *openHevcContexts = (OpenHevcWrapperContexts *) openHevcHandle;
+    OpenHevcWrapperContext  *openHevcContext  = display_decoder(openHevcContexts);
+    AVFrame                 *picture          = openHevcContext->picture;
+
+    if (picture->data[3])
+        memset(picture->data[3], 0, picture->linesize[0] * openHevcContext->c->coded_height);
+}
+
+/* Set the number of decoding threads shared by all the handles created from now
+ * on, 0 for one per core, -1 to remove the limit (the default). */
+void libOpenHevcSetThreadPoolSize(int nb_threads)
+{
+    if (!nb_threads)
+        nb_threads = av_cpu_count();
+    avpriv_atomic_int_set(&thread_pool_size, nb_threads);
+}
+
+/* Restrict the decoding threads of the handle to a set of CPUs (Linux only).
+ * Call it before libOpenHevcStartDecoder, the threads are created there, it
+ * fails afterwards. The frame buffers are first written by the frame threads,
+ * so with frame threading they end up on the NUMA node of these CPUs. */
+int libOpenHevcSetCpuAffinity(OpenHevc_Handle openHevcHandle, const int *cpus, int nb_cpus)
+{
+    OpenHevcWrapperContexts *openHevcContexts = (OpenHevcWrapperContexts *) openHevcHandle;
+
+    /* the open decoders hold thread_cpus */
+    if (openHevcContexts->started) {
+        fprintf(stderr, "The CPU affinity must be set before the decoders start\n");
+        return -1;
+    }
+    av_freep(&openHevcContexts->thread_cpus);
+    openHevcContexts->nb_thread_cpus = 0;
+    if (!cpus || nb_cpus <= 0)
+        return 0;
+    openHevcContexts->thread_cpus = av_malloc_array(nb_cpus, sizeof(*cpus));
+    if (!openHevcContexts->thread_cpus)
+        return -1;
+    memcpy(openHevcContexts->thread_cpus, cpus, nb_cpus * sizeof(*cpus));
+    openHevcContexts->nb_thread_cpus = nb_cpus;
+    return 0;
+}
+
+static int cpu_node(int cpu)
+{
+#if defined(__linux__)
+    char path[64];
+    int node;
+
+    for (node = 0; node < 256; node++) {
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/node%d", cpu, node);
+        if (!access(path, F_OK))
+            return node;
+    }
+#endif
+    return -1;
+}
+
+/* Describe where the decoders of the handle run: threading, CPUs and the NUMA
+ * nodes of these CPUs. Returns the length of the report. */
+int libOpenHevcGetPlacementReport(OpenHevc_Handle openHevcHandle, char *report, int size)
+{
+    OpenHevcWrapperContexts *openHevcContexts = (OpenHevcWrapperContexts *) openHevcHandle;
+    uint64_t nodes = 0;
+    int i, nb_frame_threads = 1, nb_slice_threads = 1, thread_type;
+
+    if (!report || size <= 0)
+        return 0;
+    report[0] = 0;
+    thread_type = libOpenHevcGetThreadConfig(openHevcHandle, &nb_frame_threads, &nb_slice_threads);
+    av_strlcatf(report, size, "%d decoder(s), %s threading, %d frame x %d slice threads\n",
+                openHevcContexts->nb_decoders, thread_type ? thread_type_name(thread_type) : "not started",
+                nb_frame_threads, nb_slice_threads);
+    if (!openHevcContexts->nb_thread_cpus) {
+        av_strlcatf(report, size, "threads not pinned\n");
+        return strlen(report);
+    }
+    av_strlcatf(report, size, "threads pinned to cpus");
+    for (i = 0; i < openHevcContexts->nb_thread_cpus; i++) {
+        int node = cpu_node(openHevcContexts->thread_cpus[i]);
+        av_strlcatf(report, size, " %d", openHevcContexts->thread_cpus[i]);
+        if (node >= 0 && node < 64)
+            nodes |= UINT64_C(1) << node;
+    }
+    av_strlcatf(report, size, "\nnuma nodes");
+    for (i = 0; i < 64; i++)
+        if (nodes & (UINT64_C(1) << i))
+            av_strlcatf(report, size, " %d", i);
+    av_strlcatf(report, size, "\nframe buffers first touched by the %s\n",
+                nb_frame_threads > 1 ? "pinned frame threads" : "calling thread");
+    return strlen(report);
+}
+
 const char *libOpenHevcVersion(OpenHevc_Handle openHevcHandle)
 {
     return "OpenHEVC v"NV_VERSION;
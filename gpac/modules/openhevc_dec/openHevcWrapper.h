@@ -83,6 +83,87 @@ typedef struct OpenHevc_Frame_cpy
    OpenHevc_FrameInfo frameInfo;
 } OpenHevc_Frame_cpy;
 
+/* camera motion per POC unit, in quarter luma samples, at the luma sample
+ * position (x, y): mv_x = fParams[0] + fParams[1] * x + fParams[2] * y,
+ * mv_y = fParams[3] + fParams[4] * x + fParams[5] * y */
+typedef struct OpenHevc_GlobalMotion
+{
+   float       fParams[6];
+   float       fInliers;      //share of the motion field fitted by the model
+   int32_t     nNbSamples;    //8x8 inter samples of the fit, 0 if there is no model
+} OpenHevc_GlobalMotion;
+
+#define OPENHEVC_ACTIVITY_INTRA     1 //intra picture
+#define OPENHEVC_ACTIVITY_SCENE_CUT 2 //inter picture mostly coded intra
+#define OPENHEVC_ACTIVITY_HIGH      4 //fast motion or little skipped area
+
+typedef struct OpenHevc_Activity
+{
+   int32_t     nBits;         //bits of the slice NAL units
+   float       fIntra;        //share of the picture area in intra CUs
+   float       fInter;        //in inter CUs that are not skipped
+   float       fSkip;         //in skipped CUs
+   float       fMeanMv;       //mean |MV| per POC unit of the inter area, quarter samples
+   float       fMeanQp;       //mean luma QP
+   int32_t     nFlags;        //OPENHEVC_ACTIVITY_*
+} OpenHevc_Activity;
+
+/* coefficient features of a TU, followed by its nb_coeffs OpenHevc_Coeff */
+typedef struct OpenHevc_CoeffTU
+{
+   uint16_t    x, y;          //position in samples of the component
+   uint8_t     log2_size;
+   uint8_t     c_idx;         //0: Y, 1: Cb, 2: Cr
+   int8_t      qp;            //QP of the dequantization, 0 with the transquant bypass
+   uint8_t     flags;         //1: transform skip, 2: transquant bypass, 4: intra
+   uint32_t    nb_coeffs;
+} OpenHevc_CoeffTU;
+
+typedef struct OpenHevc_Coeff
+{
+   uint16_t    pos;           //y * (1 << log2_size) + x
+   int16_t     level;         //dequantized level
+} OpenHevc_Coeff;
+
+/* planes of libOpenHevcGetChecksums */
+enum OpenHevc_ChecksumPlane {
+    OPENHEVC_CRC_Y = 0,
+    OPENHEVC_CRC_U,
+    OPENHEVC_CRC_V,
+    OPENHEVC_CRC_MV_L0_X,
+    OPENHEVC_CRC_MV_L0_Y,
+    OPENHEVC_CRC_MV_L1_X,
+    OPENHEVC_CRC_MV_L1_Y,
+    OPENHEVC_CRC_REF_L0,
+    OPENHEVC_CRC_REF_L1,
+    OPENHEVC_CRC_SIZE,
+    OPENHEVC_CRC_SYNTAX_MAPS,                           //6 planes, 0 without syntax maps
+    OPENHEVC_CRC_META = OPENHEVC_CRC_SYNTAX_MAPS + 6,   //picture type, models and CTU quadtree
+    OPENHEVC_CRC_RES_Y,
+    OPENHEVC_CRC_RES_U,
+    OPENHEVC_CRC_RES_V,
+    OPENHEVC_NB_CRC,
+};
+
+typedef struct OpenHevc_AUInfo
+{
+   int         nSize;
+   int         nPoc;
+   int         nTemporalId;
+   int         nNalUnitType;  //first base layer VCL NAL unit of the AU
+   int         nSliceType;    //slice_type of the first slice (0: B, 1: P, 2: I)
+   int         bIrap;
+   int64_t     nTimeStamp;
+} OpenHevc_AUInfo;
+
+/* Number of decoding threads shared by all the handles opened from now on,
+ * 0 for one per core, -1 for no limit (the default). A decoder is charged all
+ * its threads, slice threads times frame threads with frameslice threading.
+ * The budget is not split between the handles: they take what they ask for in
+ * the order their decoders start, and once it is spent the next ones decode
+ * without worker threads until a handle is closed. */
+void libOpenHevcSetThreadPoolSize(int nb_threads);
+/* thread_type: 1 frame, 2 slice, 4 frameslice, 8 picked from the SPS/PPS */
 OpenHevc_Handle libOpenHevcInit(int nb_pthreads, int thread_type);
 int libOpenHevcStartDecoder(OpenHevc_Handle openHevcHandle);
 int  libOpenHevcDecode(OpenHevc_Handle openHevcHandle, const unsigned char *buff, int nal_len, int64_t pts);
@@ -96,11 +177,68 @@ void libOpenHevcSetCheckMD5(OpenHevc_Handle openHevcHandle, int val);
 void libOpenHevcSetDebugMode(OpenHevc_Handle openHevcHandle, int val);
 void libOpenHevcSetTemporalLayer_id(OpenHevc_Handle openHevcHandle, int val);
 void libOpenHevcSetNoCropping(OpenHevc_Handle openHevcHandle, int val);
+/* decode the independent slices of a picture in parallel with the slice
+ * threads, to be set before libOpenHevcStartDecoder */
+void libOpenHevcSetParallelSlices(OpenHevc_Handle openHevcHandle, int val);
+/* run the in-loop filters of a slice on a slice thread of their own, behind
+ * the CTB decoding, to be set before libOpenHevcStartDecoder */
+void libOpenHevcSetParallelFilters(OpenHevc_Handle openHevcHandle, int val);
+/* extend the borders of the decoded pictures once, so that the motion
+ * compensation reads the blocks near and past them without copying */
+void libOpenHevcSetPadRefs(OpenHevc_Handle openHevcHandle, int val);
+/* append to pvMV, after the size plane, 6 planes of one byte per 8x8 block:
+ * luma QP (int8_t), skip flag, luma intra mode (255 when inter), part mode,
+ * coding tree depth and luma cbf */
+void libOpenHevcSetSyntaxMaps(OpenHevc_Handle openHevcHandle, int val);
+/* parse only: neither the pictures nor the feature planes are decoded, the
+ * activity of each picture is computed instead */
+void libOpenHevcSetAnalysis(OpenHevc_Handle openHevcHandle, int val);
+/* activity of the last output picture, returns 0 if there is none; to be
+ * called before libOpenHevcGetOutputCpy */
+int  libOpenHevcGetActivity(OpenHevc_Handle openHevcHandle, OpenHevc_Activity *openHevcActivity);
+/* 0: off, 1: fit a camera motion model to the motion field of each picture,
+ * 2: same, and remove it from the MVs of pvMV */
+void libOpenHevcSetGlobalMotion(OpenHevc_Handle openHevcHandle, int val);
+/* model of the last output picture, returns 0 if there is none; to be called
+ * before libOpenHevcGetOutputCpy, which clears the MV planes. The model is
+ * also in the metadata copied to pvMV. */
+int  libOpenHevcGetGlobalMotion(OpenHevc_Handle openHevcHandle, OpenHevc_GlobalMotion *openHevcGlobalMotion);
+/* 0: off, 1: keep the dequantized coefficients of the TUs of each picture,
+ * 2: same, but parse only: no inverse transform, the pixel and residual
+ * planes are not reconstructed */
+/* accumulate the MVs of each picture along its references, back to the
+ * intra picture, intra block or picture without a field the chain starts from */
+void libOpenHevcSetAccMotion(OpenHevc_Handle openHevcHandle, int val);
+/* accumulated motion of the last output picture, returns 0 if there is none:
+ * width x height pairs of int16_t (x, y), one per minimum PU of the coded
+ * picture (4x4 luma samples, or larger with a minimum CB above 8x8),
+ * displacement to the anchor picture in quarter luma samples; to be called
+ * before libOpenHevcGetOutputCpy, which clears the MV planes */
+int  libOpenHevcGetAccMotion(OpenHevc_Handle openHevcHandle, const int16_t **field, int *width, int *height);
+void libOpenHevcSetCoeffFeatures(OpenHevc_Handle openHevcHandle, int val);
+/* OpenHevc_CoeffTU records of the last output picture, returns their size
+ * in bytes */
+int  libOpenHevcGetCoeffFeatures(OpenHevc_Handle openHevcHandle, const uint8_t **data);
+/* CRC-32 of each plane of the last output picture, over the region
+ * libOpenHevcGetOutputCpy copies, returns 0 if there is none; to be called
+ * before libOpenHevcGetOutputCpy, which clears the MV planes */
+int  libOpenHevcGetChecksums(OpenHevc_Handle openHevcHandle, uint32_t crc[OPENHEVC_NB_CRC]);
 void libOpenHevcSetActiveDecoders(OpenHevc_Handle openHevcHandle, int val);
 void libOpenHevcSetViewLayers(OpenHevc_Handle openHevcHandle, int val);
 void libOpenHevcClose(OpenHevc_Handle openHevcHandle);
 void libOpenHevcFlush(OpenHevc_Handle openHevcHandle);
 void libOpenHevcFlushSVC(OpenHevc_Handle openHevcHandle, int decoderId);
+/* Parse only, returns 1 and fills openHevcAUInfo if the AU holds a picture,
+ * 0 if it does not, a negative error if its slice header cannot be parsed
+ * (e.g. its parameter sets are missing); the AU is in Annex B, or in the NAL
+ * unit length format of the hvcC extradata set with libOpenHevcCopyExtraData */
+int  libOpenHevcScanAU(OpenHevc_Handle openHevcHandle, const unsigned char *buff, int au_len, int64_t pts, OpenHevc_AUInfo *openHevcAUInfo);
+void libOpenHevcStartAtIRAP(OpenHevc_Handle openHevcHandle);
+void libOpenHevcSetSkipNonRef(OpenHevc_Handle openHevcHandle, int val);
+void libOpenHevcDiscardOutput(OpenHevc_Handle openHevcHandle);
+int  libOpenHevcGetThreadConfig(OpenHevc_Handle openHevcHandle, int *nb_frame_threads, int *nb_slice_threads);
+int  libOpenHevcSetCpuAffinity(OpenHevc_Handle openHevcHandle, const int *cpus, int nb_cpus);
+int  libOpenHevcGetPlacementReport(OpenHevc_Handle openHevcHandle, char *report, int size);
 
 const char *libOpenHevcVersion(OpenHevc_Handle openHevcHandle);
 
@@ -3137,6 +3137,15 @@ typedef struct AVCodecContext {
     void *BL_frame;
     void *BL_avcontext;
     int quality_id;
+
+    /**
+     * CPUs the decoding threads are restricted to (Linux only), NULL to leave
+     * them to the scheduler. Must stay valid while the codec is open.
+     * - encoding: unused
+     * - decoding: Set by user before avcodec_open2().
+     */
+    const int *thread_cpus;
+    int nb_thread_cpus;
 } AVCodecContext;
 
 AVRational av_codec_get_pkt_timebase         (const AVCodecContext *avctx);
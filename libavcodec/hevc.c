@@ -62,11 +62,18 @@ static void printf_ref_pic_list(HEVCContext *s);
 /* free everything allocated  by pic_arrays_init() */
 static void pic_arrays_free(HEVCContext *s)
 {
+    int i;
+
     av_freep(&s->sao);
     av_freep(&s->deblock);
+    for (i = 0; i < 3; i++) {
+        av_freep(&s->sao_pixel_buffer_h[i]);
+        av_freep(&s->sao_pixel_buffer_v[i]);
+    }
 
     av_freep(&s->skip_flag);
     av_freep(&s->tab_ct_depth);
+    av_freep(&s->tab_part_mode);
 
     av_freep(&s->tab_ipm);
     av_freep(&s->cbf_luma);
@@ -84,7 +91,9 @@ static void pic_arrays_free(HEVCContext *s)
     av_freep(&s->sh.offset);
 
     av_buffer_pool_uninit(&s->tab_mvf_pool);
+    av_buffer_pool_uninit(&s->tab_mvf_col_pool);
     av_buffer_pool_uninit(&s->rpl_tab_pool);
+    av_buffer_pool_uninit(&s->acc_motion_pool);
 
 #ifdef SVC_EXTENSION
 #if ACTIVE_BOTH_FRAME_AND_PU
@@ -102,10 +111,6 @@ static void pic_arrays_free(HEVCContext *s)
 #endif
 #endif    
 #endif
-
-#if PARALLEL_SLICE
-    av_freep(&s->decoded_rows);
-#endif
 }
 
 /* allocate arrays that depend on frame dimensions */
@@ -132,14 +137,29 @@ static int pic_arrays_init(HEVCContext *s, const HEVCSPS *sps)
     if (!s->sao || !s->deblock)
         goto fail;
 
-    s->skip_flag    = av_malloc(sps->min_cb_height * sps->min_cb_width);
-    s->tab_ct_depth = av_malloc(sps->min_cb_height * sps->min_cb_width);
+    if (sps->sao_enabled) {
+        int c_count = sps->chroma_array_type ? 3 : 1;
+        int c_idx;
+
+        for (c_idx = 0; c_idx < c_count; c_idx++) {
+            int w = sps->width  >> sps->hshift[c_idx];
+            int h = sps->height >> sps->vshift[c_idx];
+            s->sao_pixel_buffer_h[c_idx] = av_malloc((w * 2 * sps->ctb_height) << sps->pixel_shift);
+            s->sao_pixel_buffer_v[c_idx] = av_malloc((h * 2 * sps->ctb_width)  << sps->pixel_shift);
+            s->dynamic_alloc += (w * 2 * sps->ctb_height) << sps->pixel_shift;
+            s->dynamic_alloc += (h * 2 * sps->ctb_width)  << sps->pixel_shift;
+            if (!s->sao_pixel_buffer_h[c_idx] || !s->sao_pixel_buffer_v[c_idx])
+                goto fail;
+        }
+    }
+
+    s->skip_flag     = av_malloc(sps->min_cb_height * sps->min_cb_width);
+    s->tab_ct_depth  = av_malloc(sps->min_cb_height * sps->min_cb_width);
+    s->tab_part_mode = av_malloc(sps->min_cb_height * sps->min_cb_width);
     s->dynamic_alloc += (sps->min_cb_height * sps->min_cb_width);
     s->dynamic_alloc += (sps->min_cb_height * sps->min_cb_width);
-#if PARALLEL_SLICE
-    s->decoded_rows = av_malloc(sps->ctb_height);
-#endif
-    if (!s->skip_flag || !s->tab_ct_depth)
+    s->dynamic_alloc += (sps->min_cb_height * sps->min_cb_width);
+    if (!s->skip_flag || !s->tab_ct_depth || !s->tab_part_mode)
         goto fail;
 
     s->cbf_luma = av_malloc(sps->min_tb_width * sps->min_tb_height);
@@ -179,10 +199,20 @@ static int pic_arrays_init(HEVCContext *s, const HEVCSPS *sps)
                                           av_buffer_allocz);
     s->rpl_tab_pool = av_buffer_pool_init(ctb_count * sizeof(RefPicListTab),
                                           av_buffer_allocz);
+    s->tab_mvf_col_pool = av_buffer_pool_init(((width + 15) >> 4) * ((height + 15) >> 4) * sizeof(MvField),
+                                              av_buffer_allocz);
     s->dynamic_alloc += (min_pu_size * sizeof(MvField));
+    s->dynamic_alloc += (((width + 15) >> 4) * ((height + 15) >> 4) * sizeof(MvField));
     s->dynamic_alloc += (ctb_count * sizeof(RefPicListTab));
 
-    if (!s->tab_mvf_pool || !s->rpl_tab_pool)
+    if (s->acc_motion) {
+        s->acc_motion_pool = av_buffer_pool_init(min_pu_size * 2 * sizeof(int16_t),
+                                                 av_buffer_allocz);
+        if (!s->acc_motion_pool)
+            goto fail;
+        s->dynamic_alloc += (min_pu_size * 2 * sizeof(int16_t));
+    }
+    if (!s->tab_mvf_pool || !s->tab_mvf_col_pool || !s->rpl_tab_pool)
         goto fail;
 #ifdef SVC_EXTENSION
     if(s->decoder_id)    {
@@ -366,23 +396,8 @@ static int decode_lt_rps(HEVCContext *s, LongTermRPS *rps, GetBitContext *gb)
     return 0;
 }
 
-static int get_buffer_sao(HEVCContext *s, AVFrame *frame, const HEVCSPS *sps)
+static void intra_pred_none(HEVCContext *s, int x0, int y0, int c_idx)
 {
-    int ret, i;
-
-    frame->width  = s->avctx->width  + 2;
-    frame->height = s->avctx->height + 2;
-    if ((ret = ff_get_buffer(s->avctx, frame, AV_GET_BUFFER_FLAG_REF)) < 0)
-        return ret;
-    for (i = 0; frame->data[i]; i++) {
-        int offset = frame->linesize[i] + (1 << sps->pixel_shift);
-        frame->data[i] += offset;
-    }
-    frame->width  = s->avctx->width;
-    frame->height = s->avctx->height;
-
-
-    return 0;
 }
 
 static int set_sps(HEVCContext *s, const HEVCSPS *sps)
@@ -420,16 +435,15 @@ static int set_sps(HEVCContext *s, const HEVCSPS *sps)
     }
 
     ff_hevc_pred_init(&s->hpc,     sps->bit_depth);
+    if (s->analysis) {
+        int i;
+        // parse only, there is no picture to predict from
+        for (i = 0; i < FF_ARRAY_ELEMS(s->hpc.intra_pred); i++)
+            s->hpc.intra_pred[i] = intra_pred_none;
+    }
     ff_hevc_dsp_init (&s->hevcdsp, sps->bit_depth);
     ff_videodsp_init (&s->vdsp,    sps->bit_depth);
 
-    if (sps->sao_enabled) {
-        av_frame_unref(s->tmp_frame);
-        //Mvdecoder: create buffer
-        ret = get_buffer_sao(s, s->tmp_frame, sps);
-        s->sao_frame = s->tmp_frame;
-    }
-
     s->sps = sps;
     s->vps = (HEVCVPS*) s->vps_list[s->sps->vps_id]->data;
 
@@ -532,25 +546,6 @@ static int hls_slice_header(HEVCContext *s)
 #endif
     int first_slice_in_pic_flag = get_bits1(gb);
 
-#if PARALLEL_SLICE
-    if (IS_IRAP(s)) {
-        if(!first_slice_in_pic_flag) {
-            int self_id, temporal_id, nuh_layer_id, nal_unit_type, job;
-            nal_unit_type = s->nal_unit_type;
-            self_id       = s->self_id;
-            temporal_id   = s->temporal_id;
-            nuh_layer_id  = s->nuh_layer_id;
-            job           = s->job;
-            ff_thread_await_progress_slice(s->avctx);
-            memcpy(s, s1, sizeof(HEVCContext));
-            s->HEVClc                 = s1->HEVClcList[self_id];
-            s->nal_unit_type          = nal_unit_type;
-            s->temporal_id            = temporal_id;
-            s->nuh_layer_id           = nuh_layer_id;
-            s->job                    = job;
-        }
-    }
-#endif
     sh->first_slice_in_pic_flag   = first_slice_in_pic_flag;
 
 	if (s1->force_first_slice_in_pic) {
@@ -625,10 +620,6 @@ static int hls_slice_header(HEVCContext *s)
         slice_address_length = av_ceil_log2(s->sps->ctb_width *
                                             s->sps->ctb_height);
         sh->slice_segment_addr = get_bits(gb, slice_address_length);
-#if PARALLEL_SLICE
-        s1->slice_segment_addr[s->job] = sh->slice_segment_addr;
-        ff_thread_report_progress_slice2(s->avctx, s->job);
-#endif
 
         print_cabac("slice_segment_address", sh->slice_segment_addr );
         if (sh->slice_segment_addr >= s->sps->ctb_width * s->sps->ctb_height) {
@@ -640,15 +631,7 @@ static int hls_slice_header(HEVCContext *s)
 
         if (!sh->dependent_slice_segment_flag) {
             sh->slice_addr = sh->slice_segment_addr;
-#if PARALLEL_SLICE
-if (0)
-    s->slice_idx = s->job;
-else
-    s->slice_idx++;
-
-#else
             s->slice_idx++;
-#endif
         }
     } else {
         sh->slice_segment_addr = sh->slice_addr = 0;
@@ -1700,6 +1683,7 @@ static void luma_mc_uni(HEVCContext *s, uint8_t *dst, ptrdiff_t dststride,
     ptrdiff_t srcstride  = ref->linesize[0];
     int pic_width        = s->sps->width;
     int pic_height       = s->sps->height;
+    int pad              = s->ref_pad;
     //亚像素的运动矢量
     //mv0,mv1单位是1/4像素，与00000011相与之后保留后两位
     int mx               = mv->x & 3;
@@ -1714,9 +1698,9 @@ static void luma_mc_uni(HEVCContext *s, uint8_t *dst, ptrdiff_t dststride,
     y_off += mv->y >> 2;
     src   += y_off * srcstride + (x_off << s->sps->pixel_shift);
     //边界处处理
-    if (x_off < QPEL_EXTRA_BEFORE || y_off < QPEL_EXTRA_AFTER ||
-        x_off >= pic_width - block_w - QPEL_EXTRA_AFTER ||
-        y_off >= pic_height - block_h - QPEL_EXTRA_AFTER) {
+    if (x_off < QPEL_EXTRA_BEFORE - pad || y_off < QPEL_EXTRA_AFTER - pad ||
+        x_off >= pic_width + pad - block_w - QPEL_EXTRA_AFTER ||
+        y_off >= pic_height + pad - block_h - QPEL_EXTRA_AFTER) {
         const int edge_emu_stride = EDGE_EMU_BUFFER_STRIDE << s->sps->pixel_shift;
         int offset     = QPEL_EXTRA_BEFORE * srcstride       + (QPEL_EXTRA_BEFORE << s->sps->pixel_shift);
         int buf_offset = QPEL_EXTRA_BEFORE * edge_emu_stride + (QPEL_EXTRA_BEFORE << s->sps->pixel_shift);
@@ -1771,6 +1755,7 @@ static void luma_mc_uni(HEVCContext *s, uint8_t *dst, ptrdiff_t dststride,
     ptrdiff_t src1stride  = ref1->linesize[0];
     int pic_width        = s->sps->width;
     int pic_height       = s->sps->height;
+    int pad              = s->ref_pad;
 
     //亚像素的运动矢量
     //mv0,mv1单位是1/4像素，与00000011相与之后保留后两位
@@ -1796,9 +1781,9 @@ static void luma_mc_uni(HEVCContext *s, uint8_t *dst, ptrdiff_t dststride,
     //list1
     uint8_t *src1  = ref1->data[0] + y_off1 * src1stride + (int)((unsigned)x_off1 << s->sps->pixel_shift);
     //边界位置的处理
-    if (x_off0 < QPEL_EXTRA_BEFORE || y_off0 < QPEL_EXTRA_AFTER ||
-        x_off0 >= pic_width - block_w - QPEL_EXTRA_AFTER ||
-        y_off0 >= pic_height - block_h - QPEL_EXTRA_AFTER) {
+    if (x_off0 < QPEL_EXTRA_BEFORE - pad || y_off0 < QPEL_EXTRA_AFTER - pad ||
+        x_off0 >= pic_width + pad - block_w - QPEL_EXTRA_AFTER ||
+        y_off0 >= pic_height + pad - block_h - QPEL_EXTRA_AFTER) {
         const int edge_emu_stride = EDGE_EMU_BUFFER_STRIDE << s->sps->pixel_shift;
         int offset     = QPEL_EXTRA_BEFORE * src0stride       + (QPEL_EXTRA_BEFORE << s->sps->pixel_shift);
         int buf_offset = QPEL_EXTRA_BEFORE * edge_emu_stride + (QPEL_EXTRA_BEFORE << s->sps->pixel_shift);
@@ -1813,9 +1798,9 @@ static void luma_mc_uni(HEVCContext *s, uint8_t *dst, ptrdiff_t dststride,
         src0stride = edge_emu_stride;
     }
 
-    if (x_off1 < QPEL_EXTRA_BEFORE || y_off1 < QPEL_EXTRA_AFTER ||
-        x_off1 >= pic_width - block_w - QPEL_EXTRA_AFTER ||
-        y_off1 >= pic_height - block_h - QPEL_EXTRA_AFTER) {
+    if (x_off1 < QPEL_EXTRA_BEFORE - pad || y_off1 < QPEL_EXTRA_AFTER - pad ||
+        x_off1 >= pic_width + pad - block_w - QPEL_EXTRA_AFTER ||
+        y_off1 >= pic_height + pad - block_h - QPEL_EXTRA_AFTER) {
         const int edge_emu_stride = EDGE_EMU_BUFFER_STRIDE << s->sps->pixel_shift;
         int offset     = QPEL_EXTRA_BEFORE * src1stride       + (QPEL_EXTRA_BEFORE << s->sps->pixel_shift);
         int buf_offset = QPEL_EXTRA_BEFORE * edge_emu_stride + (QPEL_EXTRA_BEFORE << s->sps->pixel_shift);
@@ -1877,6 +1862,12 @@ static void MvDecoder_write_mv_buffer(HEVCContext *s, uint8_t *dst3_base, int x0
     int16_t *dst_l1_my = (int16_t*)(dst3_base + pu_resolution*6) + pu_y0 * pu_linesize + pu_x0;
     uint8_t *dst_l0_ref = dst3_base + pu_resolution*8 + pu_y0 * pu_linesize + pu_x0;
     uint8_t *dst_l1_ref = dst3_base + pu_resolution*9 + pu_y0 * pu_linesize + pu_x0;
+    // the MvField keeps ref_idx only, the POC distances come from the slice lists
+    RefPicList *refPicList = s->ref->refPicList[s->slice_idx];
+    uint8_t l0_ref = current_mv->pred_flag & PF_L0 ?
+                     s->poc - refPicList[0].list[current_mv->ref_idx[0]] : 0;
+    uint8_t l1_ref = current_mv->pred_flag & PF_L1 ?
+                     refPicList[1].list[current_mv->ref_idx[1]] - s->poc : 0;
 
     //亚像素的运动矢量
     //mv0,mv1单位是1/4像素 for UV, 1/8 for Y.
@@ -1887,7 +1878,7 @@ static void MvDecoder_write_mv_buffer(HEVCContext *s, uint8_t *dst3_base, int x0
             for (x = 0; x < pu_block_w; x++) {
                 dst_l0_mx[x] = current_mv->mv[0].x;
                 dst_l0_my[x] = current_mv->mv[0].y;
-                dst_l0_ref[x] = s->poc - current_mv->poc[0];
+                dst_l0_ref[x] = l0_ref;
             }
             dst_l0_mx += pu_linesize;
             dst_l0_my += pu_linesize;
@@ -1900,7 +1891,7 @@ static void MvDecoder_write_mv_buffer(HEVCContext *s, uint8_t *dst3_base, int x0
             for (x = 0; x < pu_block_w; x++) {
                 dst_l1_mx[x] = current_mv->mv[1].x;
                 dst_l1_my[x] = current_mv->mv[1].y;
-                dst_l1_ref[x] = current_mv->poc[1] - s->poc;
+                dst_l1_ref[x] = l1_ref;
             }
             dst_l1_mx += pu_linesize;
             dst_l1_my += pu_linesize;
@@ -1913,10 +1904,10 @@ static void MvDecoder_write_mv_buffer(HEVCContext *s, uint8_t *dst3_base, int x0
             for (x = 0; x < pu_block_w; x++) {
                 dst_l0_mx[x] = current_mv->mv[0].x;
                 dst_l0_my[x] = current_mv->mv[0].y;
-                dst_l0_ref[x] = s->poc - current_mv->poc[0];
+                dst_l0_ref[x] = l0_ref;
                 dst_l1_mx[x] = current_mv->mv[1].x;
                 dst_l1_my[x] = current_mv->mv[1].y;
-                dst_l1_ref[x] = current_mv->poc[1] - s->poc;
+                dst_l1_ref[x] = l1_ref;
             }
             dst_l0_mx += pu_linesize;
             dst_l0_my += pu_linesize;
@@ -1962,9 +1953,450 @@ static void MvDecoder_write_size_buffer(HEVCContext *s, int x0, int y0, int log2
 }
 
 
-static void MvDecoder_write_residual_initialization(uint8_t* dst, int block_w, int block_h, int linesize)
+/**
+ * MvDecoder_write_activity
+ *
+ * Gather the CU statistics of the slice threads, with the mean QP of the
+ * picture, in the MvDecoderActivity of the metadata.
+ *
+ * @param s HEVC decoding context
+ */
+static void MvDecoder_write_activity(HEVCContext *s)
+{
+    HEVCActivityStats st = { 0 };
+    MvDecoderActivity act = { 0 };
+    int min_cb_width = s->sps->min_cb_width;
+    int64_t qp_sum = 0, area;
+    int x, y, i;
+
+    for (i = 0; i <= s->threads_number; i++) {
+        HEVCLocalContext *lc = s->HEVClcList[i];
+        if (!lc)
+            continue;
+        st.intra_area += lc->activity.intra_area;
+        st.inter_area += lc->activity.inter_area;
+        st.skip_area  += lc->activity.skip_area;
+        st.mv_area    += lc->activity.mv_area;
+        st.mv_sum     += lc->activity.mv_sum;
+    }
+    for (y = 0; y < s->sps->min_cb_height; y++)
+        for (x = 0; x < min_cb_width; x++)
+            qp_sum += s->qp_y_tab[y * min_cb_width + x];
+
+    area = FFMAX(st.intra_area + st.inter_area + st.skip_area, 1);
+    act.bits    = s->nal_bytes * 8;
+    act.intra   = st.intra_area / (float)area;
+    act.inter   = st.inter_area / (float)area;
+    act.skip    = st.skip_area  / (float)area;
+    act.mean_mv = st.mv_area ? st.mv_sum / st.mv_area : 0;
+    act.mean_qp = qp_sum / (float)(s->sps->min_cb_height * min_cb_width);
+
+    if (!st.inter_area && !st.skip_area)
+        act.flags |= MVDECODER_ACTIVITY_INTRA;
+    else {
+        if (act.intra >= MVDECODER_SCENE_CUT_INTRA)
+            act.flags |= MVDECODER_ACTIVITY_SCENE_CUT;
+        if (act.mean_mv >= MVDECODER_HIGH_ACTIVITY_MV || act.skip < MVDECODER_HIGH_ACTIVITY_SKIP)
+            act.flags |= MVDECODER_ACTIVITY_HIGH;
+    }
+    memcpy(s->frame->data[3] + ((s->frame->linesize[0]>>1)*(s->frame->coded_height>>1))*3 +
+           MVDECODER_META_ACTIVITY, &act, sizeof(act));
+}
+
+/**
+ * MvDecoder_write_syntax_maps
+ *
+ * Copy the CU syntax of the decoded picture to the planes following the size
+ * plane, see MvDecoderSyntaxMap. Called before the motion field is released.
+ *
+ * @param s HEVC decoding context
+ */
+static void MvDecoder_write_syntax_maps(HEVCContext *s)
+{
+    int pu_resolution = (s->frame->coded_height>>2)*(s->frame->linesize[0]>>2);
+    int cu_linesize = s->frame->linesize[0]>>3;
+    int plane_size = pu_resolution >> 2;
+    uint8_t *dst = &s->frame->data[3][pu_resolution*10 + plane_size];
+    const MvField *tab_mvf = s->ref->tab_mvf;
+    int log2_min_cb_size = s->sps->log2_min_cb_size;
+    int log2_min_pu_size = s->sps->log2_min_pu_size;
+    int log2_min_tb_size = s->sps->log2_min_tb_size;
+    int min_cb_width = s->sps->min_cb_width;
+    int min_pu_width = s->sps->min_pu_width;
+    int min_tb_width = s->sps->min_tb_width;
+    // 4x4 TBs: 2x2 of them per block
+    int tb_count = log2_min_tb_size < 3 ? 2 : 1;
+    int x, y, i, j;
+
+    for (y = 0; y < s->sps->height >> 3; y++) {
+        int y_cb = (y << 3) >> log2_min_cb_size;
+        int y_pu = (y << 3) >> log2_min_pu_size;
+        int y_tb = (y << 3) >> log2_min_tb_size;
+        for (x = 0; x < s->sps->width >> 3; x++) {
+            int cb = y_cb * min_cb_width + ((x << 3) >> log2_min_cb_size);
+            int pu = y_pu * min_pu_width + ((x << 3) >> log2_min_pu_size);
+            int tb = y_tb * min_tb_width + ((x << 3) >> log2_min_tb_size);
+            int cbf = 0;
+
+            for (j = 0; j < tb_count; j++)
+                for (i = 0; i < tb_count; i++)
+                    cbf |= s->cbf_luma[tb + j * min_tb_width + i];
+
+            dst[MVDECODER_MAP_QP         * plane_size + x] = s->qp_y_tab[cb];
+            dst[MVDECODER_MAP_SKIP       * plane_size + x] = s->skip_flag[cb];
+            dst[MVDECODER_MAP_INTRA_MODE * plane_size + x] =
+                tab_mvf[pu].pred_flag == PF_INTRA ? s->tab_ipm[pu] : 255;
+            dst[MVDECODER_MAP_PART_MODE  * plane_size + x] = s->tab_part_mode[cb];
+            dst[MVDECODER_MAP_CT_DEPTH   * plane_size + x] = s->tab_ct_depth[cb];
+            dst[MVDECODER_MAP_CBF_LUMA   * plane_size + x] = cbf;
+        }
+        dst += cu_linesize;
+    }
+}
+
+/* weighted least squares fit of u = p[0] + p[1] * x + p[2] * y, same for v */
+static int MvDecoder_fit_affine(const float *xs, const float *ys, const float *us,
+                                const float *vs, const float *ws, int n, float *p)
+{
+    double s1 = 0, sx = 0, sy = 0, sxx = 0, sxy = 0, syy = 0;
+    double su = 0, sxu = 0, syu = 0, sv = 0, sxv = 0, syv = 0;
+    double m00, m01, m02, m11, m12, m22, det;
+    int i;
+
+    for (i = 0; i < n; i++) {
+        float w = ws[i], wx = w * xs[i], wy = w * ys[i];
+        s1  += w;
+        sx  += wx;
+        sy  += wy;
+        sxx += wx * xs[i];
+        sxy += wx * ys[i];
+        syy += wy * ys[i];
+        su  += w  * us[i];
+        sxu += wx * us[i];
+        syu += wy * us[i];
+        sv  += w  * vs[i];
+        sxv += wx * vs[i];
+        syv += wy * vs[i];
+    }
+    // inverse of the symmetric normal matrix, by its cofactors
+    m00 = sxx * syy - sxy * sxy;
+    m01 = sxy * sy  - sx  * syy;
+    m02 = sx  * sxy - sxx * sy;
+    m11 = s1  * syy - sy  * sy;
+    m12 = sx  * sy  - s1  * sxy;
+    m22 = s1  * sxx - sx  * sx;
+    det = s1 * m00 + sx * m01 + sy * m02;
+    if (s1 <= 0 || fabs(det) < 1e-6 * s1 * s1 * s1)
+        return AVERROR_INVALIDDATA;
+
+    p[0] = (m00 * su + m01 * sxu + m02 * syu) / det;
+    p[1] = (m01 * su + m11 * sxu + m12 * syu) / det;
+    p[2] = (m02 * su + m12 * sxu + m22 * syu) / det;
+    p[3] = (m00 * sv + m01 * sxv + m02 * syv) / det;
+    p[4] = (m01 * sv + m11 * sxv + m12 * syv) / det;
+    p[5] = (m02 * sv + m12 * sxv + m22 * syv) / det;
+    return 0;
+}
+
+/* k-th smallest of the n values of v, which are reordered */
+static float MvDecoder_select(float *v, int n, int k)
+{
+    int lo = 0, hi = n - 1;
+
+    while (lo < hi) {
+        float pivot = v[(lo + hi) >> 1];
+        int i = lo, j = hi;
+        while (i <= j) {
+            while (v[i] < pivot)
+                i++;
+            while (v[j] > pivot)
+                j--;
+            if (i <= j) {
+                FFSWAP(float, v[i], v[j]);
+                i++;
+                j--;
+            }
+        }
+        if (k <= j)
+            hi = j;
+        else if (k >= i)
+            lo = i;
+        else
+            break;
+    }
+    return v[k];
+}
+
+/* POC distance of a list of the motion field, 0 if it is not usable */
+static av_always_inline int MvDecoder_poc_distance(HEVCContext *s, const RefPicList *rpl,
+                                                   const MvField *mvf, int list)
+{
+    int ref_idx = mvf->ref_idx[list];
+
+    if (!(mvf->pred_flag & (PF_L0 << list)) || ref_idx >= rpl[list].nb_refs ||
+        rpl[list].isLongTerm[ref_idx])
+        return 0;
+    return s->poc - rpl[list].list[ref_idx];
+}
+
+/* reference lists of the CTB covering (x0, y0), NULL if it is not decoded */
+static const RefPicList *MvDecoder_ref_list(HEVCContext *s, int x0, int y0)
+{
+    int ctb_addr_rs = (y0 >> s->sps->log2_ctb_size) * s->sps->ctb_width +
+                      (x0 >> s->sps->log2_ctb_size);
+
+    if (s->tab_slice_address[ctb_addr_rs] < 0)
+        return NULL;
+    return ff_hevc_get_ref_list(s, s->ref, x0, y0);
+}
+
+/**
+ * MvDecoder_global_motion
+ *
+ * Fit an affine camera motion model to the motion field of the decoded
+ * picture. The fit is reweighted with Cauchy weights, so that the moving
+ * objects do not pull the model. One sample is taken per 8x8 block and
+ * list, so that the PUs weigh by their area, and the MVs are divided by
+ * their POC distance.
+ *
+ * @param s HEVC decoding context
+ */
+static int MvDecoder_global_motion(HEVCContext *s)
+{
+    const MvField *tab_mvf = s->ref->tab_mvf;
+    int min_pu_width = s->sps->min_pu_width;
+    int log2_min_pu_size = s->sps->log2_min_pu_size;
+    int width  = s->sps->width;
+    int height = s->sps->height;
+    int nb_max = 2 * (width >> 3) * (height >> 3);
+    float cx = width * 0.5f, cy = height * 0.5f, norm = 2.0f / FFMAX(width, height);
+    float *xs, *ys, *us, *vs, *ws, *rs;
+    float p[6];
+    MvDecoderGlobalMotion gm = { { 0 } };
+    int x, y, i, list, iter, n = 0, inliers = 0;
+
+    av_fast_malloc(&s->gm_buf, &s->gm_buf_size, 6 * nb_max * sizeof(*s->gm_buf));
+    if (!s->gm_buf)
+        return AVERROR(ENOMEM);
+    xs = s->gm_buf;
+    ys = xs + nb_max;
+    us = ys + nb_max;
+    vs = us + nb_max;
+    ws = vs + nb_max;
+    rs = ws + nb_max;
+
+    for (y = 0; y < height; y += 8) {
+        for (x = 0; x < width; x += 8) {
+            const MvField *mvf = &tab_mvf[(y >> log2_min_pu_size) * min_pu_width +
+                                          (x >> log2_min_pu_size)];
+            const RefPicList *rpl;
+
+            if (mvf->pred_flag == PF_INTRA || !(rpl = MvDecoder_ref_list(s, x, y)))
+                continue;
+            for (list = 0; list < 2; list++) {
+                int td = MvDecoder_poc_distance(s, rpl, mvf, list);
+                if (!td)
+                    continue;
+                xs[n] = (x + 4 - cx) * norm;
+                ys[n] = (y + 4 - cy) * norm;
+                us[n] = mvf->mv[list].x / (float)td;
+                vs[n] = mvf->mv[list].y / (float)td;
+                ws[n] = 1.0f;
+                n++;
+            }
+        }
+    }
+
+    for (iter = 0; iter < 6; iter++) {
+        float sigma2, c2;
+
+        if (n < 16 || MvDecoder_fit_affine(xs, ys, us, vs, ws, n, p) < 0) {
+            n = 0;
+            break;
+        }
+        for (i = 0; i < n; i++) {
+            float du = us[i] - (p[0] + p[1] * xs[i] + p[2] * ys[i]);
+            float dv = vs[i] - (p[3] + p[4] * xs[i] + p[5] * ys[i]);
+            ws[i] = du * du + dv * dv;
+        }
+        // variance from the median squared residual (1.386 for 2 normal
+        // components), at least a quarter sample
+        memcpy(rs, ws, n * sizeof(*rs));
+        sigma2 = FFMAX(MvDecoder_select(rs, n, n >> 1) / 1.386f, 1.0f);
+        c2     = 1.0f / (2.385f * 2.385f * sigma2);
+        for (i = 0; i < n; i++)
+            ws[i] = 1.0f / (1.0f + ws[i] * c2);
+    }
+
+    if (n) {
+        // back from the normalized coordinates to luma samples
+        for (i = 0; i < 2; i++) {
+            gm.params[3 * i + 1] = p[3 * i + 1] * norm;
+            gm.params[3 * i + 2] = p[3 * i + 2] * norm;
+            gm.params[3 * i]     = p[3 * i] - gm.params[3 * i + 1] * cx - gm.params[3 * i + 2] * cy;
+        }
+        // Cauchy weight of 1/(1+9/2.385^2) at 3 sigma
+        for (i = 0; i < n; i++)
+            inliers += ws[i] > 0.387f;
+        gm.inliers    = inliers / (float)n;
+        gm.nb_samples = n;
+    }
+    memcpy(s->frame->data[3] + ((s->frame->linesize[0]>>1)*(s->frame->coded_height>>1))*3 +
+           MVDECODER_META_GLOBAL_MOTION, &gm, sizeof(gm));
+
+    if (n && s->global_motion == MVDECODER_GLOBAL_MOTION_RESIDUAL) {
+        int pu_resolution = (s->frame->coded_height>>2)*(s->frame->linesize[0]>>2);
+        int pu_linesize = s->frame->linesize[0]>>2;
+        int16_t *dst_mv[2][2] = {
+            { (int16_t *)s->frame->data[3],
+              (int16_t *)(s->frame->data[3] + pu_resolution*2) },
+            { (int16_t *)(s->frame->data[3] + pu_resolution*4),
+              (int16_t *)(s->frame->data[3] + pu_resolution*6) },
+        };
+
+        for (y = 0; y < height; y += 4) {
+            for (x = 0; x < width; x += 4) {
+                const MvField *mvf = &tab_mvf[(y >> log2_min_pu_size) * min_pu_width +
+                                              (x >> log2_min_pu_size)];
+                const RefPicList *rpl;
+                float mx = gm.params[0] + gm.params[1] * (x + 2) + gm.params[2] * (y + 2);
+                float my = gm.params[3] + gm.params[4] * (x + 2) + gm.params[5] * (y + 2);
+                int offset = (y >> 2) * pu_linesize + (x >> 2);
+
+                if (mvf->pred_flag == PF_INTRA || !(rpl = MvDecoder_ref_list(s, x, y)))
+                    continue;
+                for (list = 0; list < 2; list++) {
+                    int td = MvDecoder_poc_distance(s, rpl, mvf, list);
+                    if (!td)
+                        continue;
+                    dst_mv[list][0][offset] = av_clip_int16(mvf->mv[list].x - lrintf(mx * td));
+                    dst_mv[list][1][offset] = av_clip_int16(mvf->mv[list].y - lrintf(my * td));
+                }
+            }
+        }
+    }
+    return 0;
+}
+
+/* accumulated motion field of a picture, NULL if it has none */
+static int16_t *MvDecoder_acc_motion_field(const HEVCFrame *f)
+{
+    if (!f || !f->frame->nb_extended_buf)
+        return NULL;
+    return (int16_t *)f->frame->extended_buf[0]->data;
+}
+
+static int alloc_acc_motion(HEVCContext *s)
+{
+    AVFrame *f = s->frame;
+
+    if (f->nb_extended_buf) {
+        av_log(s->avctx, AV_LOG_WARNING, "extended_buf in use, no accumulated motion\n");
+        return 0;
+    }
+    f->extended_buf = av_mallocz(sizeof(*f->extended_buf));
+    if (!f->extended_buf)
+        return AVERROR(ENOMEM);
+    f->extended_buf[0] = av_buffer_pool_get(s->acc_motion_pool);
+    if (!f->extended_buf[0]) {
+        av_freep(&f->extended_buf);
+        return AVERROR(ENOMEM);
+    }
+    f->nb_extended_buf = 1;
+    return 0;
+}
+
+/**
+ * MvDecoder_accumulate_motion
+ *
+ * Compose the motion field of the decoded picture with the accumulated
+ * fields of its references, so that each minimum PU gets its displacement
+ * to the picture the chain of references starts from: an intra picture,
+ * an intra block or a reference without a field. The field of a reference
+ * is read at the block the MV points to, and the bi-predicted blocks take
+ * the average of their two lists. The fields live in extended_buf[0] of
+ * the pictures, so they go with the DPB.
+ *
+ * @param s HEVC decoding context
+ */
+static void MvDecoder_accumulate_motion(HEVCContext *s)
+{
+    const MvField *tab_mvf = s->ref->tab_mvf;
+    int16_t *acc = MvDecoder_acc_motion_field(s->ref);
+    int min_pu_width  = s->sps->min_pu_width;
+    int min_pu_height = s->sps->min_pu_height;
+    int log2_min_pu_size = s->sps->log2_min_pu_size;
+    int half_pu  = 1 << (log2_min_pu_size - 1);
+    int ctb_mask = (1 << (s->sps->log2_ctb_size - log2_min_pu_size)) - 1;
+    const RefPicList *rpl = NULL;
+    int x, y, i, list;
+
+    if (!acc)
+        return;
+    /* the fields of the references are written when they are done */
+    if (s->threads_type & FF_THREAD_FRAME) {
+        for (i = 0; i < FF_ARRAY_ELEMS(s->DPB); i++) {
+            HEVCFrame *f = &s->DPB[i];
+            if (f != s->ref && f->frame->buf[0] &&
+                (f->flags & (HEVC_FRAME_FLAG_SHORT_REF | HEVC_FRAME_FLAG_LONG_REF)))
+                ff_thread_await_progress(&f->tf, INT_MAX, 0);
+        }
+    }
+
+    for (y = 0; y < min_pu_height; y++) {
+        for (x = 0; x < min_pu_width; x++) {
+            const MvField *mvf = &tab_mvf[y * min_pu_width + x];
+            int acc_x = 0, acc_y = 0, n = 0;
+
+            if (!(x & ctb_mask))
+                rpl = MvDecoder_ref_list(s, x << log2_min_pu_size, y << log2_min_pu_size);
+            if (mvf->pred_flag != PF_INTRA && rpl) {
+                for (list = 0; list < 2; list++) {
+                    int ref_idx = mvf->ref_idx[list];
+                    const int16_t *ref_acc;
+                    int cx, cy;
+
+                    if (!(mvf->pred_flag & (PF_L0 << list)) || ref_idx >= rpl[list].nb_refs)
+                        continue;
+                    acc_x += mvf->mv[list].x;
+                    acc_y += mvf->mv[list].y;
+                    n++;
+                    ref_acc = MvDecoder_acc_motion_field(rpl[list].ref[ref_idx]);
+                    if (!ref_acc)
+                        continue;
+                    /* block of the reference covering the center of the prediction */
+                    cx = av_clip(((x << log2_min_pu_size) + half_pu + (mvf->mv[list].x >> 2)) >> log2_min_pu_size,
+                                 0, min_pu_width  - 1);
+                    cy = av_clip(((y << log2_min_pu_size) + half_pu + (mvf->mv[list].y >> 2)) >> log2_min_pu_size,
+                                 0, min_pu_height - 1);
+                    acc_x += ref_acc[2 * (cy * min_pu_width + cx)];
+                    acc_y += ref_acc[2 * (cy * min_pu_width + cx) + 1];
+                }
+            }
+            if (n == 2) {
+                acc_x >>= 1;
+                acc_y >>= 1;
+            }
+            acc[2 * (y * min_pu_width + x)]     = av_clip_int16(acc_x);
+            acc[2 * (y * min_pu_width + x) + 1] = av_clip_int16(acc_y);
+        }
+    }
+}
+
+static void MvDecoder_write_residual_initialization(uint8_t* dst, int block_w, int block_h, int linesize,
+                                                    int bit_depth)
 {
     int x, y;
+    //high bit depth: 16-bit samples, biased at half the range
+    if (bit_depth > 8) {
+        for (y = 0; y < block_h; y++) {
+            uint16_t *dst16 = (uint16_t *)dst;
+            for (x = 0; x < block_w; x++)
+                dst16[x] = 1 << (bit_depth - 1);
+            dst += linesize;
+        }
+        return;
+    }
     //处理x*y个像素
     for (y = 0; y < block_h; y++) {
         for (x = 0; x < block_w; x++) {
@@ -1998,6 +2430,8 @@ static void chroma_mc_uni(HEVCContext *s, uint8_t *dst0,
     HEVCLocalContext *lc = s->HEVClc;
     int pic_width        = s->sps->width >> s->sps->hshift[1];
     int pic_height       = s->sps->height >> s->sps->vshift[1];
+    int pad_x            = s->ref_pad >> s->sps->hshift[1];
+    int pad_y            = s->ref_pad >> s->sps->vshift[1];
     const Mv *mv         = &current_mv->mv[reflist];
     int weight_flag      = (s->sh.slice_type == P_SLICE && s->pps->weighted_pred_flag) ||
                            (s->sh.slice_type == B_SLICE && s->pps->weighted_bipred_flag);
@@ -2013,9 +2447,9 @@ static void chroma_mc_uni(HEVCContext *s, uint8_t *dst0,
     y_off += mv->y >> (2 + vshift);
     src0  += y_off * srcstride + (x_off << s->sps->pixel_shift);
 
-    if (x_off < EPEL_EXTRA_BEFORE || y_off < EPEL_EXTRA_AFTER ||
-        x_off >= pic_width - block_w - EPEL_EXTRA_AFTER ||
-        y_off >= pic_height - block_h - EPEL_EXTRA_AFTER) {
+    if (x_off < EPEL_EXTRA_BEFORE - pad_x || y_off < EPEL_EXTRA_AFTER - pad_y ||
+        x_off >= pic_width + pad_x - block_w - EPEL_EXTRA_AFTER ||
+        y_off >= pic_height + pad_y - block_h - EPEL_EXTRA_AFTER) {
         const int edge_emu_stride = EDGE_EMU_BUFFER_STRIDE << s->sps->pixel_shift;
         int offset0 = EPEL_EXTRA_BEFORE * (srcstride + (1 << s->sps->pixel_shift));
         int buf_offset0 = EPEL_EXTRA_BEFORE *
@@ -2070,6 +2504,8 @@ static void chroma_mc_bi(HEVCContext *s, uint8_t *dst0, ptrdiff_t dststride, AVF
                            (s->sh.slice_type == B_SLICE && s->pps->weighted_bipred_flag);
     int pic_width        = s->sps->width >> s->sps->hshift[1];
     int pic_height       = s->sps->height >> s->sps->vshift[1];
+    int pad_x            = s->ref_pad >> s->sps->hshift[1];
+    int pad_y            = s->ref_pad >> s->sps->vshift[1];
     Mv *mv0              = &current_mv->mv[0];
     Mv *mv1              = &current_mv->mv[1];
     int hshift = s->sps->hshift[1];
@@ -2092,9 +2528,9 @@ static void chroma_mc_bi(HEVCContext *s, uint8_t *dst0, ptrdiff_t dststride, AVF
     src1  += y_off0 * src1stride + (int)((unsigned)x_off0 << s->sps->pixel_shift);
     src2  += y_off1 * src2stride + (int)((unsigned)x_off1 << s->sps->pixel_shift);
 
-    if (x_off0 < EPEL_EXTRA_BEFORE || y_off0 < EPEL_EXTRA_AFTER ||
-        x_off0 >= pic_width - block_w - EPEL_EXTRA_AFTER ||
-        y_off0 >= pic_height - block_h - EPEL_EXTRA_AFTER) {
+    if (x_off0 < EPEL_EXTRA_BEFORE - pad_x || y_off0 < EPEL_EXTRA_AFTER - pad_y ||
+        x_off0 >= pic_width + pad_x - block_w - EPEL_EXTRA_AFTER ||
+        y_off0 >= pic_height + pad_y - block_h - EPEL_EXTRA_AFTER) {
         const int edge_emu_stride = EDGE_EMU_BUFFER_STRIDE << s->sps->pixel_shift;
         int offset1 = EPEL_EXTRA_BEFORE * (src1stride + (1 << s->sps->pixel_shift));
         int buf_offset1 = EPEL_EXTRA_BEFORE *
@@ -2111,9 +2547,9 @@ static void chroma_mc_bi(HEVCContext *s, uint8_t *dst0, ptrdiff_t dststride, AVF
         src1stride = edge_emu_stride;
     }
 
-    if (x_off1 < EPEL_EXTRA_BEFORE || y_off1 < EPEL_EXTRA_AFTER ||
-        x_off1 >= pic_width - block_w - EPEL_EXTRA_AFTER ||
-        y_off1 >= pic_height - block_h - EPEL_EXTRA_AFTER) {
+    if (x_off1 < EPEL_EXTRA_BEFORE - pad_x || y_off1 < EPEL_EXTRA_AFTER - pad_y ||
+        x_off1 >= pic_width + pad_x - block_w - EPEL_EXTRA_AFTER ||
+        y_off1 >= pic_height + pad_y - block_h - EPEL_EXTRA_AFTER) {
         const int edge_emu_stride = EDGE_EMU_BUFFER_STRIDE << s->sps->pixel_shift;
         int offset1 = EPEL_EXTRA_BEFORE * (src2stride + (1 << s->sps->pixel_shift));
         int buf_offset1 = EPEL_EXTRA_BEFORE *
@@ -2151,7 +2587,7 @@ static void chroma_mc_bi(HEVCContext *s, uint8_t *dst0, ptrdiff_t dststride, AVF
 static void hevc_await_progress(HEVCContext *s, HEVCFrame *ref,
                                 const Mv *mv, int y0, int height)
 {
-    int y = (mv->y >> 2) + y0 + height + 9;
+    int y = FFMAX(0, (mv->y >> 2) + y0 + height + 9);
 
     if (s->threads_type & FF_THREAD_FRAME )
         ff_thread_await_progress(&ref->tf, y, 0);
@@ -2231,9 +2667,6 @@ static void hls_prediction_unit(HEVCContext *s, int x0, int y0,
             if (inter_pred_idc != PRED_L1) {
                 if (s->sh.nb_refs[L0]) {
                     current_mv.ref_idx[0] = ff_hevc_ref_idx_lx_decode(s, s->sh.nb_refs[L0]);
-#ifdef TEST_MV_POC
-                    current_mv.poc[0] = refPicList[0].list[current_mv.ref_idx[0]];
-#endif
                 }
                 current_mv.pred_flag = PF_L0;
                 ff_hevc_hls_mvd_coding(s, x0, y0, 0);
@@ -2248,9 +2681,6 @@ static void hls_prediction_unit(HEVCContext *s, int x0, int y0,
             if (inter_pred_idc != PRED_L0) {
                 if (s->sh.nb_refs[L1]) {
                     current_mv.ref_idx[1] = ff_hevc_ref_idx_lx_decode(s, s->sh.nb_refs[L1]);
-#ifdef TEST_MV_POC
-                    current_mv.poc[1] = refPicList[1].list[current_mv.ref_idx[1]];
-#endif
                 }
 
                 if (s->sh.mvd_l1_zero_flag == 1 && inter_pred_idc == PRED_BI) {
@@ -2278,6 +2708,17 @@ static void hls_prediction_unit(HEVCContext *s, int x0, int y0,
         for (i = 0; i < nPbW >> s->sps->log2_min_pu_size; i++)
             tab_mvf[(y_pu + j) * min_pu_width + x_pu + i] = current_mv;
 
+    if (s->analysis) {
+        int list = current_mv.pred_flag & PF_L0 ? 0 : 1;
+        int td   = FFABS(s->poc - refPicList[list].list[current_mv.ref_idx[list]]);
+        float mx = current_mv.mv[list].x, my = current_mv.mv[list].y;
+
+        lc->activity.mv_sum  += nPbW * nPbH * sqrtf(mx * mx + my * my) / FFMAX(td, 1);
+        lc->activity.mv_area += nPbW * nPbH;
+        // parse only, neither motion compensation nor MV planes
+        return;
+    }
+
     //参考了List0
     if (current_mv.pred_flag & PF_L0) {
         ref0 = refPicList[0].ref[current_mv.ref_idx[0]];
@@ -2615,7 +3056,7 @@ static int hls_coding_unit(HEVCContext *s, int x0, int y0, int log2_cb_size, u_i
 
 
 
-    //Mvdecoder: initailize residual yuv base as 128 as residual offset might be negative
+    //Mvdecoder: initailize residual yuv base as 128 (1 << (bit_depth - 1)) as residual offset might be negative
     uint8_t *dst4 = &s->frame->data[4][((y0) >> s->sps->vshift[0]) * s->frame->linesize[0] + \
                            (((x0) >> s->sps->hshift[0]) << s->sps->pixel_shift)];
     uint8_t *dst5 = &s->frame->data[5][((y0) >> s->sps->vshift[1]) * s->frame->linesize[1] + \
@@ -2623,9 +3064,11 @@ static int hls_coding_unit(HEVCContext *s, int x0, int y0, int log2_cb_size, u_i
     uint8_t *dst6 = &s->frame->data[6][((y0) >> s->sps->vshift[2]) * s->frame->linesize[2] + \
                            (((x0) >> s->sps->hshift[2]) << s->sps->pixel_shift)];
 
-    MvDecoder_write_residual_initialization(dst4, cb_size, cb_size, s->frame->linesize[0]);
-    MvDecoder_write_residual_initialization(dst5, cb_size >> s->sps->hshift[1], cb_size >> s->sps->vshift[1], s->frame->linesize[1]);
-    MvDecoder_write_residual_initialization(dst6, cb_size >> s->sps->hshift[1], cb_size >> s->sps->vshift[1], s->frame->linesize[2]);
+    if (!s->analysis) {
+        MvDecoder_write_residual_initialization(dst4, cb_size, cb_size, s->frame->linesize[0], s->sps->bit_depth);
+        MvDecoder_write_residual_initialization(dst5, cb_size >> s->sps->hshift[1], cb_size >> s->sps->vshift[1], s->frame->linesize[1], s->sps->bit_depth);
+        MvDecoder_write_residual_initialization(dst6, cb_size >> s->sps->hshift[1], cb_size >> s->sps->vshift[1], s->frame->linesize[2], s->sps->bit_depth);
+    }
 
 
 
@@ -2937,12 +3380,29 @@ static int hls_coding_unit(HEVCContext *s, int x0, int y0, int log2_cb_size, u_i
     }
 
     set_ct_depth(s, x0, y0, log2_cb_size, lc->ct.depth);
+    if (s->syntax_maps) {
+        x = y_cb * min_cb_width + x_cb;
+        for (y = 0; y < length; y++) {
+            memset(&s->tab_part_mode[x], lc->cu.part_mode, length);
+            x += min_cb_width;
+        }
+    }
 
     // MvDevoder: bytestream checkpoint of the start of cu
     int bytes_size_cu = lc->cc.bytestream - bytestream_last;
     //int bytes_pu_tu = bytestream_pu + bytestream_tu;
-    // MvDeocder: fill totalByteSize of this CU.
-    MvDecoder_write_size_buffer(s, x0, y0, log2_cb_size, bytes_size_cu);
+    if (s->analysis) {
+        int64_t area = 1 << (2 * log2_cb_size);
+        if (lc->cu.pred_mode == MODE_INTRA)
+            lc->activity.intra_area += area;
+        else if (lc->cu.pred_mode == MODE_SKIP)
+            lc->activity.skip_area  += area;
+        else
+            lc->activity.inter_area += area;
+    } else {
+        // MvDeocder: fill totalByteSize of this CU.
+        MvDecoder_write_size_buffer(s, x0, y0, log2_cb_size, bytes_size_cu);
+    }
 
     return 0;
 }
@@ -3162,6 +3622,50 @@ static void hls_decode_neighbour(HEVCContext *s, int x_ctb, int y_ctb,
     lc->ctb_up_left_flag  = ((x_ctb > 0) && (y_ctb > 0)  && (ctb_addr_in_slice-1 >= s->sps->ctb_width) && (s->pps->tile_id[ctb_addr_ts] == s->pps->tile_id[s->pps->ctb_addr_rs_to_ts[ctb_addr_rs-1 - s->sps->ctb_width]]));
 }
 
+/*
+ * With the parallel-filters option, hls_decode_entry() reports every decoded
+ * CTB in the first progress entry and hls_filter_entry() runs the in-loop
+ * filters of the slice behind it, the filtered CTBs in the second entry. It
+ * calls ff_hevc_hls_filters() for a CTB as soon as that CTB is decoded, where
+ * the inline path calls it, so the same CTBs up and left of it are filtered.
+ */
+static void stop_filter_job(HEVCContext *s, int ctb_addr_ts)
+{
+    if (!s->filters_pipelined)
+        return;
+    avpriv_atomic_int_set(&s->filter_ctb_end, ctb_addr_ts);
+    ff_thread_report_progress2(s->avctx, 0, 0, s->sps->ctb_size);
+}
+
+static int hls_filter_entry(HEVCContext *s)
+{
+    int ctb_size    = 1 << s->sps->log2_ctb_size;
+    int ctb_addr_ts = s->pps->ctb_addr_rs_to_ts[s->sh.slice_ctb_addr_rs];
+    int x_ctb       = 0;
+    int y_ctb       = 0;
+
+    for (;;) {
+        int ctb_addr_rs;
+
+        ff_thread_await_progress2(s->avctx, 1, 1, 1);
+        if (ctb_addr_ts >= avpriv_atomic_int_get(&s->filter_ctb_end))
+            break;
+
+        ctb_addr_rs = s->pps->ctb_addr_ts_to_rs[ctb_addr_ts];
+        x_ctb = FFUMOD(ctb_addr_rs, s->sps->ctb_width) << s->sps->log2_ctb_size;
+        y_ctb = FFUDIV(ctb_addr_rs, s->sps->ctb_width) << s->sps->log2_ctb_size;
+        ff_hevc_hls_filters(s, x_ctb, y_ctb, ctb_size);
+        ctb_addr_ts++;
+        ff_thread_report_progress2(s->avctx, 1, 1, 1);
+    }
+
+    if (ctb_addr_ts >= s->sps->ctb_size &&
+        x_ctb + ctb_size >= s->sps->width &&
+        y_ctb + ctb_size >= s->sps->height)
+        ff_hevc_hls_filter(s, x_ctb, y_ctb, ctb_size);
+    return 0;
+}
+
 static int hls_decode_entry(AVCodecContext *avctxt, void *isFilterThread)
 {
     /*
@@ -3187,6 +3691,7 @@ static int hls_decode_entry(AVCodecContext *avctxt, void *isFilterThread)
 
     if (!ctb_addr_ts && s->sh.dependent_slice_segment_flag) {
         av_log(s->avctx, AV_LOG_ERROR, "Impossible initial tile.\n");
+        stop_filter_job(s, ctb_addr_ts);
         return AVERROR_INVALIDDATA;
     }
 
@@ -3194,6 +3699,7 @@ static int hls_decode_entry(AVCodecContext *avctxt, void *isFilterThread)
         int prev_rs = s->pps->ctb_addr_ts_to_rs[ctb_addr_ts - 1];
         if (s->tab_slice_address[prev_rs] != s->sh.slice_addr) {
             av_log(s->avctx, AV_LOG_ERROR, "Previous slice segment missing\n");
+            stop_filter_job(s, ctb_addr_ts);
             return AVERROR_INVALIDDATA;
         }
     }
@@ -3329,6 +3835,7 @@ static int hls_decode_entry(AVCodecContext *avctxt, void *isFilterThread)
         more_data = hls_coding_quadtree(s, x_ctb, y_ctb, s->sps->log2_ctb_size, 0, MvDecoder_ctu_quadtree, 0);
         if (more_data < 0) {
             s->tab_slice_address[ctb_addr_rs] = -1;
+            stop_filter_job(s, ctb_addr_ts);
             return more_data;
         }
 
@@ -3337,8 +3844,16 @@ static int hls_decode_entry(AVCodecContext *avctxt, void *isFilterThread)
 
         // save decode states for further usage
         ff_hevc_save_states(s, ctb_addr_ts);
-        // de-block filter
-        ff_hevc_hls_filters(s, x_ctb, y_ctb, ctb_size);
+        // de-block filter, or hand the CTB to the filter job
+        if (s->filters_pipelined)
+            ff_thread_report_progress2(s->avctx, 0, 0, 1);
+        else
+            ff_hevc_hls_filters(s, x_ctb, y_ctb, ctb_size);
+    }
+
+    if (s->filters_pipelined) {
+        stop_filter_job(s, ctb_addr_ts);
+        return ctb_addr_ts;
     }
 
     if (x_ctb + ctb_size >= s->sps->width &&
@@ -3348,57 +3863,51 @@ static int hls_decode_entry(AVCodecContext *avctxt, void *isFilterThread)
     return ctb_addr_ts;
 }
 
-#if PARALLEL_SLICE
-static int hls_decode_entry_slice(HEVCContext *s)
+/*
+ * Decode one independent slice of the picture, job is the index of the slice
+ * in the batch queued by queue_slice(). The in-loop filters are left to
+ * slices_filters() once every slice of the picture has been decoded.
+ */
+static int hls_decode_entry_slice(AVCodecContext *avctxt, void *arg, int job, int self_id)
 {
-    int ctb_size    = 1 << s->sps->log2_ctb_size;
+    HEVCContext *s1 = avctxt->priv_data;
+    HEVCContext *s  = s1->sList[job + 1];
     int more_data   = 1;
-    int x_ctb       = 0;
-    int y_ctb       = 0;
     int ctb_addr_ts = s->pps->ctb_addr_rs_to_ts[s->sh.slice_ctb_addr_rs];
 
-    if (!ctb_addr_ts && s->sh.dependent_slice_segment_flag) {
-        av_log(s->avctx, AV_LOG_ERROR, "Impossible initial tile.\n");
-        return AVERROR_INVALIDDATA;
-    }
-
-    if (s->sh.dependent_slice_segment_flag) {
-        int prev_rs = s->pps->ctb_addr_ts_to_rs[ctb_addr_ts - 1];
-        if (s->tab_slice_address[prev_rs] != s->sh.slice_addr) {
-            av_log(s->avctx, AV_LOG_ERROR, "Previous slice segment missing\n");
-            return AVERROR_INVALIDDATA;
-        }
-    }
-
-    while (more_data) {
+    while (more_data && ctb_addr_ts < s->sps->ctb_size) {
         int ctb_addr_rs = s->pps->ctb_addr_ts_to_rs[ctb_addr_ts];
+        int x_ctb       = FFUMOD(ctb_addr_rs, s->sps->ctb_width) << s->sps->log2_ctb_size;
+        int y_ctb       = FFUDIV(ctb_addr_rs, s->sps->ctb_width) << s->sps->log2_ctb_size;
+        uint8_t *MvDecoder_ctu_quadtree;
 
-        x_ctb = FFUMOD(ctb_addr_rs, s->sps->ctb_width) << s->sps->log2_ctb_size;
-        y_ctb = FFUDIV(ctb_addr_rs, s->sps->ctb_width) << s->sps->log2_ctb_size;
         hls_decode_neighbour(s, x_ctb, y_ctb, ctb_addr_ts);
-
         ff_hevc_cabac_init(s, ctb_addr_ts);
-
         hls_sao_param(s, x_ctb >> s->sps->log2_ctb_size, y_ctb >> s->sps->log2_ctb_size);
 
         s->deblock[ctb_addr_rs].beta_offset = s->sh.beta_offset;
         s->deblock[ctb_addr_rs].tc_offset   = s->sh.tc_offset;
         s->filter_slice_edges[ctb_addr_rs]  = s->sh.slice_loop_filter_across_slices_enabled_flag;
-        more_data = hls_coding_quadtree(s, x_ctb, y_ctb, s->sps->log2_ctb_size, 0);
 
+        MvDecoder_ctu_quadtree = s->frame->data[3] + ((s->frame->linesize[0]>>1)*(s->frame->height>>1))*3 + 1024 + ctb_addr_rs*12;
+
+        more_data = hls_coding_quadtree(s, x_ctb, y_ctb, s->sps->log2_ctb_size, 0, MvDecoder_ctu_quadtree, 0);
         if (more_data < 0) {
             s->tab_slice_address[ctb_addr_rs] = -1;
             return more_data;
         }
         ctb_addr_ts++;
-        ff_hevc_save_states(s, ctb_addr_ts);
-#if PARALLEL_FILTERS
-        ff_hevc_hls_filters_slice(s, x_ctb, y_ctb, ctb_size);
-#endif
     }
     return ctb_addr_ts;
 }
-#endif
+
+static int hls_decode_entry_filters(AVCodecContext *avctxt, void *arg, int job, int self_id)
+{
+    if (job)
+        return hls_filter_entry(avctxt->priv_data);
+    return hls_decode_entry(avctxt, arg);
+}
+
 static int hls_decode_entry_wpp(AVCodecContext *avctxt, void *input_ctb_row, int job, int self_id)
 {
     HEVCContext *s1  = avctxt->priv_data, *s;
@@ -3671,27 +4180,86 @@ static void tiles_filters(HEVCContext *s)
         for (x0 = 0; x0 < s->sps->width; x0 += ctb_size)
             ff_hevc_hls_filter(s, x0, y0, ctb_size);
 }
-#if !PARALLEL_FILTERS
+
+/*
+ * The slices decoded by the same batch are not available to each other, so
+ * the strengths of the edges a slice shares with the slices above and on its
+ * left are evaluated again once the batch is over, with the slice context.
+ */
+static void slices_boundary_strengths(HEVCContext *s)
+{
+    int ctb_size    = 1 << s->sps->log2_ctb_size;
+    int ctb_addr_rs = s->sh.slice_addr;
+    int end         = FFMIN(ctb_addr_rs + s->sps->ctb_width, s->sps->ctb_width * s->sps->ctb_height);
+    int no_filter   = !s->sh.slice_loop_filter_across_slices_enabled_flag;
+    int x0          = (ctb_addr_rs % s->sps->ctb_width) << s->sps->log2_ctb_size;
+    int y0          = (ctb_addr_rs / s->sps->ctb_width) << s->sps->log2_ctb_size;
+    int x, y;
+
+    if (x0 > 0)
+        for (y = y0; y < FFMIN(y0 + ctb_size, s->sps->height); y += 4)
+            ff_hevc_deblocking_boundary_strengths_v(s, x0, y, no_filter);
+
+    for (; ctb_addr_rs < end && s->tab_slice_address[ctb_addr_rs] == s->sh.slice_addr; ctb_addr_rs++) {
+        x0 = (ctb_addr_rs % s->sps->ctb_width) << s->sps->log2_ctb_size;
+        y0 = (ctb_addr_rs / s->sps->ctb_width) << s->sps->log2_ctb_size;
+        if (!y0)
+            continue;
+        for (x = x0; x < FFMIN(x0 + ctb_size, s->sps->width); x += 4)
+            ff_hevc_deblocking_boundary_strengths_h(s, x, y0, no_filter);
+    }
+}
+
+/*
+ * Filter the picture in the order hls_decode_entry() does, CTB after CTB: on
+ * the last rows the filters of a CTB run before the chroma edges on its right
+ * are deblocked, a raster pass would not give the same samples.
+ */
 static void slices_filters(HEVCContext *s)
 {
     uint16_t ctb_size        = 1 << s->sps->log2_ctb_size;
-    int x0, y0;
+    int x0 = 0, y0 = 0;
     // Deblocking and SAO filters
     for (y0 = 0; y0 < s->sps->height; y0 += ctb_size)
         for (x0 = 0; x0 < s->sps->width; x0 += ctb_size)
-            ff_hevc_hls_filter(s, x0, y0, ctb_size);
+            ff_hevc_hls_filters(s, x0, y0, ctb_size);
+    ff_hevc_hls_filter(s, x0 - ctb_size, y0 - ctb_size, ctb_size);
 }
-#endif
 
 
+/*
+ * Bring the context of slice thread i up to date for the slice being decoded.
+ * It is copied whole at its first slice of the picture, the next slices only
+ * change the slice level fields.
+ */
+static void update_slice_context(HEVCContext *s, int i)
+{
+    HEVCContext *s1 = s->sList[i];
+
+    if (s1->ref != s->ref) {
+        memcpy(s1, s, sizeof(HEVCContext));
+    } else {
+        s1->sh                = s->sh;
+        s1->vps               = s->vps;
+        s1->sps               = s->sps;
+        s1->pps               = s->pps;
+        s1->slice_idx         = s->slice_idx;
+        s1->data              = s->data;
+        s1->skipped_bytes     = s->skipped_bytes;
+        s1->skipped_bytes_pos = s->skipped_bytes_pos;
+        s1->prev_pos          = s->prev_pos;
+    }
+    s1->HEVClc = s->HEVClcList[i];
+}
+
 static int hls_slice_data(HEVCContext *s, const uint8_t *nal, int length)
 {
     HEVCLocalContext *lc = s->HEVClc;
-    int *ret = av_malloc((s->sh.num_entry_point_offsets + 1) * sizeof(int));
+    int *ret = av_malloc(FFMAX(s->sh.num_entry_point_offsets + 1, 2) * sizeof(int));
     int *arg = av_malloc((s->sh.num_entry_point_offsets + 1) * sizeof(int));
     int offset;
     int startheader, cmpt = 0;
-    int i, j, res = 0;
+    int i, j, res = 0, nb_contexts;
 
     ff_alloc_entries(s->avctx, s->sh.num_entry_point_offsets + 1);
 
@@ -3734,14 +4302,18 @@ static int hls_slice_data(HEVCContext *s, const uint8_t *nal, int length)
     if (s->sh.first_slice_in_pic_flag){
         s->HEVClc->ctb_tile_rs = 0;
     }
+    /* Only the slice threads that get an entry point run a job (see the
+     * worker loop in pthread_slice.c), the others are not refreshed. */
+    nb_contexts = (s->pps->entropy_coding_sync_enabled_flag || s->pps->tiles_enabled_flag) ?
+                  FFMIN(s->threads_number, s->sh.num_entry_point_offsets + 1) : 1;
     for (i = 1; i < s->threads_number; i++) {
         if (s->sh.first_slice_in_pic_flag){
             s->sList[i]->HEVClc->ctb_tile_rs = 0;
         }
         s->sList[i]->HEVClc->first_qp_group = 1;
         s->sList[i]->HEVClc->qp_y = s->sList[0]->HEVClc->qp_y;
-        memcpy(s->sList[i], s, sizeof(HEVCContext));
-        s->sList[i]->HEVClc = s->HEVClcList[i];
+        if (i < nb_contexts)
+            update_slice_context(s, i);
     }
 
     for (i = 0; i <= s->sh.num_entry_point_offsets; i++) {
@@ -3755,9 +4327,25 @@ static int hls_slice_data(HEVCContext *s, const uint8_t *nal, int length)
         s->avctx->execute2(s->avctx, (void *) hls_decode_entry_wpp  , arg, ret, s->sh.num_entry_point_offsets + 1);
     else if (s->pps->tiles_enabled_flag        && s->threads_number!=1)
         s->avctx->execute2(s->avctx, (void *) hls_decode_entry_tiles, arg, ret, s->sh.num_entry_point_offsets + 1);
-    else
+    else if (s->parallel_filters && s->threads_number!=1) {
+        res = ff_alloc_entries(s->avctx, 2);
+        if (res < 0) {
+            av_free(ret);
+            av_free(arg);
+            return res;
+        }
+        ff_reset_entries(s->avctx);
+        s->filter_ctb_end    = INT_MAX;
+        s->filters_pipelined = 1;
+        s->avctx->execute2(s->avctx, (void *) hls_decode_entry_filters, arg, ret, 2);
+        s->filters_pipelined = 0;
+    } else
         s->avctx->execute(s->avctx, hls_decode_entry, arg, ret , 1, sizeof(int));
 
+    if (s->pps->entropy_coding_sync_enabled_flag && s->threads_number != 1 &&
+        s->avctx->debug & FF_DEBUG_THREADS)
+        ff_thread_log_wpp_stats(s->avctx);
+
     res = ret[s->threads_number==1 ? 0:s->sh.num_entry_point_offsets];
 
     av_free(ret);
@@ -3837,10 +4425,12 @@ static int hevc_ref_frame(HEVCContext *s, HEVCFrame *dst, HEVCFrame *src)
     if (ret < 0)
         return ret;
 
-    dst->tab_mvf_buf = av_buffer_ref(src->tab_mvf_buf);
-    if (!dst->tab_mvf_buf)
+    /* the full motion field is only used by the context decoding the
+     * picture, the references only need the collocated field */
+    dst->tab_mvf_col_buf = av_buffer_ref(src->tab_mvf_col_buf);
+    if (!dst->tab_mvf_col_buf)
         goto fail;
-    dst->tab_mvf = src->tab_mvf;
+    dst->tab_mvf_col = src->tab_mvf_col;
 
     dst->rpl_tab_buf = av_buffer_ref(src->rpl_tab_buf);
     if (!dst->rpl_tab_buf)
@@ -3864,12 +4454,118 @@ fail:
 }
 
 
-static int hevc_frame_start(HEVCContext *s)
+/* Border the frame buffers leave around the picture on every side, in luma
+ * samples. The pool of ff_get_buffer() gives EDGE_WIDTH unless
+ * CODEC_FLAG_EMU_EDGE is set. */
+static int ref_pad_size(HEVCContext *s, AVFrame *frame)
+{
+    int pad = MAX_PB_SIZE;
+    int c_idx;
+
+    for (c_idx = 0; c_idx < (s->sps->chroma_array_type ? 3 : 1); c_idx++) {
+        AVBufferRef *buf = frame->buf[c_idx];
+        ptrdiff_t stride = frame->linesize[c_idx];
+        ptrdiff_t offset, left;
+        int right, top, bottom;
+
+        if (!buf || stride <= 0)
+            return 0;
+        offset = frame->data[c_idx] - buf->data;
+        if (offset < 0 || offset >= buf->size)
+            return 0;
+        left   = offset % stride;
+        top    = offset / stride;
+        right  = ((stride - left) >> s->sps->pixel_shift) - (s->sps->width >> s->sps->hshift[c_idx]);
+        bottom = (buf->size - offset) / stride - (s->sps->height >> s->sps->vshift[c_idx]);
+        left >>= s->sps->pixel_shift;
+        pad = FFMIN(pad, FFMIN(left, right) << s->sps->hshift[c_idx]);
+        pad = FFMIN(pad, FFMIN(top, bottom) << s->sps->vshift[c_idx]);
+    }
+    return FFMAX(pad, 0);
+}
+
+static void free_coeff_features(void *opaque, uint8_t *data)
+{
+    HEVCCoeffFeatures *cf = (HEVCCoeffFeatures *)data;
+
+    av_freep(&cf->data);
+    av_free(cf);
+}
+
+/* The TU records are gathered in data[7] once the picture is decoded */
+static int alloc_coeff_features(HEVCContext *s)
+{
+    HEVCCoeffFeatures *cf;
+    int i;
+
+    for (i = 0; i <= s->threads_number; i++)
+        if (s->HEVClcList[i]) {
+            s->HEVClcList[i]->coeff_buf_len  = 0;
+            s->HEVClcList[i]->coeff_buf_lost = 0;
+        }
+
+    if (s->frame->buf[7]) {
+        av_log(s->avctx, AV_LOG_WARNING, "data[7] in use, no coefficient features\n");
+        return 0;
+    }
+    cf = av_mallocz(sizeof(*cf));
+    if (!cf)
+        return AVERROR(ENOMEM);
+    s->frame->buf[7] = av_buffer_create((uint8_t *)cf, sizeof(*cf),
+                                        free_coeff_features, NULL, 0);
+    if (!s->frame->buf[7]) {
+        av_free(cf);
+        return AVERROR(ENOMEM);
+    }
+    s->frame->data[7] = s->frame->buf[7]->data;
+    return 0;
+}
+
+static int export_coeff_features(HEVCContext *s)
+{
+    HEVCCoeffFeatures *cf;
+    int i, size = 0, lost = 0;
+
+    if (!s->ref->frame->buf[7])
+        return 0;
+    cf = (HEVCCoeffFeatures *)s->ref->frame->buf[7]->data;
+
+    for (i = 0; i <= s->threads_number; i++)
+        if (s->HEVClcList[i]) {
+            size += s->HEVClcList[i]->coeff_buf_len;
+            lost |= s->HEVClcList[i]->coeff_buf_lost;
+        }
+    av_freep(&cf->data);
+    cf->size = 0;
+    if (lost) {
+        for (i = 0; i <= s->threads_number; i++)
+            if (s->HEVClcList[i])
+                s->HEVClcList[i]->coeff_buf_len = 0;
+        av_log(s->avctx, AV_LOG_ERROR, "TU records of POC %d lost, out of memory\n", s->poc);
+        return AVERROR(ENOMEM);
+    }
+    if (!size)
+        return 0;
+    cf->data = av_malloc(size);
+    if (!cf->data)
+        return AVERROR(ENOMEM);
+    for (i = 0; i <= s->threads_number; i++) {
+        HEVCLocalContext *lc = s->HEVClcList[i];
+        if (lc && lc->coeff_buf_len) {
+            memcpy(cf->data + cf->size, lc->coeff_buf, lc->coeff_buf_len);
+            cf->size += lc->coeff_buf_len;
+            lc->coeff_buf_len = 0;
+        }
+    }
+    return 0;
+}
+
+static int hevc_frame_start(HEVCContext *s)
 {
     HEVCLocalContext *lc = s->HEVClc;
     int pic_size_in_ctb  = ((s->sps->width  >> s->sps->log2_min_cb_size) + 1) *
                            ((s->sps->height >> s->sps->log2_min_cb_size) + 1);
-    int ret = 0;
+    int i, ret = 0;
     AVFrame *cur_frame;
     av_log(s->avctx, AV_LOG_DEBUG, "frame start %d\n", s->decoder_id);
 
@@ -3878,11 +4574,11 @@ static int hevc_frame_start(HEVCContext *s)
     memset(s->vertical_bs,   0, s->bs_width * s->bs_height);
     memset(s->cbf_luma,      0, s->sps->min_tb_width * s->sps->min_tb_height);
     memset(s->tab_slice_address, -1, pic_size_in_ctb * sizeof(*s->tab_slice_address));
-#if PARALLEL_SLICE
-    memset(s->decoded_rows, 0,s->sps->ctb_height);
-#endif
     s->is_decoded        = 0;
     s->first_nal_type    = s->nal_unit_type;
+    // the slice thread contexts are copied whole again for the new picture
+    for (i = 1; s->threads_number > 1 && i <= s->threads_number; i++)
+        s->sList[i]->ref = NULL;
 
     if (s->pps->tiles_enabled_flag)
         lc->end_of_tiles_x = s->pps->column_width[0] << s->sps->log2_ctb_size;
@@ -3916,6 +4612,25 @@ static int hevc_frame_start(HEVCContext *s)
 
     if (ret < 0)
         goto fail;
+    /* the inter-layer references are not padded */
+    s->ref_pad = s->pad_refs && !s->decoder_id ? ref_pad_size(s, s->frame) : 0;
+    if (s->coeff_features) {
+        ret = alloc_coeff_features(s);
+        if (ret < 0)
+            goto fail;
+    }
+    if (s->acc_motion_pool) {
+        ret = alloc_acc_motion(s);
+        if (ret < 0)
+            goto fail;
+    }
+    if (s->analysis) {
+        int i;
+        for (i = 0; i <= s->threads_number; i++)
+            if (s->HEVClcList[i])
+                memset(&s->HEVClcList[i]->activity, 0, sizeof(HEVCActivityStats));
+        s->nal_bytes = 0;
+    }
     s->avctx->BL_frame = s->ref;
     ret = ff_hevc_frame_rps(s);
     if (ret < 0) {
@@ -3927,13 +4642,21 @@ static int hevc_frame_start(HEVCContext *s)
     if (ret < 0)
         goto fail;
 
-    cur_frame = s->sps->sao_enabled ? s->sao_frame : s->frame;
+    cur_frame = s->frame;
     cur_frame->pict_type = 3 - s->sh.slice_type;
 
     uint8_t *MvDecoder_metaBuffer = s->frame->data[3] + ((s->frame->linesize[0]>>1)*(s->frame->coded_height>>1))*3;
     //MvDecoder: Add magic number at the front of the buffer
     MvDecoder_metaBuffer[0] = 4;
     MvDecoder_metaBuffer[1] = 2;
+    //MvDecoder: the CU syntax planes follow the size plane
+    MvDecoder_metaBuffer[3] = !!s->syntax_maps;
+    //MvDecoder: MvDecoderGlobalMotion at MVDECODER_META_GLOBAL_MOTION
+    MvDecoder_metaBuffer[4] = !!s->global_motion;
+    //MvDecoder: MvDecoderActivity at MVDECODER_META_ACTIVITY
+    MvDecoder_metaBuffer[5] = !!s->analysis;
+    //MvDecoder: log2 of the block size of the accumulated motion in extended_buf[0], 0 if none
+    MvDecoder_metaBuffer[6] = s->frame->nb_extended_buf > 0 ? s->sps->log2_min_pu_size : 0;
     //MvDecoder: save frame type to buffer
 
     if(cur_frame->pict_type==AV_PICTURE_TYPE_I) {
@@ -3971,6 +4694,134 @@ fail:
     return ret;
 }
 
+/* Last slice of the picture decoded */
+static int hevc_frame_decoded(HEVCContext *s)
+{
+    int ret;
+
+    s->is_decoded = 1;
+#ifdef SVC_EXTENSION
+#if !ACTIVE_PU_UPSAMPLING
+    if (s->bl_decoder_el_exist) {
+        int i;
+        s->bl_decoder_el_exist = 0;
+        for (i = 0; i < FF_ARRAY_ELEMS(s->Add_ref); i++) {
+            HEVCFrame *frame = &s->Add_ref[i];
+            if (frame->frame->buf[0])
+                continue;
+            ret = hevc_ref_frame(s, &s->Add_ref[i], s->ref);
+            if (ret < 0)
+                return ret;
+            ff_thread_report_il_progress(s->avctx, s->poc_id, &s->Add_ref[i], s->ref);
+            break;
+        }
+        if(i==FF_ARRAY_ELEMS(s->Add_ref))
+            av_log(s->avctx, AV_LOG_ERROR, "Error allocating frame, Addditional DPB full, decoder_%d.\n", s->decoder_id);
+    }
+#endif
+#endif
+
+#ifdef SVC_EXTENSION
+    if(s->decoder_id > 0)
+        ff_hevc_unref_frame(s, s->inter_layer_ref, ~0);
+#endif
+
+    ret = export_coeff_features(s);
+    if (ret < 0)
+        return ret;
+    if (s->syntax_maps)
+        MvDecoder_write_syntax_maps(s);
+    if (s->analysis)
+        MvDecoder_write_activity(s);
+    if (s->global_motion) {
+        ret = MvDecoder_global_motion(s);
+        if (ret < 0)
+            return ret;
+    }
+    if (s->acc_motion)
+        MvDecoder_accumulate_motion(s);
+
+    /* the collocated field was filled row by row by the filters */
+    av_buffer_unref(&s->ref->tab_mvf_buf);
+    s->ref->tab_mvf = NULL;
+    /* already output, or not to be output: the features are not needed */
+    if (!(s->ref->flags & HEVC_FRAME_FLAG_OUTPUT))
+        ff_hevc_unref_features(s, s->ref);
+    return 0;
+}
+
+/*
+ * Independent slices are decoded in parallel when the parallel-slices option
+ * is set and the slices are not split any further by tiles, WPP or dependent
+ * slice segments.
+ */
+static int use_slice_jobs(HEVCContext *s)
+{
+    return s->parallel_slices && s->threads_number > 1 &&
+           !s->pps->tiles_enabled_flag &&
+           !s->pps->entropy_coding_sync_enabled_flag &&
+           !s->pps->dependent_slice_segments_enabled_flag;
+}
+
+/*
+ * Decode the queued slices, one job each, then fix the edges between them and
+ * filter the picture once its last slice is in.
+ */
+static int run_slice_jobs(HEVCContext *s)
+{
+    int *ret = av_malloc_array(s->nb_slice_jobs, sizeof(*ret));
+    int i, res = 0, ctb_addr_ts = 0;
+
+    if (!ret) {
+        s->nb_slice_jobs = 0;
+        return AVERROR(ENOMEM);
+    }
+    s->avctx->execute2(s->avctx, (void *) hls_decode_entry_slice, NULL, ret, s->nb_slice_jobs);
+
+    for (i = 0; i < s->nb_slice_jobs; i++) {
+        if (ret[i] < 0) {
+            av_log(s->avctx, AV_LOG_ERROR, "Error decoding the slice at CTB %d.\n",
+                   s->sList[i + 1]->sh.slice_addr);
+            res = ret[i];
+            continue;
+        }
+        if (!s->sList[i + 1]->sh.disable_deblocking_filter_flag)
+            slices_boundary_strengths(s->sList[i + 1]);
+        ctb_addr_ts = FFMAX(ctb_addr_ts, ret[i]);
+    }
+    s->nb_slice_jobs = 0;
+    av_free(ret);
+
+    if (ctb_addr_ts >= s->sps->ctb_width * s->sps->ctb_height) {
+        int err;
+        slices_filters(s);
+        err = hevc_frame_decoded(s);
+        if (err < 0)
+            return err;
+    }
+    return res;
+}
+
+/*
+ * Hand the slice whose header was just parsed to the slice context of its
+ * job. The batch is decoded once there is a slice per thread.
+ */
+static int queue_slice(HEVCContext *s)
+{
+    HEVCLocalContext *lc = s->HEVClcList[s->nb_slice_jobs + 1];
+
+    update_slice_context(s, s->nb_slice_jobs + 1);
+    lc->gb                 = s->HEVClc->gb;
+    lc->first_qp_group     = s->HEVClc->first_qp_group;
+    lc->qp_y               = s->HEVClc->qp_y;
+    lc->tu.cu_qp_offset_cb = s->HEVClc->tu.cu_qp_offset_cb;
+    lc->tu.cu_qp_offset_cr = s->HEVClc->tu.cu_qp_offset_cr;
+
+    if (++s->nb_slice_jobs == s->threads_number)
+        return run_slice_jobs(s);
+    return 0;
+}
+
 static int decode_nal_unit(HEVCContext *s, const uint8_t *nal, int length)
 {
     HEVCLocalContext *lc = s->HEVClc;
@@ -3991,6 +4842,13 @@ static int decode_nal_unit(HEVCContext *s, const uint8_t *nal, int length)
 
     if ((s->temporal_id > s->temporal_layer_id) || (ret > s->quality_layer_id))
         return 0;
+
+    /* the queued slices still point to the parameter sets and the picture */
+    if (s->nb_slice_jobs && (s->nal_unit_type > NAL_CRA_NUT || show_bits1(gb))) {
+        int err = run_slice_jobs(s);
+        if (err < 0 && (s->avctx->err_recognition & AV_EF_EXPLODE))
+            return err;
+    }
     s->nuh_layer_id = ret;
     
     s->nuh_layer_id = ret;
@@ -4087,11 +4945,22 @@ static int decode_nal_unit(HEVCContext *s, const uint8_t *nal, int length)
             ret = hevc_frame_start(s);
             if (ret < 0)
                 return ret;
+            s->slice_jobs_active = use_slice_jobs(s);
         } else if (!s->ref) {
             av_log(s->avctx, AV_LOG_ERROR, "First slice in a frame missing.\n");
             goto fail;
+        } else if (!s->ref->tab_mvf) {
+            av_log(s->avctx, AV_LOG_ERROR, "Slice after the last CTB of the frame.\n");
+            goto fail;
+        } else if (s->slice_jobs_active != use_slice_jobs(s)) {
+            av_log(s->avctx, AV_LOG_ERROR,
+                   "Slices of a picture decoded both in parallel and in sequence.\n");
+            goto fail;
         }
 
+        if (s->analysis)
+            s->nal_bytes += length;
+
         if (s->nal_unit_type != s->first_nal_type) {
             av_log(s->avctx, AV_LOG_ERROR,
                    "Non-matching NAL types of the VCL NALUs: %d %d\n",
@@ -4127,37 +4996,29 @@ static int decode_nal_unit(HEVCContext *s, const uint8_t *nal, int length)
                     av_log(s->avctx, AV_LOG_ERROR, "Error allocating frame, Addditional DPB full, decoder_%d.\n", s->decoder_id);
             }
 #endif
+        /* Sub-layer non-reference pictures of the highest sub-layer are never
+         * referenced, so their slice data can be skipped. The frame is still
+         * output, with undefined content, to keep the output numbering. */
+        if (s->avctx->skip_frame >= AVDISCARD_NONREF && IS_SUB_LAYER_NON_REF(s) &&
+            s->temporal_id == s->sps->max_sub_layers - 1 &&
+            s->decoder_id >= s->avctx->quality_id)
+            break;
+
+        if (s->slice_jobs_active) {
+            ret = queue_slice(s);
+            if (ret < 0)
+                goto fail;
+            break;
+        }
+
         ctb_addr_ts = hls_slice_data(s, nal, length);
 
         if (ctb_addr_ts >= (s->sps->ctb_width * s->sps->ctb_height)) {
-            s->is_decoded = 1;
             if (s->pps->tiles_enabled_flag && s->threads_number!=1)
                 tiles_filters(s);
-#ifdef SVC_EXTENSION
-#if !ACTIVE_PU_UPSAMPLING
-            if (s->bl_decoder_el_exist) {
-                int i;
-                s->bl_decoder_el_exist = 0;
-                for (i = 0; i < FF_ARRAY_ELEMS(s->Add_ref); i++) {
-                    HEVCFrame *frame = &s->Add_ref[i];
-                    if (frame->frame->buf[0])
-                        continue;
-                    ret = hevc_ref_frame(s, &s->Add_ref[i], s->ref);
-                    if (ret < 0)
-                        return ret;
-                    ff_thread_report_il_progress(s->avctx, s->poc_id, &s->Add_ref[i], s->ref);
-                    break;
-                }
-                if(i==FF_ARRAY_ELEMS(s->Add_ref))
-                    av_log(s->avctx, AV_LOG_ERROR, "Error allocating frame, Addditional DPB full, decoder_%d.\n", s->decoder_id);
-            }
-#endif
-#endif
-
-#ifdef SVC_EXTENSION
-            if(s->decoder_id > 0)
-                ff_hevc_unref_frame(s, s->inter_layer_ref, ~0);
-#endif
+            ret = hevc_frame_decoded(s);
+            if (ret < 0)
+                return ret;
         }
 
         if (ctb_addr_ts < 0) {
@@ -4185,226 +5046,6 @@ fail:
     return 0;
 }
 
-#if PARALLEL_SLICE
-static int decode_nal_unit_slice(AVCodecContext *avctxt, void *input_ctb_row, int job, int self_id) {
-    HEVCContext *s1      = avctxt->priv_data;
-    HEVCContext *s       = s1->sList[self_id];
-    HEVCLocalContext *lc = s->HEVClc;
-    GetBitContext *gb    = &lc->gb;
-    s->avctx = avctxt;
-    int i; 
-    int *nal_id          = input_ctb_row;
-
-    const uint8_t *nal   = s1->nals[nal_id[job]].data;
-    int length           = s1->nals[nal_id[job]].size;
-    int ctb_addr_ts, ret;
-    
-
-    ret = init_get_bits8(gb, nal, length);
-    if (ret < 0)
-        return ret;
-
-    ret = hls_nal_unit(s);
-
-    av_log(s->avctx, AV_LOG_DEBUG,
-           "decode IRAP in parallel #%d.\n", s->nal_unit_type);
-    if (ret < 0) {
-        av_log(s->avctx, AV_LOG_ERROR, "Invalid NAL unit %d, skipping.\n",
-               s->nal_unit_type);
-        goto fail;
-    } else if (ret != (s->decoder_id) && (s->nal_unit_type != NAL_VPS && (s->nal_unit_type != NAL_SPS) /*&& s->nal_unit_type != NAL_PPS*/))
-        return 0;
-
-    if ((s->temporal_id > s->temporal_layer_id) || (ret > s->quality_layer_id))
-        return 0;
-    s->nuh_layer_id          = ret;
-    s->avctx->layers_size   += length;
-    s->self_id               = self_id;
-    s->job                   = job;
-
-
-    switch (s->nal_unit_type) {
-        case NAL_VPS:
-            ret = ff_hevc_decode_nal_vps(s);
-            if (ret < 0)
-                goto fail;
-            break;
-        case NAL_SPS:
-            ret = ff_hevc_decode_nal_sps(s);
-            if (ret < 0)
-                goto fail;
-            break;
-        case NAL_PPS:
-            ret = ff_hevc_decode_nal_pps(s);
-            if (ret < 0)
-                goto fail;
-            break;
-        case NAL_SEI_PREFIX:
-        case NAL_SEI_SUFFIX:
-            ret = ff_hevc_decode_nal_sei(s);
-            if (ret < 0)
-                goto fail;
-            break;
-        case NAL_TRAIL_R:
-        case NAL_TRAIL_N:
-        case NAL_TSA_N:
-        case NAL_TSA_R:
-        case NAL_STSA_N:
-        case NAL_STSA_R:
-        case NAL_BLA_W_LP:
-        case NAL_BLA_W_RADL:
-        case NAL_BLA_N_LP:
-        case NAL_IDR_W_RADL:
-        case NAL_IDR_N_LP:
-        case NAL_CRA_NUT:
-        case NAL_RADL_N:
-        case NAL_RADL_R:
-        case NAL_RASL_N:
-        case NAL_RASL_R:
-            ret = hls_slice_header(s);
-            
-            if (ret < 0)
-                return ret;
-
-            if (s->max_ra == INT_MAX) {
-                if (s->nal_unit_type == NAL_CRA_NUT || IS_BLA(s)) {
-                    s->max_ra = s->poc;
-                    av_log(s->avctx, AV_LOG_WARNING,
-                           "max_ra equal to s->max_ra %d \n", s->max_ra);
-                } else {
-                    if (IS_IDR(s))
-                        s->max_ra = INT_MIN;
-                    else if( s->decoder_id ) {
-                        av_log(s->avctx, AV_LOG_WARNING,
-                               "Nal type %d s->max_ra %d \n", s->nal_unit_type,  s->max_ra);
-                        break;
-                    }
-                }
-            }
-
-            if ((s->nal_unit_type == NAL_RASL_R || s->nal_unit_type == NAL_RASL_N) &&
-                s->poc <= s->max_ra) {
-                s->is_decoded = 0;
-                return 0;
-            } else {
-                if (s->nal_unit_type == NAL_RASL_R && s->poc > s->max_ra)
-                    s->max_ra = INT_MIN;
-            }
-            
-            if (s->sh.first_slice_in_pic_flag) {
-                ret = hevc_frame_start(s);
-                ff_thread_report_progress_slice(s->avctx);
-                if (ret < 0)
-                    return ret;
-
-            } else if (!s->ref) {
-                av_log(s->avctx, AV_LOG_ERROR, "First slice in a frame missing.\n");
-                goto fail;
-            }
-
-            if (s->nal_unit_type != s->first_nal_type) {
-                av_log(s->avctx, AV_LOG_ERROR,
-                       "Non-matching NAL types of the VCL NALUs: %d %d\n",
-                       s->first_nal_type, s->nal_unit_type);
-                goto fail;
-            }
-            
-            if (!s->sh.dependent_slice_segment_flag &&
-                s->sh.slice_type != I_SLICE) {
-                
-                ret = ff_hevc_slice_rpl(s);
-                if (ret < 0) {
-                    av_log(s->avctx, AV_LOG_WARNING,
-                           "Error constructing the reference lists for the current slice.\n");
-                    goto fail;
-                }
-            } 
-              
-#if ACTIVE_PU_UPSAMPLING
-            if (s->bl_decoder_el_exist) {
-                int i;
-                s->bl_decoder_el_exist = 0;
-                for (i = 0; i < FF_ARRAY_ELEMS(s->Add_ref); i++) {
-                    HEVCFrame *frame = &s->Add_ref[i];
-                    if (frame->frame->buf[0])
-                        continue;
-                    ret = hevc_ref_frame(s, &s->Add_ref[i], s->ref);
-                    if (ret < 0)
-                        return ret;
-                    ff_thread_report_il_progress(s->avctx, s->poc_id, &s->Add_ref[i], s->ref);
-                    break;
-                }
-                if(i==FF_ARRAY_ELEMS(s->Add_ref))
-                    av_log(s->avctx, AV_LOG_ERROR, "Error allocating frame, Addditional DPB full, decoder_%d.\n", s->decoder_id);
-            }
-#endif
-            if(s->job != s1->max_slices) {
-                ff_thread_await_progress_slice2(s->avctx, s->job);
-                for(i=s1->slice_segment_addr[s->job]; i < s1->slice_segment_addr[s->job+1]; i++)
-                    s->tab_slice_address[i] = s1->slice_segment_addr[s->job];
-            } else {
-                for(i = s1->slice_segment_addr[s->job]; i < s->sps->ctb_height*s->sps->ctb_width; i++)
-                    s->tab_slice_address[i] = s1->slice_segment_addr[s->job];
-            }
-            ctb_addr_ts = hls_decode_entry_slice(s);
-
-
-            if (ctb_addr_ts >= (s->sps->ctb_width * s->sps->ctb_height)) {
-                for(int i= 0; i < s->threads_number ; i++)
-                    s->sList[i]->is_decoded = 1;
-                if (s->pps->tiles_enabled_flag && s->threads_number!=1)
-                    tiles_filters(s);
-#ifdef SVC_EXTENSION
-#if !ACTIVE_PU_UPSAMPLING
-                if (s->active_el_frame) {
-                    int i;
-                    s->active_el_frame = 0;
-                    for (i = 0; i < FF_ARRAY_ELEMS(s->Add_ref); i++) {
-                        HEVCFrame *frame = &s->Add_ref[i];
-                        if (frame->frame->buf[0])
-                            continue;
-                        ret = hevc_ref_frame(s, &s->Add_ref[i], s->ref);
-                        if (ret < 0)
-                            return ret;
-                        ff_thread_report_il_progress(s->avctx, s->poc_id, &s->Add_ref[i], s->ref);
-                        break;
-                    }
-                    if(i==FF_ARRAY_ELEMS(s->Add_ref))
-                        av_log(s->avctx, AV_LOG_ERROR, "Error allocating frame, Addditional DPB full, decoder_%d.\n", s->decoder_id);
-                }
-#endif
-#endif
-
-#ifdef SVC_EXTENSION
-                if(s->decoder_id > 0)
-                    ff_hevc_unref_frame(s, s->inter_layer_ref, ~0);
-#endif
-            }
-            
-            if (ctb_addr_ts < 0) {
-                ret = ctb_addr_ts;
-                goto fail;
-            }
-            break;
-        case NAL_EOS_NUT:
-        case NAL_EOB_NUT:
-            s->seq_decode = (s->seq_decode + 1) & 0xff;
-            s->max_ra     = INT_MAX;
-            break;
-        case NAL_AUD:
-        case NAL_FD_NUT:
-            break;
-        default:
-            av_log(s->avctx, AV_LOG_INFO,
-                   "Skipping NAL unit %d\n", s->nal_unit_type);
-    }
-    return 0;
-fail:
-    if (s->avctx->err_recognition & AV_EF_EXPLODE)
-        return ret;
-    return 0;
-}
-#endif
 /* FIXME: This is adapted from ff_h264_decode_nal, avoiding duplication
  * between these functions would be nice. */
 int ff_hevc_extract_rbsp(HEVCContext *s, const uint8_t *src, int length,
@@ -4517,12 +5158,7 @@ nsc:
 static int decode_nal_units(HEVCContext *s, const uint8_t *buf, int length)
 {
     int i,  consumed, ret = 0;
-    
-#if PARALLEL_SLICE
-    int cum_nal_pos = 0, k, nal_type, prv_nal_type=-1;
-    int arg[128];
-    int is_irap = 1;
-#endif
+
     s->ref = NULL;
     s->au_poc = -1;
     s->last_eos = s->eos;
@@ -4530,11 +5166,8 @@ static int decode_nal_units(HEVCContext *s, const uint8_t *buf, int length)
     s->bl_decoder_el_exist  = 0;
     s->el_decoder_el_exist  = 0;
     s->el_decoder_bl_exist  = 0;
-#if PARALLEL_SLICE
-    s->NbListElement        = 0;
-    for(i = 0; i < 16; i++)
-        s->NALListOrder[i]  = 0;
-#endif
+    s->slice_jobs_active    = 0;
+    s->nb_slice_jobs        = 0;
     /* split the input packet into NAL units, so we know the upper bound on the
      * number of slices in the frame */
     s->nb_nals = 0;
@@ -4611,23 +5244,6 @@ static int decode_nal_units(HEVCContext *s, const uint8_t *buf, int length)
             goto fail;
         ret = hls_nal_unit(s);
 
-#if PARALLEL_SLICE
-        /*   Find out the set of slices to run in parallel   */
-        nal_type = s->nal_unit_type > NAL_CRA_NUT;
-        if (!nal_type)
-            is_irap &= IS_IRAP(s);
-
-        if(prv_nal_type==-1)
-            s->NALListOrder[0]++;
-        else {
-            if(nal_type || (!nal_type && nal_type != prv_nal_type))
-                s->NbListElement++;
-            s->NALListOrder[s->NbListElement]++;
-        }
-
-        prv_nal_type = nal_type;
-#endif
-
         if(!s->bl_decoder_el_exist && ret == s->decoder_id+1 && s->avctx->quality_id >= ret && s->nal_unit_type <= NAL_CRA_NUT && (s->threads_type&FF_THREAD_FRAME)) {
             s->bl_decoder_el_exist = 1;
             s->poc_id++;
@@ -4653,44 +5269,6 @@ static int decode_nal_units(HEVCContext *s, const uint8_t *buf, int length)
     if(!s->el_decoder_bl_exist) {
         s->el_decoder_el_exist = 0;
     }
-#if PARALLEL_SLICE
-    if (is_irap) {
-        for(i = 0; i <= s->NbListElement; i++) {
-            //      s->skipped_bytes = s->skipped_bytes_nal[i];
-            //      s->skipped_bytes_pos = s->skipped_bytes_pos_nal[i];
-            s->max_slices = s->NALListOrder[i]-1;
-            for(k=0; k < s->NALListOrder[i]; k++)
-                arg[k] = cum_nal_pos+k;
-            s->avctx->execute2(s->avctx, (void *) decode_nal_unit_slice, arg, ret, s->NALListOrder[i]);
-            cum_nal_pos += s->NALListOrder[i];
-
-            if (ret < 0) {
-                av_log(s->avctx, AV_LOG_WARNING,
-                       "Error parsing NAL unit #%d.\n", i);
-                goto fail;
-            }
-        }
-    } else {
-        for (i = 0; i < s->nb_nals; i++) {
-            int ret;
-            s->skipped_bytes = s->skipped_bytes_nal[i];
-            s->skipped_bytes_pos = s->skipped_bytes_pos_nal[i];
-
-            ret = decode_nal_unit(s, s->nals[i].data, s->nals[i].size);
-            if (ret < 0) {
-                av_log(s->avctx, AV_LOG_WARNING,
-                       "Error parsing NAL unit #%d.\n", i);
-                goto fail;
-            }
-        }
-
-    }
-#if !PARALLEL_FILTERS
-    if(s->is_decoded)
-        slices_filters(s);
-#endif
-
-#else
     for (i = 0; i < s->nb_nals; i++) {
         int ret;
         s->skipped_bytes = s->skipped_bytes_nal[i];
@@ -4703,12 +5281,15 @@ static int decode_nal_units(HEVCContext *s, const uint8_t *buf, int length)
             goto fail;
         }
     }
-#endif
+    if (s->nb_slice_jobs) {
+        ret = run_slice_jobs(s);
+        if (ret < 0)
+            av_log(s->avctx, AV_LOG_WARNING, "Error decoding the slices in parallel.\n");
+        if (ret < 0 && (s->avctx->err_recognition & AV_EF_EXPLODE))
+            goto fail;
+        ret = 0;
+    }
 fail:
-#if PARALLEL_SLICE
-    ff_thread_report_progress_slice(s->avctx);
-    ff_thread_report_progress_slice2(s->avctx, s->job);
-#endif
     if (s->ref && (s->threads_type & FF_THREAD_FRAME))
         ff_thread_report_progress(&s->ref->tf, INT_MAX, 0);
     if (s->decoder_id) {
@@ -4812,10 +5393,6 @@ static int hevc_decode_frame(AVCodecContext *avctx, void *data, int *got_output,
         return 0;
     }
     s->ref = NULL;
-#if PARALLEL_SLICE
-    ff_thread_set_slice_flag(avctx, 0);
-    ff_init_flags(avctx);
-#endif
 
 	if (avpkt->pts != AV_NOPTS_VALUE) {
 		if (! s->last_frame_pts || (s->last_frame_pts!=avpkt->pts)) {
@@ -4891,7 +5468,6 @@ static av_cold int hevc_decode_free(AVCodecContext *avctx)
 
     av_freep(&s->cabac_state);
 
-    av_frame_free(&s->tmp_frame);
     av_frame_free(&s->output_frame);
 
     for (i = 0; i < FF_ARRAY_ELEMS(s->DPB); i++) {
@@ -4912,20 +5488,31 @@ static av_cold int hevc_decode_free(AVCodecContext *avctx)
     for (i = 0; i < FF_ARRAY_ELEMS(s->pps_list); i++)
         av_buffer_unref(&s->pps_list[i]);
 
+    av_freep(&s->gm_buf);
     av_freep(&s->sh.entry_point_offset); // TODO Free for each slice
     av_freep(&s->sh.offset);
     av_freep(&s->sh.size);
 
-    for (i = 1; i < s->threads_number; i++) {
+    for (i = 1; s->HEVClcList && i <= s->threads_number; i++) {
         lc = s->HEVClcList[i];
         if (lc) {
+            av_freep(&lc->coeff_buf);
             av_freep(&s->HEVClcList[i]);
             av_freep(&s->sList[i]);
         }
     }
-    if (s->HEVClc == s->HEVClcList[0])
-        s->HEVClc = NULL;
-    av_freep(&s->HEVClcList[0]);
+    if (s->HEVClcList) {
+        if (s->HEVClc == s->HEVClcList[0])
+            s->HEVClc = NULL;
+        if (s->HEVClcList[0])
+            av_freep(&s->HEVClcList[0]->coeff_buf);
+        av_freep(&s->HEVClcList[0]);
+    } else if (s->HEVClc) {
+        av_freep(&s->HEVClc->coeff_buf);
+        av_freep(&s->HEVClc);
+    }
+    av_freep(&s->HEVClcList);
+    av_freep(&s->sList);
 
     for (i = 0; i < s->nals_allocated; i++)
         av_freep(&s->nals[i].rbsp_buffer);
@@ -4948,6 +5535,18 @@ static av_cold int hevc_init_context(AVCodecContext *avctx)
 #if 0
     printf("static ## %ld ## \n", sizeof(HEVCLocalContext) );
 #endif
+    s->threads_type        = avctx->active_thread_type;
+    if(avctx->active_thread_type & FF_THREAD_SLICE)
+        s->threads_number  = avctx->thread_count;
+    else
+        s->threads_number  = 1;
+
+    /* one more context than threads, the independent slices decoded in
+     * parallel are parsed in the main context and run in the other ones */
+    s->sList      = av_mallocz_array(s->threads_number + 1, sizeof(*s->sList));
+    s->HEVClcList = av_mallocz_array(s->threads_number + 1, sizeof(*s->HEVClcList));
+    if (!s->sList || !s->HEVClcList)
+        goto fail;
     s->HEVClcList[0] = s->HEVClc;
     s->sList[0] = s;
 
@@ -4956,11 +5555,6 @@ static av_cold int hevc_init_context(AVCodecContext *avctx)
     if (!s->cabac_state)
         goto fail;
      s->HEVClc->dbs_g = InitC();
-    s->tmp_frame = av_frame_alloc();
-    s->dynamic_alloc += sizeof(AVFrame); 
-    if (!s->tmp_frame)
-        goto fail;
-
     s->output_frame = av_frame_alloc();
     s->dynamic_alloc += sizeof(AVFrame); 
     if (!s->output_frame)
@@ -4996,17 +5590,14 @@ static av_cold int hevc_init_context(AVCodecContext *avctx)
     s->quality_layer_id    = 8;
 
     s->context_initialized = 1;
-    s->threads_type        = avctx->active_thread_type;
-    if(avctx->active_thread_type & FF_THREAD_SLICE)
-        s->threads_number  = avctx->thread_count;
-    else
-        s->threads_number  = 1;
     s->eos = 0;
 
-    for (i = 1; i < s->threads_number ; i++) {
+    for (i = 1; i < s->threads_number + (s->threads_number > 1); i++) {
         s->sList[i] = av_mallocz(sizeof(HEVCContext));
-        memcpy(s->sList[i], s, sizeof(HEVCContext));
         s->HEVClcList[i] = av_mallocz(sizeof(HEVCLocalContext));
+        if (!s->sList[i] || !s->HEVClcList[i])
+            goto fail;
+        memcpy(s->sList[i], s, sizeof(HEVCContext));
         s->sList[i]->HEVClc = s->HEVClcList[i];
     }
 
@@ -5084,6 +5675,14 @@ static int hevc_update_thread_context(AVCodecContext *dst,
     s->temporal_layer_id    = s0->temporal_layer_id;
     s->quality_layer_id     = s0->quality_layer_id;
     s->decode_checksum_sei  = s0->decode_checksum_sei;
+    s->parallel_slices      = s0->parallel_slices;
+    s->parallel_filters     = s0->parallel_filters;
+    s->pad_refs             = s0->pad_refs;
+    s->analysis             = s0->analysis;
+    s->global_motion        = s0->global_motion;
+    s->acc_motion           = s0->acc_motion;
+    s->syntax_maps          = s0->syntax_maps;
+    s->coeff_features       = s0->coeff_features;
     s->poc_id               = s0->poc_id;
 
     if (s->sps != s0->sps)
@@ -5230,6 +5829,22 @@ static const AVOption options[] = {
         AV_OPT_TYPE_INT, {.i64 = 0}, 0, 10, PAR },
     { "quality_layer_id", "set the max quality id", OFFSET(quality_layer_id),
         AV_OPT_TYPE_INT, {.i64 = 0}, 0, 10, PAR },
+    { "parallel-slices", "decode the independent slices of a picture in parallel", OFFSET(parallel_slices),
+        AV_OPT_TYPE_INT, {.i64 = 0}, 0, 1, PAR },
+    { "parallel-filters", "run the in-loop filters on a slice thread of their own", OFFSET(parallel_filters),
+        AV_OPT_TYPE_INT, {.i64 = 0}, 0, 1, PAR },
+    { "pad-refs", "extend the reference picture borders once instead of per MC block", OFFSET(pad_refs),
+        AV_OPT_TYPE_INT, {.i64 = 0}, 0, 1, PAR },
+    { "analysis", "parse only, for the activity and scene-cut index of the pictures", OFFSET(analysis),
+        AV_OPT_TYPE_INT, {.i64 = 0}, 0, 1, PAR },
+    { "global-motion", "fit a camera motion model to the MVs (2: also remove it from the MV planes)", OFFSET(global_motion),
+        AV_OPT_TYPE_INT, {.i64 = 0}, 0, 2, PAR },
+    { "acc-motion", "accumulate the MVs along the references back to the anchor picture, in extended_buf[0]", OFFSET(acc_motion),
+        AV_OPT_TYPE_INT, {.i64 = 0}, 0, 1, PAR },
+    { "syntax-maps", "export the QP, skip, intra mode, part mode, depth and cbf maps after the size plane", OFFSET(syntax_maps),
+        AV_OPT_TYPE_INT, {.i64 = 0}, 0, 1, PAR },
+    { "coeff-features", "export the dequantized coefficients of each TU in data[7] (2: parse only, no inverse transform)",
+        OFFSET(coeff_features), AV_OPT_TYPE_INT, {.i64 = 0}, 0, 2, PAR },
     { NULL },
 };
 
@@ -62,19 +62,13 @@
 #define EncryptMVDiffSign 1
 
 
-#define PARALLEL_SLICE   0
-#define PARALLEL_FILTERS 0
 
-#define MAX_SLICES_FRAME 64
 
 
 
-
-#define TEST_MV_POC
 #define MAX_DPB_SIZE 16 // A.4.1
 #define MAX_REFS 16
 
-#define MAX_NB_THREADS 16
 #define SHIFT_CTB_WPP 2
 #define MAX_POC      1024
 /**
@@ -119,6 +113,10 @@
 
 #define EDGE_EMU_BUFFER_STRIDE 80
 
+/* stride of the CTB copy the edge offset of SAO filters from, *2 for high
+ * bit depths, padded for the SIMD reads past the CTB width */
+#define SAO_BUFFER_STRIDE (2 * MAX_PB_SIZE + FF_INPUT_BUFFER_PADDING_SIZE)
+
 /**
  * Value of the luma sample at position (x, y) in the 2D array tab.
  */
@@ -129,6 +127,7 @@
 #define IS_BLA(s) ((s)->nal_unit_type == NAL_BLA_W_RADL || (s)->nal_unit_type == NAL_BLA_W_LP || \
                    (s)->nal_unit_type == NAL_BLA_N_LP)
 #define IS_IRAP(s) ((s)->nal_unit_type >= 16 && (s)->nal_unit_type <= 23)
+#define IS_SUB_LAYER_NON_REF(s) ((s)->nal_unit_type <= NAL_RASL_R && !((s)->nal_unit_type & 1))
 
 enum ScalabilityType
 {
@@ -1032,12 +1031,7 @@ typedef struct Mv {
 
 typedef struct MvField {
     Mv mv[2];
-#ifdef TEST_MV_POC
-    int32_t poc[2];
-    uint32_t pred_flag;
-#else
     uint8_t pred_flag;
-#endif
     uint8_t ref_idx[2];
 } MvField;
 
@@ -1086,6 +1080,101 @@ typedef struct DBParams {
     int8_t tc_offset;
 } DBParams;
 
+/**
+ * MvDecoder: CU syntax planes, one byte per 8x8 block, following the size
+ * plane in data[3] when syntax_maps is set
+ */
+enum MvDecoderSyntaxMap {
+    MVDECODER_MAP_QP = 0,       ///< luma QP (int8_t)
+    MVDECODER_MAP_SKIP,
+    MVDECODER_MAP_INTRA_MODE,   ///< luma intra mode of the top-left PU, 255 when inter
+    MVDECODER_MAP_PART_MODE,    ///< PartMode
+    MVDECODER_MAP_CT_DEPTH,
+    MVDECODER_MAP_CBF_LUMA,     ///< a luma TB of the block has coefficients
+    MVDECODER_NB_MAPS,
+};
+
+#define MVDECODER_GLOBAL_MOTION_RESIDUAL 2 ///< global_motion: remove the camera motion from the MV planes
+#define MVDECODER_META_GLOBAL_MOTION     16 ///< offset of MvDecoderGlobalMotion in the metadata
+
+/**
+ * MvDecoder: camera motion model of a picture, in the metadata of data[3].
+ * With x and y the luma sample position, the motion per POC unit, in
+ * quarter luma samples, is
+ * mv_x = params[0] + params[1] * x + params[2] * y
+ * mv_y = params[3] + params[4] * x + params[5] * y
+ */
+typedef struct MvDecoderGlobalMotion {
+    float   params[6];
+    float   inliers;        ///< share of the samples the model fits
+    int32_t nb_samples;     ///< inter 8x8 samples of the fit, 0 if there is no model
+} MvDecoderGlobalMotion;
+
+#define MVDECODER_META_ACTIVITY          48 ///< offset of MvDecoderActivity in the metadata
+
+#define MVDECODER_ACTIVITY_INTRA         (1 << 0) ///< intra picture
+#define MVDECODER_ACTIVITY_SCENE_CUT     (1 << 1) ///< inter picture mostly coded intra
+#define MVDECODER_ACTIVITY_HIGH          (1 << 2) ///< fast motion or little skipped area
+
+#define MVDECODER_SCENE_CUT_INTRA        0.5f ///< intra share of an inter picture at a scene cut
+#define MVDECODER_HIGH_ACTIVITY_MV       16.0f ///< mean |MV| per POC unit, in quarter samples
+#define MVDECODER_HIGH_ACTIVITY_SKIP     0.2f ///< skipped share below which an inter picture is active
+
+/**
+ * MvDecoder: compressed domain activity of a picture decoded with the
+ * analysis option, in the metadata of data[3]
+ */
+typedef struct MvDecoderActivity {
+    int32_t bits;           ///< bits of the slice NAL units
+    float   intra;          ///< share of the picture area in intra CUs
+    float   inter;          ///< share in inter CUs that are not skipped
+    float   skip;           ///< share in skipped CUs
+    float   mean_mv;        ///< mean |MV| per POC unit of the inter area, in quarter samples
+    float   mean_qp;        ///< mean luma QP
+    int32_t flags;          ///< a combination of MVDECODER_ACTIVITY_*
+} MvDecoderActivity;
+
+/* CU statistics of a slice thread, for MvDecoderActivity */
+typedef struct HEVCActivityStats {
+    int64_t intra_area;
+    int64_t inter_area;
+    int64_t skip_area;
+    int64_t mv_area;
+    double  mv_sum;
+} HEVCActivityStats;
+
+#define HEVC_COEFF_FEATURES_PARSE_ONLY 2   ///< coeff_features: skip the inverse transform
+
+#define HEVC_COEFF_TU_TRANSFORM_SKIP  (1 << 0)
+#define HEVC_COEFF_TU_BYPASS          (1 << 1)
+#define HEVC_COEFF_TU_INTRA           (1 << 2)
+
+/**
+ * Coefficient features of a TU, followed by its nb_coeffs HEVCCoeff.
+ * Position and size are in samples of the component.
+ */
+typedef struct HEVCCoeffTU {
+    uint16_t x, y;
+    uint8_t  log2_size;
+    uint8_t  c_idx;
+    int8_t   qp;            ///< QP of the dequantization, 0 with the transquant bypass
+    uint8_t  flags;         ///< a combination of HEVC_COEFF_TU_*
+    uint32_t nb_coeffs;
+} HEVCCoeffTU;
+
+typedef struct HEVCCoeff {
+    uint16_t pos;           ///< y * (1 << log2_size) + x
+    int16_t  level;         ///< dequantized level
+} HEVCCoeff;
+
+/**
+ * TU records of a picture, in data[7] of its frame when coeff_features is set
+ */
+typedef struct HEVCCoeffFeatures {
+    uint8_t *data;
+    int      size;
+} HEVCCoeffFeatures;
+
 #define HEVC_FRAME_FLAG_OUTPUT    (1 << 0)
 #define HEVC_FRAME_FLAG_SHORT_REF (1 << 1)
 #define HEVC_FRAME_FLAG_LONG_REF  (1 << 2)
@@ -1094,7 +1183,8 @@ typedef struct DBParams {
 typedef struct HEVCFrame {
     AVFrame *frame;
     ThreadFrame tf;
-    MvField *tab_mvf;
+    MvField *tab_mvf;       ///< min PU motion field, only while the picture is decoded
+    MvField *tab_mvf_col;   ///< one MvField per 16x16 block, for the collocated prediction
     RefPicList *refPicList[MAX_SLICES_IN_FRAME];
     RefPicListTab **rpl_tab;
     int ctb_count;
@@ -1104,6 +1194,7 @@ typedef struct HEVCFrame {
     HEVCWindow window;
 
     AVBufferRef *tab_mvf_buf;
+    AVBufferRef *tab_mvf_col_buf;
     AVBufferRef *rpl_tab_buf;
     AVBufferRef *rpl_buf;
 
@@ -1163,12 +1254,22 @@ typedef struct HEVCLocalContext {
     DECLARE_ALIGNED(32, uint8_t, edge_emu_buffer)[(MAX_PB_SIZE + 7) * EDGE_EMU_BUFFER_STRIDE * 2];
     DECLARE_ALIGNED(32, uint8_t, edge_emu_buffer2)[(MAX_PB_SIZE + 7) * EDGE_EMU_BUFFER_STRIDE * 2];
     DECLARE_ALIGNED(32, int16_t, edge_emu_buffer_up_v[MAX_EDGE_BUFFER_SIZE]);
+    /* unfiltered CTB and its one sample border, +3 rows for the borders and
+     * the SIMD reads of the last row */
+    DECLARE_ALIGNED(32, uint8_t, sao_buffer)[(MAX_PB_SIZE + 3) * SAO_BUFFER_STRIDE];
 
     uint8_t slice_or_tiles_left_boundary;
     uint8_t slice_or_tiles_up_boundary;
 
     int ctb_tile_rs;
     Crypto_Handle       dbs_g;
+
+    HEVCActivityStats activity;     ///< CUs of the current picture, with the analysis option
+
+    uint8_t     *coeff_buf;         ///< HEVCCoeffTU records of the current picture
+    unsigned int coeff_buf_size;
+    int          coeff_buf_len;
+    int          coeff_buf_lost;    ///< a record could not be allocated
     
 } HEVCLocalContext;
 
@@ -1176,15 +1277,13 @@ typedef struct HEVCContext {
     const AVClass *c;  // needed by private avoptions
     AVCodecContext *avctx;
 
-    struct HEVCContext  *sList[MAX_NB_THREADS];
+    struct HEVCContext  **sList;      ///< per slice thread contexts, threads_number + 1 entries
 
-    HEVCLocalContext    *HEVClcList[MAX_NB_THREADS];
+    HEVCLocalContext    **HEVClcList; ///< per slice thread local contexts, threads_number + 1 entries
     HEVCLocalContext    *HEVClc;
     uint8_t *cabac_state;
 
     AVFrame *frame;
-    AVFrame *sao_frame;
-    AVFrame *tmp_frame;
     AVFrame *output_frame;
 
     const HEVCVPS *vps;
@@ -1195,10 +1294,16 @@ typedef struct HEVCContext {
     AVBufferRef *pps_list[MAX_PPS_COUNT];
 
     AVBufferPool *tab_mvf_pool;
+    AVBufferPool *tab_mvf_col_pool;
     AVBufferPool *rpl_tab_pool;
+    AVBufferPool *acc_motion_pool;  ///< accumulated motion fields, with acc_motion
 
     SAOParams *sao;
     DBParams *deblock;
+    /* deblocked samples of the first and last row (h) and column (v) of
+     * every CTB, saved before SAO filters the CTB in place */
+    uint8_t *sao_pixel_buffer_h[3];
+    uint8_t *sao_pixel_buffer_v[3];
 
     ///< candidate references for the current frame
     RefPicList rps[5+2]; // 2 for inter layer reference pictures
@@ -1234,6 +1339,7 @@ typedef struct HEVCContext {
     //  CU
     uint8_t *skip_flag;
     uint8_t *tab_ct_depth;
+    uint8_t *tab_part_mode;     ///< only filled for the syntax maps
     // PU
     uint8_t *tab_ipm;
 
@@ -1314,22 +1420,29 @@ typedef struct HEVCContext {
     long unsigned int dynamic_alloc;
 
     uint8_t threads_type;
-    uint8_t threads_number;
+    int     threads_number;
 #if FRAME_CONCEALMENT
     int prev_display_poc;
     int no_display_pic;
 #endif
     int     decode_checksum_sei;
 
-#if PARALLEL_SLICE
-    int NALListOrder[MAX_SLICES_FRAME];
-    int slice_segment_addr[MAX_SLICES_FRAME]; 
-    int NbListElement;
-    int self_id;
-    int job;
-    int max_slices;
-    uint8_t *decoded_rows; 
-#endif
+    int     parallel_slices;    ///< decode the independent slices of a picture concurrently
+    int     slice_jobs_active;  ///< the current picture is decoded through the slice jobs
+    int     nb_slice_jobs;      ///< slices parsed and waiting for the next execute2
+    int     parallel_filters;   ///< run the in-loop filters of a slice in a job of their own
+    int     filters_pipelined;  ///< the current slice is filtered by the filter job
+    int     filter_ctb_end;     ///< CTB (ts) where the filter job stops, INT_MAX while decoding
+    int     pad_refs;           ///< extend the borders of the pictures once for the MC
+    int     ref_pad;            ///< luma samples of extended border MC reads directly, 0 if none
+    int     analysis;           ///< parse only, for MvDecoderActivity: no pixels nor feature planes
+    int     nal_bytes;          ///< slice NAL bytes of the current picture
+    int     global_motion;      ///< fit a camera motion model, MVDECODER_GLOBAL_MOTION_RESIDUAL
+    float  *gm_buf;             ///< samples of the global motion fit
+    unsigned int gm_buf_size;
+    int     acc_motion;         ///< accumulated motion field in extended_buf[0] of the pictures
+    int     syntax_maps;        ///< export the CU syntax planes, see MvDecoderSyntaxMap
+    int     coeff_features;     ///< TU coefficients in data[7], HEVC_COEFF_FEATURES_PARSE_ONLY skips the IDCT
     enum NALUnitType nal_unit_type;
     int temporal_id;  ///< temporal_id_plus1 - 1
     int nuh_layer_id;
@@ -1440,6 +1553,12 @@ int ff_hevc_output_frame(HEVCContext *s, AVFrame *frame, int flush);
 
 void ff_hevc_unref_frame(HEVCContext *s, HEVCFrame *frame, int flags);
 
+/**
+ * Release the MvDecoder feature planes (data[3] to data[7]) of a frame that
+ * stays in the DPB, once they have been output or will never be.
+ */
+void ff_hevc_unref_features(HEVCContext *s, HEVCFrame *frame);
+
 void ff_hevc_set_neighbour_available(HEVCContext *s, int x0, int y0,
                                      int nPbW, int nPbH);
 void ff_hevc_luma_mv_merge_mode(HEVCContext *s, int x0, int y0,
@@ -1449,6 +1568,11 @@ void ff_hevc_luma_mv_mvp_mode(HEVCContext *s, int x0, int y0,
                               int nPbW, int nPbH, int log2_cb_size,
                               int part_idx, int merge_idx,
                               MvField *mv, int mvp_lx_flag, int LX);
+/**
+ * Copy the motion of the luma rows [y0, y1) of the current picture to its
+ * 16x16 collocated field.
+ */
+void ff_hevc_store_col_mvf(HEVCContext *s, int y0, int y1);
 void ff_hevc_set_qPy(HEVCContext *s, int xBase, int yBase,
                      int log2_cb_size);
 void ff_hevc_deblocking_boundary_strengths(HEVCContext *s, int x0, int y0,
@@ -1466,10 +1590,12 @@ int ff_hevc_cu_chroma_qp_offset_flag(HEVCContext *s);
 int ff_hevc_cu_chroma_qp_offset_idx(HEVCContext *s);
 void ff_hevc_hls_filter(HEVCContext *s, int x, int y, int ctb_size);
 void ff_hevc_hls_filters(HEVCContext *s, int x_ctb, int y_ctb, int ctb_size);
-#if PARALLEL_FILTERS
-void ff_hevc_hls_filters_slice( HEVCContext *s, int x_ctb, int y_ctb, int ctb_size);
-void ff_hevc_hls_filter_slice(  HEVCContext *s, int x, int y, int ctb_size);
-#endif
+
+/**
+ * Extend the borders of the luma rows [y0, y1) of frame by s->ref_pad
+ * samples, and above and below the picture with its first and last rows.
+ */
+void ff_hevc_pad_ref(HEVCContext *s, AVFrame *frame, int y0, int y1);
 void ff_upsample_block(HEVCContext *s, HEVCFrame *ref0, int x0, int y0, int nPbW, int nPbH);
 void ff_hevc_hls_residual_coding(HEVCContext *s, int x0, int y0,
                                  int log2_trafo_size, enum ScanType scan_idx,
@@ -23,6 +23,7 @@
 
 #include "libavutil/attributes.h"
 #include "libavutil/common.h"
+#include "libavutil/intmath.h"
 
 #include "cabac_functions.h"
 #include "hevc.h"
@@ -407,6 +408,35 @@ static const uint8_t init_values[3][HEVC_CONTEXTS] = {
     },
 };
 
+/**
+ * significant_coeff_flag context increments of a 4x4 sub-block, in the scan
+ * order of the sub-block: [scan_idx][map][n], map being 0 for the 4x4 TUs,
+ * prev_sig + 1 for the larger ones and 4 with transform_skip_context.
+ */
+static const uint8_t sig_ctx_idx_map[3][5][16] = {
+    { // SCAN_DIAG
+        { 0, 2, 1, 6, 3, 4, 7, 6, 4, 5, 7, 8, 5, 8, 8, 8 },
+        { 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0 },
+        { 2, 1, 2, 0, 1, 2, 0, 0, 1, 2, 0, 0, 1, 0, 0, 0 },
+        { 2, 2, 1, 2, 1, 0, 2, 1, 0, 0, 1, 0, 0, 0, 0, 0 },
+        { 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2 },
+    },
+    { // SCAN_HORIZ
+        { 0, 1, 4, 5, 2, 3, 4, 5, 6, 6, 8, 8, 7, 7, 8, 8 },
+        { 1, 1, 1, 0, 1, 1, 0, 0, 1, 0, 0, 0, 0, 0, 0, 0 },
+        { 2, 2, 2, 2, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0, 0 },
+        { 2, 1, 0, 0, 2, 1, 0, 0, 2, 1, 0, 0, 2, 1, 0, 0 },
+        { 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2 },
+    },
+    { // SCAN_VERT
+        { 0, 2, 6, 7, 1, 3, 6, 7, 4, 4, 8, 8, 5, 5, 8, 8 },
+        { 1, 1, 1, 0, 1, 1, 0, 0, 1, 0, 0, 0, 0, 0, 0, 0 },
+        { 2, 1, 0, 0, 2, 1, 0, 0, 2, 1, 0, 0, 2, 1, 0, 0 },
+        { 2, 2, 2, 2, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0, 0 },
+        { 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2 },
+    },
+};
+
 static const uint8_t scan_1x1[1] = {
     0,
 };
@@ -656,6 +686,36 @@ void ff_hevc_cabac_init(HEVCContext *s, int ctb_addr_ts)
 
 #define GET_CABAC(ctx) get_cabac(&s->HEVClc->cc, &s->HEVClc->cabac_state[ctx])
 
+/**
+ * Decode n bypass bins, msb first. The lowest set bit of low marks the end
+ * of the buffered bits, so the bins that fit in them are decoded without
+ * the refill check of get_cabac_bypass().
+ */
+static av_always_inline int get_cabac_bypass_bins(CABACContext *c, int n)
+{
+    int range = c->range << (CABAC_BITS + 1);
+    int value = 0;
+
+    while (n > 0) {
+        int k = FFMIN(n, CABAC_BITS - 1 - ff_ctz(c->low));
+
+        n -= k;
+        while (k--) {
+            int mask;
+            c->low += c->low;
+            c->low -= range;
+            mask    = c->low >> 31;
+            c->low += range & mask;
+            value   = (value << 1) | (mask + 1);
+        }
+        if (n) {
+            value = (value << 1) | get_cabac_bypass(c);
+            n--;
+        }
+    }
+    return value;
+}
+
 int ff_hevc_sao_merge_flag_decode(HEVCContext *s)
 {
     return GET_CABAC(elem_offset[SAO_MERGE_FLAG]);
@@ -1112,34 +1172,17 @@ static av_always_inline int significant_coeff_group_flag_decode(HEVCContext *s,
 
     return GET_CABAC(elem_offset[SIGNIFICANT_COEFF_GROUP_FLAG] + inc);
 }
-static av_always_inline int significant_coeff_flag_decode(HEVCContext *s, int x_c, int y_c,
-                                           int offset, const uint8_t *ctx_idx_map)
-{
-    int inc = ctx_idx_map[(y_c << 2) + x_c] + offset;
-    return GET_CABAC(elem_offset[SIGNIFICANT_COEFF_FLAG] + inc);
-}
-
 static av_always_inline int significant_coeff_flag_decode_0(HEVCContext *s, int c_idx, int offset)
 {
     return GET_CABAC(elem_offset[SIGNIFICANT_COEFF_FLAG] + offset);
 }
 
-static av_always_inline int coeff_abs_level_greater1_flag_decode(HEVCContext *s, int c_idx, int inc)
-{
-
-    if (c_idx > 0)
-        inc += 16;
-
-    return GET_CABAC(elem_offset[COEFF_ABS_LEVEL_GREATER1_FLAG] + inc);
-}
-
 
 static av_always_inline int coeff_abs_level_remaining_decode_enc(HEVCContext *s, int rc_rice_param, int base)
 {
     int prefix = 0;
     int suffix = 0;
     int last_coeff_abs_level_remaining;
-    int i;
     unsigned int key;
     
     while (prefix < CABAC_MAX_BIN && get_cabac_bypass(&s->HEVClc->cc))
@@ -1147,8 +1190,7 @@ static av_always_inline int coeff_abs_level_remaining_decode_enc(HEVCContext *s,
     if (prefix == CABAC_MAX_BIN)
         av_log(s->avctx, AV_LOG_ERROR, "CABAC_MAX_BIN : %d\n", prefix);
     if (prefix < 3) {
-        for (i = 0; i < rc_rice_param; i++)
-            suffix = (suffix << 1) | get_cabac_bypass(&s->HEVClc->cc);
+        suffix = get_cabac_bypass_bins(&s->HEVClc->cc, rc_rice_param);
         unsigned int codeNumber=(prefix << (rc_rice_param)) + suffix;
         unsigned int res=suffix;
         if(rc_rice_param==1) {
@@ -1307,8 +1349,7 @@ static av_always_inline int coeff_abs_level_remaining_decode_enc(HEVCContext *s,
         last_coeff_abs_level_remaining = codeNumber;
     } else { // EG code does not change
         int prefix_minus3 = prefix - 3;
-        for (i = 0; i < prefix_minus3 + rc_rice_param; i++)
-            suffix = (suffix << 1) | get_cabac_bypass(&s->HEVClc->cc);
+        suffix = get_cabac_bypass_bins(&s->HEVClc->cc, prefix_minus3 + rc_rice_param);
         key = ff_get_key (&s->HEVClc->dbs_g, prefix_minus3 + rc_rice_param);
         s->prev_pos = suffix - (s->prev_pos^key);
         key = (s->prev_pos&((1<<(prefix_minus3 + rc_rice_param))-1));
@@ -1337,20 +1378,17 @@ static av_always_inline int coeff_abs_level_remaining_decode(HEVCContext *s, int
     int prefix = 0;
     int suffix = 0;
     int last_coeff_abs_level_remaining;
-    int i;
 
     while (prefix < CABAC_MAX_BIN && get_cabac_bypass(&s->HEVClc->cc))
         prefix++;
     if (prefix == CABAC_MAX_BIN)
         av_log(s->avctx, AV_LOG_ERROR, "CABAC_MAX_BIN : %d\n", prefix);
     if (prefix < 3) {
-        for (i = 0; i < rc_rice_param; i++)
-            suffix = (suffix << 1) | get_cabac_bypass(&s->HEVClc->cc);
+        suffix = get_cabac_bypass_bins(&s->HEVClc->cc, rc_rice_param);
         last_coeff_abs_level_remaining = (prefix << rc_rice_param) + suffix;
     } else {
         int prefix_minus3 = prefix - 3;
-        for (i = 0; i < prefix_minus3 + rc_rice_param; i++)
-            suffix = (suffix << 1) | get_cabac_bypass(&s->HEVClc->cc);
+        suffix = get_cabac_bypass_bins(&s->HEVClc->cc, prefix_minus3 + rc_rice_param);
         last_coeff_abs_level_remaining = (((1 << prefix_minus3) + 3 - 1)
                                               << rc_rice_param) + suffix;
     }
@@ -1359,11 +1397,8 @@ static av_always_inline int coeff_abs_level_remaining_decode(HEVCContext *s, int
 
 static av_always_inline int coeff_sign_flag_decode(HEVCContext *s, uint8_t nb)
 {
-    int i;
-    int ret = 0;
+    int ret = get_cabac_bypass_bins(&s->HEVClc->cc, nb);
 
-    for (i = 0; i < nb; i++)
-        ret = (ret << 1) | get_cabac_bypass(&s->HEVClc->cc);
     if(s->encrypt_params & HEVC_CRYPTO_TRANSF_COEFF_SIGNS)
       return ret^ff_get_key (&s->HEVClc->dbs_g, nb);
     return ret;
@@ -1412,20 +1447,37 @@ void ff_hevc_hls_residual_coding(HEVCContext *s, int x0, int y0,
     int16_t *coeffs = lc->tu.coeffs[c_idx > 0];
     uint8_t significant_coeff_group_flag[8][8] = {{0}};
     int explicit_rdpcm_flag = 0;
-    int explicit_rdpcm_dir_flag;
+    int explicit_rdpcm_dir_flag = 0;
 
     int trafo_size = 1 << log2_trafo_size;
     int i;
-    int qp,shift,add,scale,scale_m;
+    int qp = 0,shift,add,scale,scale_m;
     int log2_transform_range = 15; //FFMAX(15, s->sps->bit_depth + 6); // extended_precision_processing_flag ?  : 15
     const uint8_t level_scale[] = { 40, 45, 51, 57, 64, 72 };
     const uint8_t *scale_matrix = NULL;
     uint8_t dc_scale;
     int pred_mode_intra = (c_idx == 0) ? lc->tu.intra_pred_mode :
                                          lc->tu.intra_pred_mode_c;
+    HEVCCoeffTU *coeff_tu = NULL;
+    HEVCCoeff   *coeff_rec = NULL;
 
     memset(coeffs, 0, trafo_size * trafo_size * sizeof(int16_t));
 
+    if (s->coeff_features) {
+        // room for the record of a TU with all its coefficients set
+        uint8_t *buf = av_fast_realloc(lc->coeff_buf, &lc->coeff_buf_size,
+                                       lc->coeff_buf_len + sizeof(HEVCCoeffTU) +
+                                       trafo_size * trafo_size * sizeof(HEVCCoeff));
+        if (buf) {
+            lc->coeff_buf = buf;
+            coeff_tu      = (HEVCCoeffTU *)(buf + lc->coeff_buf_len);
+            coeff_rec     = (HEVCCoeff *)(coeff_tu + 1);
+        } else {
+            // the picture gets no records rather than a partial set
+            lc->coeff_buf_lost = 1;
+        }
+    }
+
     // Derive QP for dequant
     if (!lc->cu.cu_transquant_bypass_flag) {
         static const int qp_c[] = { 29, 30, 31, 32, 33, 33, 34, 34, 35, 35, 36, 36, 37, 37 };
@@ -1625,18 +1677,12 @@ void ff_hevc_hls_residual_coding(HEVCContext *s, int x0, int y0,
             prev_sig += (!!significant_coeff_group_flag[x_cg][y_cg + 1] << 1);
 
         if (significant_coeff_group_flag[x_cg][y_cg] && n_end >= 0) {
-            static const uint8_t ctx_idx_map[] = {
-                0, 1, 4, 5, 2, 3, 4, 5, 6, 6, 8, 8, 7, 7, 8, 8, // log2_trafo_size == 2
-                1, 1, 1, 0, 1, 1, 0, 0, 1, 0, 0, 0, 0, 0, 0, 0, // prev_sig == 0
-                2, 2, 2, 2, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0, 0, // prev_sig == 1
-                2, 1, 0, 0, 2, 1, 0, 0, 2, 1, 0, 0, 2, 1, 0, 0, // prev_sig == 2
-                2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2  // default
-            };
             const uint8_t *ctx_idx_map_p;
+            uint8_t *sig_state;
             int scf_offset = 0;
             if (s->sps->spsRext.transform_skip_context_enabled_flag &&
                 (transform_skip_flag || lc->cu.cu_transquant_bypass_flag)) {
-                ctx_idx_map_p = (uint8_t*) &ctx_idx_map[4 * 16];
+                ctx_idx_map_p = sig_ctx_idx_map[scan_idx][4];
                 if (c_idx == 0) {
                     scf_offset = 40;
                 } else {
@@ -1646,9 +1692,9 @@ void ff_hevc_hls_residual_coding(HEVCContext *s, int x0, int y0,
                 if (c_idx != 0)
                     scf_offset = 27;
                 if (log2_trafo_size == 2) {
-                    ctx_idx_map_p = (uint8_t*) &ctx_idx_map[0];
+                    ctx_idx_map_p = sig_ctx_idx_map[scan_idx][0];
                 } else {
-                    ctx_idx_map_p = (uint8_t*) &ctx_idx_map[(prev_sig + 1) << 4];
+                    ctx_idx_map_p = sig_ctx_idx_map[scan_idx][prev_sig + 1];
                     if (c_idx == 0) {
                         if ((x_cg > 0 || y_cg > 0))
                             scf_offset += 3;
@@ -1665,10 +1711,9 @@ void ff_hevc_hls_residual_coding(HEVCContext *s, int x0, int y0,
                     }
                 }
             }
+            sig_state = lc->cabac_state + elem_offset[SIGNIFICANT_COEFF_FLAG] + scf_offset;
             for (n = n_end; n > 0; n--) {
-                x_c = scan_x_off[n];
-                y_c = scan_y_off[n];
-                if (significant_coeff_flag_decode(s, x_c, y_c, scf_offset, ctx_idx_map_p)) {
+                if (get_cabac_inline(&lc->cc, &sig_state[ctx_idx_map_p[n]])) {
                     significant_coeff_flag_idx[nb_significant_coeff_flag] = n;
                     nb_significant_coeff_flag++;
                     implicit_non_zero_coeff = 0;
@@ -1711,6 +1756,7 @@ void ff_hevc_hls_residual_coding(HEVCContext *s, int x0, int y0,
             int c_rice_param = 0;
             int first_greater1_coeff_idx = -1;
             uint8_t coeff_abs_level_greater1_flag[8];
+            uint8_t *gt1_state;
             uint16_t coeff_sign_flag;
             int sum_abs = 0;
             int sign_hidden;
@@ -1733,10 +1779,11 @@ void ff_hevc_hls_residual_coding(HEVCContext *s, int x0, int y0,
             greater1_ctx = 1;
             last_nz_pos_in_cg = significant_coeff_flag_idx[0];
 
+            gt1_state = lc->cabac_state + elem_offset[COEFF_ABS_LEVEL_GREATER1_FLAG] +
+                        (ctx_set << 2) + (c_idx > 0 ? 16 : 0);
             for (m = 0; m < (n_end > 8 ? 8 : n_end); m++) {
-                int inc = (ctx_set << 2) + greater1_ctx;
                 coeff_abs_level_greater1_flag[m] =
-                    coeff_abs_level_greater1_flag_decode(s, c_idx, inc);
+                    get_cabac_inline(&lc->cc, &gt1_state[greater1_ctx]);
                 if (coeff_abs_level_greater1_flag[m]) {
                     greater1_ctx = 0;
                     if (first_greater1_coeff_idx == -1)
@@ -1843,6 +1890,11 @@ void ff_hevc_hls_residual_coding(HEVCContext *s, int x0, int y0,
                     }
                 }
                 coeffs[y_c * trafo_size + x_c] = trans_coeff_level;
+                if (coeff_rec) {
+                    coeff_rec->pos   = y_c * trafo_size + x_c;
+                    coeff_rec->level = trans_coeff_level;
+                    coeff_rec++;
+                }
             }
         }
 #if COM16_C806_EMT
@@ -1869,6 +1921,22 @@ void ff_hevc_hls_residual_coding(HEVCContext *s, int x0, int y0,
         }
     #endif
 
+    if (coeff_tu) {
+        coeff_tu->x         = x0 >> hshift;
+        coeff_tu->y         = y0 >> vshift;
+        coeff_tu->log2_size = log2_trafo_size;
+        coeff_tu->c_idx     = c_idx;
+        coeff_tu->qp        = lc->cu.cu_transquant_bypass_flag ? 0 : qp;
+        coeff_tu->flags     = (transform_skip_flag ? HEVC_COEFF_TU_TRANSFORM_SKIP : 0) |
+                              (lc->cu.cu_transquant_bypass_flag ? HEVC_COEFF_TU_BYPASS : 0) |
+                              (lc->cu.pred_mode == MODE_INTRA ? HEVC_COEFF_TU_INTRA : 0);
+        coeff_tu->nb_coeffs = coeff_rec - (HEVCCoeff *)(coeff_tu + 1);
+        lc->coeff_buf_len   = (uint8_t *)coeff_rec - lc->coeff_buf;
+    }
+    // parse only, neither the pixels nor the residual planes are reconstructed
+    if (s->coeff_features == HEVC_COEFF_FEATURES_PARSE_ONLY || s->analysis)
+        return;
+
     if (lc->cu.cu_transquant_bypass_flag) {
         if (explicit_rdpcm_flag || (s->sps->spsRext.implicit_rdpcm_enabled_flag &&
                                     (pred_mode_intra == 10 || pred_mode_intra == 26))) {
@@ -148,8 +148,8 @@ static int get_qPy(HEVCContext *s, int xC, int yC)
     return s->qp_y_tab[x + y * s->sps->min_cb_width];
 }
 
-static void copy_CTB(uint8_t *dst, uint8_t *src,
-                     int width, int height, int stride_dst, int stride_src)
+static void copy_CTB(uint8_t *dst, const uint8_t *src,
+                     int width, int height, ptrdiff_t stride_dst, ptrdiff_t stride_src)
 {
     int i;
 
@@ -160,13 +160,66 @@ static void copy_CTB(uint8_t *dst, uint8_t *src,
     }
 }
 
-static void restore_tqb_pixels(HEVCContext *s, int x0, int y0, int width, int height, int c_idx)
+static void copy_pixel(uint8_t *dst, const uint8_t *src, int pixel_shift)
+{
+    if (pixel_shift)
+        *(uint16_t *)dst = *(const uint16_t *)src;
+    else
+        *dst = *src;
+}
+
+static void copy_vert(uint8_t *dst, const uint8_t *src,
+                      int pixel_shift, int height,
+                      ptrdiff_t stride_dst, ptrdiff_t stride_src)
+{
+    int i;
+
+    if (pixel_shift == 0) {
+        for (i = 0; i < height; i++) {
+            *dst = *src;
+            dst += stride_dst;
+            src += stride_src;
+        }
+    } else {
+        for (i = 0; i < height; i++) {
+            *(uint16_t *)dst = *(const uint16_t *)src;
+            dst += stride_dst;
+            src += stride_src;
+        }
+    }
+}
+
+/* save the unfiltered first and last row and column of a CTB before it is
+ * filtered in place, for the edge offset of its neighbours */
+static void copy_CTB_to_hv(HEVCContext *s, const uint8_t *src,
+                           ptrdiff_t stride_src, int x, int y, int width, int height,
+                           int c_idx, int x_ctb, int y_ctb)
+{
+    int sh = s->sps->pixel_shift;
+    int w  = s->sps->width  >> s->sps->hshift[c_idx];
+    int h  = s->sps->height >> s->sps->vshift[c_idx];
+
+    memcpy(s->sao_pixel_buffer_h[c_idx] + (((2 * y_ctb) * w + x) << sh),
+           src, width << sh);
+    memcpy(s->sao_pixel_buffer_h[c_idx] + (((2 * y_ctb + 1) * w + x) << sh),
+           src + stride_src * (height - 1), width << sh);
+
+    copy_vert(s->sao_pixel_buffer_v[c_idx] + (((2 * x_ctb) * h + y) << sh), src,
+              sh, height, 1 << sh, stride_src);
+    copy_vert(s->sao_pixel_buffer_v[c_idx] + (((2 * x_ctb + 1) * h + y) << sh), src + ((width - 1) << sh),
+              sh, height, 1 << sh, stride_src);
+}
+
+/* put back the unfiltered samples of the PCM and transquant bypass blocks of
+ * a CTB, src1 is the filtered CTB and dst1 its unfiltered copy */
+static void restore_tqb_pixels(HEVCContext *s,
+                               uint8_t *src1, const uint8_t *dst1,
+                               ptrdiff_t stride_src, ptrdiff_t stride_dst,
+                               int x0, int y0, int width, int height, int c_idx)
 {
     if ( s->pps->transquant_bypass_enable_flag ||
             (s->sps->pcm.loop_filter_disable_flag && s->sps->pcm_enabled_flag)) {
         int x, y;
-        ptrdiff_t stride_dst = s->sao_frame->linesize[c_idx];
-        ptrdiff_t stride_src = s->frame->linesize[c_idx];
         int min_pu_size  = 1 << s->sps->log2_min_pu_size;
         int hshift       = s->sps->hshift[c_idx];
         int vshift       = s->sps->vshift[c_idx];
@@ -179,8 +232,8 @@ static void restore_tqb_pixels(HEVCContext *s, int x0, int y0, int width, int he
             for (x = x_min; x < x_max; x++) {
                 if (s->is_pcm[y * s->sps->min_pu_width + x]) {
                     int n;
-                    uint8_t *src = &s->frame->data[c_idx][    ((y << s->sps->log2_min_pu_size) >> vshift) * stride_src + (((x << s->sps->log2_min_pu_size) >> hshift) << s->sps->pixel_shift)];
-                    uint8_t *dst = &s->sao_frame->data[c_idx][((y << s->sps->log2_min_pu_size) >> vshift) * stride_dst + (((x << s->sps->log2_min_pu_size) >> hshift) << s->sps->pixel_shift)];
+                    uint8_t *src       = src1 + (((y << s->sps->log2_min_pu_size) - y0) >> vshift) * stride_src + ((((x << s->sps->log2_min_pu_size) - x0) >> hshift) << s->sps->pixel_shift);
+                    const uint8_t *dst = dst1 + (((y << s->sps->log2_min_pu_size) - y0) >> vshift) * stride_dst + ((((x << s->sps->log2_min_pu_size) - x0) >> hshift) << s->sps->pixel_shift);
                     for (n = 0; n < (min_pu_size >> vshift); n++) {
                         memcpy(src, dst, len);
                         src += stride_src;
@@ -253,58 +306,118 @@ static void sao_filter_CTB(HEVCContext *s, int x, int y)
     }
 
     for (c_idx = 0; c_idx < (s->sps->chroma_array_type ? 3 : 1); c_idx++) {
-        int x0       = x >> s->sps->hshift[c_idx];
-        int y0       = y >> s->sps->vshift[c_idx];
-        int stride_src = s->frame->linesize[c_idx];
-        int stride_dst = s->sao_frame->linesize[c_idx];
+        int x0         = x >> s->sps->hshift[c_idx];
+        int y0         = y >> s->sps->vshift[c_idx];
+        int sh         = s->sps->pixel_shift;
+        ptrdiff_t stride_src = s->frame->linesize[c_idx];
+        ptrdiff_t stride_dst = SAO_BUFFER_STRIDE;
         int ctb_size_h = (1 << (s->sps->log2_ctb_size)) >> s->sps->hshift[c_idx];
         int ctb_size_v = (1 << (s->sps->log2_ctb_size)) >> s->sps->vshift[c_idx];
-        int width    = FFMIN(ctb_size_h, (s->sps->width  >> s->sps->hshift[c_idx]) - x0);
-        int height   = FFMIN(ctb_size_v, (s->sps->height >> s->sps->vshift[c_idx]) - y0);
-        uint8_t *src = &s->frame->data[c_idx][y0 * stride_src + (x0 << s->sps->pixel_shift)];
-        uint8_t *dst = &s->sao_frame->data[c_idx][y0 * stride_dst + (x0 << s->sps->pixel_shift)];
+        int width      = FFMIN(ctb_size_h, (s->sps->width  >> s->sps->hshift[c_idx]) - x0);
+        int height     = FFMIN(ctb_size_v, (s->sps->height >> s->sps->vshift[c_idx]) - y0);
+        uint8_t *src   = &s->frame->data[c_idx][y0 * stride_src + (x0 << sh)];
+        // unfiltered copy of the CTB, with room for a one sample border
+        uint8_t *dst   = s->HEVClc->sao_buffer + stride_dst + FF_INPUT_BUFFER_PADDING_SIZE;
 
         switch (sao->type_idx[c_idx]) {
         case SAO_BAND:
-            copy_CTB(dst, src, width << s->sps->pixel_shift, height, stride_dst, stride_src);
-            s->hevcdsp.sao_band_filter(src, dst,
-                                       stride_src, stride_dst,
-                                       sao,
-                                       edges, width,
-                                       height, c_idx);
-            restore_tqb_pixels(s, x, y, width, height, c_idx);
+            copy_CTB_to_hv(s, src, stride_src, x0, y0, width, height, c_idx, x_ctb, y_ctb);
+            if (s->pps->transquant_bypass_enable_flag ||
+                (s->sps->pcm.loop_filter_disable_flag && s->sps->pcm_enabled_flag)) {
+                copy_CTB(dst, src, width << sh, height, stride_dst, stride_src);
+                s->hevcdsp.sao_band_filter(src, dst,
+                                           stride_src, stride_dst,
+                                           sao,
+                                           edges, width,
+                                           height, c_idx);
+                restore_tqb_pixels(s, src, dst, stride_src, stride_dst,
+                                   x, y, width, height, c_idx);
+            } else {
+                // the band offset only reads the sample it writes
+                s->hevcdsp.sao_band_filter(src, src,
+                                           stride_src, stride_src,
+                                           sao,
+                                           edges, width,
+                                           height, c_idx);
+            }
             sao->type_idx[c_idx] = SAO_APPLIED;
             break;
         case SAO_EDGE:
         {
-            uint8_t left_pixels = !edges[0] && (CTB(s->sao, x_ctb-1, y_ctb).type_idx[c_idx] != SAO_APPLIED);
+            int w = s->sps->width  >> s->sps->hshift[c_idx];
+            int h = s->sps->height >> s->sps->vshift[c_idx];
+            int left_pixels, right_pixels;
+
+            /* the border samples of a neighbour already filtered in place
+             * come from the line buffers, the others from the frame */
             if (!edges[1]) {
-                uint8_t top_left  = !edges[0] && (CTB(s->sao, x_ctb-1, y_ctb-1).type_idx[c_idx] != SAO_APPLIED);
-                uint8_t top_right = !edges[2] && (CTB(s->sao, x_ctb+1, y_ctb-1).type_idx[c_idx] != SAO_APPLIED);
-                if (CTB(s->sao, x_ctb  , y_ctb-1).type_idx[c_idx] == 0)
-                    memcpy( dst - stride_dst - (top_left << s->sps->pixel_shift),
-                            src - stride_src - (top_left << s->sps->pixel_shift),
-                            (top_left + width + top_right) << s->sps->pixel_shift);
-                else {
-                    if (top_left)
-                        memcpy( dst - stride_dst - (1 << s->sps->pixel_shift),
-                                src - stride_src - (1 << s->sps->pixel_shift),
-                                1 << s->sps->pixel_shift);
-                    if(top_right)
-                        memcpy( dst - stride_dst + (width << s->sps->pixel_shift),
-                                src - stride_src + (width << s->sps->pixel_shift),
-                                1 << s->sps->pixel_shift);
+                int left  = 1 - edges[0];
+                int right = 1 - edges[2];
+                const uint8_t *src1[2];
+                uint8_t *dst1 = dst - stride_dst - (left << sh);
+                int src_idx, pos = 0;
+
+                src1[0] = src - stride_src - (left << sh);
+                src1[1] = s->sao_pixel_buffer_h[c_idx] + (((2 * y_ctb - 1) * w + x0 - left) << sh);
+                if (left) {
+                    src_idx = CTB(s->sao, x_ctb - 1, y_ctb - 1).type_idx[c_idx] == SAO_APPLIED;
+                    copy_pixel(dst1, src1[src_idx], sh);
+                    pos += 1 << sh;
+                }
+                src_idx = CTB(s->sao, x_ctb, y_ctb - 1).type_idx[c_idx] == SAO_APPLIED;
+                memcpy(dst1 + pos, src1[src_idx] + pos, width << sh);
+                if (right) {
+                    pos += width << sh;
+                    src_idx = CTB(s->sao, x_ctb + 1, y_ctb - 1).type_idx[c_idx] == SAO_APPLIED;
+                    copy_pixel(dst1 + pos, src1[src_idx] + pos, sh);
                 }
             }
-            if (!edges[3]) {                                                                // bottom and bottom right
-                uint8_t bottom_left = !edges[0] && (CTB(s->sao, x_ctb-1, y_ctb+1).type_idx[c_idx] != SAO_APPLIED);
-                memcpy( dst + height * stride_dst - (bottom_left << s->sps->pixel_shift),
-                        src + height * stride_src - (bottom_left << s->sps->pixel_shift),
-                        (width + 1 + bottom_left) << s->sps->pixel_shift);
+            if (!edges[3]) {
+                int left  = 1 - edges[0];
+                int right = 1 - edges[2];
+                const uint8_t *src1[2];
+                uint8_t *dst1 = dst + height * stride_dst - (left << sh);
+                int src_idx, pos = 0;
+
+                src1[0] = src + height * stride_src - (left << sh);
+                src1[1] = s->sao_pixel_buffer_h[c_idx] + (((2 * y_ctb + 2) * w + x0 - left) << sh);
+                if (left) {
+                    src_idx = CTB(s->sao, x_ctb - 1, y_ctb + 1).type_idx[c_idx] == SAO_APPLIED;
+                    copy_pixel(dst1, src1[src_idx], sh);
+                    pos += 1 << sh;
+                }
+                src_idx = CTB(s->sao, x_ctb, y_ctb + 1).type_idx[c_idx] == SAO_APPLIED;
+                memcpy(dst1 + pos, src1[src_idx] + pos, width << sh);
+                if (right) {
+                    pos += width << sh;
+                    src_idx = CTB(s->sao, x_ctb + 1, y_ctb + 1).type_idx[c_idx] == SAO_APPLIED;
+                    copy_pixel(dst1 + pos, src1[src_idx] + pos, sh);
+                }
+            }
+            left_pixels = 0;
+            if (!edges[0]) {
+                if (CTB(s->sao, x_ctb - 1, y_ctb).type_idx[c_idx] == SAO_APPLIED)
+                    copy_vert(dst - (1 << sh),
+                              s->sao_pixel_buffer_v[c_idx] + (((2 * x_ctb - 1) * h + y0) << sh),
+                              sh, height, stride_dst, 1 << sh);
+                else
+                    left_pixels = 1;
+            }
+            right_pixels = 0;
+            if (!edges[2]) {
+                if (CTB(s->sao, x_ctb + 1, y_ctb).type_idx[c_idx] == SAO_APPLIED)
+                    copy_vert(dst + (width << sh),
+                              s->sao_pixel_buffer_v[c_idx] + (((2 * x_ctb + 2) * h + y0) << sh),
+                              sh, height, stride_dst, 1 << sh);
+                else
+                    right_pixels = 1;
             }
-            copy_CTB(dst - (left_pixels << s->sps->pixel_shift),
-                     src - (left_pixels << s->sps->pixel_shift),
-                     (width + 1 + left_pixels) << s->sps->pixel_shift, height, stride_dst, stride_src);
+
+            copy_CTB(dst - (left_pixels << sh),
+                     src - (left_pixels << sh),
+                     (width + left_pixels + right_pixels) << sh,
+                     height, stride_dst, stride_src);
+            copy_CTB_to_hv(s, src, stride_src, x0, y0, width, height, c_idx, x_ctb, y_ctb);
             s->hevcdsp.sao_edge_filter[restore](src, dst,
                                                 stride_src, stride_dst,
                                                 sao,
@@ -313,7 +426,8 @@ static void sao_filter_CTB(HEVCContext *s, int x, int y)
                                                 vert_edge,
                                                 horiz_edge,
                                                 diag_edge);
-            restore_tqb_pixels(s, x, y, width, height, c_idx);
+            restore_tqb_pixels(s, src, dst, stride_src, stride_dst,
+                               x, y, width, height, c_idx);
             sao->type_idx[c_idx] = SAO_APPLIED;
             break;
         }
@@ -580,132 +694,15 @@ static void deblocking_filter_CTB(HEVCContext *s, int x0, int y0)
     }
 }
 
-#ifdef TEST_MV_POC
-static int boundary_strength(HEVCContext *s, MvField *curr, MvField *neigh)
-{
-#if HAVE_SSE42
-    {
-        __m128i x0, x1, x2, x3;
-        x0 = _mm_loadu_si128((__m128i *) neigh);
-        x1 = _mm_loadu_si128((__m128i *) curr);
-        x2 = _mm_loadl_epi64((__m128i *) &(neigh->pred_flag));
-        x3 = _mm_loadl_epi64((__m128i *) &(curr->pred_flag));
-        x0 = _mm_cmpeq_epi64 (x0, x1);
-        x2 = _mm_cmpeq_epi32 (x2, x3);
-
-        if (_mm_test_all_ones(x0) && _mm_test_all_ones(x2))
-            return 0;
-    }
-#else
-    if ( memcmp(curr, neigh, sizeof(MvField)) == 0)
-        return 0;
-#endif
-    if (curr->pred_flag == PF_BI &&  neigh->pred_flag == PF_BI) {
-        // same L0 and L1
-        if (curr->poc[0] == neigh->poc[0]  &&
-            curr->poc[0] == curr->poc[1] &&
-            neigh->poc[0] == neigh->poc[1]) {
-#if HAVE_SSE42
-            __m128i x0, x1, x2;
-            x0 = _mm_loadl_epi64((__m128i *) neigh);
-            x1 = _mm_loadl_epi64((__m128i *) curr);
-            x2 =  _mm_shufflelo_epi16(x0, 0x4E);
-            x0 = _mm_sub_epi16(x0, x1);
-            x2 = _mm_sub_epi16(x2, x1);
-            x1 = _mm_set1_epi16(4);
-            x0 = _mm_abs_epi16(x0);
-            x2 = _mm_abs_epi16(x2);
-            x0 = _mm_cmplt_epi16(x0, x1);
-            x2 = _mm_cmplt_epi16(x2, x1);
-            return !(_mm_test_all_ones(x0) || _mm_test_all_ones(x2));
-#else
-            if ((FFABS(neigh->mv[0].x - curr->mv[0].x) >= 4 || FFABS(neigh->mv[0].y - curr->mv[0].y) >= 4 ||
-                 FFABS(neigh->mv[1].x - curr->mv[1].x) >= 4 || FFABS(neigh->mv[1].y - curr->mv[1].y) >= 4) &&
-                (FFABS(neigh->mv[1].x - curr->mv[0].x) >= 4 || FFABS(neigh->mv[1].y - curr->mv[0].y) >= 4 ||
-                 FFABS(neigh->mv[0].x - curr->mv[1].x) >= 4 || FFABS(neigh->mv[0].y - curr->mv[1].y) >= 4))
-                return 1;
-            else
-                return 0;
-#endif
-        } else if (neigh->poc[0] == curr->poc[0] &&
-                   neigh->poc[1] == curr->poc[1]) {
-#if HAVE_SSE42
-            __m128i x0, x1;
-            x0 = _mm_loadl_epi64((__m128i *) neigh);
-            x1 = _mm_loadl_epi64((__m128i *) curr);
-            x0 = _mm_sub_epi16(x0, x1);
-            x1 = _mm_set1_epi16(4);
-            x0 = _mm_abs_epi16(x0);
-            x0 = _mm_cmplt_epi16(x0, x1);
-            return !(_mm_test_all_ones(x0));
-#else
-            if (FFABS(neigh->mv[0].x - curr->mv[0].x) >= 4 || FFABS(neigh->mv[0].y - curr->mv[0].y) >= 4 ||
-                FFABS(neigh->mv[1].x - curr->mv[1].x) >= 4 || FFABS(neigh->mv[1].y - curr->mv[1].y) >= 4)
-                return 1;
-            else
-                return 0;
-#endif
-        } else if (neigh->poc[1] == curr->poc[0] &&
-                   neigh->poc[0] == curr->poc[1]) {
-#if HAVE_SSE42
-            __m128i x0, x1, x2;
-            x0 = _mm_loadl_epi64((__m128i *) neigh);
-            x1 = _mm_loadl_epi64((__m128i *) curr);
-            x2 = _mm_shufflelo_epi16(x0, 0x4E);
-            x2 = _mm_sub_epi16(x2, x1);
-            x1 = _mm_set1_epi16(4);
-            x2 = _mm_abs_epi16(x2);
-            x2 = _mm_cmplt_epi16(x2, x1);
-            return !(_mm_test_all_ones(x2));
-#else
-            if (FFABS(neigh->mv[1].x - curr->mv[0].x) >= 4 || FFABS(neigh->mv[1].y - curr->mv[0].y) >= 4 ||
-                FFABS(neigh->mv[0].x - curr->mv[1].x) >= 4 || FFABS(neigh->mv[0].y - curr->mv[1].y) >= 4)
-                return 1;
-            else
-                return 0;
-#endif
-        } else {
-            return 1;
-        }
-    } else if ((curr->pred_flag != PF_BI) && (neigh->pred_flag != PF_BI)){ // 1 MV
-        Mv A, B;
-        int ref_A, ref_B;
-
-        if (curr->pred_flag & 1) {
-            A     = curr->mv[0];
-            ref_A = curr->poc[0];
-        } else {
-            A     = curr->mv[1];
-            ref_A = curr->poc[1];
-        }
-
-        if (neigh->pred_flag & 1) {
-            B     = neigh->mv[0];
-            ref_B = neigh->poc[0];
-        } else {
-            B     = neigh->mv[1];
-            ref_B = neigh->poc[1];
-        }
-
-        if (ref_A == ref_B) {
-            if (FFABS(A.x - B.x) >= 4 || FFABS(A.y - B.y) >= 4)
-                return 1;
-            else
-                return 0;
-        } else
-            return 1;
-    }
-
-    return 1;
-}
-#else
 static int boundary_strength(HEVCContext *s, MvField *curr, MvField *neigh,
                              RefPicList *neigh_refPicList)
 {
+    RefPicList *refPicList = s->ref->refPicList[s->slice_idx];
+
     if (curr->pred_flag == PF_BI &&  neigh->pred_flag == PF_BI) {
         // same L0 and L1
-        if (s->ref->refPicList[0].list[curr->ref_idx[0]] == neigh_refPicList[0].list[neigh->ref_idx[0]]  &&
-            s->ref->refPicList[0].list[curr->ref_idx[0]] == s->ref->refPicList[1].list[curr->ref_idx[1]] &&
+        if (refPicList[0].list[curr->ref_idx[0]] == neigh_refPicList[0].list[neigh->ref_idx[0]]  &&
+            refPicList[0].list[curr->ref_idx[0]] == refPicList[1].list[curr->ref_idx[1]] &&
             neigh_refPicList[0].list[neigh->ref_idx[0]] == neigh_refPicList[1].list[neigh->ref_idx[1]]) {
 #if HAVE_SSE42
             __m128i x0, x1, x2;
@@ -729,8 +726,8 @@ static int boundary_strength(HEVCContext *s, MvField *curr, MvField *neigh,
             else
                 return 0;
 #endif
-        } else if (neigh_refPicList[0].list[neigh->ref_idx[0]] == s->ref->refPicList[0].list[curr->ref_idx[0]] &&
-                   neigh_refPicList[1].list[neigh->ref_idx[1]] == s->ref->refPicList[1].list[curr->ref_idx[1]]) {
+        } else if (neigh_refPicList[0].list[neigh->ref_idx[0]] == refPicList[0].list[curr->ref_idx[0]] &&
+                   neigh_refPicList[1].list[neigh->ref_idx[1]] == refPicList[1].list[curr->ref_idx[1]]) {
 #if HAVE_SSE42
             __m128i x0, x1;
             x0 = _mm_loadl_epi64((__m128i *) neigh);
@@ -747,8 +744,8 @@ static int boundary_strength(HEVCContext *s, MvField *curr, MvField *neigh,
             else
                 return 0;
 #endif
-        } else if (neigh_refPicList[1].list[neigh->ref_idx[1]] == s->ref->refPicList[0].list[curr->ref_idx[0]] &&
-                   neigh_refPicList[0].list[neigh->ref_idx[0]] == s->ref->refPicList[1].list[curr->ref_idx[1]]) {
+        } else if (neigh_refPicList[1].list[neigh->ref_idx[1]] == refPicList[0].list[curr->ref_idx[0]] &&
+                   neigh_refPicList[0].list[neigh->ref_idx[0]] == refPicList[1].list[curr->ref_idx[1]]) {
 #if HAVE_SSE42
             __m128i x0, x1, x2;
             x0 = _mm_loadl_epi64((__m128i *) neigh);
@@ -775,10 +772,10 @@ static int boundary_strength(HEVCContext *s, MvField *curr, MvField *neigh,
 
         if (curr->pred_flag & 1) {
             A     = curr->mv[0];
-            ref_A = s->ref->refPicList[0].list[curr->ref_idx[0]];
+            ref_A = refPicList[0].list[curr->ref_idx[0]];
         } else {
             A     = curr->mv[1];
-            ref_A = s->ref->refPicList[1].list[curr->ref_idx[1]];
+            ref_A = refPicList[1].list[curr->ref_idx[1]];
         }
 
         if (neigh->pred_flag & 1) {
@@ -800,7 +797,6 @@ static int boundary_strength(HEVCContext *s, MvField *curr, MvField *neigh,
 
     return 1;
 }
-#endif
 
 void ff_hevc_deblocking_boundary_strengths(HEVCContext *s, int x0, int y0,
                                            int log2_trafo_size)
@@ -826,10 +822,8 @@ void ff_hevc_deblocking_boundary_strengths(HEVCContext *s, int x0, int y0,
             int yq_pu =  y0      >> log2_min_pu_size;
             int yp_tu = (y0 - 1) >> log2_min_tu_size;
             int yq_tu =  y0      >> log2_min_tu_size;
-#ifndef TEST_MV_POC
             RefPicList *top_refPicList = ff_hevc_get_ref_list(s, s->ref,
                                                               x0, y0 - 1);
-#endif
             for (i = 0; i < (1 << log2_trafo_size); i += 4) {
                 int x_pu = (x0 + i) >> log2_min_pu_size;
                 int x_tu = (x0 + i) >> log2_min_tu_size;
@@ -843,11 +837,7 @@ void ff_hevc_deblocking_boundary_strengths(HEVCContext *s, int x0, int y0,
                 else if (curr_cbf_luma || top_cbf_luma)
                     bs = 1;
                 else
-#ifdef TEST_MV_POC
-                    bs = boundary_strength(s, curr, top);
-#else
                     bs = boundary_strength(s, curr, top, top_refPicList);
-#endif
                 s->horizontal_bs[((x0 + i) + y0 * s->bs_width) >> 2] = bs;
             }
         }
@@ -865,10 +855,8 @@ void ff_hevc_deblocking_boundary_strengths(HEVCContext *s, int x0, int y0,
             int xq_pu =  x0      >> log2_min_pu_size;
             int xp_tu = (x0 - 1) >> log2_min_tu_size;
             int xq_tu =  x0      >> log2_min_tu_size;
-#ifndef TEST_MV_POC
             RefPicList *left_refPicList = ff_hevc_get_ref_list(s, s->ref,
                                                                x0 - 1, y0);
-#endif
             for (i = 0; i < (1 << log2_trafo_size); i += 4) {
                 int y_pu      = (y0 + i) >> log2_min_pu_size;
                 int y_tu      = (y0 + i) >> log2_min_tu_size;
@@ -882,22 +870,16 @@ void ff_hevc_deblocking_boundary_strengths(HEVCContext *s, int x0, int y0,
                 else if (curr_cbf_luma || left_cbf_luma)
                     bs = 1;
                 else
-#ifdef TEST_MV_POC
-                    bs = boundary_strength(s, curr, left);
-#else
                     bs = boundary_strength(s, curr, left, left_refPicList);
-#endif
                 s->vertical_bs[(x0 + (y0 + i) * s->bs_width) >> 2] = bs;
             }
         }
     }
 
     if (log2_trafo_size > log2_min_pu_size && !is_intra) {
-#ifndef TEST_MV_POC
         RefPicList *refPicList = ff_hevc_get_ref_list(s, s->ref,
                                                            x0,
                                                            y0);
-#endif
         // bs for TU internal horizontal PU boundaries
         for (i = 0; i < (1 << log2_trafo_size); i += 4) {
             int x_pu  = (x0 + i) >> log2_min_pu_size;
@@ -908,11 +890,7 @@ void ff_hevc_deblocking_boundary_strengths(HEVCContext *s, int x0, int y0,
                 int yq_pu = (y0 + j)     >> log2_min_pu_size;
                 MvField *curr = &tab_mvf[yq_pu * min_pu_width + x_pu];
 
-#ifdef TEST_MV_POC
-                bs = boundary_strength(s, curr, top);
-#else
                 bs = boundary_strength(s, curr, top, refPicList);
-#endif
                 s->horizontal_bs[((x0 + i) + (y0 + j) * s->bs_width) >> 2] = bs;
                 top = curr;
             }
@@ -928,11 +906,7 @@ void ff_hevc_deblocking_boundary_strengths(HEVCContext *s, int x0, int y0,
                 int xq_pu = (x0 + i)     >> log2_min_pu_size;
                 MvField *curr = &tab_mvf[y_pu * min_pu_width + xq_pu];
 
-#ifdef TEST_MV_POC
-                bs = boundary_strength(s, curr, left);
-#else
                 bs = boundary_strength(s, curr, left, refPicList);
-#endif
                 s->vertical_bs[((x0 + i) + (y0 + j) * s->bs_width) >> 2] = bs;
                 left = curr;
             }
@@ -959,19 +933,13 @@ void ff_hevc_deblocking_boundary_strengths_h(HEVCContext *s, int x0, int y0, int
         MvField *curr = &tab_mvf[yq_pu * pic_width_in_min_pu + x_pu];
         uint8_t top_cbf_luma  = s->cbf_luma[yp_tu * pic_width_in_min_tu + x_tu];
         uint8_t curr_cbf_luma = s->cbf_luma[yq_tu * pic_width_in_min_tu + x_tu];
-#ifndef TEST_MV_POC
         RefPicList* top_refPicList = ff_hevc_get_ref_list(s, s->ref, x0, y0 - 1);
-#endif
         if (curr->pred_flag == PF_INTRA || top->pred_flag == PF_INTRA)
             bs = 2;
         else if (curr_cbf_luma || top_cbf_luma)
             bs = 1;
         else
-#ifdef TEST_MV_POC
-                bs = boundary_strength(s, curr, top);
-#else
                 bs = boundary_strength(s, curr, top, top_refPicList);
-#endif
         if ((slice_up_boundary & 1) && (y0 % (1 << s->sps->log2_ctb_size)) == 0)
             bs = 0;
         if (s->sh.disable_deblocking_filter_flag == 1)
@@ -1000,19 +968,13 @@ void ff_hevc_deblocking_boundary_strengths_v(HEVCContext *s, int x0, int y0, int
         MvField *curr = &tab_mvf[y_pu * pic_width_in_min_pu + xq_pu];
         uint8_t left_cbf_luma = s->cbf_luma[y_tu * pic_width_in_min_tu + xp_tu];
         uint8_t curr_cbf_luma = s->cbf_luma[y_tu * pic_width_in_min_tu + xq_tu];
-#ifndef TEST_MV_POC
         RefPicList* left_refPicList = ff_hevc_get_ref_list(s, s->ref, x0 - 1, y0);
-#endif
         if (curr->pred_flag == PF_INTRA || left->pred_flag == PF_INTRA)
             bs = 2;
         else if (curr_cbf_luma || left_cbf_luma)
             bs = 1;
         else
-#ifdef TEST_MV_POC
-                bs = boundary_strength(s, curr, left);
-#else
                 bs = boundary_strength(s, curr, left, left_refPicList);
-#endif
         if ((slice_left_boundary & 1) && (x0 % (1 << s->sps->log2_ctb_size)) == 0)
             bs = 0;
         if (s->sh.disable_deblocking_filter_flag == 1)
@@ -1024,30 +986,98 @@ void ff_hevc_deblocking_boundary_strengths_v(HEVCContext *s, int x0, int y0, int
 #undef CB
 #undef CR
 
+void ff_hevc_pad_ref(HEVCContext *s, AVFrame *frame, int y0, int y1)
+{
+    int sh = s->sps->pixel_shift;
+    int c_idx;
+
+    for (c_idx = 0; c_idx < (s->sps->chroma_array_type ? 3 : 1); c_idx++) {
+        int pad_x        = s->ref_pad >> s->sps->hshift[c_idx];
+        int pad_y        = s->ref_pad >> s->sps->vshift[c_idx];
+        int width        = s->sps->width  >> s->sps->hshift[c_idx];
+        int height       = s->sps->height >> s->sps->vshift[c_idx];
+        int start        = y0 >> s->sps->vshift[c_idx];
+        int end          = FFMIN(y1, s->sps->height) >> s->sps->vshift[c_idx];
+        ptrdiff_t stride = frame->linesize[c_idx];
+        uint8_t *data    = frame->data[c_idx];
+        int x, y;
+
+        for (y = start; y < end; y++) {
+            uint8_t *row = data + y * stride;
+
+            if (!sh) {
+                memset(row - pad_x, row[0], pad_x);
+                memset(row + width, row[width - 1], pad_x);
+            } else {
+                uint16_t *row16 = (uint16_t *)row;
+
+                for (x = 1; x <= pad_x; x++) {
+                    row16[-x]            = row16[0];
+                    row16[width - 1 + x] = row16[width - 1];
+                }
+            }
+        }
+        if (start == 0 && end > 0) {
+            for (y = 1; y <= pad_y; y++)
+                memcpy(data - y * stride - (pad_x << sh),
+                       data - (pad_x << sh), (width + 2 * pad_x) << sh);
+        }
+        if (end == height && end > start) {
+            uint8_t *last = data + (height - 1) * stride - (pad_x << sh);
+
+            for (y = 1; y <= pad_y; y++)
+                memcpy(last + y * stride, last, (width + 2 * pad_x) << sh);
+        }
+    }
+}
+
 void ff_hevc_hls_filter(HEVCContext *s, int x, int y, int ctb_size)
 {
+    int x_end = x >= s->sps->width  - ctb_size;
+    int y_end = y >= s->sps->height - ctb_size;
+
+    if (s->analysis) {
+        // parse only: no pixels to filter, the collocated motion is still needed
+        if (x_end) {
+            ff_hevc_store_col_mvf(s, y, y + ctb_size);
+            if (s->threads_type & FF_THREAD_FRAME)
+                ff_thread_report_progress(&s->ref->tf, y + ctb_size - 1, 0);
+        }
+        return;
+    }
+
     deblocking_filter_CTB(s, x, y);
+    // the motion of the row is final, before any progress is reported on it
+    if (x_end)
+        ff_hevc_store_col_mvf(s, y, y + ctb_size);
     if (s->sps->sao_enabled) {
-        int x_end = x >= s->sps->width  - ctb_size;
-        int y_end = y >= s->sps->height - ctb_size;
         if (y && x)
             sao_filter_CTB(s, x - ctb_size, y - ctb_size);
         if (x && y_end)
             sao_filter_CTB(s, x - ctb_size, y);
         if (y && x_end) {
             sao_filter_CTB(s, x, y - ctb_size);
+            if (s->ref_pad)
+                ff_hevc_pad_ref(s, s->frame, y - ctb_size, y);
             if (s->threads_type & FF_THREAD_FRAME )
                 ff_thread_report_progress(&s->ref->tf, y - ctb_size, 0);
         }
         if (x_end && y_end) {
             sao_filter_CTB(s, x , y);
+            if (s->ref_pad)
+                ff_hevc_pad_ref(s, s->frame, y, s->sps->height);
             if (s->threads_type & FF_THREAD_FRAME )
                 ff_thread_report_progress(&s->ref->tf, y, 0);
         }
     } else {
-        if (y && x >= s->sps->width - ctb_size)
+        if (y && x_end) {
+            if (s->ref_pad)
+                ff_hevc_pad_ref(s, s->frame, y - ctb_size, y);
             if (s->threads_type & FF_THREAD_FRAME )
                 ff_thread_report_progress(&s->ref->tf, y, 0);
+        }
+        if (x_end && y_end && s->ref_pad)
+            ff_hevc_pad_ref(s, s->frame, y, s->sps->height);
     }
 }
 
@@ -1063,105 +1093,6 @@ void ff_hevc_hls_filters(HEVCContext *s, int x_ctb, int y_ctb, int ctb_size)
         ff_hevc_hls_filter(s, x_ctb - ctb_size, y_ctb, ctb_size);
 }
 
-#if PARALLEL_FILTERS
-void ff_hevc_hls_filters_slice(HEVCContext *s, int x_ctb, int y_ctb, int ctb_size) {
-    int x_slice_end = 0, y_slice_end = 0;
-    unsigned int x_end = x_ctb >= s->sps->width  - ctb_size;
-    unsigned int y_end = y_ctb >= s->sps->height - ctb_size;
-    int ctb_addr_rs = (x_ctb >> s->sps->log2_ctb_size) + (y_ctb >> s->sps->log2_ctb_size) * s->sps->ctb_width;
-
-    if (y_ctb && x_ctb && (s->tab_slice_address[ctb_addr_rs] == s->tab_slice_address[ctb_addr_rs - 1 - s->sps->ctb_width]))
-        ff_hevc_hls_filter_slice(s, x_ctb - ctb_size, y_ctb - ctb_size, ctb_size);
-
-    if (y_ctb && x_end && (s->tab_slice_address[ctb_addr_rs] == s->tab_slice_address[ctb_addr_rs - s->sps->ctb_width]))
-        ff_hevc_hls_filter_slice(s, x_ctb, y_ctb - ctb_size, ctb_size);
-
-
-    if (x_ctb && y_end && (s->tab_slice_address[ctb_addr_rs] == s->tab_slice_address[ctb_addr_rs - 1]))
-        ff_hevc_hls_filter_slice(s, x_ctb - ctb_size, y_ctb, ctb_size);
-
-    if(!x_end)
-        x_slice_end = (s->tab_slice_address[ctb_addr_rs] != s->tab_slice_address[ctb_addr_rs + 1]);
-    if(!y_end)
-        y_slice_end = (s->tab_slice_address[ctb_addr_rs] != s->tab_slice_address[ctb_addr_rs + s->sps->ctb_width]);
-
-    if(x_slice_end && y_ctb && (s->tab_slice_address[ctb_addr_rs] == s->tab_slice_address[ctb_addr_rs - s->sps->ctb_width]))
-        ff_hevc_hls_filter_slice(s, x_ctb , y_ctb - ctb_size, ctb_size);
-
-    if(y_slice_end && x_ctb && (s->tab_slice_address[ctb_addr_rs] == s->tab_slice_address[ctb_addr_rs- 1]))
-        ff_hevc_hls_filter_slice(s, x_ctb - ctb_size , y_ctb, ctb_size);
-
-    if(x_end && y_slice_end)
-        ff_hevc_hls_filter_slice(s, x_ctb , y_ctb, ctb_size);
-    if(y_end && x_slice_end)
-        ff_hevc_hls_filter_slice(s, x_ctb , y_ctb, ctb_size);
-    if(y_end && x_end)
-        ff_hevc_hls_filter_slice(s, x_ctb , y_ctb, ctb_size);
-}
-void ff_hevc_hls_filter_slice(HEVCContext *s, int x, int y, int ctb_size)
-{
-    int x_slice_end = 0, y_slice_end= 0;
-    deblocking_filter_CTB(s, x, y);
-    int ctb_addr_rs = (x >> s->sps->log2_ctb_size) + (y >> s->sps->log2_ctb_size) * s->sps->ctb_width;
-
-    if (s->sps->sao_enabled) {
-        int x_end = x >= s->sps->width  - ctb_size;
-        int y_end = y >= s->sps->height - ctb_size;
-        if (y && x && (s->tab_slice_address[ctb_addr_rs] == s->tab_slice_address[ctb_addr_rs - 1 - s->sps->ctb_width]))
-            sao_filter_CTB(s, x - ctb_size, y - ctb_size);
-        if (x && y_end && (s->tab_slice_address[ctb_addr_rs] == s->tab_slice_address[ctb_addr_rs - 1]))
-            sao_filter_CTB(s, x - ctb_size, y);
-        if (y && x_end && (s->tab_slice_address[ctb_addr_rs] == s->tab_slice_address[ctb_addr_rs - s->sps->ctb_width])) {
-            sao_filter_CTB(s, x, y - ctb_size);
-            if (s->threads_type & FF_THREAD_FRAME ) {
-                int i;
-                s->decoded_rows[(y - ctb_size)>>s->sps->log2_ctb_size] = 1;
-                for(i = 0; i < s->sps->ctb_height && s->decoded_rows[i]; i++);
-                ff_thread_report_progress(&s->ref->tf, i*ctb_size, 0);
-            }
-        }
-
-        if(!x_end)
-            x_slice_end = (s->tab_slice_address[ctb_addr_rs] != s->tab_slice_address[ctb_addr_rs + 1]);
-        if(!y_end)
-            y_slice_end = (s->tab_slice_address[ctb_addr_rs] != s->tab_slice_address[ctb_addr_rs + s->sps->ctb_width]);
-
-        if(x_slice_end && y && (s->tab_slice_address[ctb_addr_rs] == s->tab_slice_address[ctb_addr_rs - s->sps->ctb_width])) {
-            sao_filter_CTB(s, x , y - ctb_size);
-            if (s->threads_type & FF_THREAD_FRAME ) {
-                int i; 
-                s->decoded_rows[(y - ctb_size)>>s->sps->log2_ctb_size] = 1;
-                for(i = 0; i < s->sps->ctb_height && s->decoded_rows[i]; i++);
-                    ff_thread_report_progress(&s->ref->tf, i*ctb_size, 0);
-            }
-        }
-
-        if(y_slice_end && x && (s->tab_slice_address[ctb_addr_rs] == s->tab_slice_address[ctb_addr_rs- 1]))
-            sao_filter_CTB(s, x - ctb_size , y);
-
-        if(x_end && y_slice_end)
-            sao_filter_CTB(s, x , y);
-
-        if(y_end && x_slice_end)
-            sao_filter_CTB(s, x , y);
-
-        if (x_end && y_end) {
-            sao_filter_CTB(s, x , y);
-            if (s->threads_type & FF_THREAD_FRAME )
-                ff_thread_report_progress(&s->ref->tf, y, 0);
-        }
-    } else {
-        if (y && x >= s->sps->width - ctb_size)
-            if (s->threads_type & FF_THREAD_FRAME ) {
-                int i;
-                s->decoded_rows[y>>s->sps->log2_ctb_size] = 1;
-                for(i = 0; i < s->sps->ctb_height && s->decoded_rows[i]; i++);
-                    ff_thread_report_progress(&s->ref->tf, i*ctb_size, 0);
-            }
-    }
-}
-#endif
-
 static void copy_block (pixel *src, pixel * dst, ptrdiff_t bl_stride, ptrdiff_t el_stride, int ePbH, int ePbW ) {
     int i;
 
@@ -1309,60 +1240,42 @@ static void upsample_block_mc(HEVCContext *s, HEVCFrame *ref0, int x0, int y0) {
 }
 
 void ff_upscale_mv_block(HEVCContext *s, int ctb_x, int ctb_y) {
-    int xEL, yEL, xBL, yBL, list, Ref_pre_unit, pre_unit, pre_unit_col;
-    int pic_width_in_min_pu = s->sps->width>>s->sps->log2_min_pu_size;
-    int pic_height_in_min_pu = s->sps->height>>s->sps->log2_min_pu_size;
-    int pic_width_in_min_puBL = s->BL_frame->frame->coded_width >> s->sps->log2_min_pu_size;
+    int xEL, yEL, xBL, yBL, list, Ref_pre_unit, pre_unit;
+    int col_width    = (s->sps->width + 15) >> 4;
+    int col_width_BL = (s->BL_frame->frame->coded_width + 15) >> 4;
     int ctb_size = 1 << s->sps->log2_ctb_size;
     int nb_list = s->sh.slice_type==B_SLICE ? 2:1;
     HEVCFrame *refBL = s->BL_frame;
     HEVCFrame *refEL = s->inter_layer_ref;
+    MvField *col_BL  = refBL->tab_mvf_col;
+    MvField *col_EL  = refEL->tab_mvf_col;
 
+    // only the 16x16 collocated fields are kept for the references
     for(yEL=ctb_y; yEL < ctb_y+ctb_size && yEL<s->sps->height; yEL+=16) {
         for(xEL=ctb_x; xEL < ctb_x+ctb_size && xEL<s->sps->width; xEL+=16) {
             xBL = (((av_clip_c(xEL+8, 0, s->sps->width -1)  - s->sps->pic_conf_win.left_offset)*s->up_filter_inf.scaleXLum + (1<<15)) >> 16) + 4;
             yBL = (((av_clip_c(yEL+8, 0, s->sps->height -1) - s->sps->pic_conf_win.top_offset )*s->up_filter_inf.scaleYLum + (1<<15)) >> 16) + 4;
-            pre_unit = ((yEL>>s->sps->log2_min_pu_size)*pic_width_in_min_pu) + (xEL>>s->sps->log2_min_pu_size);
+            pre_unit = (yEL >> 4) * col_width + (xEL >> 4);
             if(xBL < s->BL_frame->frame->coded_width && yBL < s->BL_frame->frame->coded_height) {
-                xBL >>= 4;
-                xBL <<= 4-s->sps->log2_min_pu_size; // 4 <==> xBL & 0xFFFFFFF0
-                yBL >>= 4;
-                yBL <<= 4-s->sps->log2_min_pu_size; // 4 <==> yBL & 0xFFFFFFF0
-                Ref_pre_unit = (yBL*pic_width_in_min_puBL)+xBL;
-                if(refBL->tab_mvf[Ref_pre_unit].pred_flag) {
+                Ref_pre_unit = (yBL >> 4) * col_width_BL + (xBL >> 4);
+                if(col_BL[Ref_pre_unit].pred_flag) {
                     if (s->up_filter_inf.idx == SNR) {
-                        memcpy(&refEL->tab_mvf[pre_unit], &refBL->tab_mvf[Ref_pre_unit], sizeof(MvField));
+                        memcpy(&col_EL[pre_unit], &col_BL[Ref_pre_unit], sizeof(MvField));
                     } else {
 
                         for( list=0; list < nb_list; list++) {
-                            refEL->tab_mvf[pre_unit].mv[list].x  = av_clip_c( (s->sh.ScalingFactor[s->nuh_layer_id][0] * refBL->tab_mvf[Ref_pre_unit].mv[list].x + 127 + (s->sh.ScalingFactor[s->nuh_layer_id][0] * refBL->tab_mvf[Ref_pre_unit].mv[list].x < 0)) >> 8 , -32768, 32767);
-                            refEL->tab_mvf[pre_unit].mv[list].y = av_clip_c( (s->sh.ScalingFactor[s->nuh_layer_id][1] * refBL->tab_mvf[Ref_pre_unit].mv[list].y + 127 + (s->sh.ScalingFactor[s->nuh_layer_id][1] * refBL->tab_mvf[Ref_pre_unit].mv[list].y < 0)) >> 8, -32768, 32767);
-                            refEL->tab_mvf[pre_unit].ref_idx[list] = refBL->tab_mvf[Ref_pre_unit].ref_idx[list];
-#ifdef TEST_MV_POC
-                            refEL->tab_mvf[pre_unit].poc[list] = refBL->tab_mvf[Ref_pre_unit].poc[list];
-#endif
-                            refEL->tab_mvf[pre_unit].pred_flag = refBL->tab_mvf[Ref_pre_unit].pred_flag;
+                            col_EL[pre_unit].mv[list].x  = av_clip_c( (s->sh.ScalingFactor[s->nuh_layer_id][0] * col_BL[Ref_pre_unit].mv[list].x + 127 + (s->sh.ScalingFactor[s->nuh_layer_id][0] * col_BL[Ref_pre_unit].mv[list].x < 0)) >> 8 , -32768, 32767);
+                            col_EL[pre_unit].mv[list].y = av_clip_c( (s->sh.ScalingFactor[s->nuh_layer_id][1] * col_BL[Ref_pre_unit].mv[list].y + 127 + (s->sh.ScalingFactor[s->nuh_layer_id][1] * col_BL[Ref_pre_unit].mv[list].y < 0)) >> 8, -32768, 32767);
+                            col_EL[pre_unit].ref_idx[list] = col_BL[Ref_pre_unit].ref_idx[list];
+                            col_EL[pre_unit].pred_flag = col_BL[Ref_pre_unit].pred_flag;
                         }
                     }
                 } else
-                    memset(&refEL->tab_mvf[pre_unit], 0, sizeof(MvField));
+                    memset(&col_EL[pre_unit], 0, sizeof(MvField));
 
 
             } else
-                memset(&refEL->tab_mvf[pre_unit], 0, sizeof(MvField));
-
-            if( ((xEL+1)>>s->sps->log2_min_pu_size) < pic_width_in_min_pu && ((yEL+1)>>s->sps->log2_min_pu_size) < pic_height_in_min_pu) {
-                pre_unit_col = (((yEL+1)>>s->sps->log2_min_pu_size)*pic_width_in_min_pu) + ((xEL+1)>>s->sps->log2_min_pu_size);
-                memcpy(&refEL->tab_mvf[pre_unit_col], &refEL->tab_mvf[pre_unit], sizeof(MvField));
-            }
-            if( ((xEL+1)>>s->sps->log2_min_pu_size) < pic_width_in_min_pu) {
-                pre_unit_col = ((yEL>>s->sps->log2_min_pu_size)*pic_width_in_min_pu) + ((xEL+1)>>s->sps->log2_min_pu_size);
-                memcpy(&refEL->tab_mvf[pre_unit_col], &refEL->tab_mvf[pre_unit], sizeof(MvField));
-            }
-            if( ((yEL+1)>>s->sps->log2_min_pu_size) < pic_height_in_min_pu) {
-                pre_unit_col = (((yEL+1)>>s->sps->log2_min_pu_size)*pic_width_in_min_pu) + ((xEL)>>s->sps->log2_min_pu_size);
-                memcpy(&refEL->tab_mvf[pre_unit_col], &refEL->tab_mvf[pre_unit], sizeof(MvField));
-            }
+                memset(&col_EL[pre_unit], 0, sizeof(MvField));
         }
     }
 }
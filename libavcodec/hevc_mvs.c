@@ -98,16 +98,6 @@ static av_always_inline int compare_mv_ref_idx(struct MvField A, struct MvField
     int a_pf = A.pred_flag;
     int b_pf = B.pred_flag;
     if (a_pf == b_pf) {
-#ifdef TEST_MV_POC
-        if (a_pf == PF_BI) {
-            return MATCH(poc[0]) && MATCH(mv[0].x) && MATCH(mv[0].y) &&
-                   MATCH(poc[1]) && MATCH(mv[1].x) && MATCH(mv[1].y);
-        } else if (a_pf == PF_L0) {
-            return MATCH(poc[0]) && MATCH(mv[0].x) && MATCH(mv[0].y);
-        } else if (a_pf == PF_L1) {
-            return MATCH(poc[1]) && MATCH(mv[1].x) && MATCH(mv[1].y);
-        }
-#else
         if (a_pf == PF_BI) {
             return MATCH(ref_idx[0]) && MATCH(mv[0].x) && MATCH(mv[0].y) &&
                    MATCH(ref_idx[1]) && MATCH(mv[1].x) && MATCH(mv[1].y);
@@ -116,7 +106,6 @@ static av_always_inline int compare_mv_ref_idx(struct MvField A, struct MvField
         } else if (a_pf == PF_L1) {
             return MATCH(ref_idx[1]) && MATCH(mv[1].x) && MATCH(mv[1].y);
         }
-#endif
     }
     return 0;
 }
@@ -210,7 +199,7 @@ static int derive_temporal_colocated_mvs(HEVCContext *s, MvField temp_col,
 }
 
 #define TAB_MVF(x, y)                                                   \
-    tab_mvf[(y) * min_pu_width + x]
+    tab_mvf[(y) * min_pu_width + (x)]
 
 #define TAB_MVF_PU(v)                                                   \
     TAB_MVF(((x ## v) >> s->sps->log2_min_pu_size),                     \
@@ -221,6 +210,24 @@ static int derive_temporal_colocated_mvs(HEVCContext *s, MvField temp_col,
                                   refIdxLx, mvLXCol, X, colPic,         \
                                   ff_hevc_get_ref_list(s, ref, x, y))
 
+void ff_hevc_store_col_mvf(HEVCContext *s, int y0, int y1)
+{
+    MvField *tab_mvf     = s->ref->tab_mvf;
+    MvField *tab_col     = s->ref->tab_mvf_col;
+    int min_pu_width     = s->sps->min_pu_width;
+    int col_width        = (s->sps->width + 15) >> 4;
+    int log2_min_pu_size = s->sps->log2_min_pu_size;
+    int x, y;
+
+    if (!tab_mvf)
+        return;
+    y1 = FFMIN(y1, s->sps->height);
+    for (y = y0 & ~15; y < y1; y += 16)
+        for (x = 0; x < s->sps->width; x += 16)
+            tab_col[(y >> 4) * col_width + (x >> 4)] =
+                TAB_MVF(x >> log2_min_pu_size, y >> log2_min_pu_size);
+}
+
 /*
  * 8.5.3.1.7  temporal luma motion vector prediction
  */
@@ -230,8 +237,8 @@ static int temporal_luma_motion_vector(HEVCContext *s, int x0, int y0,
 {
     MvField *tab_mvf;
     MvField temp_col;
-    int x, y, x_pu, y_pu;
-    int min_pu_width = s->sps->min_pu_width;
+    int x, y;
+    int col_width = (s->sps->width + 15) >> 4;
     int availableFlagLXCol = 0;
     int colPic;
 
@@ -240,7 +247,7 @@ static int temporal_luma_motion_vector(HEVCContext *s, int x0, int y0,
     if (!ref)
         return 0;
 
-    tab_mvf = ref->tab_mvf;
+    tab_mvf = ref->tab_mvf_col;
     colPic  = ref->poc;
 
     //bottom right collocated motion vector
@@ -264,9 +271,7 @@ static int temporal_luma_motion_vector(HEVCContext *s, int x0, int y0,
         x < s->sps->width) {
         x                  = ((x >> 4) << 4);
         y                  = ((y >> 4) << 4);
-        x_pu               = x >> s->sps->log2_min_pu_size;
-        y_pu               = y >> s->sps->log2_min_pu_size;
-        temp_col           = TAB_MVF(x_pu, y_pu);
+        temp_col           = tab_mvf[(y >> 4) * col_width + (x >> 4)];
         availableFlagLXCol = DERIVE_TEMPORAL_COLOCATED_MVS;
     }
 
@@ -276,9 +281,7 @@ static int temporal_luma_motion_vector(HEVCContext *s, int x0, int y0,
         y                  = y0 + (nPbH >> 1);
         x                  = ((x >> 4) << 4);
         y                  = ((y >> 4) << 4);
-        x_pu               = x >> s->sps->log2_min_pu_size;
-        y_pu               = y >> s->sps->log2_min_pu_size;
-        temp_col           = TAB_MVF(x_pu, y_pu);
+        temp_col           = tab_mvf[(y >> 4) * col_width + (x >> 4)];
         availableFlagLXCol = DERIVE_TEMPORAL_COLOCATED_MVS;
     }
     return availableFlagLXCol;
@@ -430,16 +433,10 @@ static void derive_spatial_merge_candidates(HEVCContext *s, int x0, int y0,
             if (available_l0) {
                 mergecandlist[nb_merge_cand].mv[0]      = mv_l0_col;
                 mergecandlist[nb_merge_cand].ref_idx[0] = 0;
-#ifdef TEST_MV_POC
-                mergecandlist[nb_merge_cand].poc[0]     = refPicList[0].list[0];
-#endif
             }
             if (available_l1) {
                 mergecandlist[nb_merge_cand].mv[1]      = mv_l1_col;
                 mergecandlist[nb_merge_cand].ref_idx[1] = 0;
-#ifdef TEST_MV_POC
-                mergecandlist[nb_merge_cand].poc[1]     = refPicList[1].list[0];
-#endif
             }
             if (merge_idx == nb_merge_cand) return;
             nb_merge_cand++;
@@ -463,12 +460,8 @@ static void derive_spatial_merge_candidates(HEVCContext *s, int x0, int y0,
             if ((l0_cand.pred_flag & PF_L0) &&
                 (l1_cand.pred_flag & PF_L1) &&
                 (
-#ifdef TEST_MV_POC
-                 l0_cand.poc[0] != l1_cand.poc[1] ||
-#else
                  refPicList[0].list[l0_cand.ref_idx[0]] !=
                  refPicList[1].list[l1_cand.ref_idx[1]] ||
-#endif
                  l0_cand.mv[0].x != l1_cand.mv[1].x ||
                  l0_cand.mv[0].y != l1_cand.mv[1].y)) {
                 mergecandlist[nb_merge_cand].ref_idx[0]   = l0_cand.ref_idx[0];
@@ -476,10 +469,6 @@ static void derive_spatial_merge_candidates(HEVCContext *s, int x0, int y0,
                 mergecandlist[nb_merge_cand].pred_flag    = PF_BI;
                 mergecandlist[nb_merge_cand].mv[0]        = l0_cand.mv[0];
                 mergecandlist[nb_merge_cand].mv[1]        = l1_cand.mv[1];
-#ifdef TEST_MV_POC
-                mergecandlist[nb_merge_cand].poc[0]       = l0_cand.poc[0];
-                mergecandlist[nb_merge_cand].poc[1]       = l1_cand.poc[1];
-#endif
                 if (merge_idx == nb_merge_cand) return;
                 nb_merge_cand++;
             }
@@ -495,10 +484,6 @@ static void derive_spatial_merge_candidates(HEVCContext *s, int x0, int y0,
         mergecandlist[nb_merge_cand].mv[1].y      = 0;
         mergecandlist[nb_merge_cand].ref_idx[0]   = zero_idx < nb_refs ? zero_idx : 0;
         mergecandlist[nb_merge_cand].ref_idx[1]   = zero_idx < nb_refs ? zero_idx : 0;
-#ifdef TEST_MV_POC
-        mergecandlist[nb_merge_cand].poc[0]       = refPicList[0].list[zero_idx < nb_refs ? zero_idx : 0];
-        mergecandlist[nb_merge_cand].poc[1]       = refPicList[1].list[zero_idx < nb_refs ? zero_idx : 0];
-#endif
         if (merge_idx == nb_merge_cand) return;
         nb_merge_cand++;
         zero_idx++;
@@ -547,11 +532,7 @@ static av_always_inline void dist_scale(HEVCContext *s, Mv *mv,
 {
     RefPicList *refPicList = s->ref->refPicList[s->slice_idx];
     MvField *tab_mvf       = s->ref->tab_mvf;
-#ifdef TEST_MV_POC
-    int ref_pic_elist      = TAB_MVF(x, y).poc[elist];
-#else
     int ref_pic_elist      = refPicList[elist].list[TAB_MVF(x, y).ref_idx[elist]];
-#endif
     int ref_pic_curr       = refPicList[ref_idx_curr].list[ref_idx];
 
     if (ref_pic_elist != ref_pic_curr) {
@@ -571,11 +552,7 @@ static int mv_mp_mode_mx(HEVCContext *s, int x, int y, int pred_flag_index,
     RefPicList *refPicList = s->ref->refPicList[s->slice_idx];
 
     if (((TAB_MVF(x, y).pred_flag) & (1 << pred_flag_index)) &&
-#ifdef TEST_MV_POC
-        TAB_MVF(x, y).poc[pred_flag_index] == refPicList[ref_idx_curr].list[ref_idx]
-#else
         refPicList[pred_flag_index].list[TAB_MVF(x, y).ref_idx[pred_flag_index]] == refPicList[ref_idx_curr].list[ref_idx]
-#endif
     ) {
         *mv = TAB_MVF(x, y).mv[pred_flag_index];
         return 1;
@@ -36,6 +36,8 @@ void ff_hevc_unref_frame(HEVCContext *s, HEVCFrame *frame, int flags) {
         ff_thread_release_buffer(s->avctx, &frame->tf);
         av_buffer_unref(&frame->tab_mvf_buf);
         frame->tab_mvf = NULL;
+        av_buffer_unref(&frame->tab_mvf_col_buf);
+        frame->tab_mvf_col = NULL;
         av_buffer_unref(&frame->rpl_buf);
         av_buffer_unref(&frame->rpl_tab_buf);
         frame->rpl_tab    = NULL;
@@ -46,6 +48,20 @@ void ff_hevc_unref_frame(HEVCContext *s, HEVCFrame *frame, int flags) {
     }
 }
 
+void ff_hevc_unref_features(HEVCContext *s, HEVCFrame *frame)
+{
+    int i;
+    /* the buffers of a user get_buffer2() may not be released out of order */
+    if (s->avctx->get_buffer2 != avcodec_default_get_buffer2)
+        return;
+    /* no later picture reads the features, only the pixel planes have to
+     * live as long as the frame is used as a reference */
+    for (i = 3; i < 8; i++) {
+        av_buffer_unref(&frame->frame->buf[i]);
+        frame->frame->data[i] = NULL;
+    }
+}
+
 RefPicList *ff_hevc_get_ref_list(HEVCContext *s, HEVCFrame *ref, int x0, int y0)
 {
     int x_cb         = x0 >> s->sps->log2_ctb_size;
@@ -94,6 +110,11 @@ static HEVCFrame *alloc_frame(HEVCContext *s)
             goto fail;
         frame->tab_mvf = (MvField *)frame->tab_mvf_buf->data;
 
+        frame->tab_mvf_col_buf = av_buffer_pool_get(s->tab_mvf_col_pool);
+        if (!frame->tab_mvf_col_buf)
+            goto fail;
+        frame->tab_mvf_col = (MvField *)frame->tab_mvf_col_buf->data;
+
         frame->rpl_tab_buf = av_buffer_pool_get(s->rpl_tab_pool);
         if (!frame->rpl_tab_buf)
             goto fail;
@@ -248,6 +269,12 @@ int ff_hevc_output_frame(HEVCContext *s, AVFrame *out, int flush)
             if (ret < 0)
                 return ret;
 
+            /* out holds the features now, unless the frame is still being
+             * decoded by this context: then they are dropped when it ends */
+            if (!(frame->flags & HEVC_FRAME_FLAG_OUTPUT) &&
+                (frame != s->ref || s->is_decoded))
+                ff_hevc_unref_features(s, frame);
+
             for (i = 0; i < 3; i++) {
                 int hshift = (i > 0) ? desc->log2_chroma_w : 0;
                 int vshift = (i > 0) ? desc->log2_chroma_h : 0;
@@ -573,7 +600,7 @@ static HEVCFrame *generate_missing_ref(HEVCContext *s, int poc)
                     conc_frame->frame->height);
 #if COPY_MV
     memcpy(frame->rpl_buf->data, conc_frame->rpl_buf->data, frame->rpl_buf->size);
-    memcpy(frame->tab_mvf_buf->data, conc_frame->tab_mvf_buf->data, frame->tab_mvf_buf->size);
+    memcpy(frame->tab_mvf_col_buf->data, conc_frame->tab_mvf_col_buf->data, frame->tab_mvf_col_buf->size);
     memcpy(frame->rpl_tab_buf->data, conc_frame->rpl_tab_buf->data, frame->rpl_tab_buf->size);
 #endif
 #else
@@ -589,7 +616,12 @@ static HEVCFrame *generate_missing_ref(HEVCContext *s, int poc)
                             1 << (s->sps->bit_depth - 1));
                 }
     }
+    if (s->ref_pad)
+        ff_hevc_pad_ref(s, frame->frame, 0, s->sps->height);
+    memset(frame->tab_mvf_col_buf->data, 0, frame->tab_mvf_col_buf->size); // is intra = 0
 #endif
+    av_buffer_unref(&frame->tab_mvf_buf);
+    frame->tab_mvf              = NULL;
     frame->poc                  = poc;
     frame->sequence             = s->seq_decode;
     
@@ -599,6 +631,7 @@ static HEVCFrame *generate_missing_ref(HEVCContext *s, int poc)
     frame->is_concealment_frame = 1;
 #else
     frame->flags                = 0;
+    ff_hevc_unref_features(s, frame);
 #endif
 
     if (s->threads_type & FF_THREAD_FRAME) {
@@ -633,7 +666,7 @@ static int add_candidate_ref(HEVCContext *s, RefPicList *list,
 #ifdef REF_IDX_FRAMEWORK
 static void init_upsampled_mv_fields(HEVCContext *s) {
     HEVCFrame *refEL = s->inter_layer_ref;
-    memset(refEL->tab_mvf_buf->data, 0, refEL->tab_mvf_buf->size); // is intra = 0
+    memset(refEL->tab_mvf_col_buf->data, 0, refEL->tab_mvf_col_buf->size); // is intra = 0
 }
 #endif
 
@@ -29,6 +29,7 @@
 struct AVFrame;
 struct UpsamplInf;
 struct HEVCWindow;
+struct SAOParams;
 
 
 #define NTAPS_LUMA 8
@@ -29,6 +29,17 @@
  * @see doc/multithreading.txt
  */
 
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE // pthread_setaffinity_np
+#endif
+
+#include "config.h"
+
+#if HAVE_PTHREADS
+#include <pthread.h>
+#include <sched.h>
+#endif
+
 #include "avcodec.h"
 #include "internal.h"
 #include "pthread_internal.h"
@@ -64,7 +75,8 @@ static void validate_thread_parameters(AVCodecContext *avctx)
         avctx->thread_count_frame = 1;
     } else if(frameslice_threading_supported && (avctx->thread_type & FF_THREAD_FRAME_SLICE)) {
         avctx->thread_count        = avctx->thread_count ? avctx->thread_count : av_cpu_count()>>1;
-        avctx->thread_count_frame  = FFMIN((av_cpu_count() / avctx->thread_count) + 1, MAX_AUTO_THREADS);
+        if (avctx->thread_count_frame <= 0)
+            avctx->thread_count_frame = FFMIN((av_cpu_count() / avctx->thread_count) + 1, MAX_AUTO_THREADS);
         if (avctx->thread_count_frame > 1)
             avctx->active_thread_type = FF_THREAD_FRAME | FF_THREAD_SLICE;
         else
@@ -100,6 +112,24 @@ int ff_thread_init(AVCodecContext *avctx)
     return ret;
 }
 
+void ff_thread_set_affinity(AVCodecContext *avctx)
+{
+#if HAVE_PTHREADS && defined(__linux__)
+    cpu_set_t set;
+    int i;
+
+    if (!avctx->thread_cpus || avctx->nb_thread_cpus <= 0)
+        return;
+
+    CPU_ZERO(&set);
+    for (i = 0; i < avctx->nb_thread_cpus; i++)
+        if (avctx->thread_cpus[i] >= 0 && avctx->thread_cpus[i] < CPU_SETSIZE)
+            CPU_SET(avctx->thread_cpus[i], &set);
+    if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set))
+        av_log(avctx, AV_LOG_WARNING, "Could not restrict a decoding thread to the requested CPUs\n");
+#endif
+}
+
 void ff_thread_free(AVCodecContext *avctx)
 {
     if (avctx->active_thread_type&FF_THREAD_FRAME)
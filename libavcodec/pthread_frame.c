@@ -39,6 +39,7 @@
 #include "pthread_internal.h"
 #include "thread.h"
 
+#include "libavutil/atomic.h"
 #include "libavutil/avassert.h"
 #include "libavutil/buffer.h"
 #include "libavutil/common.h"
@@ -150,6 +151,8 @@ static attribute_align_arg void *frame_worker_thread(void *arg)
     AVCodecContext *avctx = p->avctx;
     const AVCodec *codec = avctx->codec;
 
+    ff_thread_set_affinity(avctx);
+
     pthread_mutex_lock(&p->mutex);
     while (1) {
             while (p->state == STATE_INPUT_READY && !fctx->die)
@@ -476,30 +479,43 @@ int ff_thread_decode_frame(AVCodecContext *avctx,
     return (p->result >= 0) ? avpkt->size : p->result;
 }
 
+/*
+ * The progress buffer holds the progress of each field followed by, for each
+ * field, the lowest progress value a sleeping thread is waiting for (INT_MAX
+ * if none). Progress values are read and written atomically so that neither
+ * side takes progress_mutex when nobody has to sleep or be woken up, and the
+ * owner only broadcasts progress_cond once a waiter can actually proceed.
+ */
 void ff_thread_report_progress(ThreadFrame *f, int n, int field)
 {
     PerThreadContext *p;
-    volatile int *progress = f->progress ? (int*)f->progress->data : NULL;
+    int *progress = f->progress ? (int*)f->progress->data : NULL;
 
-    if (!progress || progress[field] >= n) return;
+    if (!progress || avpriv_atomic_int_get(&progress[field]) >= n) return;
 
     p = f->owner->internal->thread_ctx_frame;
 
     if (f->owner->debug&FF_DEBUG_THREADS)
         av_log(f->owner, AV_LOG_DEBUG, "%p finished %d field %d\n", progress, n, field);
 
+    avpriv_atomic_int_set(&progress[field], n);
+    if (avpriv_atomic_int_get(&progress[field + 2]) > n)
+        return;
+
     pthread_mutex_lock(&p->progress_mutex);
-    progress[field] = n;
-    pthread_cond_broadcast(&p->progress_cond);
+    if (progress[field + 2] <= n) {
+        progress[field + 2] = INT_MAX;
+        pthread_cond_broadcast(&p->progress_cond);
+    }
     pthread_mutex_unlock(&p->progress_mutex);
 }
 
 void ff_thread_await_progress(ThreadFrame *f, int n, int field)
 {
     PerThreadContext *p;
-    volatile int *progress = f->progress ? (int*)f->progress->data : NULL;
+    int *progress = f->progress ? (int*)f->progress->data : NULL;
 
-    if (!progress || progress[field] >= n) return;
+    if (!progress || avpriv_atomic_int_get(&progress[field]) >= n) return;
 
     p = f->owner->internal->thread_ctx_frame;
 
@@ -507,8 +523,15 @@ void ff_thread_await_progress(ThreadFrame *f, int n, int field)
         av_log(f->owner, AV_LOG_DEBUG, "thread awaiting %d field %d from %p\n", n, field, progress);
 
     pthread_mutex_lock(&p->progress_mutex);
-    while (progress[field] < n)
+    while (1) {
+        /* publish what we wait for before checking the progress again, the
+         * reporter stores the progress before reading it */
+        if (progress[field + 2] > n)
+            avpriv_atomic_int_set(&progress[field + 2], n);
+        if (avpriv_atomic_int_get(&progress[field]) >= n)
+            break;
         pthread_cond_wait(&p->progress_cond, &p->progress_mutex);
+    }
     pthread_mutex_unlock(&p->progress_mutex);
 }
 
@@ -889,13 +912,14 @@ static int thread_get_buffer_internal(AVCodecContext *avctx, ThreadFrame *f, int
 
     if (avctx->internal->allocate_progress) {
         int *progress;
-        f->progress = av_buffer_alloc(2 * sizeof(int));
+        f->progress = av_buffer_alloc(4 * sizeof(int));
         if (!f->progress) {
             return AVERROR(ENOMEM);
         }
         progress = (int*)f->progress->data;
 
         progress[0] = progress[1] = -1;
+        progress[2] = progress[3] = INT_MAX;
     }
 
     pthread_mutex_lock(&p->parent->buffer_mutex);
@@ -31,4 +31,9 @@ void ff_slice_thread_free(AVCodecContext *avctx);
 int ff_frame_thread_init(AVCodecContext *avctx);
 void ff_frame_thread_free(AVCodecContext *avctx, int thread_count);
 
+/**
+ * Restrict the calling worker thread to avctx->thread_cpus, if set.
+ */
+void ff_thread_set_affinity(AVCodecContext *avctx);
+
 #endif // AVCODEC_PTHREAD_INTERNAL_H
@@ -37,13 +37,30 @@
 #include "pthread_internal.h"
 #include "thread.h"
 
+#include "libavutil/atomic.h"
 #include "libavutil/common.h"
 #include "libavutil/cpu.h"
 #include "libavutil/mem.h"
+#include "libavutil/time.h"
+
+/* Number of progress checks before a WPP row goes to sleep */
+#define WPP_SPIN_COUNT 256
 
 typedef int (action_func)(AVCodecContext *c, void *arg);
 typedef int (action_func2)(AVCodecContext *c, void *arg, int jobnr, int threadnr);
 
+/**
+ * Progress of one WPP row, padded to its own cache line so that the rows
+ * decoded by different threads do not share lines.
+ */
+typedef struct RowProgress {
+    int64_t stall_time;             ///< Time in us the row spent sleeping on the row above
+    volatile int done;              ///< CTBs decoded in the row, plus the shift once the row is over
+    volatile int waiting;           ///< Set while the row sleeps on the row above
+    int nb_stalls;                  ///< Number of times the row had to sleep on the row above
+    uint8_t padding[64 - sizeof(int64_t) - 3 * sizeof(int)];
+} RowProgress;
+
 typedef struct SliceThreadContext {
     pthread_t *workers;
     action_func *func;
@@ -61,9 +78,11 @@ typedef struct SliceThreadContext {
     int current_job;
     int done;
 
-    int *entries;
+    RowProgress *entries;
     int entries_count;
+    int entries_allocated;
     int thread_count;
+    int spin_count;
     pthread_cond_t *progress_cond;
     pthread_mutex_t *progress_mutex;
 } SliceThreadContext;
@@ -77,6 +96,8 @@ static void* attribute_align_arg worker(void *v)
     int thread_count = avctx->thread_count;
     int self_id;
 
+    ff_thread_set_affinity(avctx);
+
     pthread_mutex_lock(&c->current_job_lock);
     self_id = c->current_job++;
     for (;;){
@@ -121,6 +142,10 @@ void ff_slice_thread_free(AVCodecContext *avctx)
     pthread_cond_destroy(&c->current_job_cond);
     pthread_cond_destroy(&c->last_job_cond);
     av_free(c->workers);
+    for (i = 0; c->progress_mutex && i < c->thread_count; i++) {
+        pthread_mutex_destroy(&c->progress_mutex[i]);
+        pthread_cond_destroy(&c->progress_cond[i]);
+    }
     av_freep(&c->entries);
     av_freep(&c->progress_mutex);
     av_freep(&c->progress_cond);
@@ -235,31 +260,59 @@ int ff_slice_thread_init(AVCodecContext *avctx)
     return 0;
 }
 
+/*
+ * A WPP row may start a CTB once the row above is at least shift CTBs ahead.
+ * The row counters are updated with atomics, the thread of the row above is
+ * only asked to signal once the row below has gone to sleep on its condition,
+ * so that the common case takes no lock at all.
+ */
 void ff_thread_report_progress2(AVCodecContext *avctx, int field, int thread, int n)
 {
     SliceThreadContext *p = avctx->internal->thread_ctx;
-    int *entries = p->entries;
+    RowProgress *entries  = p->entries;
+
+    avpriv_atomic_int_add_and_fetch((int *)&entries[field].done, n);
+    if (field + 1 >= p->entries_count || !avpriv_atomic_int_get((int *)&entries[field + 1].waiting))
+        return;
 
     pthread_mutex_lock(&p->progress_mutex[thread]);
-    entries[field] +=n;
     pthread_cond_signal(&p->progress_cond[thread]);
     pthread_mutex_unlock(&p->progress_mutex[thread]);
 }
 
+static av_always_inline int row_ready(RowProgress *entries, int field, int shift)
+{
+    return avpriv_atomic_int_get((int *)&entries[field - 1].done) - entries[field].done >= shift;
+}
+
 void ff_thread_await_progress2(AVCodecContext *avctx, int field, int thread, int shift)
 {
-    SliceThreadContext *p  = avctx->internal->thread_ctx;
-    int *entries      = p->entries;
+    SliceThreadContext *p = avctx->internal->thread_ctx;
+    RowProgress *entries  = p->entries;
+    int64_t start;
+    int i;
 
     if (!entries || !field) return;
 
+    for (i = 0; i < p->spin_count; i++)
+        if (row_ready(entries, field, shift))
+            return;
+    if (row_ready(entries, field, shift))
+        return;
+
     thread = thread ? thread - 1 : p->thread_count - 1;
+    start  = av_gettime_relative();
 
     pthread_mutex_lock(&p->progress_mutex[thread]);
-    while ((entries[field - 1] - entries[field]) < shift){
+    /* the row above reads the flag after updating its counter */
+    avpriv_atomic_int_set((int *)&entries[field].waiting, 1);
+    while (!row_ready(entries, field, shift))
         pthread_cond_wait(&p->progress_cond[thread], &p->progress_mutex[thread]);
-    }
+    avpriv_atomic_int_set((int *)&entries[field].waiting, 0);
     pthread_mutex_unlock(&p->progress_mutex[thread]);
+
+    entries[field].nb_stalls++;
+    entries[field].stall_time += av_gettime_relative() - start;
 }
 
 int ff_alloc_entries(AVCodecContext *avctx, int count)
@@ -268,23 +321,36 @@ int ff_alloc_entries(AVCodecContext *avctx, int count)
 
     if (avctx->active_thread_type & FF_THREAD_SLICE)  {
         SliceThreadContext *p = avctx->internal->thread_ctx;
-        p->thread_count  = avctx->thread_count;
-        p->entries       = av_mallocz_array(count, sizeof(int));
 
-        p->progress_mutex = av_malloc_array(p->thread_count, sizeof(pthread_mutex_t));
-        p->progress_cond  = av_malloc_array(p->thread_count, sizeof(pthread_cond_t));
-
-        if (!p->entries || !p->progress_mutex || !p->progress_cond) {
+        if (count > p->entries_allocated) {
             av_freep(&p->entries);
-            av_freep(&p->progress_mutex);
-            av_freep(&p->progress_cond);
-            return AVERROR(ENOMEM);
+            p->entries = av_mallocz_array(count, sizeof(RowProgress));
+            if (!p->entries) {
+                p->entries_allocated = p->entries_count = 0;
+                return AVERROR(ENOMEM);
+            }
+            p->entries_allocated = count;
         }
-        p->entries_count  = count;
+        p->entries_count = count;
+
+        if (!p->progress_mutex) {
+            p->thread_count   = avctx->thread_count;
+            p->spin_count     = p->thread_count <= av_cpu_count() ? WPP_SPIN_COUNT : 0;
+            p->progress_mutex = av_malloc_array(p->thread_count, sizeof(pthread_mutex_t));
+            p->progress_cond  = av_malloc_array(p->thread_count, sizeof(pthread_cond_t));
+
+            if (!p->progress_mutex || !p->progress_cond) {
+                av_freep(&p->entries);
+                av_freep(&p->progress_mutex);
+                av_freep(&p->progress_cond);
+                p->entries_allocated = p->entries_count = 0;
+                return AVERROR(ENOMEM);
+            }
 
-        for (i = 0; i < p->thread_count; i++) {
-            pthread_mutex_init(&p->progress_mutex[i], NULL);
-            pthread_cond_init(&p->progress_cond[i], NULL);
+            for (i = 0; i < p->thread_count; i++) {
+                pthread_mutex_init(&p->progress_mutex[i], NULL);
+                pthread_cond_init(&p->progress_cond[i], NULL);
+            }
         }
     }
 
@@ -294,6 +360,26 @@ int ff_alloc_entries(AVCodecContext *avctx, int count)
 void ff_reset_entries(AVCodecContext *avctx)
 {
     SliceThreadContext *p = avctx->internal->thread_ctx;
-    if (p)
-        memset(p->entries, 0, p->entries_count * sizeof(int));
+    if (p && p->entries)
+        memset(p->entries, 0, p->entries_count * sizeof(RowProgress));
+}
+
+void ff_thread_log_wpp_stats(AVCodecContext *avctx)
+{
+    SliceThreadContext *p = avctx->internal->thread_ctx;
+    int64_t stall_time = 0;
+    int i, nb_stalls = 0;
+
+    if (!p || !p->entries || !(avctx->active_thread_type & FF_THREAD_SLICE))
+        return;
+
+    for (i = 0; i < p->entries_count; i++) {
+        if (p->entries[i].nb_stalls)
+            av_log(avctx, AV_LOG_DEBUG, "WPP row %d: %d stalls, %"PRId64" us\n",
+                   i, p->entries[i].nb_stalls, p->entries[i].stall_time);
+        nb_stalls  += p->entries[i].nb_stalls;
+        stall_time += p->entries[i].stall_time;
+    }
+    av_log(avctx, AV_LOG_DEBUG, "WPP slice: %d rows, %d stalls, %"PRId64" us stalled\n",
+           p->entries_count, nb_stalls, stall_time);
 }
@@ -36,8 +36,8 @@
 typedef struct ThreadFrame {
     AVFrame *f;
     AVCodecContext *owner;
-    // progress->data is an array of 2 ints holding progress for top/bottom
-    // fields
+    // progress->data is an array of 4 ints holding progress for top/bottom
+    // fields, then the lowest progress awaited on each of them
     AVBufferRef *progress;
 } ThreadFrame;
 
@@ -150,15 +150,10 @@ int ff_alloc_entries(AVCodecContext *avctx, int count);
 void ff_reset_entries(AVCodecContext *avctx);
 void ff_thread_report_progress2(AVCodecContext *avctx, int field, int thread, int n);
 void ff_thread_await_progress2(AVCodecContext *avctx,  int field, int thread, int shift);
-
-void ff_thread_report_progress_slice(AVCodecContext *avctx);
-void ff_thread_await_progress_slice(AVCodecContext *avctx);
-void ff_thread_set_slice_flag(AVCodecContext *avctx, int flag);
-
-
-void ff_thread_await_progress_slice2(AVCodecContext *avctx, int i);
-void ff_thread_report_progress_slice2(AVCodecContext *avctx, int i);
-void ff_init_flags(AVCodecContext *avctx);
-
+/**
+ * Log at debug level how often and how long each WPP row of the last slice
+ * waited for the row above.
+ */
+void ff_thread_log_wpp_stats(AVCodecContext *avctx);
 
 #endif /* AVCODEC_THREAD_H */
@@ -3731,6 +3731,10 @@ void ff_thread_report_progress2(AVCodecContext *avctx, int field, int thread, in
 {
 }
 
+void ff_thread_log_wpp_stats(AVCodecContext *avctx)
+{
+}
+
 #endif
 
 enum AVMediaType avcodec_get_type(enum AVCodecID codec_id)
@@ -130,7 +130,7 @@ void av_write_image_line(const uint16_t *src,
 #if !FF_API_PIX_FMT_DESC
 static
 #endif
-//MvDecoder: only support yuv420p
+//MvDecoder: only support yuv420p and yuv420p10
 const AVPixFmtDescriptor av_pix_fmt_descriptors[AV_PIX_FMT_NB] = {
     [AV_PIX_FMT_YUV420P] = {
         .name = "yuv420p",
@@ -1206,25 +1206,27 @@ const AVPixFmtDescriptor av_pix_fmt_descriptors[AV_PIX_FMT_NB] = {
     },
     [AV_PIX_FMT_YUV420P10LE] = {
         .name = "yuv420p10le",
-        .nb_components = 3,
+        .nb_components = 7,
         .log2_chroma_w = 1,
         .log2_chroma_h = 1,
         .comp = {
             { 0, 1, 1, 0, 9 },        /* Y */
             { 1, 1, 1, 0, 9 },        /* U */
             { 2, 1, 1, 0, 9 },        /* V */
+            { 3, 1, 1, 0, 9 },        /* MV */
         },
         .flags = AV_PIX_FMT_FLAG_PLANAR,
     },
     [AV_PIX_FMT_YUV420P10BE] = {
         .name = "yuv420p10be",
-        .nb_components = 3,
+        .nb_components = 7,
         .log2_chroma_w = 1,
         .log2_chroma_h = 1,
         .comp = {
             { 0, 1, 1, 0, 9 },        /* Y */
             { 1, 1, 1, 0, 9 },        /* U */
             { 2, 1, 1, 0, 9 },        /* V */
+            { 3, 1, 1, 0, 9 },        /* MV */
         },
         .flags = AV_PIX_FMT_FLAG_BE | AV_PIX_FMT_FLAG_PLANAR,
     },
@@ -51,7 +51,7 @@ void print_usage() {
     printf(usage, program);
     printf("     -a : disable AU\n");
     printf("     -c : no check md5\n");
-    printf("     -f <thread type> (1: frame, 2: slice, 4: frameslice)\n");
+    printf("     -f <thread type> (1: frame, 2: slice, 4: frameslice, 8: auto)\n");
     printf("     -i <input file>\n");
     printf("     -n : no display\n");
     printf("     -o <output file>\n");
@@ -61,6 +61,23 @@ void print_usage() {
     printf("     -l <Quality layer id> \n");
     printf("     -s <num> Stop after num frames \n");
     printf("     -r <num> Frame rate (FPS) \n");
+    printf("     -x <index file> Write the AU index (csv) of the input and exit without decoding \n");
+    printf("     -b <offset> Start decoding at the IRAP AU found at this byte offset (see -x) \n");
+    printf("     -B <num> Output frames from num on (seeks to the closest preceding IRAP) \n");
+    printf("     -E <num> Output frames up to num (included) \n");
+    printf("     -u : -B and -E are PTS in the stream time base instead of frame indices \n");
+    printf("     -A <cpus> Run the decoding threads on these CPUs (e.g. 0-7,16-23) \n");
+    printf("     -P : Decode the independent slices of a picture in parallel (-f 2 or 4) \n");
+    printf("     -L : Run the in-loop filters on a thread of their own (-f 2 or 4) \n");
+    printf("     -e : Extend the reference picture borders once instead of per MC block \n");
+    printf("     -M : Append the CU syntax maps to the MV planes \n");
+    printf("     -g <mode> Fit the camera motion of each frame (2: also remove it from the MVs) \n");
+    printf("     -I <csv file> Write the activity of each frame (parse only, no YUV output) \n");
+    printf("     -C <file> Write the dequantized TU coefficients of each frame \n");
+    printf("     -T : With -C, parse only (no inverse transform) \n");
+    printf("     -K <file> Write the motion of each frame accumulated back to its anchor frame \n");
+    printf("     -H <csv file> Write the CRC-32 of each plane of each frame \n");
+    printf("     -G <csv file> Compare the CRCs of each frame with this file of -H, exit with 1 if they differ \n");
 }
 
 /*
@@ -132,7 +149,7 @@ int getopt(int nargc, char * const *nargv, const char *ostr) {
 void init_main(int argc, char *argv[]) {
     // every command line option must be followed by ':' if it takes an
     // argument, and '::' if this argument is optional
-    const char *ostr = "achi:no:p:f:s:t:wl:r:";
+    const char *ostr = "achi:no:p:f:s:t:wl:r:x:b:B:E:uA:PLeMg:I:C:TK:H:G:";
 
     int c;
     check_md5_flags   = ENABLE;
@@ -146,6 +163,23 @@ void init_main(int argc, char *argv[]) {
     quality_layer_id  = 0; // Base layer
     num_frames        = 0;
     frame_rate        = 0;
+    index_file        = NULL;
+    start_offset      = -1;
+    range_start       = -1;
+    range_end         = -1;
+    range_pts         = DISABLE;
+    cpu_affinity      = NULL;
+    parallel_slices   = DISABLE;
+    parallel_filters  = DISABLE;
+    pad_refs          = DISABLE;
+    syntax_maps       = DISABLE;
+    global_motion     = DISABLE;
+    activity_file     = NULL;
+    coeff_file        = NULL;
+    acc_file          = NULL;
+    checksum_file     = NULL;
+    golden_file       = NULL;
+    parse_only        = DISABLE;
 
     program           = argv[0];
     
@@ -158,7 +192,7 @@ void init_main(int argc, char *argv[]) {
             break;
         case 'f':
             thread_type = atoi(optarg);
-            if (thread_type!=1 && thread_type!=2 && thread_type!=4) {
+            if (thread_type!=1 && thread_type!=2 && thread_type!=4 && thread_type!=8) {
                 print_usage();
                 exit(1);
             }
@@ -192,6 +226,57 @@ void init_main(int argc, char *argv[]) {
         case 'r':
             frame_rate = atoi(optarg);
             break;
+        case 'x':
+            index_file = strdup(optarg);
+            break;
+        case 'b':
+            start_offset = strtoll(optarg, NULL, 10);
+            break;
+        case 'B':
+            range_start = strtoll(optarg, NULL, 10);
+            break;
+        case 'E':
+            range_end = strtoll(optarg, NULL, 10);
+            break;
+        case 'u':
+            range_pts = ENABLE;
+            break;
+        case 'A':
+            cpu_affinity = strdup(optarg);
+            break;
+        case 'P':
+            parallel_slices = ENABLE;
+            break;
+        case 'L':
+            parallel_filters = ENABLE;
+            break;
+        case 'e':
+            pad_refs = ENABLE;
+            break;
+        case 'M':
+            syntax_maps = ENABLE;
+            break;
+        case 'g':
+            global_motion = atoi(optarg);
+            break;
+        case 'I':
+            activity_file = strdup(optarg);
+            break;
+        case 'C':
+            coeff_file = strdup(optarg);
+            break;
+        case 'T':
+            parse_only = ENABLE;
+            break;
+        case 'K':
+            acc_file = strdup(optarg);
+            break;
+        case 'H':
+            checksum_file = strdup(optarg);
+            break;
+        case 'G':
+            golden_file = strdup(optarg);
+            break;
         default:
             print_usage();
             exit(1);
@@ -200,4 +285,8 @@ void init_main(int argc, char *argv[]) {
 
         c = getopt(argc, argv, ostr);
     }
+    if (range_end >= 0 && range_start < 0)
+        range_start = 0;
+    if (range_start >= 0 && range_end < 0)
+        range_end = INT64_MAX;
 }
@@ -33,6 +33,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
 
 #define	BADCH	(int)'?'
 #define	BADARG	(int)':'
@@ -53,6 +54,23 @@ int quality_layer_id;
 int no_cropping;
 int num_frames;
 int frame_rate;
+char *index_file;
+int64_t start_offset;
+int64_t range_start;
+int64_t range_end;
+int range_pts;
+char *cpu_affinity;
+int parallel_slices;
+int parallel_filters;
+int pad_refs;
+int syntax_maps;
+int global_motion;
+char *activity_file;
+char *coeff_file;
+char *acc_file;
+char *checksum_file;
+char *golden_file;
+int parse_only;
 
 // initialize APR and parse command-line options
 void init_main(int argc, char *argv[]);
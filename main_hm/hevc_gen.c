@@ -0,0 +1,2016 @@
+//
+//  hevc_gen.c
+//  libavHEVC
+//
+//  Synthetic HEVC Main profile bitstream generator. Every syntax element is
+//  drawn from a seeded PRNG, so the same command line always produces the
+//  same stream; the stream is only meant to be decoded (benchmarks, thread
+//  mode comparisons), the pictures themselves are noise.
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "libavutil/common.h"
+#include "libavcodec/cabac.h"
+#include "libavcodec/cabac_functions.h"
+#include "libavcodec/golomb.h"
+#include "libavcodec/put_bits.h"
+
+#define MAX_DPB_SIZE   16
+#define MAX_REFS        4
+#define MAX_GOP_SIZE   16
+#define MAX_TILES      20
+#define LOG2_MIN_TB     2
+#define POC_LSB_BITS    8
+
+enum NALUnitType {
+    NAL_TRAIL_N  =  0,
+    NAL_TRAIL_R  =  1,
+    NAL_IDR_N_LP = 20,
+    NAL_VPS      = 32,
+    NAL_SPS      = 33,
+    NAL_PPS      = 34,
+};
+
+enum SliceType {
+    B_SLICE = 0,
+    P_SLICE = 1,
+    I_SLICE = 2,
+};
+
+enum PredMode {
+    MODE_INTER = 0,
+    MODE_INTRA,
+    MODE_SKIP,
+};
+
+enum PartMode {
+    PART_2Nx2N = 0,
+    PART_2NxN,
+    PART_Nx2N,
+    PART_NxN,
+    PART_2NxnU,
+    PART_2NxnD,
+    PART_nLx2N,
+    PART_nRx2N,
+};
+
+enum InterPredIdc {
+    PRED_L0 = 0,
+    PRED_L1,
+    PRED_BI,
+};
+
+enum ScanType {
+    SCAN_DIAG = 0,
+    SCAN_HORIZ,
+    SCAN_VERT,
+};
+
+#define INTRA_PLANAR   0
+#define INTRA_DC       1
+#define INTRA_ANGULAR_26 26
+
+/**
+ * Offsets of the syntax elements in the context state array. The layout is
+ * private to the generator, only the init values have to match the decoder.
+ */
+enum SyntaxContext {
+    CTX_SAO_MERGE      = 0,
+    CTX_SAO_TYPE       = CTX_SAO_MERGE      + 1,
+    CTX_SPLIT_CU       = CTX_SAO_TYPE       + 1,
+    CTX_SKIP           = CTX_SPLIT_CU       + 3,
+    CTX_CU_QP_DELTA    = CTX_SKIP           + 3,
+    CTX_PRED_MODE      = CTX_CU_QP_DELTA    + 2,
+    CTX_PART_MODE      = CTX_PRED_MODE      + 1,
+    CTX_PREV_INTRA     = CTX_PART_MODE      + 4,
+    CTX_CHROMA_MODE    = CTX_PREV_INTRA     + 1,
+    CTX_MERGE_FLAG     = CTX_CHROMA_MODE    + 1,
+    CTX_MERGE_IDX      = CTX_MERGE_FLAG     + 1,
+    CTX_INTER_PRED_IDC = CTX_MERGE_IDX      + 1,
+    CTX_REF_IDX        = CTX_INTER_PRED_IDC + 5,
+    CTX_MVD_GT0        = CTX_REF_IDX        + 2,
+    CTX_MVD_GT1        = CTX_MVD_GT0        + 1,
+    CTX_MVP_FLAG       = CTX_MVD_GT1        + 1,
+    CTX_RQT_ROOT_CBF   = CTX_MVP_FLAG       + 1,
+    CTX_SPLIT_TU       = CTX_RQT_ROOT_CBF   + 1,
+    CTX_CBF_LUMA       = CTX_SPLIT_TU       + 3,
+    CTX_CBF_CHROMA     = CTX_CBF_LUMA       + 2,
+    CTX_LAST_X         = CTX_CBF_CHROMA     + 4,
+    CTX_LAST_Y         = CTX_LAST_X         + 18,
+    CTX_CSBF           = CTX_LAST_Y         + 18,
+    CTX_SIG            = CTX_CSBF           + 4,
+    CTX_GT1            = CTX_SIG            + 42,
+    CTX_GT2            = CTX_GT1            + 24,
+    NB_CONTEXTS        = CTX_GT2            + 6,
+};
+
+#define CNU 154
+/**
+ * Context init values for each init_type (I, P, B), in SyntaxContext order.
+ */
+static const uint8_t init_values[3][NB_CONTEXTS] = {
+    { // I
+        153,                                    // sao_merge
+        200,                                    // sao_type_idx
+        139, 141, 157,                          // split_cu_flag
+        CNU, CNU, CNU,                          // cu_skip_flag
+        154, 154,                               // cu_qp_delta_abs
+        CNU,                                    // pred_mode_flag
+        184, CNU, CNU, CNU,                     // part_mode
+        184,                                    // prev_intra_luma_pred_flag
+        63,                                     // intra_chroma_pred_mode
+        CNU,                                    // merge_flag
+        CNU,                                    // merge_idx
+        CNU, CNU, CNU, CNU, CNU,                // inter_pred_idc
+        CNU, CNU,                               // ref_idx
+        CNU,                                    // abs_mvd_greater0_flag
+        CNU,                                    // abs_mvd_greater1_flag
+        CNU,                                    // mvp_lx_flag
+        CNU,                                    // rqt_root_cbf
+        153, 138, 138,                          // split_transform_flag
+        111, 141,                               // cbf_luma
+        94, 138, 182, 154,                      // cbf_cb, cbf_cr
+        // last_sig_coeff_x_prefix
+        110, 110, 124, 125, 140, 153, 125, 127, 140, 109, 111, 143, 127, 111,
+        79, 108, 123, 63,
+        // last_sig_coeff_y_prefix
+        110, 110, 124, 125, 140, 153, 125, 127, 140, 109, 111, 143, 127, 111,
+        79, 108, 123, 63,
+        91, 171, 134, 141,                      // coded_sub_block_flag
+        // sig_coeff_flag
+        111, 111, 125, 110, 110, 94, 124, 108, 124, 107, 125, 141, 179, 153,
+        125, 107, 125, 141, 179, 153, 125, 107, 125, 141, 179, 153, 125, 140,
+        139, 182, 182, 152, 136, 152, 136, 153, 136, 139, 111, 136, 139, 111,
+        // coeff_abs_level_greater1_flag
+        140, 92, 137, 138, 140, 152, 138, 139, 153, 74, 149, 92, 139, 107,
+        122, 152, 140, 179, 166, 182, 140, 227, 122, 197,
+        138, 153, 136, 167, 152, 152,           // coeff_abs_level_greater2_flag
+    },
+    { // P
+        153,
+        185,
+        107, 139, 126,
+        197, 185, 201,
+        154, 154,
+        149,
+        154, 139, 154, 154,
+        154,
+        152,
+        110,
+        122,
+        95, 79, 63, 31, 31,
+        153, 153,
+        140,
+        198,
+        168,
+        79,
+        124, 138, 94,
+        153, 111,
+        149, 107, 167, 154,
+        125, 110, 94, 110, 95, 79, 125, 111, 110, 78, 110, 111, 111, 95,
+        94, 108, 123, 108,
+        125, 110, 94, 110, 95, 79, 125, 111, 110, 78, 110, 111, 111, 95,
+        94, 108, 123, 108,
+        121, 140, 61, 154,
+        155, 154, 139, 153, 139, 123, 123, 63, 153, 166, 183, 140, 136, 153,
+        154, 166, 183, 140, 136, 153, 154, 166, 183, 140, 136, 153, 154, 170,
+        153, 123, 123, 107, 121, 107, 121, 167, 151, 183, 140, 151, 183, 140,
+        154, 196, 196, 167, 154, 152, 167, 182, 182, 134, 149, 136, 153, 121,
+        136, 137, 169, 194, 166, 167, 154, 167, 137, 182,
+        107, 167, 91, 122, 107, 167,
+    },
+    { // B
+        153,
+        160,
+        107, 139, 126,
+        197, 185, 201,
+        154, 154,
+        134,
+        154, 139, 154, 154,
+        183,
+        152,
+        154,
+        137,
+        95, 79, 63, 31, 31,
+        153, 153,
+        169,
+        198,
+        168,
+        79,
+        224, 167, 122,
+        153, 111,
+        149, 92, 167, 154,
+        125, 110, 124, 110, 95, 94, 125, 111, 111, 79, 125, 126, 111, 111,
+        79, 108, 123, 93,
+        125, 110, 124, 110, 95, 94, 125, 111, 111, 79, 125, 126, 111, 111,
+        79, 108, 123, 93,
+        121, 140, 61, 154,
+        170, 154, 139, 153, 139, 123, 123, 63, 124, 166, 183, 140, 136, 153,
+        154, 166, 183, 140, 136, 153, 154, 166, 183, 140, 136, 153, 154, 170,
+        153, 138, 138, 122, 121, 122, 121, 167, 151, 183, 140, 151, 183, 140,
+        154, 196, 167, 167, 154, 152, 167, 182, 182, 134, 149, 136, 153, 121,
+        136, 122, 169, 208, 166, 167, 154, 152, 167, 182,
+        107, 167, 91, 107, 107, 167,
+    },
+};
+
+/**
+ * Command line parameters, all in percent unless stated otherwise.
+ */
+typedef struct GenParams {
+    char *output;
+    int width;
+    int height;
+    int frames;
+    int ctb_size;
+    int min_cb_size;
+    int intra_period;   ///< frames between IDR pictures, 0: only the first one
+    int gop_size;       ///< 1: low delay, > 1: hierarchical with reordering
+    int refs;           ///< reference pictures in each direction
+    int bframes;        ///< B slices instead of P slices
+    int slices;
+    int tile_cols;
+    int tile_rows;
+    int wpp;
+    int split_cu;
+    int split_tu;
+    int skip;
+    int intra;
+    int merge;
+    int part;           ///< non 2Nx2N inter partitions
+    int amp;
+    int mvd;            ///< mean |mvd| in quarter samples
+    int residual;       ///< residual density
+    int qp;
+    int dqp;            ///< max |cu_qp_delta|, 0 disables it
+    int sao;
+    int merge_cand;
+    int seed;
+} GenParams;
+
+typedef struct GenPicture {
+    int poc;            ///< within its IDR period
+    int nal_type;
+    int slice_type;
+    int nb_refs;        ///< NumPicTotalCurr
+    int ref_poc[2 * MAX_REFS];
+    int nb_rps;
+    int rps_poc[MAX_DPB_SIZE];
+    int rps_used[MAX_DPB_SIZE];
+} GenPicture;
+
+typedef struct GenCU {
+    int x0;
+    int y0;
+    int log2_cb_size;
+    int depth;
+    int pred_mode;
+    int part_mode;
+    int intra_split;
+    int max_trafo_depth;
+    int merge_flag;
+    int intra_mode[4];
+    int intra_mode_c;
+    int intra_mode_tu;  ///< luma intra mode of the PU the current TU is in
+} GenCU;
+
+typedef struct HEVCGenContext {
+    GenParams p;
+    uint64_t rng;
+
+    int coded_width;
+    int coded_height;
+    int log2_ctb_size;
+    int log2_min_cb_size;
+    int log2_max_tb_size;
+    int max_trafo_depth_inter;
+    int max_trafo_depth_intra;
+    int diff_cu_qp_delta_depth;
+    int level_idc;
+    int ctb_width;
+    int ctb_height;
+    int nb_ctbs;
+    int min_cb_width;
+    int min_pu_width;
+
+    int col_bd[MAX_TILES + 1];
+    int row_bd[MAX_TILES + 1];
+    int *ctb_addr_rs_to_ts;
+    int *ctb_addr_ts_to_rs;
+    int *tile_id;       ///< indexed by ts
+
+    GenPicture *pics;   ///< in decoding order
+    int nb_pics;
+    int num_reorder;
+    int max_dec_pic_buffering;
+
+    int *slice_addr;    ///< slice address of each coded CTB, by rs
+    uint8_t *ct_depth;
+    uint8_t *skip_flag;
+    uint8_t *ipm;
+
+    const GenPicture *pic;
+    int cur_slice_addr;
+    int ctb_left_flag;
+    int ctb_up_flag;
+    int is_cu_qp_delta_coded;
+
+    CABACContext cc;
+    uint8_t state[NB_CONTEXTS];
+    uint8_t wpp_state[NB_CONTEXTS];
+    uint8_t *slice_buf;
+    int slice_buf_size;
+    int *entry_size;
+
+    FILE *out;
+    int64_t bytes;
+} HEVCGenContext;
+
+static uint8_t scan_pos[4][3][64][2];   ///< [log2 of the block size][scan_idx][n] = (x, y)
+
+static const GenParams default_params = {
+    .width        = 416,
+    .height       = 240,
+    .frames       = 30,
+    .ctb_size     = 64,
+    .min_cb_size  = 8,
+    .gop_size     = 1,
+    .refs         = 2,
+    .bframes      = 1,
+    .slices       = 1,
+    .tile_cols    = 1,
+    .tile_rows    = 1,
+    .split_cu     = 50,
+    .split_tu     = 30,
+    .skip         = 30,
+    .intra        = 10,
+    .merge        = 40,
+    .part         = 30,
+    .amp          = 1,
+    .mvd          = 16,
+    .residual     = 30,
+    .qp           = 32,
+    .sao          = 1,
+    .merge_cand   = 5,
+    .seed         = 1,
+};
+
+static GenParams params;
+
+typedef struct GenOption {
+    const char *name;
+    int *value;
+    int min;
+    int max;
+    const char *help;
+} GenOption;
+
+static const GenOption options[] = {
+    { "w",          &params.width,        8, 8192, "picture width" },
+    { "h",          &params.height,       8, 4320, "picture height" },
+    { "n",          &params.frames,       1, 1 << 20, "number of frames" },
+    { "ctb",        &params.ctb_size,    16,   64, "CTB size (16, 32 or 64)" },
+    { "min-cb",     &params.min_cb_size,  8,   64, "minimum CB size (8 to the CTB size)" },
+    { "intra",      &params.intra_period, 0, 1 << 20, "IDR period in frames (0: only the first frame)" },
+    { "gop",        &params.gop_size,     1, MAX_GOP_SIZE, "GOP size (1: low delay, > 1: hierarchical)" },
+    { "refs",       &params.refs,         1, MAX_REFS, "reference pictures in each direction" },
+    { "b",          &params.bframes,      0,    1, "B slices (0: P slices)" },
+    { "slices",     &params.slices,       1, 1 << 16, "slices per picture" },
+    { "tile-cols",  &params.tile_cols,    1, MAX_TILES, "tile columns" },
+    { "tile-rows",  &params.tile_rows,    1, MAX_TILES, "tile rows" },
+    { "wpp",        &params.wpp,          0,    1, "wavefront parallel processing" },
+    { "split",      &params.split_cu,     0,  100, "% of split coding quadtree nodes" },
+    { "tu-split",   &params.split_tu,     0,  100, "% of split transform tree nodes" },
+    { "skip",       &params.skip,         0,  100, "% of skipped CUs" },
+    { "intra-cu",   &params.intra,        0,  100, "% of intra CUs in P and B slices" },
+    { "merge",      &params.merge,        0,  100, "% of merged PUs" },
+    { "part",       &params.part,         0,  100, "% of CUs with more than one PU" },
+    { "amp",        &params.amp,          0,    1, "asymmetric motion partitions" },
+    { "mvd",        &params.mvd,          0, 1 << 12, "mean |mvd| in quarter samples" },
+    { "res",        &params.residual,     0,  100, "% residual density" },
+    { "qp",         &params.qp,           0,   51, "slice QP" },
+    { "dqp",        &params.dqp,          0,   25, "max |cu_qp_delta| (0: disabled)" },
+    { "sao",        &params.sao,          0,    1, "sample adaptive offset" },
+    { "merge-cand", &params.merge_cand,   1,    5, "merge candidates" },
+    { "seed",       &params.seed,         0, 0x7fffffff, "PRNG seed" },
+};
+
+static void print_usage(const char *program)
+{
+    int i;
+
+    printf("%s: -o <file> [options]\n", program);
+    printf("     -o <file> output bitstream\n");
+    for (i = 0; i < FF_ARRAY_ELEMS(options); i++)
+        printf("     -%s <num> %s (%d)\n", options[i].name, options[i].help,
+               *(const int *)((const char *)&default_params +
+                              ((const char *)options[i].value - (const char *)&params)));
+}
+
+static int parse_options(int argc, char *argv[])
+{
+    int i, j;
+
+    params = default_params;
+    for (i = 1; i < argc; i++) {
+        const char *name = argv[i];
+
+        if (name[0] != '-' || i + 1 >= argc)
+            return -1;
+        name++;
+        if (!strcmp(name, "o")) {
+            params.output = argv[++i];
+            continue;
+        }
+        for (j = 0; j < FF_ARRAY_ELEMS(options); j++)
+            if (!strcmp(name, options[j].name))
+                break;
+        if (j == FF_ARRAY_ELEMS(options)) {
+            fprintf(stderr, "unknown option -%s\n", name);
+            return -1;
+        }
+        *options[j].value = atoi(argv[++i]);
+        if (*options[j].value < options[j].min || *options[j].value > options[j].max) {
+            fprintf(stderr, "-%s must be in [%d, %d]\n", name, options[j].min, options[j].max);
+            return -1;
+        }
+    }
+    if (!params.output)
+        return -1;
+    if (params.ctb_size != 16 && params.ctb_size != 32 && params.ctb_size != 64) {
+        fprintf(stderr, "-ctb must be 16, 32 or 64\n");
+        return -1;
+    }
+    if ((params.min_cb_size & (params.min_cb_size - 1)) || params.min_cb_size > params.ctb_size) {
+        fprintf(stderr, "-min-cb must be a power of 2 up to the CTB size\n");
+        return -1;
+    }
+    if ((params.width | params.height) & 1) {
+        fprintf(stderr, "the picture size must be even (4:2:0)\n");
+        return -1;
+    }
+    if (params.wpp && params.tile_cols * params.tile_rows > 1) {
+        fprintf(stderr, "tiles and wpp cannot be combined in the Main profile\n");
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * xorshift64*, the stream must not depend on the C library.
+ */
+static uint32_t gen_rand(HEVCGenContext *s)
+{
+    s->rng ^= s->rng >> 12;
+    s->rng ^= s->rng << 25;
+    s->rng ^= s->rng >> 27;
+    return (s->rng * 0x2545F4914F6CDD1DULL) >> 32;
+}
+
+static int gen_chance(HEVCGenContext *s, int percent)
+{
+    return gen_rand(s) % 100 < percent;
+}
+
+/**
+ * Laplacian distributed magnitude with the given mean.
+ */
+static int gen_magnitude(HEVCGenContext *s, int mean)
+{
+    double u = (gen_rand(s) + 1.0) / 4294967297.0;
+
+    return FFMIN((int)(-log(u) * mean), 1 << 14);
+}
+
+/* CABAC writer, see the encoder test code of libavcodec/cabac.c */
+
+static void put_cabac_bit(CABACContext *c, int b)
+{
+    put_bits(&c->pb, 1, b);
+    for (; c->outstanding_count; c->outstanding_count--)
+        put_bits(&c->pb, 1, 1 - b);
+}
+
+static void renorm_cabac_encoder(CABACContext *c)
+{
+    while (c->range < 0x100) {
+        if (c->low < 0x100) {
+            put_cabac_bit(c, 0);
+        } else if (c->low < 0x200) {
+            c->outstanding_count++;
+            c->low -= 0x100;
+        } else {
+            put_cabac_bit(c, 1);
+            c->low -= 0x200;
+        }
+        c->range += c->range;
+        c->low   += c->low;
+    }
+}
+
+static void put_cabac(HEVCGenContext *s, int ctx, int bit)
+{
+    CABACContext *c = &s->cc;
+    uint8_t *state  = &s->state[ctx];
+    int RangeLPS    = ff_h264_lps_range[2 * (c->range & 0xC0) + *state];
+
+    if (bit == (*state & 1)) {
+        c->range -= RangeLPS;
+        *state    = ff_h264_mlps_state[128 + *state];
+    } else {
+        c->low  += c->range - RangeLPS;
+        c->range = RangeLPS;
+        *state   = ff_h264_mlps_state[127 - *state];
+    }
+    renorm_cabac_encoder(c);
+}
+
+static void put_cabac_bypass(HEVCGenContext *s, int bit)
+{
+    CABACContext *c = &s->cc;
+
+    c->low += c->low;
+    if (bit)
+        c->low += c->range;
+    if (c->low < 0x200) {
+        put_cabac_bit(c, 0);
+    } else if (c->low < 0x400) {
+        c->outstanding_count++;
+        c->low -= 0x200;
+    } else {
+        put_cabac_bit(c, 1);
+        c->low -= 0x400;
+    }
+}
+
+static void put_cabac_bypass_bits(HEVCGenContext *s, int value, int nb_bits)
+{
+    while (nb_bits--)
+        put_cabac_bypass(s, (value >> nb_bits) & 1);
+}
+
+/**
+ * Code a terminating bin, a 1 also flushes the arithmetic coder (the last
+ * bit written is the rbsp_stop_one_bit / alignment bit).
+ */
+static void put_cabac_terminate(HEVCGenContext *s, int bit)
+{
+    CABACContext *c = &s->cc;
+
+    c->range -= 2;
+    if (!bit) {
+        renorm_cabac_encoder(c);
+    } else {
+        c->low  += c->range;
+        c->range = 2;
+        renorm_cabac_encoder(c);
+        put_cabac_bit(c, c->low >> 9);
+        put_bits(&c->pb, 2, ((c->low >> 7) & 3) | 1);
+        flush_put_bits(&c->pb);
+    }
+}
+
+static void put_exp_golomb_bypass(HEVCGenContext *s, int value, int k)
+{
+    while (value >= 1 << k) {
+        put_cabac_bypass(s, 1);
+        value -= 1 << k;
+        k++;
+    }
+    put_cabac_bypass(s, 0);
+    put_cabac_bypass_bits(s, value, k);
+}
+
+static void init_contexts(HEVCGenContext *s)
+{
+    const uint8_t *init = init_values[2 - s->pic->slice_type];
+    int qp = av_clip(s->p.qp, 0, 51);
+    int i;
+
+    for (i = 0; i < NB_CONTEXTS; i++) {
+        int m   = (init[i] >> 4) * 5 - 45;
+        int n   = ((init[i] & 15) << 3) - 16;
+        int pre = 2 * (((m * qp) >> 4) + n) - 127;
+
+        pre ^= pre >> 31;
+        if (pre > 124)
+            pre = 124 + (pre & 1);
+        s->state[i] = pre;
+    }
+}
+
+static void init_scan_pos(void)
+{
+    int log2_size, scan_idx, i, x, y;
+
+    for (log2_size = 0; log2_size < 4; log2_size++) {
+        int size = 1 << log2_size;
+
+        for (scan_idx = SCAN_DIAG; scan_idx <= SCAN_VERT; scan_idx++) {
+            uint8_t (*pos)[2] = scan_pos[log2_size][scan_idx];
+
+            i = 0;
+            if (scan_idx == SCAN_DIAG) {
+                x = y = 0;
+                while (i < size * size) {
+                    while (y >= 0) {
+                        if (x < size && y < size) {
+                            pos[i][0] = x;
+                            pos[i][1] = y;
+                            i++;
+                        }
+                        y--;
+                        x++;
+                    }
+                    y = x;
+                    x = 0;
+                }
+            } else {
+                for (y = 0; y < size; y++)
+                    for (x = 0; x < size; x++, i++) {
+                        pos[i][0] = scan_idx == SCAN_HORIZ ? x : y;
+                        pos[i][1] = scan_idx == SCAN_HORIZ ? y : x;
+                    }
+            }
+        }
+    }
+}
+
+/* Parameter sets */
+
+static void put_nal_unit_header(PutBitContext *pb, int nal_type)
+{
+    put_bits(pb, 1, 0);         // forbidden_zero_bit
+    put_bits(pb, 6, nal_type);
+    put_bits(pb, 6, 0);         // nuh_layer_id
+    put_bits(pb, 3, 1);         // nuh_temporal_id_plus1
+}
+
+static void put_rbsp_trailing_bits(PutBitContext *pb)
+{
+    put_bits(pb, 1, 1);
+    flush_put_bits(pb);
+}
+
+static void put_profile_tier_level(HEVCGenContext *s, PutBitContext *pb)
+{
+    put_bits(pb, 2, 0);         // general_profile_space
+    put_bits(pb, 1, 0);         // general_tier_flag
+    put_bits(pb, 5, 1);         // general_profile_idc: Main
+    put_bits(pb, 16, 0x6000);   // general_profile_compatibility_flag: Main, Main 10
+    put_bits(pb, 16, 0);
+    put_bits(pb, 1, 1);         // general_progressive_source_flag
+    put_bits(pb, 1, 0);         // general_interlaced_source_flag
+    put_bits(pb, 1, 0);         // general_non_packed_constraint_flag
+    put_bits(pb, 1, 1);         // general_frame_only_constraint_flag
+    put_bits(pb, 22, 0);        // general_reserved_zero_43bits, general_inbld_flag
+    put_bits(pb, 22, 0);
+    put_bits(pb, 8, s->level_idc);
+}
+
+static void put_sub_layer_ordering_info(HEVCGenContext *s, PutBitContext *pb)
+{
+    put_bits(pb, 1, 1);         // sub_layer_ordering_info_present_flag
+    set_ue_golomb(pb, s->max_dec_pic_buffering - 1);
+    set_ue_golomb(pb, s->num_reorder);
+    set_ue_golomb(pb, 0);       // max_latency_increase_plus1
+}
+
+static void put_vps(HEVCGenContext *s, PutBitContext *pb)
+{
+    put_nal_unit_header(pb, NAL_VPS);
+    put_bits(pb, 4, 0);         // vps_video_parameter_set_id
+    put_bits(pb, 2, 3);         // vps_reserved_three_2bits
+    put_bits(pb, 6, 0);         // vps_max_layers_minus1
+    put_bits(pb, 3, 0);         // vps_max_sub_layers_minus1
+    put_bits(pb, 1, 1);         // vps_temporal_id_nesting_flag
+    put_bits(pb, 16, 0xffff);   // vps_reserved_0xffff_16bits
+    put_profile_tier_level(s, pb);
+    put_sub_layer_ordering_info(s, pb);
+    put_bits(pb, 6, 0);         // vps_max_layer_id
+    set_ue_golomb(pb, 0);       // vps_num_layer_sets_minus1
+    put_bits(pb, 1, 0);         // vps_timing_info_present_flag
+    put_bits(pb, 1, 0);         // vps_extension_flag
+    put_rbsp_trailing_bits(pb);
+}
+
+static void put_sps(HEVCGenContext *s, PutBitContext *pb)
+{
+    int conf_right  = (s->coded_width  - s->p.width)  >> 1;
+    int conf_bottom = (s->coded_height - s->p.height) >> 1;
+
+    put_nal_unit_header(pb, NAL_SPS);
+    put_bits(pb, 4, 0);         // sps_video_parameter_set_id
+    put_bits(pb, 3, 0);         // sps_max_sub_layers_minus1
+    put_bits(pb, 1, 1);         // sps_temporal_id_nesting_flag
+    put_profile_tier_level(s, pb);
+    set_ue_golomb(pb, 0);       // sps_seq_parameter_set_id
+    set_ue_golomb(pb, 1);       // chroma_format_idc: 4:2:0
+    set_ue_golomb(pb, s->coded_width);
+    set_ue_golomb(pb, s->coded_height);
+    put_bits(pb, 1, conf_right || conf_bottom);
+    if (conf_right || conf_bottom) {
+        set_ue_golomb(pb, 0);
+        set_ue_golomb(pb, conf_right);
+        set_ue_golomb(pb, 0);
+        set_ue_golomb(pb, conf_bottom);
+    }
+    set_ue_golomb(pb, 0);       // bit_depth_luma_minus8
+    set_ue_golomb(pb, 0);       // bit_depth_chroma_minus8
+    set_ue_golomb(pb, POC_LSB_BITS - 4);
+    put_sub_layer_ordering_info(s, pb);
+    set_ue_golomb(pb, s->log2_min_cb_size - 3);
+    set_ue_golomb(pb, s->log2_ctb_size - s->log2_min_cb_size);
+    set_ue_golomb(pb, LOG2_MIN_TB - 2);
+    set_ue_golomb(pb, s->log2_max_tb_size - LOG2_MIN_TB);
+    set_ue_golomb(pb, s->max_trafo_depth_inter);
+    set_ue_golomb(pb, s->max_trafo_depth_intra);
+    put_bits(pb, 1, 0);         // scaling_list_enabled_flag
+    put_bits(pb, 1, s->p.amp);
+    put_bits(pb, 1, s->p.sao);
+    put_bits(pb, 1, 0);         // pcm_enabled_flag
+    set_ue_golomb(pb, 0);       // num_short_term_ref_pic_sets
+    put_bits(pb, 1, 0);         // long_term_ref_pics_present_flag
+    put_bits(pb, 1, 1);         // sps_temporal_mvp_enabled_flag
+    put_bits(pb, 1, 1);         // strong_intra_smoothing_enabled_flag
+    put_bits(pb, 1, 0);         // vui_parameters_present_flag
+    put_bits(pb, 1, 0);         // sps_extension_present_flag
+    put_rbsp_trailing_bits(pb);
+}
+
+static void put_pps(HEVCGenContext *s, PutBitContext *pb)
+{
+    int tiles = s->p.tile_cols * s->p.tile_rows > 1;
+
+    put_nal_unit_header(pb, NAL_PPS);
+    set_ue_golomb(pb, 0);       // pps_pic_parameter_set_id
+    set_ue_golomb(pb, 0);       // pps_seq_parameter_set_id
+    put_bits(pb, 1, 0);         // dependent_slice_segments_enabled_flag
+    put_bits(pb, 1, 0);         // output_flag_present_flag
+    put_bits(pb, 3, 0);         // num_extra_slice_header_bits
+    put_bits(pb, 1, 0);         // sign_data_hiding_enabled_flag
+    put_bits(pb, 1, 0);         // cabac_init_present_flag
+    set_ue_golomb(pb, 0);       // num_ref_idx_l0_default_active_minus1
+    set_ue_golomb(pb, 0);       // num_ref_idx_l1_default_active_minus1
+    set_se_golomb(pb, 0);       // init_qp_minus26
+    put_bits(pb, 1, 0);         // constrained_intra_pred_flag
+    put_bits(pb, 1, 0);         // transform_skip_enabled_flag
+    put_bits(pb, 1, s->p.dqp > 0);
+    if (s->p.dqp > 0)
+        set_ue_golomb(pb, s->diff_cu_qp_delta_depth);
+    set_se_golomb(pb, 0);       // pps_cb_qp_offset
+    set_se_golomb(pb, 0);       // pps_cr_qp_offset
+    put_bits(pb, 1, 0);         // pps_slice_chroma_qp_offsets_present_flag
+    put_bits(pb, 1, 0);         // weighted_pred_flag
+    put_bits(pb, 1, 0);         // weighted_bipred_flag
+    put_bits(pb, 1, 0);         // transquant_bypass_enabled_flag
+    put_bits(pb, 1, tiles);
+    put_bits(pb, 1, s->p.wpp);  // entropy_coding_sync_enabled_flag
+    if (tiles) {
+        set_ue_golomb(pb, s->p.tile_cols - 1);
+        set_ue_golomb(pb, s->p.tile_rows - 1);
+        put_bits(pb, 1, 1);     // uniform_spacing_flag
+        put_bits(pb, 1, 1);     // loop_filter_across_tiles_enabled_flag
+    }
+    put_bits(pb, 1, 1);         // pps_loop_filter_across_slices_enabled_flag
+    put_bits(pb, 1, 0);         // deblocking_filter_control_present_flag
+    put_bits(pb, 1, 0);         // pps_scaling_list_data_present_flag
+    put_bits(pb, 1, 0);         // lists_modification_present_flag
+    set_ue_golomb(pb, 0);       // log2_parallel_merge_level_minus2
+    put_bits(pb, 1, 0);         // slice_segment_header_extension_present_flag
+    put_bits(pb, 1, 0);         // pps_extension_present_flag
+    put_rbsp_trailing_bits(pb);
+}
+
+/**
+ * Write the payload with emulation prevention. The state is not carried
+ * across calls: every part of a NAL unit ends with a non-zero byte.
+ */
+static int write_escaped(HEVCGenContext *s, const uint8_t *buf, int size, int dry_run)
+{
+    int i, zeros = 0, escaped = size;
+
+    for (i = 0; i < size; i++) {
+        if (zeros >= 2 && buf[i] <= 3) {
+            if (!dry_run)
+                fputc(3, s->out);
+            escaped++;
+            zeros = 0;
+        }
+        if (!dry_run)
+            fputc(buf[i], s->out);
+        zeros = buf[i] ? 0 : zeros + 1;
+    }
+    return escaped;
+}
+
+static void write_start_code(HEVCGenContext *s)
+{
+    static const uint8_t start_code[4] = { 0, 0, 0, 1 };
+
+    fwrite(start_code, 1, 4, s->out);
+    s->bytes += 4;
+}
+
+static void write_parameter_set(HEVCGenContext *s,
+                                void (*put)(HEVCGenContext *s, PutBitContext *pb))
+{
+    uint8_t buf[256];
+    PutBitContext pb;
+
+    init_put_bits(&pb, buf, sizeof(buf));
+    put(s, &pb);
+    write_start_code(s);
+    s->bytes += write_escaped(s, buf, put_bits_count(&pb) >> 3, 0);
+}
+
+/* Picture structure */
+
+static void plan_bisect(HEVCGenContext *s, int start, int end)
+{
+    int mid = (start + end) >> 1;
+
+    if (mid == start)
+        return;
+    s->pics[s->nb_pics++].poc = mid;
+    plan_bisect(s, start, mid);
+    plan_bisect(s, mid, end);
+}
+
+/**
+ * Order the pictures of one IDR period in decoding order and derive their
+ * references: the closest past and future pictures already decoded.
+ */
+static int plan_period(HEVCGenContext *s, int nb_frames)
+{
+    GenPicture *pics = s->pics + s->nb_pics;
+    // any reference is at most this far away in decoding order
+    int window = 2 * (s->p.gop_size + s->p.refs);
+    int nb, i, j, k, base, first = s->nb_pics;
+
+    s->pics[s->nb_pics++].poc = 0;
+    for (base = 0; base < nb_frames - 1; base += s->p.gop_size) {
+        int last = FFMIN(base + s->p.gop_size, nb_frames - 1);
+
+        s->pics[s->nb_pics++].poc = last;
+        plan_bisect(s, base, last);
+    }
+    nb = s->nb_pics - first;
+
+    pics[0].nal_type   = NAL_IDR_N_LP;
+    pics[0].slice_type = I_SLICE;
+    for (i = 1; i < nb; i++) {
+        GenPicture *pic = &pics[i];
+        int before[MAX_REFS], after[MAX_REFS], nb_before = 0, nb_after = 0;
+
+        pic->slice_type = s->p.bframes ? B_SLICE : P_SLICE;
+        for (j = FFMAX(0, i - window); j < i; j++) {
+            int poc  = pics[j].poc;
+            int dist = abs(poc - pic->poc);
+            int *list    = poc < pic->poc ? before     : after;
+            int *nb_list = poc < pic->poc ? &nb_before : &nb_after;
+            int n;
+
+            if (*nb_list == s->p.refs && abs(list[*nb_list - 1] - pic->poc) <= dist)
+                continue;
+            if (*nb_list < s->p.refs)
+                (*nb_list)++;
+            for (n = *nb_list - 1; n > 0 && abs(list[n - 1] - pic->poc) > dist; n--)
+                list[n] = list[n - 1];
+            list[n] = poc;
+        }
+        pic->nb_refs = 0;
+        for (j = 0; j < nb_before; j++)
+            pic->ref_poc[pic->nb_refs++] = before[j];
+        for (j = 0; j < nb_after; j++)
+            pic->ref_poc[pic->nb_refs++] = after[j];
+    }
+
+    for (i = 1; i < nb; i++) {
+        GenPicture *pic = &pics[i];
+        int referenced  = 0;
+
+        // the RPS holds every decoded picture still referenced from here on
+        pic->nb_rps = 0;
+        for (j = FFMAX(0, i - window); j < i; j++) {
+            int needed = 0, used = 0;
+
+            for (k = i; k < FFMIN(nb, i + window); k++) {
+                int r;
+                for (r = 0; r < pics[k].nb_refs; r++)
+                    if (pics[k].ref_poc[r] == pics[j].poc) {
+                        needed = 1;
+                        used  |= k == i;
+                    }
+            }
+            if (!needed)
+                continue;
+            if (pic->nb_rps == MAX_DPB_SIZE - 1) {
+                fprintf(stderr, "the reference structure needs more than %d pictures\n",
+                        MAX_DPB_SIZE);
+                return -1;
+            }
+            pic->rps_poc[pic->nb_rps]    = pics[j].poc;
+            pic->rps_used[pic->nb_rps++] = used;
+        }
+
+        for (k = i + 1; k < FFMIN(nb, i + window) && !referenced; k++)
+            for (j = 0; j < pics[k].nb_refs; j++)
+                referenced |= pics[k].ref_poc[j] == pic->poc;
+        pic->nal_type = referenced ? NAL_TRAIL_R : NAL_TRAIL_N;
+
+        for (j = FFMAX(0, i - window), k = 0; j < i; j++)
+            k += pics[j].poc > pic->poc;
+        s->num_reorder = FFMAX(s->num_reorder, k);
+        s->max_dec_pic_buffering = FFMAX(s->max_dec_pic_buffering, pic->nb_rps + 1);
+    }
+    return 0;
+}
+
+/* Coding tree unit */
+
+static int ctb_available(HEVCGenContext *s, int ctb_addr_rs, int nb_addr_rs)
+{
+    return s->slice_addr[nb_addr_rs] == s->cur_slice_addr &&
+           s->tile_id[s->ctb_addr_rs_to_ts[nb_addr_rs]] ==
+           s->tile_id[s->ctb_addr_rs_to_ts[ctb_addr_rs]];
+}
+
+static void gen_sao(HEVCGenContext *s, int rx, int ry, int ctb_addr_rs)
+{
+    int merge_left = 0, merge_up = 0, c_idx, i;
+    int type_idx = 0, offset_abs[4];
+
+    if (rx > 0 && ctb_available(s, ctb_addr_rs, ctb_addr_rs - 1)) {
+        merge_left = gen_chance(s, 30);
+        put_cabac(s, CTX_SAO_MERGE, merge_left);
+    }
+    if (ry > 0 && !merge_left && ctb_available(s, ctb_addr_rs, ctb_addr_rs - s->ctb_width)) {
+        merge_up = gen_chance(s, 30);
+        put_cabac(s, CTX_SAO_MERGE, merge_up);
+    }
+    if (merge_left || merge_up)
+        return;
+
+    for (c_idx = 0; c_idx < 3; c_idx++) {
+        if (c_idx != 2) {
+            // 0: not applied, 1: band offset, 2: edge offset
+            type_idx = gen_rand(s) % 3;
+            put_cabac(s, CTX_SAO_TYPE, type_idx != 0);
+            if (type_idx)
+                put_cabac_bypass(s, type_idx == 2);
+        }
+        if (!type_idx)
+            continue;
+        for (i = 0; i < 4; i++) {
+            int j;
+
+            offset_abs[i] = gen_rand(s) % 8;
+            for (j = 0; j < offset_abs[i]; j++)
+                put_cabac_bypass(s, 1);
+            if (offset_abs[i] < 7)
+                put_cabac_bypass(s, 0);
+        }
+        if (type_idx == 1) {
+            for (i = 0; i < 4; i++)
+                if (offset_abs[i])
+                    put_cabac_bypass(s, gen_rand(s) & 1);    // sao_offset_sign
+            put_cabac_bypass_bits(s, gen_rand(s) & 31, 5);   // sao_band_position
+        } else if (c_idx != 2) {
+            put_cabac_bypass_bits(s, gen_rand(s) & 3, 2);    // sao_eo_class
+        }
+    }
+}
+
+static void gen_cu_qp_delta(HEVCGenContext *s)
+{
+    int delta  = (int)(gen_rand(s) % (2 * s->p.dqp + 1)) - s->p.dqp;
+    int abs_dq = FFABS(delta);
+    int prefix = FFMIN(abs_dq, 5), i;
+
+    for (i = 0; i < prefix; i++)
+        put_cabac(s, CTX_CU_QP_DELTA + !!i, 1);
+    if (prefix < 5)
+        put_cabac(s, CTX_CU_QP_DELTA + !!prefix, 0);
+    else
+        put_exp_golomb_bypass(s, abs_dq - 5, 0);
+    if (abs_dq)
+        put_cabac_bypass(s, delta < 0);
+}
+
+static int gen_level(HEVCGenContext *s)
+{
+    int level = 1;
+
+    while (level < 16 && gen_chance(s, 40))
+        level++;
+    if (gen_chance(s, 2))
+        level += gen_rand(s) % 500;
+    return level;
+}
+
+static void put_coeff_abs_level_remaining(HEVCGenContext *s, int value, int rice)
+{
+    int prefix, i;
+
+    if ((value >> rice) < 3) {
+        prefix = value >> rice;
+        for (i = 0; i < prefix; i++)
+            put_cabac_bypass(s, 1);
+        put_cabac_bypass(s, 0);
+        put_cabac_bypass_bits(s, value & ((1 << rice) - 1), rice);
+    } else {
+        for (prefix = 3; value >= ((2 << (prefix - 3)) + 2) << rice; prefix++)
+            ;
+        for (i = 0; i < prefix; i++)
+            put_cabac_bypass(s, 1);
+        put_cabac_bypass(s, 0);
+        put_cabac_bypass_bits(s, value - (((1 << (prefix - 3)) + 2) << rice),
+                              prefix - 3 + rice);
+    }
+}
+
+static void put_last_sig_coeff_prefix(HEVCGenContext *s, int ctx, int pos, int log2_size,
+                                      int c_idx, int *suffix, int *suffix_len)
+{
+    int max = (log2_size << 1) - 1;
+    int ctx_offset, ctx_shift, prefix, i;
+
+    if (!c_idx) {
+        ctx_offset = 3 * (log2_size - 2) + ((log2_size - 1) >> 2);
+        ctx_shift  = (log2_size + 1) >> 2;
+    } else {
+        ctx_offset = 15;
+        ctx_shift  = log2_size - 2;
+    }
+
+    *suffix_len = 0;
+    *suffix     = 0;
+    prefix      = pos;
+    if (pos >= 4) {
+        for (prefix = 4; ((1 << (((prefix + 1) >> 1) - 1)) * (2 + ((prefix + 1) & 1))) <= pos; prefix++)
+            ;
+        *suffix_len = (prefix >> 1) - 1;
+        *suffix     = pos - (1 << *suffix_len) * (2 + (prefix & 1));
+    }
+    for (i = 0; i < prefix; i++)
+        put_cabac(s, ctx + ctx_offset + (i >> ctx_shift), 1);
+    if (prefix < max)
+        put_cabac(s, ctx + ctx_offset + (prefix >> ctx_shift), 0);
+}
+
+static int sig_coeff_ctx(int log2_size, int c_idx, int scan_idx, int x_c, int y_c, int prev_csbf)
+{
+    static const uint8_t ctx_idx_map[16] = {
+        0, 1, 4, 5, 2, 3, 4, 5, 6, 6, 8, 8, 7, 7, 8, 8
+    };
+    int sig_ctx;
+
+    if (log2_size == 2) {
+        sig_ctx = ctx_idx_map[(y_c << 2) + x_c];
+    } else if (x_c + y_c == 0) {
+        sig_ctx = 0;
+    } else {
+        int x_p = x_c & 3, y_p = y_c & 3;
+
+        switch (prev_csbf) {
+        case 0:
+            sig_ctx = x_p + y_p == 0 ? 2 : x_p + y_p < 3 ? 1 : 0;
+            break;
+        case 1:
+            sig_ctx = y_p == 0 ? 2 : y_p == 1 ? 1 : 0;
+            break;
+        case 2:
+            sig_ctx = x_p == 0 ? 2 : x_p == 1 ? 1 : 0;
+            break;
+        default:
+            sig_ctx = 2;
+        }
+        if (!c_idx) {
+            if ((x_c >> 2) + (y_c >> 2))
+                sig_ctx += 3;
+            if (log2_size == 3)
+                sig_ctx += scan_idx == SCAN_DIAG ? 9 : 15;
+            else
+                sig_ctx += 21;
+        } else {
+            sig_ctx += log2_size == 3 ? 9 : 12;
+        }
+    }
+    return c_idx ? 27 + sig_ctx : sig_ctx;
+}
+
+static void gen_residual_coding(HEVCGenContext *s, int log2_trafo_size, int scan_idx, int c_idx)
+{
+    int nb_coeffs   = 1 << (2 * log2_trafo_size);
+    int log2_cg     = log2_trafo_size - 2;
+    int cg_size     = 1 << log2_cg;
+    int span        = 1 + (nb_coeffs - 1) * s->p.residual / 100;
+    int16_t coeffs[32 * 32];
+    uint8_t csbf[8][8] = { { 0 } };
+    const uint8_t (*scan_cg)[2] = scan_pos[log2_cg][scan_idx];
+    const uint8_t (*scan_4x4)[2] = scan_pos[2][scan_idx];
+    int last, last_cg, last_x, last_y, suffix_x, suffix_y, len_x, len_y;
+    int greater1_ctx = 1, i, n;
+
+    // coefficients in scan order, the last one is always significant
+    last = gen_rand(s) % span;
+    memset(coeffs, 0, nb_coeffs * sizeof(*coeffs));
+    for (n = 0; n <= last; n++)
+        if (n == last || gen_chance(s, s->p.residual))
+            coeffs[n] = gen_level(s);
+
+    last_cg = last >> 4;
+    last_x  = (scan_cg[last_cg][0] << 2) + scan_4x4[last & 15][0];
+    last_y  = (scan_cg[last_cg][1] << 2) + scan_4x4[last & 15][1];
+    if (scan_idx == SCAN_VERT)
+        FFSWAP(int, last_x, last_y);
+    put_last_sig_coeff_prefix(s, CTX_LAST_X, last_x, log2_trafo_size, c_idx, &suffix_x, &len_x);
+    put_last_sig_coeff_prefix(s, CTX_LAST_Y, last_y, log2_trafo_size, c_idx, &suffix_y, &len_y);
+    put_cabac_bypass_bits(s, suffix_x, len_x);
+    put_cabac_bypass_bits(s, suffix_y, len_y);
+
+    for (i = last_cg; i >= 0; i--) {
+        const int16_t *cg = coeffs + (i << 4);
+        int x_cg = scan_cg[i][0], y_cg = scan_cg[i][1];
+        int n_end = i == last_cg ? (last & 15) - 1 : 15;
+        int implicit_non_zero = 0, prev_csbf = 0;
+        int sig[16], nb_sig = 0;
+
+        if (x_cg < cg_size - 1)
+            prev_csbf += csbf[x_cg + 1][y_cg];
+        if (y_cg < cg_size - 1)
+            prev_csbf += csbf[x_cg][y_cg + 1] << 1;
+
+        if (i < last_cg && i > 0) {
+            int coded = 0;
+
+            for (n = 0; n < 16; n++)
+                coded |= cg[n] != 0;
+            put_cabac(s, CTX_CSBF + !!prev_csbf + (c_idx ? 2 : 0), coded);
+            csbf[x_cg][y_cg] = coded;
+            implicit_non_zero = coded;
+        } else {
+            csbf[x_cg][y_cg] = 1;
+        }
+
+        if (i == last_cg)
+            sig[nb_sig++] = last & 15;
+        if (csbf[x_cg][y_cg] && n_end >= 0) {
+            for (n = n_end; n >= 0; n--) {
+                int x_c = (x_cg << 2) + scan_4x4[n][0];
+                int y_c = (y_cg << 2) + scan_4x4[n][1];
+
+                if (!n && implicit_non_zero) {
+                    sig[nb_sig++] = 0;
+                    break;
+                }
+                put_cabac(s, CTX_SIG + sig_coeff_ctx(log2_trafo_size, c_idx, scan_idx,
+                                                     x_c, y_c, prev_csbf), cg[n] != 0);
+                if (cg[n]) {
+                    sig[nb_sig++] = n;
+                    implicit_non_zero = 0;
+                }
+            }
+        }
+
+        if (nb_sig) {
+            int ctx_set = i > 0 && !c_idx ? 2 : 0;
+            int first_greater1 = -1, rice = 0, m;
+
+            if (i != last_cg && !greater1_ctx)
+                ctx_set++;
+            greater1_ctx = 1;
+            for (m = 0; m < FFMIN(nb_sig, 8); m++) {
+                int greater1 = cg[sig[m]] > 1;
+
+                put_cabac(s, CTX_GT1 + (ctx_set << 2) + greater1_ctx + (c_idx ? 16 : 0), greater1);
+                if (greater1) {
+                    greater1_ctx = 0;
+                    if (first_greater1 < 0)
+                        first_greater1 = m;
+                } else if (greater1_ctx > 0 && greater1_ctx < 3) {
+                    greater1_ctx++;
+                }
+            }
+            if (first_greater1 >= 0)
+                put_cabac(s, CTX_GT2 + ctx_set + (c_idx ? 4 : 0), cg[sig[first_greater1]] > 2);
+            for (m = 0; m < nb_sig; m++)
+                put_cabac_bypass(s, gen_rand(s) & 1);    // coeff_sign_flag
+            for (m = 0; m < nb_sig; m++) {
+                int level = cg[sig[m]];
+                int base  = 1;
+
+                if (m < 8) {
+                    base = m == first_greater1 ? 3 : 2;
+                    if (FFMIN(level, base) != base)
+                        continue;
+                }
+                put_coeff_abs_level_remaining(s, level - base, rice);
+                if (level > 3 << rice)
+                    rice = FFMIN(rice + 1, 4);
+            }
+        }
+    }
+}
+
+static int intra_scan_idx(int mode)
+{
+    if (mode >= 6 && mode <= 14)
+        return SCAN_VERT;
+    if (mode >= 22 && mode <= 30)
+        return SCAN_HORIZ;
+    return SCAN_DIAG;
+}
+
+static void gen_transform_unit(HEVCGenContext *s, GenCU *cu, int log2_trafo_size, int blk_idx,
+                               int cbf_luma, int cbf_cb, int cbf_cr)
+{
+    int scan_idx = SCAN_DIAG, scan_idx_c = SCAN_DIAG;
+
+    if (!cbf_luma && !cbf_cb && !cbf_cr)
+        return;
+    if (s->p.dqp && !s->is_cu_qp_delta_coded) {
+        gen_cu_qp_delta(s);
+        s->is_cu_qp_delta_coded = 1;
+    }
+    if (cu->pred_mode == MODE_INTRA && log2_trafo_size < 4) {
+        scan_idx   = intra_scan_idx(cu->intra_mode_tu);
+        scan_idx_c = intra_scan_idx(cu->intra_mode_c);
+    }
+    if (cbf_luma)
+        gen_residual_coding(s, log2_trafo_size, scan_idx, 0);
+    if (log2_trafo_size > 2) {
+        if (cbf_cb)
+            gen_residual_coding(s, log2_trafo_size - 1, scan_idx_c, 1);
+        if (cbf_cr)
+            gen_residual_coding(s, log2_trafo_size - 1, scan_idx_c, 2);
+    } else if (blk_idx == 3) {
+        if (cbf_cb)
+            gen_residual_coding(s, 2, scan_idx_c, 1);
+        if (cbf_cr)
+            gen_residual_coding(s, 2, scan_idx_c, 2);
+    }
+}
+
+static void gen_transform_tree(HEVCGenContext *s, GenCU *cu, int log2_trafo_size,
+                               int trafo_depth, int blk_idx, int cbf_cb, int cbf_cr)
+{
+    int split;
+
+    if (!trafo_depth || (cu->intra_split && trafo_depth == 1))
+        cu->intra_mode_tu = cu->intra_mode[blk_idx];
+    if (log2_trafo_size <= s->log2_max_tb_size && log2_trafo_size > LOG2_MIN_TB &&
+        trafo_depth < cu->max_trafo_depth && !(cu->intra_split && !trafo_depth)) {
+        split = gen_chance(s, s->p.split_tu);
+        put_cabac(s, CTX_SPLIT_TU + 5 - log2_trafo_size, split);
+    } else {
+        int inter_split = !s->max_trafo_depth_inter && cu->pred_mode == MODE_INTER &&
+                          cu->part_mode != PART_2Nx2N && !trafo_depth;
+
+        split = log2_trafo_size > s->log2_max_tb_size ||
+                (cu->intra_split && !trafo_depth) || inter_split;
+    }
+
+    if (log2_trafo_size > 2) {
+        if (!trafo_depth || cbf_cb) {
+            cbf_cb = gen_chance(s, s->p.residual);
+            put_cabac(s, CTX_CBF_CHROMA + trafo_depth, cbf_cb);
+        }
+        if (!trafo_depth || cbf_cr) {
+            cbf_cr = gen_chance(s, s->p.residual);
+            put_cabac(s, CTX_CBF_CHROMA + trafo_depth, cbf_cr);
+        }
+    }
+
+    if (split) {
+        for (blk_idx = 0; blk_idx < 4; blk_idx++)
+            gen_transform_tree(s, cu, log2_trafo_size - 1, trafo_depth + 1, blk_idx,
+                               cbf_cb, cbf_cr);
+    } else {
+        int cbf_luma = 1;
+
+        if (cu->pred_mode == MODE_INTRA || trafo_depth || cbf_cb || cbf_cr) {
+            cbf_luma = gen_chance(s, s->p.residual);
+            put_cabac(s, CTX_CBF_LUMA + !trafo_depth, cbf_luma);
+        }
+        gen_transform_unit(s, cu, log2_trafo_size, blk_idx, cbf_luma, cbf_cb, cbf_cr);
+    }
+}
+
+static void gen_merge_idx(HEVCGenContext *s)
+{
+    int merge_idx = gen_rand(s) % s->p.merge_cand, i;
+
+    if (s->p.merge_cand == 1)
+        return;
+    put_cabac(s, CTX_MERGE_IDX, merge_idx > 0);
+    for (i = 1; i < s->p.merge_cand - 1 && merge_idx >= i; i++)
+        put_cabac_bypass(s, merge_idx > i);
+}
+
+static void gen_ref_idx(HEVCGenContext *s, int nb_refs)
+{
+    int ref_idx = gen_rand(s) % nb_refs, i;
+
+    for (i = 0; i < nb_refs - 1 && ref_idx >= i; i++) {
+        if (i < 2)
+            put_cabac(s, CTX_REF_IDX + i, ref_idx > i);
+        else
+            put_cabac_bypass(s, ref_idx > i);
+    }
+}
+
+static void gen_mvd_coding(HEVCGenContext *s)
+{
+    int mvd[2], i;
+
+    for (i = 0; i < 2; i++)
+        mvd[i] = s->p.mvd ? gen_magnitude(s, s->p.mvd) : 0;
+    for (i = 0; i < 2; i++)
+        put_cabac(s, CTX_MVD_GT0, mvd[i] > 0);
+    for (i = 0; i < 2; i++)
+        if (mvd[i])
+            put_cabac(s, CTX_MVD_GT1, mvd[i] > 1);
+    for (i = 0; i < 2; i++) {
+        if (!mvd[i])
+            continue;
+        if (mvd[i] > 1)
+            put_exp_golomb_bypass(s, mvd[i] - 2, 1);
+        put_cabac_bypass(s, gen_rand(s) & 1);           // mvd_sign_flag
+    }
+}
+
+static void gen_prediction_unit(HEVCGenContext *s, GenCU *cu, int pb_width, int pb_height)
+{
+    int inter_pred_idc = PRED_L0, list;
+
+    cu->merge_flag = gen_chance(s, s->p.merge);
+    put_cabac(s, CTX_MERGE_FLAG, cu->merge_flag);
+    if (cu->merge_flag) {
+        gen_merge_idx(s);
+        return;
+    }
+    if (s->pic->slice_type == B_SLICE) {
+        if (pb_width + pb_height == 12) {
+            inter_pred_idc = gen_rand(s) & 1;
+            put_cabac(s, CTX_INTER_PRED_IDC + 4, inter_pred_idc);
+        } else {
+            inter_pred_idc = gen_rand(s) % 3;
+            put_cabac(s, CTX_INTER_PRED_IDC + cu->depth, inter_pred_idc == PRED_BI);
+            if (inter_pred_idc != PRED_BI)
+                put_cabac(s, CTX_INTER_PRED_IDC + 4, inter_pred_idc);
+        }
+    }
+    for (list = 0; list < 2; list++) {
+        if (inter_pred_idc == (list ? PRED_L0 : PRED_L1))
+            continue;
+        if (s->pic->nb_refs > 1)
+            gen_ref_idx(s, s->pic->nb_refs);
+        gen_mvd_coding(s);
+        put_cabac(s, CTX_MVP_FLAG, gen_rand(s) & 1);
+    }
+}
+
+static void set_ipm(HEVCGenContext *s, int x0, int y0, int size, int mode)
+{
+    int x, y;
+
+    for (y = y0 >> 2; y < (y0 + size) >> 2; y++)
+        for (x = x0 >> 2; x < (x0 + size) >> 2; x++)
+            s->ipm[y * s->min_pu_width + x] = mode;
+}
+
+static void gen_intra_prediction_unit(HEVCGenContext *s, GenCU *cu)
+{
+    static const uint8_t chroma_modes[4] = { INTRA_PLANAR, INTRA_ANGULAR_26, 10, INTRA_DC };
+    int side    = 1 + cu->intra_split;
+    int pb_size = (1 << cu->log2_cb_size) / side;
+    int ctb_mask = (1 << s->log2_ctb_size) - 1;
+    int prev_flag[4], mpm_idx[4], rem_mode[4];
+    int i, j, k, chroma_mode;
+
+    for (i = 0; i < side; i++) {
+        for (j = 0; j < side; j++) {
+            int x = cu->x0 + pb_size * j, y = cu->y0 + pb_size * i;
+            int idx  = 2 * i + j;
+            int mode = gen_rand(s) % 35;
+            int cand_left = INTRA_DC, cand_up = INTRA_DC, cand[3];
+
+            if (s->ctb_left_flag || (x & ctb_mask))
+                cand_left = s->ipm[(y >> 2) * s->min_pu_width + (x >> 2) - 1];
+            if (y & ctb_mask)
+                cand_up = s->ipm[((y >> 2) - 1) * s->min_pu_width + (x >> 2)];
+
+            if (cand_left == cand_up) {
+                if (cand_left < 2) {
+                    cand[0] = INTRA_PLANAR;
+                    cand[1] = INTRA_DC;
+                    cand[2] = INTRA_ANGULAR_26;
+                } else {
+                    cand[0] = cand_left;
+                    cand[1] = 2 + ((cand_left - 2 - 1 + 32) & 31);
+                    cand[2] = 2 + ((cand_left - 2 + 1) & 31);
+                }
+            } else {
+                cand[0] = cand_left;
+                cand[1] = cand_up;
+                if (cand_left != INTRA_PLANAR && cand_up != INTRA_PLANAR)
+                    cand[2] = INTRA_PLANAR;
+                else if (cand_left != INTRA_DC && cand_up != INTRA_DC)
+                    cand[2] = INTRA_DC;
+                else
+                    cand[2] = INTRA_ANGULAR_26;
+            }
+
+            prev_flag[idx] = 0;
+            rem_mode[idx]  = mode;
+            for (k = 0; k < 3; k++) {
+                if (cand[k] == mode) {
+                    prev_flag[idx] = 1;
+                    mpm_idx[idx]   = k;
+                }
+                rem_mode[idx] -= cand[k] < mode;
+            }
+            cu->intra_mode[idx] = mode;
+            set_ipm(s, x, y, pb_size, mode);
+        }
+    }
+
+    for (k = 0; k < side * side; k++)
+        put_cabac(s, CTX_PREV_INTRA, prev_flag[k]);
+    for (k = 0; k < side * side; k++) {
+        if (prev_flag[k]) {
+            put_cabac_bypass(s, mpm_idx[k] > 0);
+            if (mpm_idx[k] > 0)
+                put_cabac_bypass(s, mpm_idx[k] > 1);
+        } else {
+            put_cabac_bypass_bits(s, rem_mode[k], 5);
+        }
+    }
+
+    chroma_mode = gen_rand(s) % 5;
+    put_cabac(s, CTX_CHROMA_MODE, chroma_mode != 4);
+    if (chroma_mode != 4) {
+        put_cabac_bypass_bits(s, chroma_mode, 2);
+        cu->intra_mode_c = chroma_modes[chroma_mode] == cu->intra_mode[0] ?
+                           34 : chroma_modes[chroma_mode];
+    } else {
+        cu->intra_mode_c = cu->intra_mode[0];
+    }
+}
+
+static void put_part_mode(HEVCGenContext *s, GenCU *cu)
+{
+    int min_cb = cu->log2_cb_size == s->log2_min_cb_size;
+    int part   = cu->part_mode;
+
+    put_cabac(s, CTX_PART_MODE, part == PART_2Nx2N);
+    if (part == PART_2Nx2N)
+        return;
+    if (min_cb) {
+        if (cu->pred_mode == MODE_INTRA)
+            return;
+        put_cabac(s, CTX_PART_MODE + 1, part == PART_2NxN);
+        // no NxN inter partitions, they are only allowed above an 8x8 min CB
+        if (part == PART_Nx2N && cu->log2_cb_size > 3)
+            put_cabac(s, CTX_PART_MODE + 2, 1);
+        return;
+    }
+    if (!s->p.amp) {
+        put_cabac(s, CTX_PART_MODE + 1, part == PART_2NxN);
+        return;
+    }
+    if (part == PART_2NxN || part == PART_2NxnU || part == PART_2NxnD) {
+        put_cabac(s, CTX_PART_MODE + 1, 1);
+        put_cabac(s, CTX_PART_MODE + 3, part == PART_2NxN);
+        if (part != PART_2NxN)
+            put_cabac_bypass(s, part == PART_2NxnD);
+    } else {
+        put_cabac(s, CTX_PART_MODE + 1, 0);
+        put_cabac(s, CTX_PART_MODE + 3, part == PART_Nx2N);
+        if (part != PART_Nx2N)
+            put_cabac_bypass(s, part == PART_nRx2N);
+    }
+}
+
+static int gen_inter_part_mode(HEVCGenContext *s, int log2_cb_size)
+{
+    static const uint8_t amp_parts[6] = {
+        PART_2NxN, PART_Nx2N, PART_2NxnU, PART_2NxnD, PART_nLx2N, PART_nRx2N
+    };
+
+    if (!gen_chance(s, s->p.part))
+        return PART_2Nx2N;
+    if (log2_cb_size > s->log2_min_cb_size && s->p.amp)
+        return amp_parts[gen_rand(s) % 6];
+    return gen_rand(s) & 1 ? PART_Nx2N : PART_2NxN;
+}
+
+static int neighbour_ctx(HEVCGenContext *s, const uint8_t *map, int x0, int y0, int depth)
+{
+    int ctb_mask = (1 << s->log2_ctb_size) - 1;
+    int x_cb = x0 >> s->log2_min_cb_size, y_cb = y0 >> s->log2_min_cb_size;
+    int inc = 0;
+
+    if (s->ctb_left_flag || (x0 & ctb_mask))
+        inc += map[y_cb * s->min_cb_width + x_cb - 1] > depth;
+    if (s->ctb_up_flag || (y0 & ctb_mask))
+        inc += map[(y_cb - 1) * s->min_cb_width + x_cb] > depth;
+    return inc;
+}
+
+static void set_cb_map(HEVCGenContext *s, uint8_t *map, int x0, int y0, int log2_cb_size, int value)
+{
+    int size = 1 << (log2_cb_size - s->log2_min_cb_size), y;
+
+    for (y = 0; y < size; y++)
+        memset(map + ((y0 >> s->log2_min_cb_size) + y) * s->min_cb_width +
+               (x0 >> s->log2_min_cb_size), value, size);
+}
+
+static void gen_coding_unit(HEVCGenContext *s, int x0, int y0, int log2_cb_size, int depth)
+{
+    int cb_size      = 1 << log2_cb_size;
+    int rqt_root_cbf = 1;
+    GenCU cu         = { 0 };
+
+    cu.x0           = x0;
+    cu.y0           = y0;
+    cu.log2_cb_size = log2_cb_size;
+    cu.depth        = depth;
+    cu.pred_mode    = MODE_INTRA;
+
+    if (s->pic->slice_type != I_SLICE) {
+        int skip = gen_chance(s, s->p.skip);
+
+        put_cabac(s, CTX_SKIP + neighbour_ctx(s, s->skip_flag, x0, y0, 0), skip);
+        set_cb_map(s, s->skip_flag, x0, y0, log2_cb_size, skip);
+        if (skip) {
+            gen_merge_idx(s);
+            set_ipm(s, x0, y0, cb_size, INTRA_DC);
+            return;
+        }
+        cu.pred_mode = gen_chance(s, s->p.intra) ? MODE_INTRA : MODE_INTER;
+        put_cabac(s, CTX_PRED_MODE, cu.pred_mode == MODE_INTRA);
+    }
+
+    if (cu.pred_mode == MODE_INTRA)
+        cu.part_mode = log2_cb_size == s->log2_min_cb_size && gen_chance(s, s->p.part) ?
+                       PART_NxN : PART_2Nx2N;
+    else
+        cu.part_mode = gen_inter_part_mode(s, log2_cb_size);
+    if (cu.pred_mode != MODE_INTRA || log2_cb_size == s->log2_min_cb_size)
+        put_part_mode(s, &cu);
+
+    if (cu.pred_mode == MODE_INTRA) {
+        cu.intra_split = cu.part_mode == PART_NxN;
+        gen_intra_prediction_unit(s, &cu);
+    } else {
+        int half = cb_size >> 1, quarter = cb_size >> 2;
+
+        switch (cu.part_mode) {
+        case PART_2Nx2N:
+            gen_prediction_unit(s, &cu, cb_size, cb_size);
+            break;
+        case PART_2NxN:
+            gen_prediction_unit(s, &cu, cb_size, half);
+            gen_prediction_unit(s, &cu, cb_size, half);
+            break;
+        case PART_Nx2N:
+            gen_prediction_unit(s, &cu, half, cb_size);
+            gen_prediction_unit(s, &cu, half, cb_size);
+            break;
+        case PART_2NxnU:
+            gen_prediction_unit(s, &cu, cb_size, quarter);
+            gen_prediction_unit(s, &cu, cb_size, cb_size - quarter);
+            break;
+        case PART_2NxnD:
+            gen_prediction_unit(s, &cu, cb_size, cb_size - quarter);
+            gen_prediction_unit(s, &cu, cb_size, quarter);
+            break;
+        case PART_nLx2N:
+            gen_prediction_unit(s, &cu, quarter, cb_size);
+            gen_prediction_unit(s, &cu, cb_size - quarter, cb_size);
+            break;
+        case PART_nRx2N:
+            gen_prediction_unit(s, &cu, cb_size - quarter, cb_size);
+            gen_prediction_unit(s, &cu, quarter, cb_size);
+            break;
+        }
+        set_ipm(s, x0, y0, cb_size, INTRA_DC);
+    }
+
+    if (cu.pred_mode != MODE_INTRA && !(cu.part_mode == PART_2Nx2N && cu.merge_flag)) {
+        rqt_root_cbf = gen_chance(s, s->p.residual);
+        put_cabac(s, CTX_RQT_ROOT_CBF, rqt_root_cbf);
+    }
+    if (rqt_root_cbf) {
+        cu.max_trafo_depth = cu.pred_mode == MODE_INTRA ?
+                             s->max_trafo_depth_intra + cu.intra_split :
+                             s->max_trafo_depth_inter;
+        gen_transform_tree(s, &cu, log2_cb_size, 0, 0, 0, 0);
+    }
+}
+
+static void gen_coding_quadtree(HEVCGenContext *s, int x0, int y0, int log2_cb_size, int depth)
+{
+    int cb_size = 1 << log2_cb_size;
+    int split;
+
+    if (x0 + cb_size <= s->coded_width && y0 + cb_size <= s->coded_height &&
+        log2_cb_size > s->log2_min_cb_size) {
+        split = gen_chance(s, s->p.split_cu);
+        put_cabac(s, CTX_SPLIT_CU + neighbour_ctx(s, s->ct_depth, x0, y0, depth), split);
+    } else {
+        split = log2_cb_size > s->log2_min_cb_size;
+    }
+
+    if (s->p.dqp && log2_cb_size >= s->log2_ctb_size - s->diff_cu_qp_delta_depth)
+        s->is_cu_qp_delta_coded = 0;
+
+    if (split) {
+        int x1 = x0 + (cb_size >> 1), y1 = y0 + (cb_size >> 1);
+
+        gen_coding_quadtree(s, x0, y0, log2_cb_size - 1, depth + 1);
+        if (x1 < s->coded_width)
+            gen_coding_quadtree(s, x1, y0, log2_cb_size - 1, depth + 1);
+        if (y1 < s->coded_height)
+            gen_coding_quadtree(s, x0, y1, log2_cb_size - 1, depth + 1);
+        if (x1 < s->coded_width && y1 < s->coded_height)
+            gen_coding_quadtree(s, x1, y1, log2_cb_size - 1, depth + 1);
+    } else {
+        gen_coding_unit(s, x0, y0, log2_cb_size, depth);
+        set_cb_map(s, s->ct_depth, x0, y0, log2_cb_size, depth);
+    }
+}
+
+/* Slices */
+
+static void put_st_ref_pic_set(const GenPicture *pic, PutBitContext *pb)
+{
+    int nb_negative = 0, prev = 0, i;
+
+    for (i = 0; i < pic->nb_rps; i++)
+        nb_negative += pic->rps_poc[i] < pic->poc;
+    set_ue_golomb(pb, nb_negative);
+    set_ue_golomb(pb, pic->nb_rps - nb_negative);
+    // the RPS is in decoding order, code it by distance on each side
+    for (;;) {
+        int best = -1;
+
+        for (i = 0; i < pic->nb_rps; i++)
+            if (pic->rps_poc[i] < pic->poc - prev &&
+                (best < 0 || pic->rps_poc[i] > pic->rps_poc[best]))
+                best = i;
+        if (best < 0)
+            break;
+        set_ue_golomb(pb, pic->poc - pic->rps_poc[best] - prev - 1);
+        put_bits(pb, 1, pic->rps_used[best]);
+        prev = pic->poc - pic->rps_poc[best];
+    }
+    for (prev = 0;;) {
+        int best = -1;
+
+        for (i = 0; i < pic->nb_rps; i++)
+            if (pic->rps_poc[i] > pic->poc + prev &&
+                (best < 0 || pic->rps_poc[i] < pic->rps_poc[best]))
+                best = i;
+        if (best < 0)
+            break;
+        set_ue_golomb(pb, pic->rps_poc[best] - pic->poc - prev - 1);
+        put_bits(pb, 1, pic->rps_used[best]);
+        prev = pic->rps_poc[best] - pic->poc;
+    }
+}
+
+static void put_slice_header(HEVCGenContext *s, PutBitContext *pb, int slice_addr_ts,
+                             const int *entry_offset, int nb_entries)
+{
+    const GenPicture *pic = s->pic;
+    int i;
+
+    put_nal_unit_header(pb, pic->nal_type);
+    put_bits(pb, 1, !slice_addr_ts);    // first_slice_segment_in_pic_flag
+    if (pic->nal_type == NAL_IDR_N_LP)
+        put_bits(pb, 1, 0);             // no_output_of_prior_pics_flag
+    set_ue_golomb(pb, 0);               // slice_pic_parameter_set_id
+    if (slice_addr_ts)
+        put_bits(pb, av_ceil_log2(s->nb_ctbs), s->ctb_addr_ts_to_rs[slice_addr_ts]);
+    set_ue_golomb(pb, pic->slice_type);
+    if (pic->nal_type != NAL_IDR_N_LP) {
+        put_bits(pb, POC_LSB_BITS, pic->poc & ((1 << POC_LSB_BITS) - 1));
+        put_bits(pb, 1, 0);             // short_term_ref_pic_set_sps_flag
+        put_st_ref_pic_set(pic, pb);
+        put_bits(pb, 1, 1);             // slice_temporal_mvp_enabled_flag
+    }
+    if (s->p.sao) {
+        put_bits(pb, 1, 1);             // slice_sao_luma_flag
+        put_bits(pb, 1, 1);             // slice_sao_chroma_flag
+    }
+    if (pic->slice_type != I_SLICE) {
+        put_bits(pb, 1, 1);             // num_ref_idx_active_override_flag
+        set_ue_golomb(pb, pic->nb_refs - 1);
+        if (pic->slice_type == B_SLICE) {
+            set_ue_golomb(pb, pic->nb_refs - 1);
+            put_bits(pb, 1, 0);         // mvd_l1_zero_flag
+            put_bits(pb, 1, 1);         // collocated_from_l0_flag
+        }
+        if (pic->nb_refs > 1)
+            set_ue_golomb(pb, 0);       // collocated_ref_idx
+        set_ue_golomb(pb, 5 - s->p.merge_cand);
+    }
+    set_se_golomb(pb, s->p.qp - 26);    // slice_qp_delta
+    put_bits(pb, 1, 1);                 // slice_loop_filter_across_slices_enabled_flag
+    if (s->p.tile_cols * s->p.tile_rows > 1 || s->p.wpp) {
+        set_ue_golomb(pb, nb_entries);
+        if (nb_entries) {
+            int max_offset = 1;
+
+            for (i = 0; i < nb_entries; i++)
+                max_offset = FFMAX(max_offset, entry_offset[i]);
+            set_ue_golomb(pb, av_log2(max_offset - 1));
+            for (i = 0; i < nb_entries; i++)
+                put_bits(pb, av_log2(max_offset - 1) + 1, entry_offset[i] - 1);
+        }
+    }
+    put_bits(pb, 1, 1);                 // byte_alignment()
+    flush_put_bits(pb);
+}
+
+static void start_substream(HEVCGenContext *s, int offset)
+{
+    ff_init_cabac_encoder(&s->cc, s->slice_buf + offset, s->slice_buf_size - offset);
+}
+
+/**
+ * Keep room for the worst case of the next CTB in the slice buffer.
+ */
+static int reserve_ctb(HEVCGenContext *s, int offset)
+{
+    int ctb_bound = 6 << (2 * s->log2_ctb_size);
+    uint8_t *buf;
+
+    if (put_bits_left(&s->cc.pb) >> 3 >= ctb_bound)
+        return 0;
+    buf = realloc(s->slice_buf, 2 * s->slice_buf_size);
+    if (!buf)
+        return -1;
+    s->slice_buf       = buf;
+    s->slice_buf_size *= 2;
+    rebase_put_bits(&s->cc.pb, buf + offset, s->slice_buf_size - offset);
+    return 0;
+}
+
+static int encode_slice(HEVCGenContext *s, int ts_start, int ts_end)
+{
+    int tiles = s->p.tile_cols * s->p.tile_rows > 1;
+    int nb_entries = 0, offset = 0, ts, i;
+    uint8_t *header;
+    PutBitContext pb;
+
+    s->cur_slice_addr = s->ctb_addr_ts_to_rs[ts_start];
+    init_contexts(s);
+    start_substream(s, 0);
+
+    for (ts = ts_start; ts < ts_end; ts++) {
+        int ctb_addr_rs = s->ctb_addr_ts_to_rs[ts];
+        int x_ctb = ctb_addr_rs % s->ctb_width;
+        int y_ctb = ctb_addr_rs / s->ctb_width;
+
+        if (ts > ts_start && ((tiles && s->tile_id[ts] != s->tile_id[ts - 1]) ||
+                              (s->p.wpp && !x_ctb))) {
+            put_cabac_terminate(s, 1);  // end_of_subset_one_bit
+            s->entry_size[nb_entries] = put_bits_count(&s->cc.pb) >> 3;
+            offset += s->entry_size[nb_entries++];
+            start_substream(s, offset);
+            if (s->p.wpp && s->ctb_width > 1)
+                memcpy(s->state, s->wpp_state, sizeof(s->state));
+            else
+                init_contexts(s);
+        }
+        if (reserve_ctb(s, offset) < 0)
+            return -1;
+
+        s->slice_addr[ctb_addr_rs] = s->cur_slice_addr;
+        s->ctb_left_flag = x_ctb > 0 && ctb_available(s, ctb_addr_rs, ctb_addr_rs - 1);
+        s->ctb_up_flag   = y_ctb > 0 && ctb_available(s, ctb_addr_rs, ctb_addr_rs - s->ctb_width);
+        if (s->p.sao)
+            gen_sao(s, x_ctb, y_ctb, ctb_addr_rs);
+        gen_coding_quadtree(s, x_ctb << s->log2_ctb_size, y_ctb << s->log2_ctb_size,
+                            s->log2_ctb_size, 0);
+        put_cabac_terminate(s, ts == ts_end - 1);   // end_of_slice_segment_flag
+        if (s->p.wpp && x_ctb == 1)
+            memcpy(s->wpp_state, s->state, sizeof(s->state));
+    }
+    s->entry_size[nb_entries] = put_bits_count(&s->cc.pb) >> 3;
+
+    // the entry points count the emulation prevention bytes of each substream
+    for (i = 0, offset = 0; i < nb_entries; i++) {
+        int size = s->entry_size[i];
+
+        s->entry_size[i] = write_escaped(s, s->slice_buf + offset, size, 1);
+        offset += size;
+    }
+    header = malloc(256 + 5 * nb_entries);
+    if (!header)
+        return -1;
+    init_put_bits(&pb, header, 256 + 5 * nb_entries);
+    put_slice_header(s, &pb, ts_start, s->entry_size, nb_entries);
+
+    write_start_code(s);
+    s->bytes += write_escaped(s, header, put_bits_count(&pb) >> 3, 0);
+    s->bytes += write_escaped(s, s->slice_buf, offset + s->entry_size[nb_entries], 0);
+    free(header);
+    return 0;
+}
+
+static int unit_to_ts(HEVCGenContext *s, int unit, int nb_units)
+{
+    int cols = s->p.tile_cols;
+
+    if (unit == nb_units)
+        return s->nb_ctbs;
+    if (cols * s->p.tile_rows > 1)
+        return s->ctb_addr_rs_to_ts[s->row_bd[unit / cols] * s->ctb_width + s->col_bd[unit % cols]];
+    if (s->p.wpp)
+        return unit * s->ctb_width;
+    return unit;
+}
+
+static int encode_picture(HEVCGenContext *s, const GenPicture *pic)
+{
+    int nb_units = s->p.tile_cols * s->p.tile_rows > 1 ? s->p.tile_cols * s->p.tile_rows :
+                   s->p.wpp ? s->ctb_height : s->nb_ctbs;
+    int nb_slices = FFMIN(s->p.slices, nb_units);
+    int i;
+
+    if (pic->nal_type == NAL_IDR_N_LP) {
+        write_parameter_set(s, put_vps);
+        write_parameter_set(s, put_sps);
+        write_parameter_set(s, put_pps);
+    }
+    s->pic = pic;
+    for (i = 0; i < s->nb_ctbs; i++)
+        s->slice_addr[i] = -1;
+    for (i = 0; i < nb_slices; i++)
+        if (encode_slice(s, unit_to_ts(s, i * nb_units / nb_slices, nb_units),
+                         unit_to_ts(s, (i + 1) * nb_units / nb_slices, nb_units)) < 0)
+            return -1;
+    return 0;
+}
+
+/* Sequence */
+
+static void init_tiles(HEVCGenContext *s)
+{
+    int cols = s->p.tile_cols, rows = s->p.tile_rows;
+    int i, j, rs;
+
+    for (i = 0; i <= cols; i++)
+        s->col_bd[i] = i * s->ctb_width / cols;
+    for (i = 0; i <= rows; i++)
+        s->row_bd[i] = i * s->ctb_height / rows;
+
+    for (rs = 0; rs < s->nb_ctbs; rs++) {
+        int tb_x = rs % s->ctb_width, tb_y = rs / s->ctb_width;
+        int tile_x = 0, tile_y = 0, ts = 0;
+
+        for (i = 0; i < cols; i++)
+            if (tb_x >= s->col_bd[i])
+                tile_x = i;
+        for (j = 0; j < rows; j++)
+            if (tb_y >= s->row_bd[j])
+                tile_y = j;
+        for (j = 0; j < tile_y; j++)
+            ts += s->ctb_width * (s->row_bd[j + 1] - s->row_bd[j]);
+        for (i = 0; i < tile_x; i++)
+            ts += (s->col_bd[i + 1] - s->col_bd[i]) * (s->row_bd[tile_y + 1] - s->row_bd[tile_y]);
+        ts += (tb_y - s->row_bd[tile_y]) * (s->col_bd[tile_x + 1] - s->col_bd[tile_x]) +
+              tb_x - s->col_bd[tile_x];
+
+        s->ctb_addr_rs_to_ts[rs] = ts;
+        s->ctb_addr_ts_to_rs[ts] = rs;
+        s->tile_id[ts]           = tile_y * cols + tile_x;
+    }
+}
+
+static int init_sequence(HEVCGenContext *s)
+{
+    static const struct {
+        int level_idc;
+        int max_luma_ps;
+    } levels[] = {
+        {  30,    36864 }, {  60,   122880 }, {  63,   245760 }, {  90,   552960 },
+        {  93,   983040 }, { 120,  2228224 }, { 150,  8912896 }, { 180, 35651584 },
+    };
+    int period = s->p.intra_period ? s->p.intra_period : s->p.frames;
+    int start, i;
+
+    s->coded_width            = FFALIGN(s->p.width,  s->p.min_cb_size);
+    s->coded_height           = FFALIGN(s->p.height, s->p.min_cb_size);
+    s->log2_ctb_size          = av_log2(s->p.ctb_size);
+    s->log2_min_cb_size       = av_log2(s->p.min_cb_size);
+    s->log2_max_tb_size       = FFMIN(s->log2_ctb_size, 5);
+    s->max_trafo_depth_inter  = 2;
+    s->max_trafo_depth_intra  = 1;
+    s->diff_cu_qp_delta_depth = s->log2_ctb_size - s->log2_min_cb_size;
+    s->ctb_width              = (s->coded_width  + s->p.ctb_size - 1) >> s->log2_ctb_size;
+    s->ctb_height             = (s->coded_height + s->p.ctb_size - 1) >> s->log2_ctb_size;
+    s->nb_ctbs                = s->ctb_width * s->ctb_height;
+    s->min_cb_width           = s->coded_width >> s->log2_min_cb_size;
+    s->min_pu_width           = s->coded_width >> 2;
+
+    s->level_idc = 186;
+    for (i = FF_ARRAY_ELEMS(levels) - 1; i >= 0; i--)
+        if (s->coded_width * s->coded_height <= levels[i].max_luma_ps)
+            s->level_idc = levels[i].level_idc;
+
+    if (s->p.tile_cols > s->ctb_width || s->p.tile_rows > s->ctb_height) {
+        fprintf(stderr, "more tiles than CTBs (%dx%d)\n", s->ctb_width, s->ctb_height);
+        return -1;
+    }
+
+    s->ctb_addr_rs_to_ts = malloc(s->nb_ctbs * sizeof(*s->ctb_addr_rs_to_ts));
+    s->ctb_addr_ts_to_rs = malloc(s->nb_ctbs * sizeof(*s->ctb_addr_ts_to_rs));
+    s->tile_id           = malloc(s->nb_ctbs * sizeof(*s->tile_id));
+    s->slice_addr        = malloc(s->nb_ctbs * sizeof(*s->slice_addr));
+    s->entry_size        = malloc(s->nb_ctbs * sizeof(*s->entry_size));
+    s->ct_depth          = calloc(s->min_cb_width, s->coded_height >> s->log2_min_cb_size);
+    s->skip_flag         = calloc(s->min_cb_width, s->coded_height >> s->log2_min_cb_size);
+    s->ipm               = calloc(s->min_pu_width, s->coded_height >> 2);
+    s->pics              = calloc(s->p.frames, sizeof(*s->pics));
+    s->slice_buf_size    = (1 << 20) + (12 << (2 * s->log2_ctb_size));
+    s->slice_buf         = malloc(s->slice_buf_size);
+    if (!s->ctb_addr_rs_to_ts || !s->ctb_addr_ts_to_rs || !s->tile_id || !s->slice_addr ||
+        !s->entry_size || !s->ct_depth || !s->skip_flag || !s->ipm || !s->pics || !s->slice_buf)
+        return -1;
+    init_tiles(s);
+    for (i = 0; i < s->p.tile_cols; i++)
+        if ((s->col_bd[i + 1] - s->col_bd[i]) << s->log2_ctb_size < 256) {
+            fprintf(stderr, "the tile columns must be at least 256 samples wide\n");
+            return -1;
+        }
+    for (i = 0; i < s->p.tile_rows; i++)
+        if ((s->row_bd[i + 1] - s->row_bd[i]) << s->log2_ctb_size < 64) {
+            fprintf(stderr, "the tile rows must be at least 64 samples high\n");
+            return -1;
+        }
+    init_scan_pos();
+    ff_init_cabac_states();
+
+    s->max_dec_pic_buffering = 1;
+    for (start = 0; start < s->p.frames; start += period)
+        if (plan_period(s, FFMIN(period, s->p.frames - start)) < 0)
+            return -1;
+    s->max_dec_pic_buffering = FFMIN(s->max_dec_pic_buffering + s->num_reorder, MAX_DPB_SIZE);
+    return 0;
+}
+
+static void close_sequence(HEVCGenContext *s)
+{
+    free(s->ctb_addr_rs_to_ts);
+    free(s->ctb_addr_ts_to_rs);
+    free(s->tile_id);
+    free(s->slice_addr);
+    free(s->entry_size);
+    free(s->ct_depth);
+    free(s->skip_flag);
+    free(s->ipm);
+    free(s->pics);
+    free(s->slice_buf);
+}
+
+int main(int argc, char *argv[])
+{
+    HEVCGenContext gen = { { 0 } }, *s = &gen;
+    int ret = 1, i;
+
+    if (parse_options(argc, argv) < 0) {
+        print_usage(argv[0]);
+        return 1;
+    }
+    s->p   = params;
+    s->rng = (uint64_t)(s->p.seed + 1) * 0x9E3779B97F4A7C15ULL;
+
+    if (init_sequence(s) < 0)
+        goto end;
+    s->out = fopen(s->p.output, "wb");
+    if (!s->out) {
+        fprintf(stderr, "cannot open %s\n", s->p.output);
+        goto end;
+    }
+    for (i = 0; i < s->nb_pics; i++)
+        if (encode_picture(s, &s->pics[i]) < 0)
+            goto end;
+    printf("%d frames, %dx%d, %"PRId64" bytes\n", s->nb_pics, s->p.width, s->p.height, s->bytes);
+    ret = 0;
+end:
+    if (s->out)
+        fclose(s->out);
+    close_sequence(s);
+    return ret;
+}
@@ -125,7 +125,253 @@ typedef struct Info {
     int size;
 } Info;
 
-static void video_decode_example(const char *filename)
+static void video_index_example(const char *filename, const char *index_filename)
+{
+    AVFormatContext *pFormatCtx = NULL;
+    AVPacket        packet;
+    FILE            *fidx;
+    OpenHevc_Handle openHevcHandle;
+    OpenHevc_AUInfo auInfo;
+    int video_stream_idx;
+    int nbAU = 0;
+
+    if (filename == NULL) {
+        printf("No input file specified.\nSpecify it with: -i <filename>\n");
+        exit(1);
+    }
+
+    openHevcHandle = libOpenHevcInit(1, 1);
+    if (!openHevcHandle) {
+        fprintf(stderr, "could not open OpenHevc\n");
+        exit(1);
+    }
+    av_register_all();
+    if (avformat_open_input(&pFormatCtx, filename, NULL, NULL) != 0) {
+        printf("%s", filename);
+        exit(1);
+    }
+    if ((video_stream_idx = av_find_best_stream(pFormatCtx, AVMEDIA_TYPE_VIDEO, -1, -1, NULL, 0)) < 0) {
+        fprintf(stderr, "Could not find video stream in input file\n");
+        exit(1);
+    }
+    fidx = fopen(index_filename, "w");
+    if (!fidx) {
+        fprintf(stderr, "Could not open index file %s\n", index_filename);
+        exit(1);
+    }
+
+    fprintf(fidx, "au,offset,size,pts,poc,tid,nal_type,slice_type,irap\n");
+    while (av_read_frame(pFormatCtx, &packet) >= 0) {
+        if (packet.stream_index == video_stream_idx &&
+            libOpenHevcScanAU(openHevcHandle, packet.data, packet.size, packet.pts, &auInfo) > 0) {
+            char pts[32] = ""; // empty if the stream has no timestamps
+            if (auInfo.nTimeStamp != AV_NOPTS_VALUE)
+                snprintf(pts, sizeof(pts), "%"PRId64, auInfo.nTimeStamp);
+            fprintf(fidx, "%d,%"PRId64",%d,%s,%d,%d,%d,%c,%d\n", nbAU, packet.pos,
+                    auInfo.nSize, pts, auInfo.nPoc, auInfo.nTemporalId,
+                    auInfo.nNalUnitType, "BPI"[auInfo.nSliceType], auInfo.bIrap);
+            nbAU++;
+        }
+        av_free_packet(&packet);
+    }
+
+    fclose(fidx);
+    avformat_close_input(&pFormatCtx);
+    libOpenHevcClose(openHevcHandle);
+}
+
+typedef struct RangeAU {
+    int64_t pos;
+    int64_t pts;
+    int64_t dts;
+    int64_t order;     // (epoch, poc): sorts the pictures in output order
+    int     nal_type;
+    int     tid;
+    int     irap;
+} RangeAU;
+
+static int cmp_int64(const void *a, const void *b)
+{
+    int64_t x = *(const int64_t *)a, y = *(const int64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+static void *range_alloc(void *ptr, size_t size)
+{
+    void *new_ptr = realloc(ptr, size);
+
+    if (!new_ptr) {
+        fprintf(stderr, "Out of memory\n");
+        exit(1);
+    }
+    return new_ptr;
+}
+
+/* Decoding index of the last keyframe at or before the AU au in the container
+ * index of the stream, -1 if it has no index listing every AU. */
+static int index_keyframe(const AVStream *st, int64_t au)
+{
+    int i;
+
+    if (!st->nb_index_entries || st->nb_index_entries != st->nb_frames)
+        return -1;
+    for (i = au < st->nb_index_entries ? au : st->nb_index_entries - 1; i > 0; i--)
+        if (st->index_entries[i].flags & AVINDEX_KEYFRAME)
+            break;
+    return i;
+}
+
+/* Parse-only pass over the input from the AU of decoding index first, a
+ * keyframe of the container index, up to the IRAP following the last picture
+ * of the window, giving the output order of every picture that can be in it. */
+static RangeAU *range_scan(OpenHevc_Handle openHevcHandle, const char *filename, int first, int64_t end, int *nb_au)
+{
+    AVFormatContext *pFormatCtx = NULL;
+    AVPacket        packet;
+    OpenHevc_AUInfo auInfo;
+    RangeAU         *aus = NULL;
+    int video_stream_idx, size = 0, nb = 0, epoch = 0;
+
+    if (avformat_open_input(&pFormatCtx, filename, NULL, NULL) != 0 ||
+        (video_stream_idx = av_find_best_stream(pFormatCtx, AVMEDIA_TYPE_VIDEO, -1, -1, NULL, 0)) < 0 ||
+        (first > 0 &&
+         av_seek_frame(pFormatCtx, video_stream_idx,
+                       pFormatCtx->streams[video_stream_idx]->index_entries[first].timestamp,
+                       AVSEEK_FLAG_BACKWARD) < 0)) {
+        fprintf(stderr, "Could not scan %s\n", filename);
+        exit(1);
+    }
+    while (av_read_frame(pFormatCtx, &packet) >= 0) {
+        if (packet.stream_index == video_stream_idx &&
+            libOpenHevcScanAU(openHevcHandle, packet.data, packet.size, packet.pts, &auInfo) > 0) {
+            if (auInfo.bIrap) {
+                // everything before an IRAP in decoding order is output before it
+                if (first + nb > end) {
+                    av_free_packet(&packet);
+                    break;
+                }
+                if (auInfo.nNalUnitType != 21) // POC reset unless CRA
+                    epoch++;
+            }
+            if (nb == size) {
+                size = size ? 2 * size : 1024;
+                aus  = range_alloc(aus, size * sizeof(*aus));
+            }
+            aus[nb].pos      = packet.pos;
+            aus[nb].pts      = packet.pts;
+            aus[nb].dts      = packet.dts;
+            aus[nb].order    = ((int64_t)epoch << 32) + ((int64_t)auInfo.nPoc + INT32_MAX);
+            aus[nb].nal_type = auInfo.nNalUnitType;
+            aus[nb].tid      = auInfo.nTemporalId;
+            aus[nb].irap     = auInfo.bIrap;
+            nb++;
+        }
+        av_free_packet(&packet);
+    }
+    avformat_close_input(&pFormatCtx);
+    *nb_au = nb;
+    return aus;
+}
+
+/* Output index of each AU, as if the whole stream were decoded, the first one
+ * being the AU of decoding index first: the pictures before an IRAP in
+ * decoding order are output before it and its leading pictures. */
+static void range_rank(RangeAU *aus, int nb_au, int first, int64_t *rank)
+{
+    int64_t *order = range_alloc(NULL, (nb_au + 1) * sizeof(*order));
+    int i, lo, hi;
+
+    for (i = 0; i < nb_au; i++)
+        order[i] = aus[i].order;
+    qsort(order, nb_au, sizeof(*order), cmp_int64);
+    for (i = 0; i < nb_au; i++) {
+        lo = 0;
+        hi = nb_au - 1;
+        while (lo < hi) {
+            int mid = (lo + hi) >> 1;
+            if (order[mid] < aus[i].order)
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+        rank[i] = first + lo;
+    }
+    free(order);
+}
+
+/* Sorted output indices of the pictures produced when decoding starts at the
+ * IRAP au_start: the RASL pictures of that IRAP are not output. */
+static int range_outputs(RangeAU *aus, int64_t *rank, int nb_au, int au_start, int64_t *out)
+{
+    int i, nb = 0, rasl_skip = aus[au_start].nal_type <= 18 || aus[au_start].nal_type == 21;
+
+    for (i = au_start; i < nb_au; i++) {
+        if (i > au_start && aus[i].irap)
+            rasl_skip = 0;
+        if (rasl_skip && (aus[i].nal_type == 8 || aus[i].nal_type == 9))
+            continue;
+        if (aus[i].tid > temporal_layer_id + 1) // same test as the decoder
+            continue;
+        out[nb++] = rank[i];
+    }
+    qsort(out, nb, sizeof(*out), cmp_int64);
+    return nb;
+}
+
+/* Parse a CPU list such as "0-7,16-23" */
+static int parse_cpu_list(const char *list, int *cpus, int max_cpus)
+{
+    int nb_cpus = 0;
+
+    while (*list) {
+        char *end;
+        int first = strtol(list, &end, 10), last = first;
+        if (end == list)
+            break;
+        if (*end == '-')
+            last = strtol(end + 1, &end, 10);
+        for (; first <= last && nb_cpus < max_cpus; first++)
+            cpus[nb_cpus++] = first;
+        list = *end == ',' ? end + 1 : end;
+        if (*end != ',')
+            break;
+    }
+    return nb_cpus;
+}
+
+static const char *crc_names[OPENHEVC_NB_CRC] = {
+    "y", "u", "v", "mv_l0_x", "mv_l0_y", "mv_l1_x", "mv_l1_y", "ref_l0", "ref_l1", "size",
+    "qp", "skip", "intra_mode", "part_mode", "ct_depth", "cbf_luma", "meta", "res_y", "res_u", "res_v",
+};
+
+/* line of the checksum file: the frame index then the CRC of each plane */
+static void format_checksums(char *line, int size, int frame, const uint32_t *crc)
+{
+    int i, len = snprintf(line, size, "%d", frame);
+
+    for (i = 0; i < OPENHEVC_NB_CRC; i++)
+        len += snprintf(line + len, size - len, ",%08x", crc[i]);
+    snprintf(line + len, size - len, "\n");
+}
+
+/* print the planes of a frame whose CRC differs from the golden line */
+static void report_mismatch(int frame, const uint32_t *crc, const char *golden)
+{
+    const char *p = strchr(golden, ',');
+    int i;
+
+    fprintf(stderr, "frame %d differs:", frame);
+    if (!p)
+        fprintf(stderr, " not in the golden file");
+    if (p && strtol(golden, NULL, 10) != frame)
+        fprintf(stderr, " golden line of frame %ld", strtol(golden, NULL, 10));
+    for (i = 0; i < OPENHEVC_NB_CRC && p; i++, p = strchr(p + 1, ','))
+        if (strtoul(p + 1, NULL, 16) != crc[i])
+            fprintf(stderr, " %s", crc_names[i]);
+    fprintf(stderr, "\n");
+}
+
+static int video_decode_example(const char *filename)
 {
     AVFormatContext *pFormatCtx=NULL;
     AVPacket        packet;
@@ -149,10 +395,22 @@ static void video_decode_example(const char *filename)
 #endif
     int video_stream_idx;
     char output_file2[256];
+    int64_t nbOutput = 0;
+    RangeAU *aus     = NULL;
+    int64_t *rank    = NULL;
+    int64_t *outRank = NULL;
+    int nbAU = 0, nbOut = 0, auIdx = 0, synced = 1, ret;
 
     OpenHevc_Frame     openHevcFrame;
     OpenHevc_Frame_cpy openHevcFrameCpy;
     OpenHevc_Handle    openHevcHandle;
+    FILE *fcoeff = NULL;
+    FILE *fact   = NULL;
+    FILE *facc   = NULL;
+    FILE *fcrc   = NULL;
+    FILE *fgolden = NULL;
+    char golden[512];
+    int nbMismatch = 0;
 
     if (filename == NULL) {
         printf("No input file specified.\nSpecify it with: -i <filename>\n");
@@ -188,6 +446,59 @@ static void video_decode_example(const char *filename)
     }
 
     libOpenHevcSetDebugMode(openHevcHandle, 0);
+    if (cpu_affinity) {
+        int cpus[1024];
+        libOpenHevcSetCpuAffinity(openHevcHandle, cpus, parse_cpu_list(cpu_affinity, cpus, 1024));
+    }
+    libOpenHevcSetParallelSlices(openHevcHandle, parallel_slices);
+    libOpenHevcSetParallelFilters(openHevcHandle, parallel_filters);
+    libOpenHevcSetPadRefs(openHevcHandle, pad_refs);
+    libOpenHevcSetSyntaxMaps(openHevcHandle, syntax_maps);
+    libOpenHevcSetGlobalMotion(openHevcHandle, global_motion);
+    if (activity_file) {
+        fact = fopen(activity_file, "w");
+        if (!fact) {
+            fprintf(stderr, "Could not open %s\n", activity_file);
+            exit(1);
+        }
+        fprintf(fact, "frame,bits,intra,inter,skip,mean_mv,mean_qp,intra_picture,scene_cut,high_activity\n");
+        libOpenHevcSetAnalysis(openHevcHandle, 1);
+    }
+    if (acc_file) {
+        facc = fopen(acc_file, "wb");
+        if (!facc) {
+            fprintf(stderr, "Could not open %s\n", acc_file);
+            exit(1);
+        }
+        libOpenHevcSetAccMotion(openHevcHandle, 1);
+    }
+    if (checksum_file) {
+        int i;
+        fcrc = fopen(checksum_file, "w");
+        if (!fcrc) {
+            fprintf(stderr, "Could not open %s\n", checksum_file);
+            exit(1);
+        }
+        fprintf(fcrc, "frame");
+        for (i = 0; i < OPENHEVC_NB_CRC; i++)
+            fprintf(fcrc, ",%s", crc_names[i]);
+        fprintf(fcrc, "\n");
+    }
+    if (golden_file) {
+        fgolden = fopen(golden_file, "r");
+        if (!fgolden || !fgets(golden, sizeof(golden), fgolden)) {
+            fprintf(stderr, "Could not read %s\n", golden_file);
+            exit(1);
+        }
+    }
+    if (coeff_file) {
+        fcoeff = fopen(coeff_file, "wb");
+        if (!fcoeff) {
+            fprintf(stderr, "Could not open %s\n", coeff_file);
+            exit(1);
+        }
+        libOpenHevcSetCoeffFeatures(openHevcHandle, parse_only ? 2 : 1);
+    }
     libOpenHevcStartDecoder(openHevcHandle);
     openHevcFrameCpy.pvY = NULL;
     openHevcFrameCpy.pvU = NULL;
@@ -202,6 +513,60 @@ static void video_decode_example(const char *filename)
     libOpenHevcSetTemporalLayer_id(openHevcHandle, temporal_layer_id);
     libOpenHevcSetActiveDecoders(openHevcHandle, quality_layer_id);
     libOpenHevcSetViewLayers(openHevcHandle, quality_layer_id);
+
+    if (start_offset >= 0) {
+        if (av_seek_frame(pFormatCtx, video_stream_idx, start_offset, AVSEEK_FLAG_BYTE) < 0) {
+            fprintf(stderr, "Could not seek to offset %"PRId64"\n", start_offset);
+            exit(1);
+        }
+        libOpenHevcStartAtIRAP(openHevcHandle);
+    }
+
+    if (range_start >= 0 && !range_pts) {
+        // with a container index the scan starts at the keyframe before the
+        // window, or an earlier one while the leading pictures of that one
+        // are in the window, instead of the start of the stream
+        int i, first = index_keyframe(pFormatCtx->streams[video_stream_idx], range_start);
+        for (;;) {
+            first   = FFMAX(first, 0);
+            aus     = range_scan(openHevcHandle, filename, first, range_end, &nbAU);
+            rank    = range_alloc(NULL, (nbAU + 1) * sizeof(*rank));
+            outRank = range_alloc(NULL, (nbAU + 1) * sizeof(*outRank));
+            range_rank(aus, nbAU, first, rank);
+            auIdx = -1;
+            for (i = 0; i < nbAU; i++)
+                if (aus[i].irap && rank[i] <= range_start)
+                    auIdx = i;
+            if (auIdx >= 0 || !first)
+                break;
+            free(aus);
+            free(rank);
+            free(outRank);
+            first = index_keyframe(pFormatCtx->streams[video_stream_idx], first - 1);
+        }
+        auIdx = FFMAX(auIdx, 0);
+        if (first > 0) {
+            // the scan did not see the start, no fallback to it
+            if (av_seek_frame(pFormatCtx, video_stream_idx, aus[auIdx].dts, AVSEEK_FLAG_BACKWARD) < 0) {
+                fprintf(stderr, "Could not seek to frame %"PRId64"\n", rank[auIdx]);
+                exit(1);
+            }
+            libOpenHevcStartAtIRAP(openHevcHandle);
+        } else if (auIdx > 0) {
+            if (!(pFormatCtx->iformat->flags & AVFMT_NO_BYTE_SEEK))
+                ret = av_seek_frame(pFormatCtx, video_stream_idx, aus[auIdx].pos, AVSEEK_FLAG_BYTE);
+            else
+                ret = av_seek_frame(pFormatCtx, video_stream_idx, aus[auIdx].pts, AVSEEK_FLAG_BACKWARD);
+            if (ret < 0)
+                auIdx = 0;
+            libOpenHevcStartAtIRAP(openHevcHandle);
+        }
+        nbOut = range_outputs(aus, rank, nbAU, auIdx, outRank);
+        synced = auIdx == 0 && !first;
+    } else if (range_start >= 0) {
+        if (av_seek_frame(pFormatCtx, video_stream_idx, range_start, AVSEEK_FLAG_BACKWARD) >= 0)
+            libOpenHevcStartAtIRAP(openHevcHandle);
+    }
 #if FRAME_CONCEALMENT
     fin_loss = fopen( "/Users/wassim/Softwares/shvc_transmission/parser/hevc_parser/BascketBall_Loss.txt", "rb");
     fin1 = fopen( "/Users/wassim/Softwares/shvc_transmission/parser/hevc_parser/BascketBall.txt", "rb");
@@ -223,6 +588,27 @@ static void video_decode_example(const char *filename)
             is_received = 0;
 #endif
         if (packet.stream_index == video_stream_idx || stop_dec == 1) {
+            if (range_start >= 0 && !stop_dec) {
+                int skip;
+                if (range_pts) {
+                    skip = packet.pts != AV_NOPTS_VALUE && packet.pts < range_start;
+                } else {
+                    if (!synced) {
+                        // a timestamp seek may land on an earlier IRAP
+                        int i;
+                        for (i = 0; i < nbAU && aus[i].pos != packet.pos; i++);
+                        if (i < nbAU && aus[i].irap && i != auIdx) {
+                            auIdx = i;
+                            nbOut = range_outputs(aus, rank, nbAU, auIdx, outRank);
+                        }
+                        synced = 1;
+                    }
+                    skip = auIdx < nbAU && aus[auIdx].pos == packet.pos && rank[auIdx] < range_start;
+                    if (auIdx < nbAU && aus[auIdx].pos == packet.pos)
+                        auIdx++;
+                }
+                libOpenHevcSetSkipNonRef(openHevcHandle, skip);
+            }
 #if FRAME_CONCEALMENT
             if(is_received)
                 got_picture = libOpenHevcDecode(openHevcHandle, packet.data, !stop_dec ? packet.size : 0, packet.pts);
@@ -239,9 +625,30 @@ static void video_decode_example(const char *filename)
                 fflush(stdout);
                 //get frame info
                 libOpenHevcGetPictureInfo(openHevcHandle, &openHevcFrame.frameInfo);
+                if (range_start >= 0) {
+                    int64_t idx = range_pts ? openHevcFrame.frameInfo.nTimeStamp :
+                                  nbOutput < nbOut ? outRank[nbOutput] : INT64_MAX;
+                    nbOutput++;
+                    if (idx > range_end) {
+                        stop = 1;
+                        av_free_packet(&packet);
+                        continue;
+                    }
+                    if (idx < range_start) {
+                        libOpenHevcDiscardOutput(openHevcHandle);
+                        av_free_packet(&packet);
+                        continue;
+                    }
+                } else
+                    nbOutput++;
                 if ((width != openHevcFrame.frameInfo.nWidth) || (height != openHevcFrame.frameInfo.nHeight)) {
                     width  = openHevcFrame.frameInfo.nWidth;
                     height = openHevcFrame.frameInfo.nHeight;
+                    if (thread_type == 8 || cpu_affinity) {
+                        char report[1024];
+                        libOpenHevcGetPlacementReport(openHevcHandle, report, sizeof(report));
+                        fprintf(stderr, "%s", report);
+                    }
 
                     fout = stdout;
 
@@ -269,23 +676,68 @@ static void video_decode_example(const char *filename)
                     }
                 }
 
-                if (fout) {
+                if (fcrc || fgolden) {
+                    // before libOpenHevcGetOutputCpy, which clears the MV planes
+                    uint32_t crc[OPENHEVC_NB_CRC];
+                    char line[512];
+                    libOpenHevcGetChecksums(openHevcHandle, crc);
+                    format_checksums(line, sizeof(line), nbFrame, crc);
+                    if (fcrc)
+                        fputs(line, fcrc);
+                    if (fgolden) {
+                        if (!fgets(golden, sizeof(golden), fgolden))
+                            golden[0] = '\0';
+                        if (strcmp(line, golden)) {
+                            report_mismatch(nbFrame, crc, golden);
+                            nbMismatch++;
+                        }
+                    }
+                }
+                if (facc) {
+                    // width and height in blocks of the field (0 if there is none), then the
+                    // (x, y) pairs; before libOpenHevcGetOutputCpy, which clears the metadata
+                    const int16_t *field;
+                    int32_t dims[2];
+                    if (!libOpenHevcGetAccMotion(openHevcHandle, &field, &dims[0], &dims[1]))
+                        dims[0] = dims[1] = 0;
+                    fwrite(dims, sizeof(*dims), 2, facc);
+                    if (field)
+                        fwrite(field, sizeof(*field) * 2, dims[0] * dims[1], facc);
+                }
+                if (fact) {
+                    OpenHevc_Activity act;
+                    if (libOpenHevcGetActivity(openHevcHandle, &act))
+                        fprintf(fact, "%d,%d,%.4f,%.4f,%.4f,%.2f,%.2f,%d,%d,%d\n", nbFrame, act.nBits,
+                                act.fIntra, act.fInter, act.fSkip, act.fMeanMv, act.fMeanQp,
+                                !!(act.nFlags & OPENHEVC_ACTIVITY_INTRA),
+                                !!(act.nFlags & OPENHEVC_ACTIVITY_SCENE_CUT),
+                                !!(act.nFlags & OPENHEVC_ACTIVITY_HIGH));
+                } else if (fout) {
                     int format = openHevcFrameCpy.frameInfo.chromat_format == YUV420 ? 1 : 0;
                     libOpenHevcGetOutputCpy(openHevcHandle, 1, &openHevcFrameCpy);
                     fwrite( openHevcFrameCpy.pvY , sizeof(uint8_t) , openHevcFrameCpy.frameInfo.nYPitch * openHevcFrameCpy.frameInfo.nHeight, fout);
                     fwrite( openHevcFrameCpy.pvU , sizeof(uint8_t) , openHevcFrameCpy.frameInfo.nUPitch * openHevcFrameCpy.frameInfo.nHeight >> format, fout);
                     fwrite( openHevcFrameCpy.pvV , sizeof(uint8_t) , openHevcFrameCpy.frameInfo.nVPitch * openHevcFrameCpy.frameInfo.nHeight >> format, fout);
-                    fwrite( openHevcFrameCpy.pvMV , sizeof(uint8_t) , openHevcFrameCpy.frameInfo.nYPitch * openHevcFrameCpy.frameInfo.nHeight, fout);
+                    // the feature planes take the same room whatever the bit depth
+                    fwrite( openHevcFrameCpy.pvMV , sizeof(uint8_t) , openHevcFrameCpy.frameInfo.nWidth * openHevcFrameCpy.frameInfo.nHeight, fout);
                     fwrite( openHevcFrameCpy.pvYR , sizeof(uint8_t) , openHevcFrameCpy.frameInfo.nYPitch * openHevcFrameCpy.frameInfo.nHeight, fout);
                     fwrite( openHevcFrameCpy.pvUR , sizeof(uint8_t) , openHevcFrameCpy.frameInfo.nUPitch * openHevcFrameCpy.frameInfo.nHeight >> format, fout);
                     fwrite( openHevcFrameCpy.pvVR , sizeof(uint8_t) , openHevcFrameCpy.frameInfo.nVPitch * openHevcFrameCpy.frameInfo.nHeight >> format, fout);
                 }
+                if (fcoeff) {
+                    // size in bytes, then the OpenHevc_CoeffTU records of the frame
+                    const uint8_t *coeffs;
+                    int32_t size = libOpenHevcGetCoeffFeatures(openHevcHandle, &coeffs);
+                    fwrite(&size, sizeof(size), 1, fcoeff);
+                    fwrite(coeffs, 1, size, fcoeff);
+                }
                 // save as yuv a single frame.
                 nbFrame++;
                 if (nbFrame == num_frames)
                     stop = 1;
             } else {
-                if (stop_dec==1 && nbFrame)
+                // drained, whether or not anything was output (e.g. no IRAP after -b)
+                if (stop_dec==1)
                 stop = 1;
             }
         }
@@ -298,17 +750,43 @@ static void video_decode_example(const char *filename)
         free(openHevcFrameCpy.pvU);
         free(openHevcFrameCpy.pvV);
     }
+    if (fcoeff)
+        fclose(fcoeff);
+    if (fact)
+        fclose(fact);
+    if (facc)
+        fclose(facc);
+    if (fcrc)
+        fclose(fcrc);
+    if (fgolden) {
+        // with -s the golden file may go further
+        if (nbFrame != num_frames && fgets(golden, sizeof(golden), fgolden)) {
+            fprintf(stderr, "the golden file has more frames than the %d decoded\n", nbFrame);
+            nbMismatch++;
+        }
+        if (nbMismatch)
+            fprintf(stderr, "%d frames differ from %s\n", nbMismatch, golden_file);
+        else
+            printf("%d frames match %s\n", nbFrame, golden_file);
+        fclose(fgolden);
+    }
+    free(aus);
+    free(rank);
+    free(outRank);
     avformat_close_input(&pFormatCtx);
     libOpenHevcClose(openHevcHandle);
 
     //printf("frame= %d fps= %.0f time= %.2f video_size= %dx%d\n", nbFrame, nbFrame/time, time, openHevcFrame.frameInfo.nWidth, openHevcFrame.frameInfo.nHeight);
-
+    return nbMismatch > 0;
 }
 
 int main(int argc, char *argv[]) {
 
     init_main(argc, argv);
-    video_decode_example(input_file);
+    if (index_file)
+        video_index_example(input_file, index_file);
+    else
+        return video_decode_example(input_file);
     return 0;
 }
 
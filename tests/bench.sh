@@ -0,0 +1,102 @@
+#!/bin/sh
+# Decoding speed on synthetic streams from hevc_gen.
+#
+#   tests/bench.sh <hevc> <hevc_gen> [<reference hevc>]
+#
+# For each case, the stream is decoded RUNS times (3 by default) with the
+# output discarded and the fastest run is kept: wall time, then the user and
+# system CPU time of that run. The system time mostly counts the futex calls
+# of the threads that sleep and wake each other. With a reference decoder
+# (e.g. built from an earlier commit), it is timed on the same streams and
+# the last column is its wall time over ours.
+
+if [ $# -lt 2 ] || [ $# -gt 3 ]; then
+    echo "usage: $0 <hevc> <hevc_gen> [<reference hevc>]" >&2
+    exit 2
+fi
+HEVC=$1
+HEVC_GEN=$2
+REF_HEVC=$3
+RUNS=${RUNS:-3}
+TMP=$(mktemp -d "${TMPDIR:-/tmp}/bench.XXXXXX") || exit 2
+trap 'rm -rf "$TMP"' EXIT
+
+# name|hevc_gen options|hevc options
+CASES="
+frame_threads_2|-w 1280 -h 720 -n 64 -gop 8 -intra 32|-f 1 -p 2
+frame_threads_4|-w 1280 -h 720 -n 64 -gop 8 -intra 32|-f 1 -p 4
+frame_threads_8|-w 1280 -h 720 -n 64 -gop 8 -intra 32|-f 1 -p 8
+wpp_rows_4|-w 1920 -h 1080 -n 16 -ctb 32 -wpp 1 -intra 8|-f 2 -p 4
+wpp_rows_8|-w 1920 -h 1080 -n 16 -ctb 32 -wpp 1 -intra 8|-f 2 -p 8
+wpp_frameslice|-w 1920 -h 1080 -n 16 -ctb 32 -wpp 1 -intra 8|-f 4 -p 4
+small_pus|-w 1280 -h 720 -n 24 -ctb 16 -split 90 -part 70 -merge 60 -gop 4 -intra 12|
+residual_qp22|-w 1280 -h 720 -n 16 -qp 22 -res 90 -tu-split 50 -gop 4 -intra 8|
+residual_qp37|-w 1280 -h 720 -n 16 -qp 37 -res 60 -tu-split 50 -gop 4 -intra 8|
+residual_intra|-w 1280 -h 720 -n 16 -qp 22 -res 90 -tu-split 50 -intra 1|
+"
+
+# cpu_seconds <file of times>: the user and system CPU time of the children
+# of the shell it was taken in; times has to run in that shell, not in a
+# command substitution
+cpu_seconds() {
+    tail -n 1 "$1" | awk '{
+        for (i = 1; i <= 2; i++) {
+            split($i, t, "m")
+            sub("s", "", t[2])
+            s[i] = t[1] * 60 + t[2]
+        }
+        print s[1], s[2]
+    }'
+}
+
+now() {
+    date +%s.%N
+}
+
+# bench <hevc> <stream> <hevc options>: "wall user sys" of the fastest run
+bench() {
+    hevc=$1
+    bit=$2
+    shift 2
+    best=
+    run=0
+    while [ $run -lt $RUNS ]; do
+        times > "$TMP/times0"
+        t0=$(now)
+        "$hevc" -i "$bit" -n "$@" > /dev/null 2>&1 || return 1
+        t1=$(now)
+        times > "$TMP/times1"
+        res=$(echo "$t0 $t1 $(cpu_seconds "$TMP/times0") $(cpu_seconds "$TMP/times1")" |
+              awk '{ printf "%.3f %.3f %.3f", $2 - $1, $5 - $3, $6 - $4 }')
+        if [ -z "$best" ] || [ "$(echo "$res $best" | awk '{ print $1 < $4 }')" = 1 ]; then
+            best=$res
+        fi
+        run=$((run + 1))
+    done
+    echo "$best"
+}
+
+printf "%-20s %8s %8s %8s" case wall user sys
+[ -n "$REF_HEVC" ] && printf " %8s %8s" ref ref/wall
+printf "\n"
+echo "$CASES" | while IFS='|' read name gen_options options; do
+    [ -n "$name" ] || continue
+    bit=$TMP/$(echo "$gen_options" | tr -c 'a-zA-Z0-9\n-' '_').bit
+    if [ ! -f "$bit" ] && ! "$HEVC_GEN" -o "$bit" $gen_options > /dev/null; then
+        echo "$name: hevc_gen $gen_options failed"
+        continue
+    fi
+    if ! res=$(bench "$HEVC" "$bit" $options); then
+        echo "$name: $HEVC $options failed"
+        continue
+    fi
+    printf "%-20s %8s %8s %8s" "$name" $res
+    if [ -n "$REF_HEVC" ]; then
+        if ref=$(bench "$REF_HEVC" "$bit" $options); then
+            echo "$res $ref" | awk '{ printf " %8.3f %8.2f", $4, $4 / $1 }'
+        else
+            printf " %8s" failed
+        fi
+    fi
+    printf "\n"
+done
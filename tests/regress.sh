@@ -0,0 +1,196 @@
+#!/bin/sh
+# Regression tests of the decoder on synthetic streams from hevc_gen.
+#
+#   tests/regress.sh <hevc> <hevc_gen>
+#   REF_HEVC=<hevc> tests/regress.sh -update <hevc> <hevc_gen>
+#
+# For each stream, tests/golden holds
+#   <name>.yuv.md5  md5 of the decoder output (YUV and feature planes), taken
+#                   from the decoder the feature series started from: the
+#                   default output must not change
+#   <name>.crc      CRC-32 of each plane of each frame (-H)
+#   <name>.feat.crc the same with the syntax maps and the camera motion removed
+#                   (-M -g 2), for the streams that have one
+#   <name>.acc.md5  md5 of the accumulated motion (-K), likewise
+# Each thread mode, the frame ranges and the IRAP starts are checked against
+# them. -update rewrites them, the md5 of the output with REF_HEVC if set.
+
+update=0
+if [ "$1" = "-update" ]; then
+    update=1
+    shift
+fi
+if [ $# -ne 2 ]; then
+    echo "usage: $0 [-update] <hevc> <hevc_gen>" >&2
+    exit 2
+fi
+HEVC=$1
+HEVC_GEN=$2
+REF_HEVC=${REF_HEVC:-$HEVC}
+GOLDEN=$(cd "$(dirname "$0")" && pwd)/golden
+TMP=$(mktemp -d "${TMPDIR:-/tmp}/regress.XXXXXX") || exit 2
+trap 'rm -rf "$TMP"' EXIT
+# a decode that does not end within this many seconds has failed
+TIMEOUT=${TIMEOUT:-60}
+
+# name|hevc_gen options|feature goldens
+STREAMS="
+lowdelay_p|-n 12 -b 0 -intra 6|
+lowdelay_b|-n 12 -intra 6 -dqp 4|feat
+hier_b|-n 16 -gop 4 -intra 8|feat
+min_cb16|-n 10 -ctb 32 -min-cb 16 -intra 5|feat
+min_cb32|-n 8 -ctb 64 -min-cb 32 -intra 4|
+tiles|-w 640 -h 256 -n 8 -tile-cols 2 -tile-rows 2 -slices 3 -intra 4|
+wpp|-n 8 -wpp 1 -slices 2 -intra 4|
+slices16|-n 8 -slices 7 -ctb 16 -intra 4|
+slices64|-n 8 -slices 3 -ctb 64 -intra 4|
+"
+THREAD_MODES="
+-f 1 -p 4
+-f 2 -p 4
+-f 4 -p 4
+-f 8 -p 4
+-f 1 -p 16
+-f 2 -p 4 -P
+-f 4 -p 4 -L
+"
+
+md5() {
+    md5sum "$1" 2>/dev/null | cut -d' ' -f1 || md5 -q "$1"
+}
+
+run() {
+    if command -v timeout >/dev/null; then
+        timeout $TIMEOUT "$@"
+    else
+        "$@"
+    fi
+}
+
+fail() {
+    echo "FAIL $*"
+}
+
+# check <name> <description> <hevc options>: the CRCs of every frame match
+check() {
+    name=$1
+    what=$2
+    shift 2
+    run "$HEVC" -n "$@" -G "$GOLDEN/$name.crc" > /dev/null 2> "$TMP/err" ||
+        fail "$name: $what"
+}
+
+# check_frames <name> <description> <first frame> <hevc options>: the CRCs of
+# the frames output match the golden ones from the first frame on
+check_frames() {
+    name=$1
+    what=$2
+    first=$3
+    shift 3
+    run "$HEVC" -n "$@" -H "$TMP/out.crc" > /dev/null 2> "$TMP/err"
+    status=$?
+    # both start with a header line
+    n=$(($(wc -l < "$TMP/out.crc") - 1))
+    tail -n +2 "$TMP/out.crc" | cut -d, -f2- > "$TMP/a"
+    tail -n +$((first + 2)) "$GOLDEN/$name.crc" | head -n $n | cut -d, -f2- > "$TMP/b"
+    if [ $status -ne 0 ] || [ $n -eq 0 ] || ! cmp -s "$TMP/a" "$TMP/b"; then
+        fail "$name: $what"
+    fi
+}
+
+# check_empty <name> <description> <hevc options>: the decoder ends without
+# output
+check_empty() {
+    name=$1
+    what=$2
+    shift 2
+    run "$HEVC" -n "$@" > "$TMP/out.yuv" 2> "$TMP/err"
+    status=$?
+    if [ $status -eq 124 ] || [ $status -gt 128 ] || [ -s "$TMP/out.yuv" ]; then
+        fail "$name: $what"
+    fi
+}
+
+echo "$STREAMS" | while IFS='|' read name options feat; do
+    [ -n "$name" ] || continue
+    bit=$TMP/$name.bit
+    if ! "$HEVC_GEN" -o "$bit" $options > /dev/null; then
+        fail "$name: hevc_gen $options"
+        continue
+    fi
+
+    if [ $update -eq 1 ]; then
+        "$REF_HEVC" -i "$bit" -n > "$TMP/out.yuv" 2> /dev/null
+        md5 "$TMP/out.yuv" > "$GOLDEN/$name.yuv.md5"
+        "$HEVC" -i "$bit" -n -H "$GOLDEN/$name.crc" > /dev/null 2>&1
+        if [ -n "$feat" ]; then
+            "$HEVC" -i "$bit" -n -M -g 2 -K "$TMP/acc" -H "$GOLDEN/$name.feat.crc" > /dev/null 2>&1
+            md5 "$TMP/acc" > "$GOLDEN/$name.acc.md5"
+        fi
+        echo "updated $name"
+        continue
+    fi
+
+    # same output as the baseline decoder
+    run "$HEVC" -i "$bit" -n > "$TMP/out.yuv" 2> "$TMP/err"
+    [ "$(md5 "$TMP/out.yuv")" = "$(cat "$GOLDEN/$name.yuv.md5")" ] ||
+        fail "$name: output differs from the baseline decoder"
+    check "$name" "checksums" -i "$bit"
+
+    echo "$THREAD_MODES" | while read mode; do
+        [ -n "$mode" ] || continue
+        check "$name" "$mode" -i "$bit" $mode
+    done
+
+    if [ -n "$feat" ]; then
+        run "$HEVC" -i "$bit" -n -M -g 2 -K "$TMP/acc" -G "$GOLDEN/$name.feat.crc" > /dev/null 2> "$TMP/err" ||
+            fail "$name: -M -g 2"
+        [ "$(md5 "$TMP/acc")" = "$(cat "$GOLDEN/$name.acc.md5")" ] ||
+            fail "$name: -K"
+        run "$HEVC" -i "$bit" -n -M -g 2 -K "$TMP/acc" -f 1 -p 4 -G "$GOLDEN/$name.feat.crc" > /dev/null 2> "$TMP/err" ||
+            fail "$name: -M -g 2 -f 1 -p 4"
+        [ "$(md5 "$TMP/acc")" = "$(cat "$GOLDEN/$name.acc.md5")" ] ||
+            fail "$name: -K -f 1 -p 4"
+    fi
+
+    # the AU index: offsets of the IRAPs, no timestamps in a raw stream
+    run "$HEVC" -i "$bit" -n -x "$TMP/index.csv" > /dev/null 2> "$TMP/err"
+    grep -q -- "-9223372036854775808" "$TMP/index.csv" &&
+        fail "$name: -x writes AV_NOPTS_VALUE"
+    # au,offset,size,pts,poc,tid,nal_type,slice_type,irap
+    irap=$(awk -F, 'NR > 2 && $9 == 1 { print $1 "," $2; exit }' "$TMP/index.csv")
+    # an AU after the last IRAP
+    last=$(awk -F, 'NR > 1 { o = $9 == 1 ? "" : $2 } END { print o }' "$TMP/index.csv")
+    nb_frames=$(($(wc -l < "$GOLDEN/$name.crc") - 1))
+    size=$(wc -c < "$bit")
+
+    # every stream has an IDR after the first one, all the pictures before it
+    # are output before it
+    if [ -n "$irap" ]; then
+        check_frames "$name" "-b at the second IRAP" "${irap%,*}" -i "$bit" -b "${irap#*,}"
+        check_frames "$name" "-B from the second IRAP" "${irap%,*}" -i "$bit" -B "${irap%,*}"
+    else
+        fail "$name: no second IRAP in the index"
+    fi
+    check_frames "$name" "-B 3 -E 6" 3 -i "$bit" -B 3 -E 6
+    check_frames "$name" "-E 2" 0 -i "$bit" -E 2
+
+    # nothing to output, the decoder has to end anyway
+    if [ -n "$last" ]; then
+        check_empty "$name" "-b with no IRAP after the offset" -i "$bit" -b "$last"
+    else
+        fail "$name: the last AU is an IRAP"
+    fi
+    check_empty "$name" "-b past the end of the file" -i "$bit" -b $((size + 1000))
+    check_empty "$name" "-B past the last frame" -i "$bit" -B $((nb_frames + 10))
+
+    echo "done $name"
+done > "$TMP/log"
+
+cat "$TMP/log"
+if grep -q "^FAIL" "$TMP/log"; then
+    echo "$(grep -c "^FAIL" "$TMP/log") failures"
+    exit 1
+fi
+[ $update -eq 1 ] || echo "all passed"
+exit 0